@@ -41,6 +41,22 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property (nonatomic, readonly) NSInteger cacheExpirationMinutes;
 
+/**
+ * 后台过期清理间隔（默认：30秒）
+ */
+@property (nonatomic, readonly) NSInteger expirationSweepIntervalSeconds;
+
+/**
+ * 每次后台清理最多处理的过期条目数（默认：64）
+ */
+@property (nonatomic, readonly) NSInteger maxExpirationsPerSweep;
+
+/**
+ * 缓存分组规则（正则表达式，默认：/vip/(\d+)/(\d+)/）
+ * 捕获组依次以"/"拼接作为分组键，例如 /vip/1071/1/... 对应分组 "1071/1"（剧集/集数）
+ */
+@property (nonatomic, readonly) NSString *groupKeyPattern;
+
 /**
  * 获取完整的缓存目录路径
  */
@@ -51,6 +67,11 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (NSUInteger)maxMemorySizeInBytes;
 
+/**
+ * 获取缓存有效期（秒）
+ */
+- (NSTimeInterval)cacheExpirationInterval;
+
 @end
 
 NS_ASSUME_NONNULL_END
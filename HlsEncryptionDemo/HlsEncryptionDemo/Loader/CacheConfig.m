@@ -27,6 +27,9 @@
         _maxFileCount = 1000;
         _maxMemorySize = 20; // 20MB
         _cacheExpirationMinutes = 60; // 60分钟
+        _expirationSweepIntervalSeconds = 30; // 30秒
+        _maxExpirationsPerSweep = 64;
+        _groupKeyPattern = @"/vip/(\\d+)/(\\d+)/";
     }
     return self;
 }
@@ -42,6 +45,10 @@
     return self.maxMemorySize * 1024 * 1024; // 转换为字节
 }
 
+- (NSTimeInterval)cacheExpirationInterval {
+    return self.cacheExpirationMinutes * 60; // 转换为秒
+}
+
 - (NSString *)description {
     return [NSString stringWithFormat:@"CacheConfig: directory=%@, maxFiles=%ld, maxMemory=%ldMB, expiration=%ldmin", 
             [self fullCacheDirectoryPath], (long)self.maxFileCount, (long)self.maxMemorySize, (long)self.cacheExpirationMinutes];
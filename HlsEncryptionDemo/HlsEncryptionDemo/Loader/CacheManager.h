@@ -34,6 +34,8 @@ NS_ASSUME_NONNULL_BEGIN
 
 /**
  * 根据URL和Token获取缓存的M3U8内容
+ * 返回的数据以内存映射方式读取（NSDataReadingMappedIfSafe），不会复制到堆上；
+ * 缓存文件被覆盖或删除时已映射的数据仍然有效
  * @param url M3U8文件URL
  * @param token 授权token
  * @return 缓存的内容，如果不存在或已过期返回nil
@@ -76,6 +78,35 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (void)performLRUCleanupIfNeeded;
 
+/**
+ * 根据URL计算缓存分组键
+ * 同一剧集同一集的主播放列表和子播放列表属于同一分组，淘汰时整组移除
+ * @param url M3U8文件URL
+ * @return 分组键（如 "1071/1"），URL不符合分组规则时返回nil
+ */
+- (NSString * _Nullable)groupKeyForURL:(NSString *)url;
+
+/**
+ * 固定分组，固定的分组不会被LRU淘汰（过期仍会清理）
+ * @param groupKey 分组键，可以是单集（"1071/1"）或整部剧（"1071"）
+ */
+- (void)pinGroup:(NSString *)groupKey;
+
+/**
+ * 取消固定分组
+ */
+- (void)unpinGroup:(NSString *)groupKey;
+
+/**
+ * 取消所有固定分组
+ */
+- (void)unpinAllGroups;
+
+/**
+ * 检查分组是否被固定（整部剧固定时其下所有单集均视为固定）
+ */
+- (BOOL)isGroupPinned:(NSString *)groupKey;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -8,7 +8,13 @@
 
 #import "CacheManager.h"
 #import "CacheConfig.h"
+#import "M3U8Metrics.h"
 #import <CommonCrypto/CommonDigest.h>
+#import <stdatomic.h>
+#import <sys/xattr.h>
+
+// 缓存文件上记录分组键的扩展属性名，重启后据此恢复分组
+static const char * const kCacheGroupAttributeName = "com.hlsencryption.cache.group";
 
 // MARK: - CacheStatistics Implementation
 @implementation CacheStatistics
@@ -34,20 +40,141 @@
 @property (nonatomic, strong) NSDate *createTime;
 @property (nonatomic, strong) NSDate *lastAccessTime;
 @property (nonatomic, assign) NSUInteger fileSize;
+@property (nonatomic, assign) CFAbsoluteTime expireTime;   // 过期时间点，写入时计算一次
+@property (nonatomic, assign) NSInteger heapIndex;         // 在过期堆中的位置，NSNotFound表示不在堆中
+@property (nonatomic, strong, nullable) NSString *groupKey; // 分组键，nil表示单独成组
 @end
 
 @implementation CacheItem
 @end
 
+// MARK: - Expiration Heap (Internal)
+/**
+ * 按过期时间排序的最小堆
+ * 后台清理只需从堆顶弹出已到期的条目，开销与过期条目数成正比，而不是与缓存总数成正比
+ */
+@interface CacheExpirationHeap : NSObject
+@property (nonatomic, assign, readonly) NSUInteger count;
+- (void)addItem:(CacheItem *)item;
+- (void)removeItem:(CacheItem *)item;
+- (CacheItem * _Nullable)peek;
+- (CacheItem * _Nullable)pop;
+- (void)removeAllItems;
+@end
+
+@implementation CacheExpirationHeap {
+    NSMutableArray<CacheItem *> *_items;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _items = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (NSUInteger)count {
+    return _items.count;
+}
+
+- (void)addItem:(CacheItem *)item {
+    item.heapIndex = _items.count;
+    [_items addObject:item];
+    [self siftUp:item.heapIndex];
+}
+
+- (void)removeItem:(CacheItem *)item {
+    NSInteger index = item.heapIndex;
+    if (index == NSNotFound || index >= (NSInteger)_items.count || _items[index] != item) {
+        return;
+    }
+    
+    NSInteger lastIndex = _items.count - 1;
+    if (index != lastIndex) {
+        [self swapIndex:index withIndex:lastIndex];
+    }
+    [_items removeLastObject];
+    item.heapIndex = NSNotFound;
+    
+    if (index < (NSInteger)_items.count) {
+        [self siftDown:index];
+        [self siftUp:index];
+    }
+}
+
+- (CacheItem *)peek {
+    return _items.firstObject;
+}
+
+- (CacheItem *)pop {
+    CacheItem *top = _items.firstObject;
+    if (top) {
+        [self removeItem:top];
+    }
+    return top;
+}
+
+- (void)removeAllItems {
+    for (CacheItem *item in _items) {
+        item.heapIndex = NSNotFound;
+    }
+    [_items removeAllObjects];
+}
+
+- (void)siftUp:(NSInteger)index {
+    while (index > 0) {
+        NSInteger parent = (index - 1) / 2;
+        if (_items[parent].expireTime <= _items[index].expireTime) break;
+        [self swapIndex:index withIndex:parent];
+        index = parent;
+    }
+}
+
+- (void)siftDown:(NSInteger)index {
+    NSInteger count = _items.count;
+    while (YES) {
+        NSInteger left = index * 2 + 1;
+        NSInteger right = left + 1;
+        NSInteger smallest = index;
+        
+        if (left < count && _items[left].expireTime < _items[smallest].expireTime) smallest = left;
+        if (right < count && _items[right].expireTime < _items[smallest].expireTime) smallest = right;
+        if (smallest == index) break;
+        
+        [self swapIndex:index withIndex:smallest];
+        index = smallest;
+    }
+}
+
+- (void)swapIndex:(NSInteger)i withIndex:(NSInteger)j {
+    [_items exchangeObjectAtIndex:i withObjectAtIndex:j];
+    _items[i].heapIndex = i;
+    _items[j].heapIndex = j;
+}
+
+@end
+
 // MARK: - CacheManager Implementation
 @interface CacheManager ()
 @property (nonatomic, strong) NSMutableDictionary<NSString *, CacheItem *> *cacheIndex;
 @property (nonatomic, strong) dispatch_queue_t cacheQueue;
 @property (nonatomic, strong) CacheStatistics *stats;
 @property (nonatomic, strong) NSFileManager *fileManager;
+@property (nonatomic, strong) CacheExpirationHeap *expirationHeap;
+@property (nonatomic, strong) dispatch_source_t expirationTimer;
+@property (nonatomic, assign) NSTimeInterval expirationInterval;
+@property (nonatomic, assign) NSUInteger totalSize;
+@property (nonatomic, strong) M3U8Metrics *metrics;
+@property (nonatomic, strong) NSRegularExpression *groupKeyRegex;
+@property (nonatomic, strong) NSMutableSet<NSString *> *pinnedGroups;
 @end
 
-@implementation CacheManager
+@implementation CacheManager {
+    // 读路径在并发队列上执行，命中/未命中计数使用原子变量
+    atomic_long _hitCount;
+    atomic_long _missCount;
+}
 
 + (instancetype)sharedManager {
     static CacheManager *instance = nil;
@@ -65,17 +192,34 @@
         _cacheQueue = dispatch_queue_create("com.hlsencryption.cache", DISPATCH_QUEUE_CONCURRENT);
         _stats = [[CacheStatistics alloc] init];
         _fileManager = [NSFileManager defaultManager];
+        _expirationHeap = [[CacheExpirationHeap alloc] init];
+        _expirationInterval = [[CacheConfig sharedConfig] cacheExpirationInterval];
+        _metrics = [M3U8Metrics sharedMetrics];
+        _pinnedGroups = [[NSMutableSet alloc] init];
+        _groupKeyRegex = [NSRegularExpression regularExpressionWithPattern:[CacheConfig sharedConfig].groupKeyPattern 
+                                                                   options:0 
+                                                                     error:nil];
+        atomic_init(&_hitCount, 0);
+        atomic_init(&_missCount, 0);
         
         [self setupCacheDirectory];
         [self loadCacheIndex];
+        [self startExpirationTimer];
     }
     return self;
 }
 
+- (void)dealloc {
+    if (_expirationTimer) {
+        dispatch_source_cancel(_expirationTimer);
+    }
+}
+
 #pragma mark - Public Methods
 
 - (NSData *)cachedDataForURL:(NSString *)url token:(NSString *)token {
     __block NSData *result = nil;
+    CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
     
     dispatch_sync(self.cacheQueue, ^{
         NSString *cacheKey = [self cacheKeyForURL:url token:token];
@@ -85,28 +229,36 @@
             // 更新访问时间
             item.lastAccessTime = [NSDate date];
             
-            // 读取文件内容
-            result = [NSData dataWithContentsOfFile:item.filePath];
+            // 以内存映射方式读取文件内容，避免整文件复制
+            result = [NSData dataWithContentsOfFile:item.filePath options:NSDataReadingMappedIfSafe error:nil];
             if (result) {
-                self.stats.hitCount++;
+                atomic_fetch_add_explicit(&self->_hitCount, 1, memory_order_relaxed);
                 NSLog(@"[CacheManager] 缓存命中: %@", cacheKey);
             } else {
                 // 文件丢失，清理索引
-                [self removeCacheItem:item];
-                self.stats.missCount++;
+                [self scheduleRemovalOfCacheItem:item reason:M3U8EvictionReasonMissingFile];
+                atomic_fetch_add_explicit(&self->_missCount, 1, memory_order_relaxed);
                 NSLog(@"[CacheManager] 缓存文件丢失: %@", cacheKey);
             }
         } else {
-            self.stats.missCount++;
-            if (item && ![self isCacheItemValid:item]) {
+            atomic_fetch_add_explicit(&self->_missCount, 1, memory_order_relaxed);
+            if (item) {
+                // 已过期但后台清理尚未处理到，交给写队列移除
                 NSLog(@"[CacheManager] 缓存已过期: %@", cacheKey);
-                [self removeCacheItem:item];
+                [self scheduleRemovalOfCacheItem:item reason:M3U8EvictionReasonExpired];
             } else {
                 NSLog(@"[CacheManager] 缓存未命中: %@", cacheKey);
             }
         }
     });
     
+    if (result) {
+        [self.metrics recordCacheHitForTier:M3U8CacheTierDisk latency:CFAbsoluteTimeGetCurrent() - startTime];
+        [self.metrics recordBytesRead:result.length forTier:M3U8CacheTierDisk];
+    } else {
+        [self.metrics recordCacheMissForTier:M3U8CacheTierDisk];
+    }
+    
     return result;
 }
 
@@ -119,19 +271,24 @@
         BOOL success = [data writeToFile:filePath atomically:YES];
         if (success) {
             // 创建缓存项
+            NSDate *now = [NSDate date];
             CacheItem *item = [[CacheItem alloc] init];
             item.key = cacheKey;
             item.filePath = filePath;
-            item.createTime = [NSDate date];
-            item.lastAccessTime = [NSDate date];
+            item.createTime = now;
+            item.lastAccessTime = now;
             item.fileSize = data.length;
+            item.expireTime = now.timeIntervalSinceReferenceDate + self.expirationInterval;
+            item.groupKey = [self groupKeyForURL:url];
+            [self writeGroupKey:item.groupKey toFile:filePath];
             
-            // 更新索引
+            // 更新索引（旧条目的文件已被新文件覆盖，只移除索引）
             CacheItem *oldItem = self.cacheIndex[cacheKey];
             if (oldItem) {
-                [self removeCacheItem:oldItem];
+                [self removeIndexEntryForCacheItem:oldItem];
             }
-            self.cacheIndex[cacheKey] = item;
+            [self addCacheItem:item];
+            [self.metrics recordBytesWritten:data.length forTier:M3U8CacheTierDisk];
             
             // 更新统计信息
             [self updateStatistics];
@@ -160,20 +317,9 @@
 
 - (void)cleanExpiredCache {
     dispatch_barrier_async(self.cacheQueue, ^{
-        NSMutableArray *expiredItems = [[NSMutableArray alloc] init];
-        
-        for (CacheItem *item in self.cacheIndex.allValues) {
-            if (![self isCacheItemValid:item]) {
-                [expiredItems addObject:item];
-            }
-        }
-        
-        for (CacheItem *item in expiredItems) {
-            [self removeCacheItem:item];
-        }
-        
-        [self updateStatistics];
-        NSLog(@"[CacheManager] 清理过期缓存完成，清理了%lu个文件", (unsigned long)expiredItems.count);
+        NSUInteger removed = [self expireDueItemsWithLimit:NSUIntegerMax];
+        [self.metrics recordEvictions:removed reason:M3U8EvictionReasonExpired];
+        NSLog(@"[CacheManager] 清理过期缓存完成，清理了%lu个文件", (unsigned long)removed);
     });
 }
 
@@ -185,10 +331,15 @@
         }
         
         // 清空索引
+        [self.metrics recordEvictions:self.cacheIndex.count reason:M3U8EvictionReasonCleared];
         [self.cacheIndex removeAllObjects];
+        [self.expirationHeap removeAllItems];
+        self.totalSize = 0;
         
         // 重置统计信息
         self.stats = [[CacheStatistics alloc] init];
+        atomic_store_explicit(&self->_hitCount, 0, memory_order_relaxed);
+        atomic_store_explicit(&self->_missCount, 0, memory_order_relaxed);
         
         NSLog(@"[CacheManager] 清空所有缓存完成");
     });
@@ -196,12 +347,14 @@
 
 
 - (CacheStatistics *)statistics {
-    static dispatch_once_t onceToken;
-    static CacheStatistics *instance = nil;
-    dispatch_once(&onceToken, ^{
-        instance = [CacheStatistics new];
+    CacheStatistics *snapshot = [CacheStatistics new];
+    dispatch_sync(self.cacheQueue, ^{
+        snapshot.fileCount = self.cacheIndex.count;
+        snapshot.totalSize = self.totalSize;
     });
-    return instance;
+    snapshot.hitCount = atomic_load_explicit(&_hitCount, memory_order_relaxed);
+    snapshot.missCount = atomic_load_explicit(&_missCount, memory_order_relaxed);
+    return snapshot;
 }
 
 - (void)performLRUCleanupIfNeeded {
@@ -214,20 +367,85 @@
     }
     
     // 检查内存大小限制
-    NSUInteger totalSize = 0;
-    for (CacheItem *item in self.cacheIndex.allValues) {
-        totalSize += item.fileSize;
-    }
-    
-    if (totalSize > [config maxMemorySizeInBytes]) {
+    if (self.totalSize > [config maxMemorySizeInBytes]) {
         // 需要清理到80%的限制
         NSUInteger targetSize = [config maxMemorySizeInBytes] * 0.8;
         [self performLRUCleanupToSize:targetSize];
     }
 }
 
+- (NSString *)groupKeyForURL:(NSString *)url {
+    if (!url || !self.groupKeyRegex) return nil;
+    
+    NSTextCheckingResult *match = [self.groupKeyRegex firstMatchInString:url options:0 range:NSMakeRange(0, url.length)];
+    if (!match || match.numberOfRanges < 2) return nil;
+    
+    NSMutableArray *components = [NSMutableArray arrayWithCapacity:match.numberOfRanges - 1];
+    for (NSUInteger i = 1; i < match.numberOfRanges; i++) {
+        NSRange range = [match rangeAtIndex:i];
+        if (range.location != NSNotFound) {
+            [components addObject:[url substringWithRange:range]];
+        }
+    }
+    return components.count > 0 ? [components componentsJoinedByString:@"/"] : nil;
+}
+
+- (void)pinGroup:(NSString *)groupKey {
+    if (groupKey.length == 0) return;
+    dispatch_barrier_async(self.cacheQueue, ^{
+        [self.pinnedGroups addObject:groupKey];
+        NSLog(@"[CacheManager] 固定缓存分组: %@", groupKey);
+    });
+}
+
+- (void)unpinGroup:(NSString *)groupKey {
+    if (groupKey.length == 0) return;
+    dispatch_barrier_async(self.cacheQueue, ^{
+        [self.pinnedGroups removeObject:groupKey];
+        NSLog(@"[CacheManager] 取消固定缓存分组: %@", groupKey);
+        [self performLRUCleanupIfNeeded];
+    });
+}
+
+- (void)unpinAllGroups {
+    dispatch_barrier_async(self.cacheQueue, ^{
+        [self.pinnedGroups removeAllObjects];
+        [self performLRUCleanupIfNeeded];
+    });
+}
+
+- (BOOL)isGroupPinned:(NSString *)groupKey {
+    __block BOOL pinned = NO;
+    dispatch_sync(self.cacheQueue, ^{
+        pinned = [self isGroupKeyPinned:groupKey];
+    });
+    return pinned;
+}
+
 #pragma mark - Private Methods
 
+- (BOOL)isGroupKeyPinned:(NSString *)groupKey {
+    if (groupKey.length == 0 || self.pinnedGroups.count == 0) return NO;
+    if ([self.pinnedGroups containsObject:groupKey]) return YES;
+    
+    // 整部剧固定："1071" 覆盖 "1071/1"、"1071/2"...
+    NSRange separator = [groupKey rangeOfString:@"/"];
+    return separator.location != NSNotFound && [self.pinnedGroups containsObject:[groupKey substringToIndex:separator.location]];
+}
+
+- (void)writeGroupKey:(NSString *)groupKey toFile:(NSString *)filePath {
+    if (groupKey.length == 0) return;
+    const char *value = groupKey.UTF8String;
+    setxattr(filePath.fileSystemRepresentation, kCacheGroupAttributeName, value, strlen(value), 0, 0);
+}
+
+- (NSString *)readGroupKeyFromFile:(NSString *)filePath {
+    char buffer[256];
+    ssize_t length = getxattr(filePath.fileSystemRepresentation, kCacheGroupAttributeName, buffer, sizeof(buffer), 0, 0);
+    if (length <= 0) return nil;
+    return [[NSString alloc] initWithBytes:buffer length:(NSUInteger)length encoding:NSUTF8StringEncoding];
+}
+
 - (void)setupCacheDirectory {
     CacheConfig *config = [CacheConfig sharedConfig];
     NSString *cacheDir = [config fullCacheDirectoryPath];
@@ -255,6 +473,7 @@
     NSArray *files = [self.fileManager contentsOfDirectoryAtPath:cacheDir error:&error];
     
     if (files) {
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
         for (NSString *fileName in files) {
             if ([fileName hasSuffix:@".m3u8"]) {
                 NSString *filePath = [cacheDir stringByAppendingPathComponent:fileName];
@@ -268,9 +487,11 @@
                     item.createTime = attributes[NSFileCreationDate];
                     item.lastAccessTime = attributes[NSFileModificationDate];
                     item.fileSize = [attributes[NSFileSize] unsignedIntegerValue];
+                    item.expireTime = item.createTime.timeIntervalSinceReferenceDate + self.expirationInterval;
+                    item.groupKey = [self readGroupKeyFromFile:filePath];
                     
-                    if ([self isCacheItemValid:item]) {
-                        self.cacheIndex[cacheKey] = item;
+                    if (item.expireTime > now) {
+                        [self addCacheItem:item];
                     } else {
                         // 过期文件，删除
                         [self.fileManager removeItemAtPath:filePath error:nil];
@@ -310,63 +531,171 @@
 }
 
 - (BOOL)isCacheItemValid:(CacheItem *)item {
-    CacheConfig *config = [CacheConfig sharedConfig];
-    NSTimeInterval expirationInterval = config.cacheExpirationMinutes * 60; // 转换为秒
-    NSTimeInterval age = [[NSDate date] timeIntervalSinceDate:item.createTime];
-    return age < expirationInterval;
+    return CFAbsoluteTimeGetCurrent() < item.expireTime;
+}
+
+- (void)addCacheItem:(CacheItem *)item {
+    self.cacheIndex[item.key] = item;
+    [self.expirationHeap addItem:item];
+    self.totalSize += item.fileSize;
+}
+
+- (void)removeIndexEntryForCacheItem:(CacheItem *)item {
+    if (self.cacheIndex[item.key] != item) return;
+    
+    [self.cacheIndex removeObjectForKey:item.key];
+    [self.expirationHeap removeItem:item];
+    self.totalSize -= MIN(self.totalSize, item.fileSize);
 }
 
 - (void)removeCacheItem:(CacheItem *)item {
     [self.fileManager removeItemAtPath:item.filePath error:nil];
-    [self.cacheIndex removeObjectForKey:item.key];
+    [self removeIndexEntryForCacheItem:item];
+}
+
+- (void)scheduleRemovalOfCacheItem:(CacheItem *)item reason:(M3U8EvictionReason)reason {
+    // 读操作在并发队列上执行，索引修改统一放到barrier中
+    dispatch_barrier_async(self.cacheQueue, ^{
+        if (self.cacheIndex[item.key] == item) {
+            [self removeCacheItem:item];
+            [self.metrics recordEvictions:1 reason:reason];
+            [self updateStatistics];
+        }
+    });
 }
 
 - (void)updateStatistics {
     self.stats.fileCount = self.cacheIndex.count;
+    self.stats.totalSize = self.totalSize;
+}
+
+#pragma mark - Expiration
+
+- (void)startExpirationTimer {
+    CacheConfig *config = [CacheConfig sharedConfig];
+    uint64_t interval = (uint64_t)MAX(config.expirationSweepIntervalSeconds, 1) * NSEC_PER_SEC;
+    NSUInteger limit = (NSUInteger)MAX(config.maxExpirationsPerSweep, 1);
+    
+    self.expirationTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0,
+                                                  dispatch_get_global_queue(QOS_CLASS_UTILITY, 0));
+    dispatch_source_set_timer(self.expirationTimer,
+                              dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval),
+                              interval,
+                              interval / 10);
+    
+    __weak typeof(self) weakSelf = self;
+    dispatch_source_set_event_handler(self.expirationTimer, ^{
+        __strong typeof(weakSelf) strongSelf = weakSelf;
+        if (!strongSelf) return;
+        
+        dispatch_barrier_async(strongSelf.cacheQueue, ^{
+            NSUInteger removed = [strongSelf expireDueItemsWithLimit:limit];
+            [strongSelf.metrics recordEvictions:removed reason:M3U8EvictionReasonExpired];
+            if (removed > 0) {
+                NSLog(@"[CacheManager] 后台清理过期缓存%lu个，剩余%lu个", 
+                      (unsigned long)removed, (unsigned long)strongSelf.cacheIndex.count);
+            }
+        });
+    });
+    dispatch_resume(self.expirationTimer);
+}
+
+/**
+ * 从过期堆顶依次移除已到期的条目（必须在barrier中调用）
+ * @param limit 本次最多移除的条目数
+ * @return 实际移除的条目数
+ */
+- (NSUInteger)expireDueItemsWithLimit:(NSUInteger)limit {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    NSUInteger removed = 0;
+    
+    while (removed < limit) {
+        CacheItem *item = [self.expirationHeap peek];
+        if (!item || item.expireTime > now) break;
+        
+        [self removeCacheItem:item];
+        removed++;
+    }
+    
+    if (removed > 0) {
+        [self updateStatistics];
+    }
+    return removed;
+}
+
+/**
+ * 按分组汇总可淘汰的缓存条目
+ * 同组条目一起淘汰，分组的访问时间取组内最近一次访问；固定的分组不参与淘汰
+ * @return 按最后访问时间排序的分组列表，最久未访问的排在前面
+ */
+- (NSArray<NSArray<CacheItem *> *> *)evictableGroupsInLRUOrder {
+    NSMutableDictionary<NSString *, NSMutableArray<CacheItem *> *> *groups = [NSMutableDictionary dictionary];
+    NSMutableDictionary<NSString *, NSDate *> *groupAccessTimes = [NSMutableDictionary dictionary];
     
-    NSUInteger totalSize = 0;
     for (CacheItem *item in self.cacheIndex.allValues) {
-        totalSize += item.fileSize;
+        if ([self isGroupKeyPinned:item.groupKey]) continue;
+        
+        NSString *groupKey = item.groupKey ?: item.key;
+        NSMutableArray *group = groups[groupKey];
+        if (!group) {
+            group = [NSMutableArray array];
+            groups[groupKey] = group;
+        }
+        [group addObject:item];
+        
+        NSDate *accessTime = groupAccessTimes[groupKey];
+        if (!accessTime || [item.lastAccessTime compare:accessTime] == NSOrderedDescending) {
+            groupAccessTimes[groupKey] = item.lastAccessTime;
+        }
     }
-    self.stats.totalSize = totalSize;
+    
+    NSArray *sortedKeys = [groups.allKeys sortedArrayUsingComparator:^NSComparisonResult(NSString *key1, NSString *key2) {
+        return [groupAccessTimes[key1] compare:groupAccessTimes[key2]];
+    }];
+    
+    NSMutableArray *sortedGroups = [NSMutableArray arrayWithCapacity:sortedKeys.count];
+    for (NSString *key in sortedKeys) {
+        [sortedGroups addObject:groups[key]];
+    }
+    return sortedGroups;
 }
 
 - (void)performLRUCleanup:(NSInteger)count {
-    // 按最后访问时间排序，最久未访问的排在前面
-    NSArray *sortedItems = [self.cacheIndex.allValues sortedArrayUsingComparator:^NSComparisonResult(CacheItem *obj1, CacheItem *obj2) {
-        return [obj1.lastAccessTime compare:obj2.lastAccessTime];
-    }];
+    // 按分组的最后访问时间排序，最久未访问的分组排在前面，整组淘汰
+    NSArray<NSArray<CacheItem *> *> *sortedGroups = [self evictableGroupsInLRUOrder];
     
     NSInteger removed = 0;
-    for (CacheItem *item in sortedItems) {
+    for (NSArray<CacheItem *> *group in sortedGroups) {
         if (removed >= count) break;
         
-        [self removeCacheItem:item];
-        removed++;
+        for (CacheItem *item in group) {
+            [self removeCacheItem:item];
+            removed++;
+        }
     }
     
     [self updateStatistics];
+    [self.metrics recordEvictions:removed reason:M3U8EvictionReasonFileCount];
     NSLog(@"[CacheManager] LRU清理完成，删除了%ld个文件", (long)removed);
 }
 
 - (void)performLRUCleanupToSize:(NSUInteger)targetSize {
-    // 按最后访问时间排序
-    NSArray *sortedItems = [self.cacheIndex.allValues sortedArrayUsingComparator:^NSComparisonResult(CacheItem *obj1, CacheItem *obj2) {
-        return [obj1.lastAccessTime compare:obj2.lastAccessTime];
-    }];
+    // 按分组的最后访问时间排序，整组淘汰
+    NSArray<NSArray<CacheItem *> *> *sortedGroups = [self evictableGroupsInLRUOrder];
     
-    NSUInteger currentSize = self.stats.totalSize;
     NSInteger removed = 0;
-    
-    for (CacheItem *item in sortedItems) {
-        if (currentSize <= targetSize) break;
+    for (NSArray<CacheItem *> *group in sortedGroups) {
+        if (self.totalSize <= targetSize) break;
         
-        currentSize -= item.fileSize;
-        [self removeCacheItem:item];
-        removed++;
+        for (CacheItem *item in group) {
+            [self removeCacheItem:item];
+            removed++;
+        }
     }
+    NSUInteger currentSize = self.totalSize;
     
     [self updateStatistics];
+    [self.metrics recordEvictions:removed reason:M3U8EvictionReasonSize];
     NSLog(@"[CacheManager] LRU大小清理完成，删除了%ld个文件，当前大小%.2fMB", 
           (long)removed, currentSize / (1024.0 * 1024.0));
 }
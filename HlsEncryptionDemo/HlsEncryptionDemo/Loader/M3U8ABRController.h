@@ -0,0 +1,131 @@
+//
+//  M3U8ABRController.h
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "M3U8Models.h"
+#import "M3U8BandwidthEstimator.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+// MARK: - M3U8ABRConfiguration
+
+/**
+ * 自适应码率参数（按网络类型分别配置）
+ * 升档与降档使用不同的安全系数，两者之间的区间作为滞后带：估算带宽在区间内波动时保持当前清晰度
+ */
+@interface M3U8ABRConfiguration : NSObject <NSCopying>
+
+/**
+ * 升档安全系数：估算带宽 × 该系数 ≥ 目标码率时才允许升档（WiFi默认0.8，蜂窝0.7）
+ * 降档时也按该系数选择落点，保证降档后的码率可持续
+ */
+@property (nonatomic, assign) double upSwitchSafetyFactor;
+
+/**
+ * 降档安全系数：估算带宽 × 该系数 < 当前码率时开始降档（WiFi默认1.0，蜂窝0.9），应不小于升档系数
+ */
+@property (nonatomic, assign) double downSwitchSafetyFactor;
+
+/**
+ * 升档条件需要持续满足的时长（秒，WiFi默认5秒，蜂窝10秒）
+ */
+@property (nonatomic, assign) NSTimeInterval upSwitchHoldDuration;
+
+/**
+ * 降档条件需要持续满足的时长（秒，WiFi默认2秒，蜂窝3秒）
+ */
+@property (nonatomic, assign) NSTimeInterval downSwitchHoldDuration;
+
+/**
+ * 两次切换之间的最小间隔（秒，WiFi默认10秒，蜂窝15秒），紧急降档不受限制
+ */
+@property (nonatomic, assign) NSTimeInterval minSwitchInterval;
+
+/**
+ * 升档所需的最小缓冲时长（秒，WiFi默认8秒，蜂窝10秒）
+ */
+@property (nonatomic, assign) NSTimeInterval minBufferForUpSwitch;
+
+/**
+ * 缓冲充足时长（秒，默认20秒）：缓冲高于该值时带宽短暂下降不降档
+ */
+@property (nonatomic, assign) NSTimeInterval comfortableBufferDuration;
+
+/**
+ * 紧急缓冲时长（秒，WiFi默认3秒，蜂窝4秒）：缓冲低于该值且带宽不足时立即降档
+ */
+@property (nonatomic, assign) NSTimeInterval panicBufferDuration;
+
+/**
+ * 最高码率（bps），0表示不限制；可用于蜂窝网络下限制流量
+ */
+@property (nonatomic, assign) NSInteger maxBandwidth;
+
+/**
+ * 指定网络类型（"wifi" / "cellular" / "unknown"）的默认参数，未知网络按蜂窝处理
+ */
++ (instancetype)defaultConfigurationForNetwork:(NSString *)network;
+
+@end
+
+// MARK: - M3U8ABRController
+
+/**
+ * 基于吞吐量的自适应码率控制器
+ * 读取M3U8BandwidthEstimator的实时估算和播放器缓冲时长，决定何时升档/降档：
+ * - 码率阶梯按清晰度等级划分，每档取该等级带宽最高的流（与switchToQuality:选择的流一致）
+ * - 升档：估算带宽 × 升档系数足以支撑上一档、缓冲足够，且持续upSwitchHoldDuration后每次升一档
+ * - 降档：估算带宽 × 降档系数不足以支撑当前档，持续downSwitchHoldDuration后降到可持续的最高档；
+ *   缓冲低于panicBufferDuration时立即降档，缓冲充足时暂不降档
+ * - 两次切换至少间隔minSwitchInterval，网络类型变化时重新计时
+ * 控制器只做决策，由M3U8PlayerManager在主线程定期调用并执行切换
+ */
+@interface M3U8ABRController : NSObject
+
+/**
+ * 带宽估算器，默认为共享估算器
+ */
+@property (nonatomic, strong) M3U8BandwidthEstimator *estimator;
+
+/**
+ * 设置指定网络类型的参数
+ * @param configuration 参数，传nil恢复默认值
+ * @param network 网络类型（"wifi" / "cellular" / "unknown"）
+ */
+- (void)setConfiguration:(M3U8ABRConfiguration * _Nullable)configuration forNetwork:(NSString *)network;
+
+/**
+ * 指定网络类型当前使用的参数（副本）
+ */
+- (M3U8ABRConfiguration *)configurationForNetwork:(NSString *)network;
+
+/**
+ * 根据当前带宽和缓冲决定是否切换清晰度
+ * 返回非nil时视为已开始切换，控制器从此刻开始计算切换间隔
+ * @param currentStream 当前播放的流
+ * @param masterPlaylist 主播放列表
+ * @param bufferedDuration 播放位置之后已缓冲的时长（秒），未知时传负数
+ * @return 需要切换到的清晰度（"标清"/"高清"/"超清"/"蓝光"），保持当前清晰度时返回nil
+ */
+- (NSString * _Nullable)qualityToSwitchFromStream:(StreamInfo *)currentStream
+                                 inMasterPlaylist:(MasterPlaylist *)masterPlaylist
+                                 bufferedDuration:(NSTimeInterval)bufferedDuration;
+
+/**
+ * 清除计时状态（开始播放新视频时调用）
+ */
+- (void)reset;
+
+/**
+ * 控制器统计
+ */
+- (NSDictionary *)statistics;
+
+@end
+
+NS_ASSUME_NONNULL_END
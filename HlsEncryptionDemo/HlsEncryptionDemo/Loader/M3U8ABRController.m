@@ -0,0 +1,327 @@
+//
+//  M3U8ABRController.m
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import "M3U8ABRController.h"
+#import "M3U8Metrics.h"
+
+// MARK: - M3U8ABRConfiguration
+
+@implementation M3U8ABRConfiguration
+
++ (instancetype)defaultConfigurationForNetwork:(NSString *)network {
+    M3U8ABRConfiguration *configuration = [[M3U8ABRConfiguration alloc] init];
+    if ([network isEqualToString:@"wifi"]) {
+        configuration.upSwitchSafetyFactor = 0.8;
+        configuration.downSwitchSafetyFactor = 1.0;
+        configuration.upSwitchHoldDuration = 5.0;
+        configuration.downSwitchHoldDuration = 2.0;
+        configuration.minSwitchInterval = 10.0;
+        configuration.minBufferForUpSwitch = 8.0;
+        configuration.panicBufferDuration = 3.0;
+    } else {
+        // 蜂窝网络波动大，升档更保守、降档更及时
+        configuration.upSwitchSafetyFactor = 0.7;
+        configuration.downSwitchSafetyFactor = 0.9;
+        configuration.upSwitchHoldDuration = 10.0;
+        configuration.downSwitchHoldDuration = 3.0;
+        configuration.minSwitchInterval = 15.0;
+        configuration.minBufferForUpSwitch = 10.0;
+        configuration.panicBufferDuration = 4.0;
+    }
+    configuration.comfortableBufferDuration = 20.0;
+    configuration.maxBandwidth = 0;
+    return configuration;
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+    M3U8ABRConfiguration *copy = [[M3U8ABRConfiguration allocWithZone:zone] init];
+    copy.upSwitchSafetyFactor = self.upSwitchSafetyFactor;
+    copy.downSwitchSafetyFactor = self.downSwitchSafetyFactor;
+    copy.upSwitchHoldDuration = self.upSwitchHoldDuration;
+    copy.downSwitchHoldDuration = self.downSwitchHoldDuration;
+    copy.minSwitchInterval = self.minSwitchInterval;
+    copy.minBufferForUpSwitch = self.minBufferForUpSwitch;
+    copy.comfortableBufferDuration = self.comfortableBufferDuration;
+    copy.panicBufferDuration = self.panicBufferDuration;
+    copy.maxBandwidth = self.maxBandwidth;
+    return copy;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"M3U8ABRConfiguration: up=%.2f, down=%.2f, hold=%.0f/%.0fs, interval=%.0fs, buffer=%.0f/%.0f/%.0fs, max=%ldbps",
+            self.upSwitchSafetyFactor, self.downSwitchSafetyFactor, self.upSwitchHoldDuration, self.downSwitchHoldDuration,
+            self.minSwitchInterval, self.panicBufferDuration, self.minBufferForUpSwitch, self.comfortableBufferDuration, (long)self.maxBandwidth];
+}
+
+@end
+
+// MARK: - M3U8ABRRung
+
+/**
+ * 码率阶梯的一档：清晰度等级及该等级带宽最高的流的码率
+ */
+@interface M3U8ABRRung : NSObject
+@property (nonatomic, copy) NSString *quality;
+@property (nonatomic, assign) NSInteger bandwidth;
+@end
+
+@implementation M3U8ABRRung
+@end
+
+// MARK: - M3U8ABRController
+
+@interface M3U8ABRController ()
+
+@property (nonatomic, strong) NSMutableDictionary<NSString *, M3U8ABRConfiguration *> *configurations;
+
+// 码率阶梯缓存（按主播放列表）
+@property (nonatomic, weak) MasterPlaylist *ladderMasterPlaylist;
+@property (nonatomic, copy) NSArray<M3U8ABRRung *> *ladder;
+
+// 计时状态
+@property (nonatomic, copy) NSString *lastNetwork;
+@property (nonatomic, assign) CFAbsoluteTime upSwitchSince;     // 升档条件开始满足的时间，0表示未满足
+@property (nonatomic, assign) CFAbsoluteTime downSwitchSince;   // 降档条件开始满足的时间，0表示未满足
+@property (nonatomic, assign) CFAbsoluteTime lastSwitchTime;
+
+// 统计
+@property (nonatomic, assign) NSUInteger upSwitchCount;
+@property (nonatomic, assign) NSUInteger downSwitchCount;
+@property (nonatomic, assign) NSUInteger panicSwitchCount;
+@property (nonatomic, copy) NSDictionary *lastDecision;
+
+@end
+
+@implementation M3U8ABRController
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _estimator = [M3U8BandwidthEstimator sharedEstimator];
+        _configurations = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+#pragma mark - Configuration
+
+- (void)setConfiguration:(M3U8ABRConfiguration *)configuration forNetwork:(NSString *)network {
+    @synchronized (self) {
+        self.configurations[network] = [configuration copy];
+    }
+    NSLog(@"[M3U8ABRController] 更新%@网络参数: %@", network, configuration ?: @"默认");
+}
+
+- (M3U8ABRConfiguration *)configurationForNetwork:(NSString *)network {
+    @synchronized (self) {
+        M3U8ABRConfiguration *configuration = self.configurations[network];
+        return configuration ? [configuration copy] : [M3U8ABRConfiguration defaultConfigurationForNetwork:network];
+    }
+}
+
+#pragma mark - Decision
+
+- (NSString *)qualityToSwitchFromStream:(StreamInfo *)currentStream
+                       inMasterPlaylist:(MasterPlaylist *)masterPlaylist
+                       bufferedDuration:(NSTimeInterval)bufferedDuration {
+    NSString *network = [self.estimator currentNetworkIdentifier];
+    M3U8ABRConfiguration *configuration = [self configurationForNetwork:network];
+    double estimate = [self.estimator estimatedBandwidth];
+    
+    @synchronized (self) {
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+        
+        // 网络类型变化时之前的计时不再有效
+        if (![network isEqualToString:self.lastNetwork]) {
+            self.lastNetwork = network;
+            self.upSwitchSince = 0;
+            self.downSwitchSince = 0;
+        }
+        
+        NSArray<M3U8ABRRung *> *ladder = [self ladderForMasterPlaylist:masterPlaylist];
+        NSUInteger currentIndex = [self indexOfQuality:[currentStream qualityLevel] inLadder:ladder];
+        if (estimate <= 0 || ladder.count < 2 || currentIndex == NSNotFound) {
+            return nil;
+        }
+        
+        // 受最高码率限制的最高档，至少保留最低一档
+        NSUInteger allowedTop = ladder.count - 1;
+        if (configuration.maxBandwidth > 0) {
+            while (allowedTop > 0 && ladder[allowedTop].bandwidth > configuration.maxBandwidth) {
+                allowedTop--;
+            }
+        }
+        
+        // 按升档系数可持续的最高档
+        double sustainableBandwidth = estimate * configuration.upSwitchSafetyFactor;
+        NSUInteger sustainableIndex = 0;
+        for (NSUInteger i = 0; i <= allowedTop; i++) {
+            if (ladder[i].bandwidth <= sustainableBandwidth) {
+                sustainableIndex = i;
+            }
+        }
+        
+        BOOL bufferKnown = bufferedDuration >= 0;
+        
+        // 降档：当前码率超出降档阈值，或超出最高码率限制
+        BOOL needsDownSwitch = currentStream.bandwidth > estimate * configuration.downSwitchSafetyFactor || currentIndex > allowedTop;
+        if (needsDownSwitch && currentIndex > 0) {
+            self.upSwitchSince = 0;
+            NSUInteger targetIndex = MIN(sustainableIndex, currentIndex - 1);
+            
+            if (bufferKnown && bufferedDuration < configuration.panicBufferDuration) {
+                return [self switchToRung:ladder[targetIndex] from:ladder[currentIndex] direction:@"panic"
+                                 estimate:estimate buffered:bufferedDuration network:network now:now];
+            }
+            if (bufferKnown && bufferedDuration >= configuration.comfortableBufferDuration && currentIndex <= allowedTop) {
+                // 缓冲足以撑过短暂的带宽下降
+                self.downSwitchSince = 0;
+                return nil;
+            }
+            if (self.downSwitchSince <= 0) {
+                self.downSwitchSince = now;
+                return nil;
+            }
+            if (now - self.downSwitchSince < configuration.downSwitchHoldDuration ||
+                now - self.lastSwitchTime < configuration.minSwitchInterval) {
+                return nil;
+            }
+            return [self switchToRung:ladder[targetIndex] from:ladder[currentIndex] direction:@"down"
+                             estimate:estimate buffered:bufferedDuration network:network now:now];
+        }
+        self.downSwitchSince = 0;
+        
+        // 升档：每次只升一档，缓冲未知时不升档
+        if (sustainableIndex > currentIndex) {
+            if (!bufferKnown || bufferedDuration < configuration.minBufferForUpSwitch) {
+                self.upSwitchSince = 0;
+                return nil;
+            }
+            if (self.upSwitchSince <= 0) {
+                self.upSwitchSince = now;
+                return nil;
+            }
+            if (now - self.upSwitchSince < configuration.upSwitchHoldDuration ||
+                now - self.lastSwitchTime < configuration.minSwitchInterval) {
+                return nil;
+            }
+            return [self switchToRung:ladder[currentIndex + 1] from:ladder[currentIndex] direction:@"up"
+                             estimate:estimate buffered:bufferedDuration network:network now:now];
+        }
+        self.upSwitchSince = 0;
+        return nil;
+    }
+}
+
+/**
+ * 记录一次切换决策（调用方已持有锁）
+ */
+- (NSString *)switchToRung:(M3U8ABRRung *)target
+                      from:(M3U8ABRRung *)current
+                 direction:(NSString *)direction
+                  estimate:(double)estimate
+                  buffered:(NSTimeInterval)buffered
+                   network:(NSString *)network
+                       now:(CFAbsoluteTime)now {
+    self.lastSwitchTime = now;
+    self.upSwitchSince = 0;
+    self.downSwitchSince = 0;
+    
+    if ([direction isEqualToString:@"up"]) {
+        self.upSwitchCount++;
+    } else if ([direction isEqualToString:@"down"]) {
+        self.downSwitchCount++;
+    } else {
+        self.panicSwitchCount++;
+    }
+    self.lastDecision = @{
+        @"direction": direction,
+        @"from": current.quality,
+        @"to": target.quality,
+        @"estimatedBandwidth": @(estimate),
+        @"bufferedDuration": @(buffered),
+        @"network": network
+    };
+    [[[M3U8Metrics sharedMetrics] counterNamed:@"m3u8_abr_switches_total" labels:@{@"direction": direction}] increment];
+    
+    NSLog(@"[M3U8ABRController] %@切换: %@(%.0fkbps) -> %@(%.0fkbps)，估算带宽%.0fkbps，缓冲%.1f秒，网络%@",
+          direction, current.quality, current.bandwidth / 1000.0, target.quality, target.bandwidth / 1000.0,
+          estimate / 1000.0, buffered, network);
+    return target.quality;
+}
+
+- (void)reset {
+    @synchronized (self) {
+        self.upSwitchSince = 0;
+        self.downSwitchSince = 0;
+        self.lastSwitchTime = 0;
+        self.ladderMasterPlaylist = nil;
+        self.ladder = nil;
+    }
+}
+
+#pragma mark - Ladder
+
+/**
+ * 按清晰度等级构建码率阶梯（码率从低到高），每档取该等级带宽最高的流
+ */
+- (NSArray<M3U8ABRRung *> *)ladderForMasterPlaylist:(MasterPlaylist *)masterPlaylist {
+    if (self.ladder && self.ladderMasterPlaylist == masterPlaylist) {
+        return self.ladder;
+    }
+    
+    NSMutableDictionary<NSString *, M3U8ABRRung *> *rungs = [NSMutableDictionary dictionary];
+    for (StreamInfo *stream in masterPlaylist.streams) {
+        NSString *quality = [stream qualityLevel];
+        M3U8ABRRung *rung = rungs[quality];
+        if (!rung) {
+            rung = [[M3U8ABRRung alloc] init];
+            rung.quality = quality;
+            rungs[quality] = rung;
+        }
+        rung.bandwidth = MAX(rung.bandwidth, stream.bandwidth);
+    }
+    
+    NSArray<M3U8ABRRung *> *ladder = [rungs.allValues sortedArrayUsingComparator:^NSComparisonResult(M3U8ABRRung *a, M3U8ABRRung *b) {
+        return [@(a.bandwidth) compare:@(b.bandwidth)];
+    }];
+    self.ladderMasterPlaylist = masterPlaylist;
+    self.ladder = ladder;
+    return ladder;
+}
+
+- (NSUInteger)indexOfQuality:(NSString *)quality inLadder:(NSArray<M3U8ABRRung *> *)ladder {
+    for (NSUInteger i = 0; i < ladder.count; i++) {
+        if ([ladder[i].quality isEqualToString:quality]) {
+            return i;
+        }
+    }
+    return NSNotFound;
+}
+
+#pragma mark - Statistics
+
+- (NSDictionary *)statistics {
+    @synchronized (self) {
+        NSMutableArray *ladder = [NSMutableArray array];
+        for (M3U8ABRRung *rung in self.ladder) {
+            [ladder addObject:@{@"quality": rung.quality, @"bandwidth": @(rung.bandwidth)}];
+        }
+        return @{
+            @"network": self.lastNetwork ?: @"unknown",
+            @"estimatedBandwidth": @([self.estimator estimatedBandwidth]),
+            @"upSwitches": @(self.upSwitchCount),
+            @"downSwitches": @(self.downSwitchCount),
+            @"panicSwitches": @(self.panicSwitchCount),
+            @"ladder": ladder,
+            @"lastDecision": self.lastDecision ?: @{}
+        };
+    }
+}
+
+@end
@@ -16,8 +16,8 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @interface M3U8AuthConfig : NSObject
 
-// 新增encrypt_token支持
-@property (nonatomic, strong) NSString *encryptToken;
+// 新增encrypt_token支持（M3U8TokenManager会在后台线程写入刷新后的token，因此为atomic）
+@property (atomic, strong) NSString *encryptToken;
 
 /**
  * 创建默认测试配置
@@ -34,6 +34,18 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (NSString *)authParamsString;
 
+/**
+ * encrypt_token中的时间戳（格式 "<时间戳>.<剧集>.<集数>.<签名>"）
+ * @return 过期时间，token格式不符时返回nil
+ */
+- (NSDate * _Nullable)tokenExpirationDate;
+
+/**
+ * 授权范围（token中的剧集与集数，如 "1071.1"）
+ * 同一范围内刷新token不改变可访问的内容，token格式不符时返回完整token
+ */
+- (NSString *)authScope;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -27,4 +27,24 @@
     return [NSString stringWithFormat:@"encrypt_token=%@", self.encryptToken ?: @""];
 }
 
+- (NSDate *)tokenExpirationDate {
+    NSArray<NSString *> *components = [self.encryptToken componentsSeparatedByString:@"."];
+    if (components.count < 4) {
+        return nil;
+    }
+    NSTimeInterval timestamp = [components.firstObject doubleValue];
+    if (timestamp <= 0) {
+        return nil;
+    }
+    return [NSDate dateWithTimeIntervalSince1970:timestamp];
+}
+
+- (NSString *)authScope {
+    NSArray<NSString *> *components = [self.encryptToken componentsSeparatedByString:@"."];
+    if (components.count < 4) {
+        return self.encryptToken ?: @"";
+    }
+    return [[components subarrayWithRange:NSMakeRange(1, components.count - 2)] componentsJoinedByString:@"."];
+}
+
 @end
@@ -0,0 +1,63 @@
+//
+//  M3U8BandwidthEstimator.h
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 带宽估算器
+ * 由播放列表、密钥和TS分片的每次传输喂入字节数与耗时：
+ * - 按传输时长加权的快/慢两条EWMA（半衰期2秒/5秒），取较小值
+ * - 最近20个样本的调和平均（对偶发的高吞吐样本不敏感）
+ * 估算值取两者较小值；小于minSampleBytes的传输不计入，避免小对象的握手/首字节时间拉低估算
+ * 每种网络（WiFi/蜂窝）的估算值会持久化，重启后作为初始值
+ */
+@interface M3U8BandwidthEstimator : NSObject
+
+/**
+ * 计入估算的最小传输字节数，默认16KB
+ */
+@property (nonatomic, assign) int64_t minSampleBytes;
+
+/**
+ * 获取共享估算器
+ */
++ (instancetype)sharedEstimator;
+
+/**
+ * 记录一次传输
+ * @param bytes 传输字节数
+ * @param duration 传输耗时（秒，不含首字节等待）
+ */
+- (void)recordTransferOfBytes:(int64_t)bytes duration:(NSTimeInterval)duration;
+
+/**
+ * 当前带宽估算（bps）
+ * 样本不足时返回当前网络持久化的估算值，没有历史时返回按网络类型的默认值
+ */
+- (double)estimatedBandwidth;
+
+/**
+ * 当前带宽估算（kbps），可直接用于QualitySelector
+ */
+- (NSInteger)estimatedBandwidthKbps;
+
+/**
+ * 当前网络标识（"wifi" / "cellular" / "unknown"）
+ */
+- (NSString *)currentNetworkIdentifier;
+
+/**
+ * 估算器状态
+ */
+- (NSDictionary *)statistics;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,273 @@
+//
+//  M3U8BandwidthEstimator.m
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import "M3U8BandwidthEstimator.h"
+#import "M3U8Metrics.h"
+#import "AFNetworkReachabilityManager.h"
+#import <os/lock.h>
+
+// 持久化键
+static NSString * const kBandwidthEstimatesDefaultsKey = @"M3U8BandwidthEstimates";
+
+// EWMA半衰期（秒）
+static const double kFastHalfLife = 2.0;
+static const double kSlowHalfLife = 5.0;
+
+// 调和平均窗口
+#define kHarmonicWindowSize 20
+
+// 启用实时估算所需的最少样本数
+static const NSUInteger kMinSamplesForEstimate = 3;
+
+// 持久化最小间隔（秒）
+static const NSTimeInterval kPersistInterval = 10.0;
+
+// MARK: - M3U8BandwidthEWMA
+
+/**
+ * 按传输时长加权的指数移动平均
+ */
+@interface M3U8BandwidthEWMA : NSObject
+@property (nonatomic, assign, readonly) double estimate;
+- (instancetype)initWithHalfLife:(double)halfLife;
+- (void)addSample:(double)bandwidth weight:(double)weight;
+- (void)reset;
+@end
+
+@implementation M3U8BandwidthEWMA {
+    double _alpha;
+    double _estimate;
+    double _totalWeight;
+}
+
+- (instancetype)initWithHalfLife:(double)halfLife {
+    self = [super init];
+    if (self) {
+        _alpha = exp(log(0.5) / halfLife);
+    }
+    return self;
+}
+
+- (void)addSample:(double)bandwidth weight:(double)weight {
+    double adjustedAlpha = pow(_alpha, weight);
+    _estimate = bandwidth * (1.0 - adjustedAlpha) + adjustedAlpha * _estimate;
+    _totalWeight += weight;
+}
+
+- (double)estimate {
+    // 零偏修正：样本少时除以已累计的权重份额
+    double zeroFactor = 1.0 - pow(_alpha, _totalWeight);
+    return zeroFactor > 0 ? _estimate / zeroFactor : 0;
+}
+
+- (void)reset {
+    _estimate = 0;
+    _totalWeight = 0;
+}
+
+@end
+
+// MARK: - M3U8BandwidthEstimator
+
+@interface M3U8BandwidthEstimator () {
+    os_unfair_lock _lock;
+    double _harmonicSamples[kHarmonicWindowSize];
+    NSUInteger _harmonicNext;
+    NSUInteger _harmonicCount;
+}
+
+@property (nonatomic, strong) M3U8BandwidthEWMA *fastEWMA;
+@property (nonatomic, strong) M3U8BandwidthEWMA *slowEWMA;
+@property (nonatomic, assign) NSUInteger sampleCount;
+@property (nonatomic, copy) NSString *networkIdentifier;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSNumber *> *persistedEstimates;
+@property (nonatomic, assign) CFAbsoluteTime lastPersistTime;
+@property (nonatomic, strong) AFNetworkReachabilityManager *reachability;
+@property (nonatomic, strong) M3U8MetricCounter *estimateGauge;
+@property (nonatomic, strong) M3U8MetricCounter *filteredCounter;
+
+@end
+
+@implementation M3U8BandwidthEstimator
+
++ (instancetype)sharedEstimator {
+    static M3U8BandwidthEstimator *instance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        instance = [[M3U8BandwidthEstimator alloc] init];
+    });
+    return instance;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _lock = OS_UNFAIR_LOCK_INIT;
+        _minSampleBytes = 16 * 1024;
+        _fastEWMA = [[M3U8BandwidthEWMA alloc] initWithHalfLife:kFastHalfLife];
+        _slowEWMA = [[M3U8BandwidthEWMA alloc] initWithHalfLife:kSlowHalfLife];
+        _persistedEstimates = [[[NSUserDefaults standardUserDefaults] dictionaryForKey:kBandwidthEstimatesDefaultsKey] mutableCopy] ?: [NSMutableDictionary dictionary];
+        _estimateGauge = [[M3U8Metrics sharedMetrics] counterNamed:@"m3u8_bandwidth_estimate_bps" labels:nil];
+        _filteredCounter = [[M3U8Metrics sharedMetrics] counterNamed:@"m3u8_bandwidth_filtered_samples_total" labels:nil];
+        
+        [self startMonitoringNetwork];
+    }
+    return self;
+}
+
+#pragma mark - Public Methods
+
+- (void)recordTransferOfBytes:(int64_t)bytes duration:(NSTimeInterval)duration {
+    if (duration <= 0 || bytes <= 0) {
+        return;
+    }
+    if (bytes < self.minSampleBytes) {
+        // 小对象的耗时主要是握手和首字节等待，不反映带宽
+        [self.filteredCounter increment];
+        return;
+    }
+    
+    double bandwidth = (double)bytes * 8.0 / duration;
+    
+    os_unfair_lock_lock(&_lock);
+    [self.fastEWMA addSample:bandwidth weight:duration];
+    [self.slowEWMA addSample:bandwidth weight:duration];
+    _harmonicSamples[_harmonicNext] = bandwidth;
+    _harmonicNext = (_harmonicNext + 1) % kHarmonicWindowSize;
+    _harmonicCount = MIN(_harmonicCount + 1, kHarmonicWindowSize);
+    self.sampleCount += 1;
+    double estimate = [self liveEstimateLocked];
+    BOOL shouldPersist = (CFAbsoluteTimeGetCurrent() - self.lastPersistTime) >= kPersistInterval;
+    if (shouldPersist && estimate > 0) {
+        self.persistedEstimates[self.networkIdentifier ?: @"unknown"] = @(estimate);
+        self.lastPersistTime = CFAbsoluteTimeGetCurrent();
+    }
+    NSDictionary *snapshot = shouldPersist ? [self.persistedEstimates copy] : nil;
+    os_unfair_lock_unlock(&_lock);
+    
+    [self.estimateGauge setValue:(int64_t)estimate];
+    if (snapshot) {
+        [[NSUserDefaults standardUserDefaults] setObject:snapshot forKey:kBandwidthEstimatesDefaultsKey];
+    }
+}
+
+- (double)estimatedBandwidth {
+    os_unfair_lock_lock(&_lock);
+    double estimate = 0;
+    if (self.sampleCount >= kMinSamplesForEstimate) {
+        estimate = [self liveEstimateLocked];
+    }
+    if (estimate <= 0) {
+        estimate = [self.persistedEstimates[self.networkIdentifier ?: @"unknown"] doubleValue];
+    }
+    if (estimate <= 0) {
+        estimate = [self defaultEstimateForNetwork:self.networkIdentifier];
+    }
+    os_unfair_lock_unlock(&_lock);
+    return estimate;
+}
+
+- (NSInteger)estimatedBandwidthKbps {
+    return (NSInteger)([self estimatedBandwidth] / 1000.0);
+}
+
+- (NSString *)currentNetworkIdentifier {
+    os_unfair_lock_lock(&_lock);
+    NSString *identifier = self.networkIdentifier ?: @"unknown";
+    os_unfair_lock_unlock(&_lock);
+    return identifier;
+}
+
+- (NSDictionary *)statistics {
+    os_unfair_lock_lock(&_lock);
+    NSDictionary *stats = @{
+        @"network": self.networkIdentifier ?: @"unknown",
+        @"samples": @(self.sampleCount),
+        @"fastEWMA": @(self.fastEWMA.estimate),
+        @"slowEWMA": @(self.slowEWMA.estimate),
+        @"harmonicMean": @([self harmonicMeanLocked]),
+        @"persisted": [self.persistedEstimates copy]
+    };
+    os_unfair_lock_unlock(&_lock);
+    
+    NSMutableDictionary *result = [stats mutableCopy];
+    result[@"estimate"] = @([self estimatedBandwidth]);
+    return result;
+}
+
+#pragma mark - Private Methods
+
+- (double)liveEstimateLocked {
+    double ewma = MIN(self.fastEWMA.estimate, self.slowEWMA.estimate);
+    double harmonic = [self harmonicMeanLocked];
+    if (harmonic <= 0) {
+        return ewma;
+    }
+    return MIN(ewma, harmonic);
+}
+
+- (double)harmonicMeanLocked {
+    if (_harmonicCount == 0) {
+        return 0;
+    }
+    double reciprocalSum = 0;
+    for (NSUInteger i = 0; i < _harmonicCount; i++) {
+        reciprocalSum += 1.0 / _harmonicSamples[i];
+    }
+    return (double)_harmonicCount / reciprocalSum;
+}
+
+- (double)defaultEstimateForNetwork:(NSString *)network {
+    if ([network isEqualToString:@"wifi"]) {
+        return 5000000.0;
+    }
+    return 1500000.0;
+}
+
+- (void)startMonitoringNetwork {
+    self.reachability = [AFNetworkReachabilityManager manager];
+    __weak typeof(self) weakSelf = self;
+    [self.reachability setReachabilityStatusChangeBlock:^(AFNetworkReachabilityStatus status) {
+        [weakSelf networkDidChangeToStatus:status];
+    }];
+    [self.reachability startMonitoring];
+}
+
+- (void)networkDidChangeToStatus:(AFNetworkReachabilityStatus)status {
+    NSString *identifier = @"unknown";
+    if (status == AFNetworkReachabilityStatusReachableViaWiFi) {
+        identifier = @"wifi";
+    } else if (status == AFNetworkReachabilityStatusReachableViaWWAN) {
+        identifier = @"cellular";
+    }
+    
+    os_unfair_lock_lock(&_lock);
+    if ([identifier isEqualToString:self.networkIdentifier ?: @""]) {
+        os_unfair_lock_unlock(&_lock);
+        return;
+    }
+    
+    // 切换网络后旧样本不再有效，从新网络的持久化估算重新开始
+    double current = self.sampleCount >= kMinSamplesForEstimate ? [self liveEstimateLocked] : 0;
+    if (current > 0 && self.networkIdentifier) {
+        self.persistedEstimates[self.networkIdentifier] = @(current);
+    }
+    self.networkIdentifier = identifier;
+    [self.fastEWMA reset];
+    [self.slowEWMA reset];
+    _harmonicCount = 0;
+    _harmonicNext = 0;
+    self.sampleCount = 0;
+    NSDictionary *snapshot = [self.persistedEstimates copy];
+    os_unfair_lock_unlock(&_lock);
+    
+    [[NSUserDefaults standardUserDefaults] setObject:snapshot forKey:kBandwidthEstimatesDefaultsKey];
+    NSLog(@"[M3U8BandwidthEstimator] 网络切换为%@，初始带宽估算: %.0f kbps", identifier, [self estimatedBandwidth] / 1000.0);
+}
+
+@end
@@ -0,0 +1,100 @@
+//
+//  M3U8CircuitBreaker.h
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 熔断器错误域
+ */
+FOUNDATION_EXPORT NSString * const M3U8CircuitBreakerErrorDomain;
+
+/**
+ * 熔断器错误码
+ */
+typedef NS_ENUM(NSInteger, M3U8CircuitBreakerError) {
+    M3U8CircuitBreakerErrorNegativeCached = 1101,   // URL最近返回过不可重试的4xx，在负缓存有效期内
+    M3U8CircuitBreakerErrorCircuitOpen = 1102       // 主机熔断中
+};
+
+/**
+ * 主机熔断状态
+ */
+typedef NS_ENUM(NSInteger, M3U8CircuitState) {
+    M3U8CircuitStateClosed = 0,    // 正常放行
+    M3U8CircuitStateOpen,          // 熔断，直接失败
+    M3U8CircuitStateHalfOpen       // 冷却结束，只放行一个试探请求
+};
+
+/**
+ * 负缓存与主机熔断器
+ * - 负缓存：按URL记录最近的不可重试响应（M3U8RetryPolicy归为Fatal的4xx），有效期内的请求不再访问网络，直接返回缓存的失败；
+ *   5xx、408、429属于暂时性错误，不写入负缓存，同一URL的退避重试仍会访问网络
+ * - 熔断器：按主机统计连续的主机层面失败（超时、连接失败、5xx），达到阈值后熔断；
+ *   冷却结束进入半开状态，只放行一个试探请求，成功则恢复，失败则以加倍的冷却时间再次熔断
+ */
+@interface M3U8CircuitBreaker : NSObject
+
+/**
+ * 不可重试的4xx响应的负缓存有效期（秒），默认30秒
+ */
+@property (nonatomic, assign) NSTimeInterval clientErrorTTL;
+
+/**
+ * 触发熔断的连续失败次数，默认5次
+ */
+@property (nonatomic, assign) NSUInteger failureThreshold;
+
+/**
+ * 首次熔断的冷却时间（秒），默认10秒，再次熔断时翻倍，最长60秒
+ */
+@property (nonatomic, assign) NSTimeInterval openDuration;
+
+/**
+ * 获取共享熔断器
+ */
++ (instancetype)sharedBreaker;
+
+/**
+ * 请求准入检查
+ * 半开状态下第一个调用者获得试探资格，之后的请求在试探结束前都会被拒绝
+ * @param url 请求URL
+ * @return nil表示放行；否则为负缓存或熔断错误
+ */
+- (NSError * _Nullable)admissionErrorForURL:(NSURL *)url;
+
+/**
+ * 记录请求成功（关闭主机熔断，清除URL的负缓存）
+ */
+- (void)recordSuccessForURL:(NSURL *)url;
+
+/**
+ * 记录请求失败
+ * 不可重试的HTTP 4xx写入负缓存；5xx、超时和连接失败计入主机熔断；取消不计入
+ */
+- (void)recordFailure:(NSError *)error response:(NSURLResponse * _Nullable)response forURL:(NSURL *)url;
+
+/**
+ * 主机当前的熔断状态
+ */
+- (M3U8CircuitState)stateForHost:(NSString *)host;
+
+/**
+ * 清空负缓存并重置所有主机
+ */
+- (void)reset;
+
+/**
+ * 负缓存与熔断统计
+ */
+- (NSDictionary *)statistics;
+
+@end
+
+NS_ASSUME_NONNULL_END
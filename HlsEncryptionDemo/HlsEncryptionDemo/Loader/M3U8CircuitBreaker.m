@@ -0,0 +1,283 @@
+//
+//  M3U8CircuitBreaker.m
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import "M3U8CircuitBreaker.h"
+#import "M3U8RetryPolicy.h"
+#import "M3U8Metrics.h"
+#import "AFNetworking.h"
+#import <os/lock.h>
+
+NSString * const M3U8CircuitBreakerErrorDomain = @"M3U8CircuitBreaker";
+
+// 熔断冷却时间上限（秒）
+static const NSTimeInterval kCircuitMaxOpenDuration = 60.0;
+
+// 负缓存条目超过此数量时清理过期条目
+static const NSUInteger kNegativeCachePruneThreshold = 256;
+
+// MARK: - M3U8NegativeEntry
+
+@interface M3U8NegativeEntry : NSObject
+@property (nonatomic, strong) NSError *error;
+@property (nonatomic, assign) NSInteger statusCode;
+@property (nonatomic, assign) CFAbsoluteTime expiresAt;
+@end
+
+@implementation M3U8NegativeEntry
+@end
+
+// MARK: - M3U8HostCircuit
+
+@interface M3U8HostCircuit : NSObject
+@property (nonatomic, assign) M3U8CircuitState state;
+@property (nonatomic, assign) NSUInteger consecutiveFailures;
+@property (nonatomic, assign) NSUInteger openCount;           // 连续熔断次数，决定冷却时间
+@property (nonatomic, assign) CFAbsoluteTime openUntil;
+@property (nonatomic, assign) CFAbsoluteTime trialStartedAt;  // 半开试探请求的开始时间，0表示尚未放行
+@end
+
+@implementation M3U8HostCircuit
+@end
+
+// MARK: - M3U8CircuitBreaker
+
+@interface M3U8CircuitBreaker () {
+    os_unfair_lock _lock;
+}
+
+@property (nonatomic, strong) NSMutableDictionary<NSString *, M3U8NegativeEntry *> *negativeCache;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, M3U8HostCircuit *> *circuits;
+@property (nonatomic, strong) M3U8MetricCounter *negativeHitCounter;
+@property (nonatomic, strong) M3U8MetricCounter *rejectedCounter;
+@property (nonatomic, strong) M3U8MetricCounter *openedCounter;
+
+@end
+
+@implementation M3U8CircuitBreaker
+
++ (instancetype)sharedBreaker {
+    static M3U8CircuitBreaker *instance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        instance = [[M3U8CircuitBreaker alloc] init];
+    });
+    return instance;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _lock = OS_UNFAIR_LOCK_INIT;
+        _clientErrorTTL = 30.0;
+        _failureThreshold = 5;
+        _openDuration = 10.0;
+        _negativeCache = [NSMutableDictionary dictionary];
+        _circuits = [NSMutableDictionary dictionary];
+        M3U8Metrics *metrics = [M3U8Metrics sharedMetrics];
+        _negativeHitCounter = [metrics counterNamed:@"m3u8_negative_cache_hits_total" labels:nil];
+        _rejectedCounter = [metrics counterNamed:@"m3u8_circuit_rejected_total" labels:nil];
+        _openedCounter = [metrics counterNamed:@"m3u8_circuit_opened_total" labels:nil];
+    }
+    return self;
+}
+
+#pragma mark - Admission
+
+- (NSError *)admissionErrorForURL:(NSURL *)url {
+    NSString *urlKey = url.absoluteString;
+    NSString *host = url.host.lowercaseString;
+    if (!urlKey || !host) {
+        return nil;
+    }
+    
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    NSError *error = nil;
+    
+    os_unfair_lock_lock(&_lock);
+    M3U8NegativeEntry *entry = self.negativeCache[urlKey];
+    if (entry && now < entry.expiresAt) {
+        error = [NSError errorWithDomain:M3U8CircuitBreakerErrorDomain
+                                    code:M3U8CircuitBreakerErrorNegativeCached
+                                userInfo:@{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"URL最近请求失败(HTTP %ld)，%.0f秒内不再重试", (long)entry.statusCode, entry.expiresAt - now],
+                                           NSUnderlyingErrorKey: entry.error,
+                                           NSURLErrorFailingURLErrorKey: url}];
+    } else {
+        if (entry) {
+            [self.negativeCache removeObjectForKey:urlKey];
+        }
+        
+        M3U8HostCircuit *circuit = self.circuits[host];
+        if (circuit.state == M3U8CircuitStateOpen && now >= circuit.openUntil) {
+            circuit.state = M3U8CircuitStateHalfOpen;
+            circuit.trialStartedAt = 0;
+        }
+        if (circuit.state == M3U8CircuitStateHalfOpen) {
+            // 只放行一个试探请求；试探迟迟没有结果时重新放行
+            BOOL trialStale = circuit.trialStartedAt > 0 && now - circuit.trialStartedAt > self.openDuration;
+            if (circuit.trialStartedAt == 0 || trialStale) {
+                circuit.trialStartedAt = now;
+                NSLog(@"[M3U8CircuitBreaker] 主机%@半开，放行试探请求", host);
+            } else {
+                error = [self circuitOpenErrorForURL:url host:host retryAfter:0];
+            }
+        } else if (circuit.state == M3U8CircuitStateOpen) {
+            error = [self circuitOpenErrorForURL:url host:host retryAfter:circuit.openUntil - now];
+        }
+    }
+    os_unfair_lock_unlock(&_lock);
+    
+    if (error.code == M3U8CircuitBreakerErrorNegativeCached) {
+        [self.negativeHitCounter increment];
+    } else if (error) {
+        [self.rejectedCounter increment];
+    }
+    return error;
+}
+
+#pragma mark - Outcomes
+
+- (void)recordSuccessForURL:(NSURL *)url {
+    NSString *host = url.host.lowercaseString;
+    if (!host) {
+        return;
+    }
+    
+    os_unfair_lock_lock(&_lock);
+    if (url.absoluteString) {
+        [self.negativeCache removeObjectForKey:url.absoluteString];
+    }
+    M3U8HostCircuit *circuit = self.circuits[host];
+    if (circuit) {
+        if (circuit.state != M3U8CircuitStateClosed) {
+            NSLog(@"[M3U8CircuitBreaker] 主机%@试探成功，恢复正常", host);
+        }
+        [self.circuits removeObjectForKey:host];
+    }
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (void)recordFailure:(NSError *)error response:(NSURLResponse *)response forURL:(NSURL *)url {
+    NSString *urlKey = url.absoluteString;
+    NSString *host = url.host.lowercaseString;
+    if (!urlKey || !host) {
+        return;
+    }
+    
+    NSHTTPURLResponse *httpResponse = [response isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse *)response : nil;
+    if (!httpResponse) {
+        id failingResponse = error.userInfo[AFNetworkingOperationFailingURLResponseErrorKey];
+        httpResponse = [failingResponse isKindOfClass:[NSHTTPURLResponse class]] ? failingResponse : nil;
+    }
+    NSInteger statusCode = httpResponse.statusCode;
+    M3U8ErrorClass errorClass = [M3U8RetryPolicy classifyError:error response:httpResponse];
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    
+    os_unfair_lock_lock(&_lock);
+    // 只有不可重试的HTTP错误写入负缓存，暂时性错误（5xx、408、429）留给重试
+    if (statusCode >= 400 && errorClass == M3U8ErrorClassFatal) {
+        M3U8NegativeEntry *entry = [[M3U8NegativeEntry alloc] init];
+        entry.error = error;
+        entry.statusCode = statusCode;
+        entry.expiresAt = now + self.clientErrorTTL;
+        if (self.negativeCache.count >= kNegativeCachePruneThreshold) {
+            [self pruneNegativeCacheLockedAt:now];
+        }
+        self.negativeCache[urlKey] = entry;
+    }
+    
+    M3U8HostCircuit *circuit = self.circuits[host];
+    if (errorClass == M3U8ErrorClassCancelled) {
+        // 试探请求被取消时让出试探资格
+        if (circuit.state == M3U8CircuitStateHalfOpen) {
+            circuit.trialStartedAt = 0;
+        }
+    } else if (errorClass == M3U8ErrorClassTransient) {
+        if (!circuit) {
+            circuit = [[M3U8HostCircuit alloc] init];
+            self.circuits[host] = circuit;
+        }
+        circuit.consecutiveFailures += 1;
+        BOOL trialFailed = (circuit.state == M3U8CircuitStateHalfOpen);
+        if (trialFailed || (circuit.state == M3U8CircuitStateClosed && circuit.consecutiveFailures >= self.failureThreshold)) {
+            NSTimeInterval duration = MIN(self.openDuration * pow(2.0, circuit.openCount), kCircuitMaxOpenDuration);
+            circuit.state = M3U8CircuitStateOpen;
+            circuit.openUntil = now + duration;
+            circuit.openCount += 1;
+            circuit.trialStartedAt = 0;
+            [self.openedCounter increment];
+            NSLog(@"[M3U8CircuitBreaker] 主机%@%@，熔断%.0f秒", host,
+                  trialFailed ? @"试探失败" : [NSString stringWithFormat:@"连续失败%lu次", (unsigned long)circuit.consecutiveFailures], duration);
+        }
+    }
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (M3U8CircuitState)stateForHost:(NSString *)host {
+    os_unfair_lock_lock(&_lock);
+    M3U8HostCircuit *circuit = self.circuits[host.lowercaseString];
+    M3U8CircuitState state = circuit ? circuit.state : M3U8CircuitStateClosed;
+    if (state == M3U8CircuitStateOpen && CFAbsoluteTimeGetCurrent() >= circuit.openUntil) {
+        state = M3U8CircuitStateHalfOpen;
+    }
+    os_unfair_lock_unlock(&_lock);
+    return state;
+}
+
+- (void)reset {
+    os_unfair_lock_lock(&_lock);
+    [self.negativeCache removeAllObjects];
+    [self.circuits removeAllObjects];
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (NSDictionary *)statistics {
+    NSMutableDictionary *hosts = [NSMutableDictionary dictionary];
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    
+    os_unfair_lock_lock(&_lock);
+    [self pruneNegativeCacheLockedAt:now];
+    for (NSString *host in self.circuits) {
+        M3U8HostCircuit *circuit = self.circuits[host];
+        hosts[host] = @{
+            @"state": @[@"closed", @"open", @"halfOpen"][circuit.state],
+            @"consecutiveFailures": @(circuit.consecutiveFailures),
+            @"openRemaining": @(MAX(circuit.openUntil - now, 0))
+        };
+    }
+    NSUInteger negativeCount = self.negativeCache.count;
+    os_unfair_lock_unlock(&_lock);
+    
+    return @{
+        @"negativeCacheEntries": @(negativeCount),
+        @"hosts": hosts
+    };
+}
+
+#pragma mark - Private Methods
+
+- (NSError *)circuitOpenErrorForURL:(NSURL *)url host:(NSString *)host retryAfter:(NSTimeInterval)retryAfter {
+    NSString *description = retryAfter > 0
+        ? [NSString stringWithFormat:@"主机%@熔断中，%.0f秒后恢复试探", host, retryAfter]
+        : [NSString stringWithFormat:@"主机%@正在试探恢复", host];
+    return [NSError errorWithDomain:M3U8CircuitBreakerErrorDomain
+                               code:M3U8CircuitBreakerErrorCircuitOpen
+                           userInfo:@{NSLocalizedDescriptionKey: description,
+                                      NSURLErrorFailingURLErrorKey: url}];
+}
+
+- (void)pruneNegativeCacheLockedAt:(CFAbsoluteTime)now {
+    NSMutableArray<NSString *> *expired = [NSMutableArray array];
+    [self.negativeCache enumerateKeysAndObjectsUsingBlock:^(NSString *key, M3U8NegativeEntry *entry, BOOL *stop) {
+        if (now >= entry.expiresAt) {
+            [expired addObject:key];
+        }
+    }];
+    [self.negativeCache removeObjectsForKeys:expired];
+}
+
+@end
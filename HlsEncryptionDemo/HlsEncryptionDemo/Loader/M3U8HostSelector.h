@@ -0,0 +1,93 @@
+//
+//  M3U8HostSelector.h
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * CDN主机选择器
+ * 同一组内的主机提供相同内容（如 cdn-aws-test2.playlet.com 与 cdn-aws2.playlet.com）
+ * - 被动评分：共享会话中每次请求的首字节延迟计入主机RTT的EWMA，可重试的失败计入错误分
+ * - 主动探测（可选）：定期向组内主机发送HEAD请求
+ * - 请求发出前把URL改写到当前最优主机；主机失败后立即冷却，重试切到组内下一个主机
+ * 主机可以写成 "host:port"，便于用本地多个端口模拟不同延迟的CDN
+ */
+@interface M3U8HostSelector : NSObject
+
+/**
+ * 是否启用主动探测，默认NO
+ */
+@property (nonatomic, assign, getter=isProbingEnabled) BOOL probingEnabled;
+
+/**
+ * 主动探测间隔（秒），默认30秒
+ */
+@property (nonatomic, assign) NSTimeInterval probeInterval;
+
+/**
+ * 探测请求的路径，默认 "/"
+ */
+@property (nonatomic, copy) NSString *probePath;
+
+/**
+ * 获取共享选择器（已内置playlet CDN主机组）
+ */
++ (instancetype)sharedSelector;
+
+/**
+ * 添加一组等价主机
+ * @param hosts 主机列表（"host" 或 "host:port"），列表顺序作为没有样本时的优先顺序
+ */
+- (void)addEquivalentHosts:(NSArray<NSString *> *)hosts;
+
+/**
+ * 移除所有主机组
+ */
+- (void)removeAllHostGroups;
+
+/**
+ * URL的主机是否属于某个等价主机组
+ */
+- (BOOL)containsHostForURL:(NSURL *)url;
+
+/**
+ * 把URL改写到所在组的当前最优主机，不在任何组内的URL原样返回
+ */
+- (NSURL *)preferredURLForURL:(NSURL *)url;
+
+/**
+ * 失败后切换主机
+ * @param url 失败的请求URL
+ * @return 组内另一个可用主机的URL，没有可用主机时返回nil
+ */
+- (NSURL * _Nullable)failoverURLForURL:(NSURL *)url;
+
+/**
+ * 记录一次成功请求的首字节延迟（被动评分，由共享会话自动调用）
+ */
+- (void)recordLatency:(NSTimeInterval)latency forURL:(NSURL *)url;
+
+/**
+ * 记录一次主机层面的失败（超时、连接失败、5xx等），主机会立即进入冷却
+ */
+- (void)recordFailureForURL:(NSURL *)url;
+
+/**
+ * 立即探测所有主机
+ */
+- (void)probeHostsNow;
+
+/**
+ * 各主机评分状态
+ */
+- (NSDictionary *)statistics;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,384 @@
+//
+//  M3U8HostSelector.m
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import "M3U8HostSelector.h"
+#import "M3U8SessionPool.h"
+#import "M3U8RetryPolicy.h"
+#import "M3U8Metrics.h"
+#import <os/lock.h>
+
+// RTT的EWMA系数
+static const double kHostRTTAlpha = 0.3;
+
+// 没有样本的主机按此RTT计分（秒）
+static const NSTimeInterval kHostDefaultRTT = 0.2;
+
+// 失败后的冷却时间：5秒起，连续失败翻倍，最长60秒
+static const NSTimeInterval kHostBaseCooldown = 5.0;
+static const NSTimeInterval kHostMaxCooldown = 60.0;
+
+// 新主机评分需要比当前主机好20%以上才切换，避免来回抖动
+static const double kHostSwitchThreshold = 0.8;
+
+// MARK: - M3U8HostScore
+
+/**
+ * 单个主机的评分状态
+ */
+@interface M3U8HostScore : NSObject
+@property (nonatomic, copy) NSString *authority;
+@property (nonatomic, copy, nullable) NSString *scheme;       // 最近请求使用的scheme，探测时沿用
+@property (nonatomic, assign) NSTimeInterval rtt;             // EWMA，<=0表示没有样本
+@property (nonatomic, assign) double failureScore;            // 失败+1，成功减半
+@property (nonatomic, assign) NSUInteger consecutiveFailures;
+@property (nonatomic, assign) CFAbsoluteTime cooldownUntil;
+@end
+
+@implementation M3U8HostScore
+
+- (double)score {
+    NSTimeInterval rtt = self.rtt > 0 ? self.rtt : kHostDefaultRTT;
+    return rtt * (1.0 + self.failureScore);
+}
+
+- (BOOL)isCoolingDownAt:(CFAbsoluteTime)now {
+    return now < self.cooldownUntil;
+}
+
+@end
+
+// MARK: - M3U8HostGroup
+
+@interface M3U8HostGroup : NSObject
+@property (nonatomic, strong) NSArray<M3U8HostScore *> *hosts;
+@property (nonatomic, strong) M3U8HostScore *preferred;
+@end
+
+@implementation M3U8HostGroup
+@end
+
+// MARK: - M3U8HostSelector
+
+@interface M3U8HostSelector () {
+    os_unfair_lock _lock;
+}
+
+@property (nonatomic, strong) NSMutableArray<M3U8HostGroup *> *groups;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, M3U8HostGroup *> *groupsByAuthority;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, M3U8HostScore *> *scoresByAuthority;
+@property (nonatomic, strong) dispatch_queue_t probeQueue;
+@property (nonatomic, strong, nullable) dispatch_source_t probeTimer;
+@property (nonatomic, strong) M3U8MetricCounter *switchCounter;
+@property (nonatomic, strong) M3U8MetricCounter *failoverCounter;
+
+@end
+
+@implementation M3U8HostSelector
+
++ (instancetype)sharedSelector {
+    static M3U8HostSelector *instance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        instance = [[M3U8HostSelector alloc] init];
+        [instance addEquivalentHosts:@[@"cdn-aws-test2.playlet.com", @"cdn-aws2.playlet.com"]];
+    });
+    return instance;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _lock = OS_UNFAIR_LOCK_INIT;
+        _probeInterval = 30.0;
+        _probePath = @"/";
+        _groups = [NSMutableArray array];
+        _groupsByAuthority = [NSMutableDictionary dictionary];
+        _scoresByAuthority = [NSMutableDictionary dictionary];
+        _probeQueue = dispatch_queue_create("com.m3u8hostselector.probe", DISPATCH_QUEUE_SERIAL);
+        _switchCounter = [[M3U8Metrics sharedMetrics] counterNamed:@"m3u8_host_switches_total" labels:nil];
+        _failoverCounter = [[M3U8Metrics sharedMetrics] counterNamed:@"m3u8_host_failovers_total" labels:nil];
+    }
+    return self;
+}
+
+#pragma mark - Host Groups
+
+- (void)addEquivalentHosts:(NSArray<NSString *> *)hosts {
+    if (hosts.count < 2) {
+        return;
+    }
+    
+    M3U8HostGroup *group = [[M3U8HostGroup alloc] init];
+    NSMutableArray<M3U8HostScore *> *scores = [NSMutableArray array];
+    
+    os_unfair_lock_lock(&_lock);
+    for (NSString *host in hosts) {
+        NSString *authority = host.lowercaseString;
+        M3U8HostScore *score = self.scoresByAuthority[authority];
+        if (!score) {
+            score = [[M3U8HostScore alloc] init];
+            score.authority = authority;
+            self.scoresByAuthority[authority] = score;
+        }
+        [scores addObject:score];
+        self.groupsByAuthority[authority] = group;
+    }
+    group.hosts = scores;
+    group.preferred = scores.firstObject;
+    [self.groups addObject:group];
+    os_unfair_lock_unlock(&_lock);
+    
+    NSLog(@"[M3U8HostSelector] 添加等价主机组: %@", [hosts componentsJoinedByString:@", "]);
+}
+
+- (void)removeAllHostGroups {
+    os_unfair_lock_lock(&_lock);
+    [self.groups removeAllObjects];
+    [self.groupsByAuthority removeAllObjects];
+    [self.scoresByAuthority removeAllObjects];
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (BOOL)containsHostForURL:(NSURL *)url {
+    NSString *authority = [self authorityForURL:url];
+    if (!authority) {
+        return NO;
+    }
+    
+    os_unfair_lock_lock(&_lock);
+    BOOL contains = (self.groupsByAuthority[authority] != nil);
+    os_unfair_lock_unlock(&_lock);
+    return contains;
+}
+
+#pragma mark - URL Rewriting
+
+- (NSURL *)preferredURLForURL:(NSURL *)url {
+    NSString *authority = [self authorityForURL:url];
+    if (!authority) {
+        return url;
+    }
+    
+    os_unfair_lock_lock(&_lock);
+    M3U8HostGroup *group = self.groupsByAuthority[authority];
+    for (M3U8HostScore *host in group.hosts) {
+        host.scheme = url.scheme;
+    }
+    NSString *target = group ? [self bestHostInGroupLocked:group excluding:nil].authority : nil;
+    os_unfair_lock_unlock(&_lock);
+    
+    if (!target || [target isEqualToString:authority]) {
+        return url;
+    }
+    return [self URL:url withAuthority:target] ?: url;
+}
+
+- (NSURL *)failoverURLForURL:(NSURL *)url {
+    NSString *authority = [self authorityForURL:url];
+    if (!authority) {
+        return nil;
+    }
+    
+    os_unfair_lock_lock(&_lock);
+    M3U8HostGroup *group = self.groupsByAuthority[authority];
+    M3U8HostScore *failed = self.scoresByAuthority[authority];
+    M3U8HostScore *target = group ? [self bestHostInGroupLocked:group excluding:failed] : nil;
+    os_unfair_lock_unlock(&_lock);
+    
+    if (!target) {
+        return nil;
+    }
+    [self.failoverCounter increment];
+    NSLog(@"[M3U8HostSelector] 主机%@失败，切换到%@", authority, target.authority);
+    return [self URL:url withAuthority:target.authority];
+}
+
+#pragma mark - Scoring
+
+- (void)recordLatency:(NSTimeInterval)latency forURL:(NSURL *)url {
+    NSString *authority = [self authorityForURL:url];
+    if (!authority || latency <= 0) {
+        return;
+    }
+    
+    os_unfair_lock_lock(&_lock);
+    M3U8HostScore *score = self.scoresByAuthority[authority];
+    if (score) {
+        score.rtt = score.rtt > 0 ? (kHostRTTAlpha * latency + (1.0 - kHostRTTAlpha) * score.rtt) : latency;
+        score.failureScore *= 0.5;
+        score.consecutiveFailures = 0;
+        score.cooldownUntil = 0;
+    }
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (void)recordFailureForURL:(NSURL *)url {
+    NSString *authority = [self authorityForURL:url];
+    if (!authority) {
+        return;
+    }
+    
+    os_unfair_lock_lock(&_lock);
+    M3U8HostScore *score = self.scoresByAuthority[authority];
+    if (score) {
+        score.failureScore += 1.0;
+        score.consecutiveFailures += 1;
+        NSTimeInterval cooldown = MIN(kHostBaseCooldown * pow(2.0, score.consecutiveFailures - 1), kHostMaxCooldown);
+        score.cooldownUntil = CFAbsoluteTimeGetCurrent() + cooldown;
+        NSLog(@"[M3U8HostSelector] 主机%@连续失败%lu次，冷却%.0f秒", authority, (unsigned long)score.consecutiveFailures, cooldown);
+    }
+    os_unfair_lock_unlock(&_lock);
+}
+
+/**
+ * 选出组内评分最好的主机（须持有锁）
+ * 冷却中的主机不参与选择；全部冷却时选最早结束冷却的主机
+ */
+- (M3U8HostScore *)bestHostInGroupLocked:(M3U8HostGroup *)group excluding:(M3U8HostScore *)excluded {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    M3U8HostScore *best = nil;
+    for (M3U8HostScore *host in group.hosts) {
+        if (host == excluded || [host isCoolingDownAt:now]) {
+            continue;
+        }
+        if (!best || [host score] < [best score]) {
+            best = host;
+        }
+    }
+    
+    if (excluded) {
+        // 失败切换不改变粘性选择，由评分决定之后的首选主机
+        return best;
+    }
+    
+    if (!best) {
+        for (M3U8HostScore *host in group.hosts) {
+            if (!best || host.cooldownUntil < best.cooldownUntil) {
+                best = host;
+            }
+        }
+        return best;
+    }
+    
+    M3U8HostScore *current = group.preferred;
+    BOOL currentUsable = current && ![current isCoolingDownAt:now];
+    if (currentUsable && best != current && [best score] > [current score] * kHostSwitchThreshold) {
+        return current;
+    }
+    if (best != current) {
+        NSLog(@"[M3U8HostSelector] 首选主机切换: %@ -> %@ (评分 %.0fms)", current.authority, best.authority, [best score] * 1000);
+        group.preferred = best;
+        [self.switchCounter increment];
+    }
+    return best;
+}
+
+#pragma mark - Probing
+
+- (void)setProbingEnabled:(BOOL)probingEnabled {
+    _probingEnabled = probingEnabled;
+    
+    dispatch_async(self.probeQueue, ^{
+        if (self.probeTimer) {
+            dispatch_source_cancel(self.probeTimer);
+            self.probeTimer = nil;
+        }
+        if (!probingEnabled || self.probeInterval <= 0) {
+            return;
+        }
+        
+        dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.probeQueue);
+        uint64_t interval = (uint64_t)(self.probeInterval * NSEC_PER_SEC);
+        dispatch_source_set_timer(timer, dispatch_time(DISPATCH_TIME_NOW, 0), interval, interval / 10);
+        __weak typeof(self) weakSelf = self;
+        dispatch_source_set_event_handler(timer, ^{
+            [weakSelf probeHostsNow];
+        });
+        dispatch_resume(timer);
+        self.probeTimer = timer;
+    });
+}
+
+- (void)probeHostsNow {
+    NSMutableArray<NSURL *> *probeURLs = [NSMutableArray array];
+    os_unfair_lock_lock(&_lock);
+    for (M3U8HostScore *score in self.scoresByAuthority.allValues) {
+        NSString *urlString = [NSString stringWithFormat:@"%@://%@%@", score.scheme ?: @"https", score.authority, self.probePath];
+        NSURL *probeURL = [NSURL URLWithString:urlString];
+        if (probeURL) {
+            [probeURLs addObject:probeURL];
+        }
+    }
+    os_unfair_lock_unlock(&_lock);
+    
+    // 探测走CDN共享会话：成功的延迟由会话的指标回调计入评分，顺带预热连接
+    AFHTTPSessionManager *sessionManager = [[M3U8SessionPool sharedPool] sessionManagerForHostClass:M3U8HostClassCDN];
+    for (NSURL *probeURL in probeURLs) {
+        NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:probeURL];
+        request.HTTPMethod = @"HEAD";
+        request.timeoutInterval = 5.0;
+        
+        NSURLSessionDataTask *task = [sessionManager dataTaskWithRequest:request uploadProgress:nil downloadProgress:nil completionHandler:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject, NSError * _Nullable error) {
+            if (error && [M3U8RetryPolicy classifyError:error response:response] == M3U8ErrorClassTransient) {
+                [self recordFailureForURL:probeURL];
+            }
+        }];
+        task.priority = NSURLSessionTaskPriorityLow;
+        [task resume];
+    }
+}
+
+#pragma mark - Statistics
+
+- (NSDictionary *)statistics {
+    NSMutableDictionary *stats = [NSMutableDictionary dictionary];
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    
+    os_unfair_lock_lock(&_lock);
+    for (NSString *authority in self.scoresByAuthority) {
+        M3U8HostScore *score = self.scoresByAuthority[authority];
+        stats[authority] = @{
+            @"rttMs": @(score.rtt * 1000),
+            @"failureScore": @(score.failureScore),
+            @"consecutiveFailures": @(score.consecutiveFailures),
+            @"coolingDown": @([score isCoolingDownAt:now]),
+            @"preferred": @(self.groupsByAuthority[authority].preferred == score)
+        };
+    }
+    os_unfair_lock_unlock(&_lock);
+    
+    return @{
+        @"hosts": stats,
+        @"probingEnabled": @(self.probingEnabled)
+    };
+}
+
+#pragma mark - Private Methods
+
+- (NSString *)authorityForURL:(NSURL *)url {
+    NSString *host = url.host.lowercaseString;
+    if (host.length == 0) {
+        return nil;
+    }
+    return url.port ? [NSString stringWithFormat:@"%@:%@", host, url.port] : host;
+}
+
+- (NSURL *)URL:(NSURL *)url withAuthority:(NSString *)authority {
+    NSURLComponents *components = [NSURLComponents componentsWithURL:url resolvingAgainstBaseURL:NO];
+    NSRange colon = [authority rangeOfString:@":" options:NSBackwardsSearch];
+    if (colon.location != NSNotFound) {
+        components.host = [authority substringToIndex:colon.location];
+        components.port = @([[authority substringFromIndex:colon.location + 1] integerValue]);
+    } else {
+        components.host = authority;
+        components.port = nil;
+    }
+    return components.URL;
+}
+
+@end
@@ -10,6 +10,7 @@
 #import <AVFoundation/AVFoundation.h>
 #import "M3U8AuthConfig.h"
 #import "M3U8PlayerDelegate.h"
+#import "M3U8ResourceRouter.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -22,6 +23,23 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, weak) id<M3U8PlayerDelegate> delegate;
 @property (nonatomic, strong) M3U8AuthConfig *authConfig;
 
+/**
+ * 是否在解析到密钥信息时预取密钥，默认YES（关闭后可对比起播耗时）
+ */
+@property (nonatomic, assign) BOOL keyPrefetchEnabled;
+
+/**
+ * 当前播放内容的ID，用于在持久化密钥存储中区分不同剧集
+ * 未设置时使用授权token中的剧集与集数（authScope）
+ */
+@property (nonatomic, copy, nullable) NSString *contentID;
+
+/**
+ * 资源加载请求的路由，默认为 [M3U8ResourceRouter defaultRouter]
+ * 密钥服务器不在默认规则中时，可向路由添加主机或关键字规则
+ */
+@property (nonatomic, strong) M3U8ResourceRouter *resourceRouter;
+
 
 /**
  * 配置授权信息
@@ -30,6 +48,7 @@ NS_ASSUME_NONNULL_BEGIN
 
 /**
  * 为Asset设置资源加载代理
+ * 每个Asset使用独立的串行代理队列，资源加载请求不经过主线程
  */
 - (void)setupResourceLoaderForAsset:(AVURLAsset *)asset;
 
@@ -38,8 +57,40 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (void)setupResourceLoaderForLocalAsset:(AVURLAsset *)asset;
 
+/**
+ * 预取密钥到内存缓存
+ * 解析到#EXT-X-KEY或#EXT-X-SESSION-KEY时调用，AVFoundation随后的密钥请求直接从内存返回
+ * @param keyURI 密钥地址（不含授权参数）
+ */
+- (void)prefetchKeyForURI:(NSString *)keyURI;
+
+/**
+ * 预取密钥到内存缓存，完成后回调（后台队列）
+ * @param keyURI 密钥地址（不含授权参数）
+ * @param completion error为nil表示密钥已在缓存中或无需预取（预取关闭、本地模式）
+ */
+- (void)prefetchKeyForURI:(NSString *)keyURI completion:(void(^ _Nullable)(NSError * _Nullable error))completion;
+
+/**
+ * 获取密钥（不经过AVFoundation，供本地代理等调用方使用）
+ * 与资源加载请求共用缓存、合并与token刷新逻辑，获取成功后写入持久化存储
+ * @param completion 完成回调；缓存命中时在调用线程上同步执行，否则在后台队列执行
+ */
+- (void)loadKeyDataForURL:(NSString *)url completion:(void(^)(NSData * _Nullable keyData, NSError * _Nullable error))completion;
+
+/**
+ * 清空内存中的密钥缓存（缓存的密钥内存会被清零）
+ */
+- (void)clearKeyCache;
+
+/**
+ * 密钥缓存统计
+ */
+- (NSDictionary *)keyCacheStatistics;
+
 /**
  * 存储密钥到本地（供离线播放使用）
+ * 网络播放时获取到的密钥会自动按「内容ID + 密钥URI」保存到M3U8KeyStore，无需手动调用
  */
 - (void)storeKeyData:(NSData *)keyData forIdentifier:(NSString *)identifier;
 
@@ -48,6 +99,13 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (NSData * _Nullable)getStoredKeyDataForIdentifier:(NSString *)identifier;
 
+/**
+ * 获取持久化存储中指定内容的密钥
+ * @param contentID 内容ID，传nil时返回该密钥URI最近保存的密钥
+ * @param keyURI 密钥地址（不含授权参数）
+ */
+- (NSData * _Nullable)storedKeyDataForContentID:(NSString * _Nullable)contentID keyURI:(NSString *)keyURI;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -8,13 +8,309 @@
 
 #import "M3U8KeyManager.h"
 #import "M3U8Loader.h"
-#import "AFNetworking.h"
+#import "CacheManager.h"
+#import "M3U8Metrics.h"
+#import "M3U8SessionPool.h"
+#import "M3U8RequestScheduler.h"
+#import "M3U8RetryPolicy.h"
+#import "M3U8TimeoutEstimator.h"
+#import "M3U8HostSelector.h"
+#import "M3U8Preconnector.h"
+#import "M3U8CircuitBreaker.h"
+#import "M3U8KeyStore.h"
+#import "M3U8TokenManager.h"
+#import "M3U8ResourceRouter.h"
+#import <sys/mman.h>
 
-@interface M3U8KeyManager () <M3U8LoaderDelegate>
-@property (nonatomic, strong) NSMutableDictionary *keyCache;
+// 改写后的播放列表在缓存中的token后缀，与原始内容区分
+static NSString * const kRewrittenPlaylistTokenSuffix = @"#m3u8-custom";
+
+// 旧版本保存在NSUserDefaults中的唯一密钥，读取时迁移到M3U8KeyStore
+static NSString * const kLegacyStoredKeyIdentifier = @"currentKey";
+
+// 密钥缓存容量与单个密钥的最大长度（AES-128密钥为16字节）
+#define kKeyCacheCapacity 64
+#define kKeySlotSize 32
+
+// 响应头和token都没有给出有效期时，密钥的缓存时间（秒）
+static const NSTimeInterval kKeyCacheDefaultLifetime = 300.0;
+
+// 密钥缓存时间上限（秒）
+static const NSTimeInterval kKeyCacheMaxLifetime = 3600.0;
+
+// MARK: - M3U8SecureKeyArena
+
+/**
+ * 密钥内存区
+ * 一块mmap分配并mlock锁定的内存（不会被换出），按固定大小的槽位存放密钥，释放槽位时清零
+ */
+@interface M3U8SecureKeyArena : NSObject
+- (NSInteger)storeBytes:(const void *)bytes length:(NSUInteger)length;
+- (NSData *)dataAtSlot:(NSInteger)slot length:(NSUInteger)length;
+- (void)freeSlot:(NSInteger)slot;
+@end
+
+@implementation M3U8SecureKeyArena {
+    uint8_t *_memory;
+    size_t _size;
+    BOOL _used[kKeyCacheCapacity];
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        size_t pageSize = (size_t)getpagesize();
+        _size = ((kKeyCacheCapacity * kKeySlotSize + pageSize - 1) / pageSize) * pageSize;
+        void *memory = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (memory == MAP_FAILED) {
+            NSLog(@"[M3U8KeyManager] 密钥内存区分配失败");
+            return nil;
+        }
+        _memory = memory;
+        if (mlock(_memory, _size) != 0) {
+            NSLog(@"[M3U8KeyManager] 密钥内存区锁定失败，内存可能被换出");
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_memory) {
+        memset_s(_memory, _size, 0, _size);
+        munlock(_memory, _size);
+        munmap(_memory, _size);
+    }
+}
+
+- (NSInteger)storeBytes:(const void *)bytes length:(NSUInteger)length {
+    if (length == 0 || length > kKeySlotSize) {
+        return -1;
+    }
+    for (NSInteger slot = 0; slot < kKeyCacheCapacity; slot++) {
+        if (!_used[slot]) {
+            _used[slot] = YES;
+            memcpy(_memory + slot * kKeySlotSize, bytes, length);
+            return slot;
+        }
+    }
+    return -1;
+}
+
+- (NSData *)dataAtSlot:(NSInteger)slot length:(NSUInteger)length {
+    return [NSData dataWithBytes:_memory + slot * kKeySlotSize length:length];
+}
+
+- (void)freeSlot:(NSInteger)slot {
+    memset_s(_memory + slot * kKeySlotSize, kKeySlotSize, 0, kKeySlotSize);
+    _used[slot] = NO;
+}
+
+@end
+
+// MARK: - M3U8CachedKey
+
+@interface M3U8CachedKey : NSObject
+@property (nonatomic, assign) NSInteger slot;
+@property (nonatomic, assign) NSUInteger length;
+@property (nonatomic, strong) NSDate *expirationDate;
+@property (nonatomic, assign) NSTimeInterval prefetchDuration;  // 预取时的获取耗时，被播放器首次使用后清零
+@end
+
+@implementation M3U8CachedKey
+@end
+
+// MARK: - M3U8PendingLoadingRequest
+
+@class M3U8ResourceLoaderContext;
+
+/**
+ * 等待网络结果的资源加载请求
+ * 由网络完成回调结束；AVFoundation取消时执行cancelHandler取消对应的网络请求
+ */
+@interface M3U8PendingLoadingRequest : NSObject
+@property (nonatomic, strong) AVAssetResourceLoadingRequest *loadingRequest;
+@property (nonatomic, weak) M3U8ResourceLoaderContext *context;  // 所属资源，资源释放后不再结束请求
+@property (nonatomic, copy) NSString *url;
+@property (nonatomic, assign) CFAbsoluteTime startTime;
+@property (nonatomic, assign, readonly, getter=isCancelled) BOOL cancelled;
+- (void)setCancelHandler:(dispatch_block_t)cancelHandler;
+- (void)cancel;
+@end
+
+@implementation M3U8PendingLoadingRequest {
+    dispatch_block_t _cancelHandler;
+    BOOL _cancelled;
+}
+
+- (BOOL)isCancelled {
+    @synchronized (self) {
+        return _cancelled;
+    }
+}
+
+- (void)setCancelHandler:(dispatch_block_t)cancelHandler {
+    BOOL cancelNow = NO;
+    @synchronized (self) {
+        cancelNow = _cancelled;
+        _cancelHandler = cancelNow ? nil : [cancelHandler copy];
+    }
+    // 注册前已被取消，立即取消网络请求
+    if (cancelNow && cancelHandler) {
+        cancelHandler();
+    }
+}
+
+- (void)cancel {
+    dispatch_block_t handler = nil;
+    @synchronized (self) {
+        if (_cancelled) {
+            return;
+        }
+        _cancelled = YES;
+        handler = _cancelHandler;
+        _cancelHandler = nil;
+    }
+    if (handler) {
+        handler();
+    }
+}
+
+@end
+
+// MARK: - M3U8ResourceLoaderContext
+
+/**
+ * 单个资源的加载上下文
+ * 每个AVURLAsset使用独立的串行代理队列，多个资源同时播放时互不阻塞，也不占用主线程
+ * pendingRequests只在该队列上访问
+ */
+@interface M3U8ResourceLoaderContext : NSObject
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, assign) BOOL isLocal;
+@property (nonatomic, strong) NSMapTable<AVAssetResourceLoadingRequest *, M3U8PendingLoadingRequest *> *pendingRequests;
+@end
+
+@implementation M3U8ResourceLoaderContext
+
+- (instancetype)initWithLocal:(BOOL)isLocal {
+    self = [super init];
+    if (self) {
+        dispatch_queue_attr_t attr = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INITIATED, 0);
+        _queue = dispatch_queue_create("com.m3u8.resourceloader", attr);
+        _isLocal = isLocal;
+        _pendingRequests = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsObjectPointerPersonality
+                                                 valueOptions:NSPointerFunctionsStrongMemory];
+    }
+    return self;
+}
+
+@end
+
+// MARK: - M3U8KeyFetchFlight
+
+@class M3U8KeyFetchFlight;
+
+/**
+ * 等待一次密钥获取结果的请求
+ * 取消只影响自己；最后一个等待者取消时才取消网络请求
+ */
+@interface M3U8KeyFetchWaiter : NSObject
+@property (nonatomic, copy) void(^completion)(NSData * _Nullable keyData, NSError * _Nullable error);
+@property (nonatomic, strong) M3U8KeyFetchFlight *flight;
+- (void)cancel;
+@end
+
+/**
+ * 同一密钥（URI + 授权范围）的一次网络获取
+ * 进程内所有KeyManager共享：主播放器、切换清晰度的播放器、预加载和预取的并发请求合并为一次
+ */
+@interface M3U8KeyFetchFlight : NSObject
+@property (nonatomic, copy) NSString *cacheKey;
+@property (nonatomic, assign) CFAbsoluteTime startTime;
+@property (nonatomic, assign) BOOL prefetch;  // 由预取发起且还没有播放器加入
+@property (nonatomic, strong) NSMutableArray<M3U8KeyFetchWaiter *> *waiters;
+@property (nonatomic, strong) NSHashTable<NSURLSessionTask *> *tasks;
+@property (nonatomic, strong) NSMutableArray<M3U8SchedulerTicket *> *tickets;  // 调度器中排队或执行中的请求，取消时一并释放名额
+@property (nonatomic, assign, getter=isCancelled) BOOL cancelled;
+@end
+
+/**
+ * 进程内所有进行中的密钥获取，键为 密钥URI|授权范围
+ * 表本身以及Flight、等待者的状态都由@synchronized(M3U8KeyFetchFlights())保护
+ */
+static NSMutableDictionary<NSString *, M3U8KeyFetchFlight *> *M3U8KeyFetchFlights(void) {
+    static NSMutableDictionary *flights;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        flights = [NSMutableDictionary dictionary];
+    });
+    return flights;
+}
+
+@implementation M3U8KeyFetchFlight
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _waiters = [NSMutableArray array];
+        _tasks = [NSHashTable weakObjectsHashTable];
+        _tickets = [NSMutableArray array];
+    }
+    return self;
+}
+
+@end
+
+@implementation M3U8KeyFetchWaiter
+
+- (void)cancel {
+    NSArray<NSURLSessionTask *> *tasks = nil;
+    NSArray<M3U8SchedulerTicket *> *tickets = nil;
+    @synchronized (M3U8KeyFetchFlights()) {
+        M3U8KeyFetchFlight *flight = self.flight;
+        if (!flight) {
+            return;
+        }
+        [flight.waiters removeObject:self];
+        self.flight = nil;
+        self.completion = nil;
+        if (flight.waiters.count > 0) {
+            return;
+        }
+        
+        // 最后一个等待者离开，放弃这次获取
+        if (M3U8KeyFetchFlights()[flight.cacheKey] == flight) {
+            [M3U8KeyFetchFlights() removeObjectForKey:flight.cacheKey];
+        }
+        flight.cancelled = YES;
+        tasks = flight.tasks.allObjects;
+        tickets = [flight.tickets copy];
+        [flight.tickets removeAllObjects];
+    }
+    
+    NSLog(@"[M3U8KeyManager] 密钥获取已无等待者，取消网络请求");
+    for (M3U8SchedulerTicket *ticket in tickets) {
+        [ticket cancel];
+    }
+    for (NSURLSessionTask *task in tasks) {
+        [task cancel];
+    }
+}
+
+@end
+
+@interface M3U8KeyManager ()
+@property (nonatomic, strong) NSMutableDictionary<NSString *, M3U8CachedKey *> *keyCache;  // 密钥URI|授权范围 -> 缓存的密钥，由@synchronized(keyCache)保护
+@property (nonatomic, strong) M3U8SecureKeyArena *keyArena;
+@property (nonatomic, strong) M3U8MetricCounter *keyCacheHitCounter;
+@property (nonatomic, strong) M3U8MetricCounter *keyCacheMissCounter;
+@property (nonatomic, strong) M3U8MetricCounter *keyCacheEvictionCounter;
+@property (nonatomic, strong) M3U8LatencyHistogram *keyPrefetchSavedHistogram;
+@property (nonatomic, strong) M3U8MetricCounter *keyCoalescedCounter;
 @property (nonatomic, assign) BOOL isLocalMode;
 @property (nonatomic, strong) NSString *originalURL;
 @property (nonatomic, strong) M3U8Loader *m3u8Loader;
+@property (nonatomic, strong) NSMapTable<AVAssetResourceLoader *, M3U8ResourceLoaderContext *> *loaderContexts;  // 由@synchronized(loaderContexts)保护
 @end
 
 @implementation M3U8KeyManager
@@ -32,14 +328,27 @@
     self = [super init];
     if (self) {
         _keyCache = [[NSMutableDictionary alloc] init];
+        _keyArena = [[M3U8SecureKeyArena alloc] init];
+        M3U8Metrics *metrics = [M3U8Metrics sharedMetrics];
+        _keyCacheHitCounter = [metrics counterNamed:@"m3u8_key_cache_hits_total" labels:nil];
+        _keyCacheMissCounter = [metrics counterNamed:@"m3u8_key_cache_misses_total" labels:nil];
+        _keyCacheEvictionCounter = [metrics counterNamed:@"m3u8_key_cache_evictions_total" labels:nil];
+        _keyPrefetchSavedHistogram = [metrics histogramNamed:@"m3u8_key_prefetch_saved_seconds" labels:nil];
+        _keyCoalescedCounter = [metrics counterNamed:@"m3u8_key_coalesced_requests_total" labels:nil];
+        _keyPrefetchEnabled = YES;
         _m3u8Loader = [M3U8Loader new];
-        _m3u8Loader.delegate = self;
+        // 播放列表下载完成后直接在后台改写，不经过主线程
+        _m3u8Loader.completionQueue = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+        _loaderContexts = [NSMapTable weakToStrongObjectsMapTable];
+        _resourceRouter = [M3U8ResourceRouter defaultRouter];
     }
     return self;
 }
 
 - (void)configureWithAuthConfig:(M3U8AuthConfig *)authConfig {
     self.authConfig = authConfig;
+    // 按token过期时间安排提前刷新
+    [[M3U8TokenManager sharedManager] registerAuthConfig:authConfig];
     [self.m3u8Loader configureWithAuthConfig:authConfig];
 }
 
@@ -51,117 +360,227 @@
         self.originalURL = [assetURLString stringByReplacingOccurrencesOfString:@"m3u8-custom://" withString:@"https://"];
         NSLog(@"[M3U8KeyManager] 设置原始URL: %@", self.originalURL);
     }
-    [[asset resourceLoader] setDelegate:self queue:dispatch_get_main_queue()];
+    [self attachToAsset:asset isLocal:NO];
 }
 
 - (void)setupResourceLoaderForLocalAsset:(AVURLAsset *)asset {
     self.isLocalMode = YES;
-    [[asset resourceLoader] setDelegate:self queue:dispatch_get_main_queue()];
+    [self attachToAsset:asset isLocal:YES];
+}
+
+/**
+ * 为资源创建加载上下文，并在它独立的串行队列上接收资源加载请求
+ */
+- (void)attachToAsset:(AVURLAsset *)asset isLocal:(BOOL)isLocal {
+    AVAssetResourceLoader *resourceLoader = [asset resourceLoader];
+    M3U8ResourceLoaderContext *context = [[M3U8ResourceLoaderContext alloc] initWithLocal:isLocal];
+    @synchronized (self.loaderContexts) {
+        [self.loaderContexts setObject:context forKey:resourceLoader];
+    }
+    [resourceLoader setDelegate:self queue:context.queue];
+}
+
+- (M3U8ResourceLoaderContext *)contextForResourceLoader:(AVAssetResourceLoader *)resourceLoader {
+    @synchronized (self.loaderContexts) {
+        return [self.loaderContexts objectForKey:resourceLoader];
+    }
 }
 
 #pragma mark - AVAssetResourceLoaderDelegate
 
 - (BOOL)resourceLoader:(AVAssetResourceLoader *)resourceLoader shouldWaitForLoadingOfRequestedResource:(AVAssetResourceLoadingRequest *)loadingRequest {
-    NSString *url = [[[loadingRequest request] URL] absoluteString];
-    if (!url) {
-        NSLog(@"[M3U8KeyManager] 请求URL为空");
+    NSURL *requestURL = [[loadingRequest request] URL];
+    M3U8ResourceLoaderContext *context = [self contextForResourceLoader:resourceLoader];
+    if (!requestURL || !context) {
         return NO;
     }
     
-    NSLog(@"[M3U8KeyManager] 拦截到请求: %@", url);
-    
-    // 处理自定义scheme的请求
-    if ([url hasPrefix:@"m3u8-custom://"]) {
-        // 将自定义scheme转换回真实URL
-        NSString *realURL = [url stringByReplacingOccurrencesOfString:@"m3u8-custom://" withString:@"https://"];
-        NSLog(@"[M3U8KeyManager] 转换为真实URL: %@", realURL);
-        
-        // 判断请求类型
-        if ([realURL hasSuffix:@".m3u8"]) {
-            // M3U8文件请求
-            [self handleM3U8Request:loadingRequest withURL:realURL];
+    // 按预编译的路由表分发，自定义scheme已还原为真实URL
+    NSString *realURL = nil;
+    switch ([self.resourceRouter routeForURL:requestURL realURL:&realURL]) {
+        case M3U8ResourceRoutePlaylist:
+            [self handleM3U8Request:loadingRequest withURL:realURL context:context];
             return YES;
-        } else if ([realURL hasSuffix:@".ts"]) {
-            // TS文件请求
+        case M3U8ResourceRouteSegment:
             [self handleTSRequest:loadingRequest withURL:realURL];
             return YES;
-        }
-    }
-    
-    // 拦截密钥请求
-    if ([url hasPrefix:@"m3u8-key://"] ||
-        [url containsString:@"api2-test.playletonline.com"] || 
-        [url containsString:@"hlsVerify"] ||
-        [url hasSuffix:@".key"]) {
-        NSLog(@"[M3U8KeyManager] 检测到密钥请求，开始处理");
-        // 如果是自定义scheme，转换为真实URL
-        NSString *realKeyURL = url;
-        if ([url hasPrefix:@"m3u8-key://"]) {
-            realKeyURL = [url stringByReplacingOccurrencesOfString:@"m3u8-key://" withString:@"https://"];
-        }
-        [self handleKeyRequest:loadingRequest withURL:realKeyURL isLocal:self.isLocalMode];
-        return YES;
+        case M3U8ResourceRouteKey:
+            [self handleKeyRequest:loadingRequest withURL:realURL context:context];
+            return YES;
+        case M3U8ResourceRouteNone:
+            return NO;
     }
-    
-    NSLog(@"[M3U8KeyManager] 非密钥请求，不处理: %@", url);
     return NO;
 }
 
+- (void)resourceLoader:(AVAssetResourceLoader *)resourceLoader didCancelLoadingRequest:(AVAssetResourceLoadingRequest *)loadingRequest {
+    M3U8ResourceLoaderContext *context = [self contextForResourceLoader:resourceLoader];
+    M3U8PendingLoadingRequest *pending = [context.pendingRequests objectForKey:loadingRequest];
+    if (!pending) {
+        return;
+    }
+    [context.pendingRequests removeObjectForKey:loadingRequest];
+    NSLog(@"[M3U8KeyManager] 资源加载请求被取消: %@", pending.url);
+    [pending cancel];
+}
+
+#pragma mark - Pending Requests
+
+/**
+ * 登记等待网络结果的加载请求（须在该资源的代理队列上调用）
+ */
+- (M3U8PendingLoadingRequest *)registerLoadingRequest:(AVAssetResourceLoadingRequest *)loadingRequest
+                                                  url:(NSString *)url
+                                              context:(M3U8ResourceLoaderContext *)context {
+    M3U8PendingLoadingRequest *pending = [[M3U8PendingLoadingRequest alloc] init];
+    pending.loadingRequest = loadingRequest;
+    pending.url = url;
+    pending.context = context;
+    pending.startTime = CFAbsoluteTimeGetCurrent();
+    [context.pendingRequests setObject:pending forKey:loadingRequest];
+    return pending;
+}
+
+/**
+ * 在所属资源的代理队列上结束加载请求
+ * 请求已被取消、已结束或资源已释放时不执行
+ */
+- (void)finishPendingRequest:(M3U8PendingLoadingRequest *)pending withBlock:(void(^)(AVAssetResourceLoadingRequest *loadingRequest))block {
+    M3U8ResourceLoaderContext *context = pending.context;
+    if (!context) {
+        return;
+    }
+    dispatch_async(context.queue, ^{
+        AVAssetResourceLoadingRequest *loadingRequest = pending.loadingRequest;
+        if (pending.isCancelled || [context.pendingRequests objectForKey:loadingRequest] != pending) {
+            return;
+        }
+        [context.pendingRequests removeObjectForKey:loadingRequest];
+        if (loadingRequest.isFinished || loadingRequest.isCancelled) {
+            return;
+        }
+        block(loadingRequest);
+    });
+}
+
 #pragma mark - Private Methods
 
-- (void)handleKeyRequest:(AVAssetResourceLoadingRequest *)loadingRequest withURL:(NSString *)url isLocal:(BOOL)isLocal {
-    // 通知代理密钥请求开始
-    if ([self.delegate respondsToSelector:@selector(m3u8Player:willRequestKeyForURL:)]) {
-        [self.delegate m3u8Player:nil willRequestKeyForURL:url];
+- (void)handleKeyRequest:(AVAssetResourceLoadingRequest *)loadingRequest withURL:(NSString *)url context:(M3U8ResourceLoaderContext *)context {
+    // 通知代理密钥请求开始（代理回调在主队列，不阻塞加载）
+    id<M3U8PlayerDelegate> delegate = self.delegate;
+    if ([delegate respondsToSelector:@selector(m3u8Player:willRequestKeyForURL:)]) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [delegate m3u8Player:nil willRequestKeyForURL:url];
+        });
     }
     
-    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-        NSData *keyData;
-        
-        if (isLocal) {
-            // 本地播放，使用存储的密钥
-            keyData = [self getStoredKeyDataForIdentifier:@"currentKey"];
-            NSLog(@"[M3U8KeyManager] 使用本地存储的密钥");
+    M3U8PendingLoadingRequest *pending = [self registerLoadingRequest:loadingRequest url:url context:context];
+    
+    if (context.isLocal) {
+        // 本地播放，按内容ID和密钥URI从持久化存储中取密钥，不访问网络
+        NSData *keyData = [self storedKeyDataForContentID:[self currentContentID] keyURI:url];
+        NSLog(@"[M3U8KeyManager] 使用本地存储的密钥%@", keyData ? @"" : @"（未找到）");
+        [self finishKeyRequest:pending keyData:keyData isLocal:YES];
+        return;
+    }
+    
+    // 记住密钥服务器，下次预热时一起建立连接
+    [[M3U8Preconnector sharedPreconnector] rememberKeyServerURL:[NSURL URLWithString:url]];
+    
+    // 网络播放，异步请求密钥，完成后在代理队列上结束加载请求
+    M3U8KeyFetchWaiter *waiter = [self requestKeyDataForURL:url completion:^(NSData * _Nullable keyData, NSError * _Nullable error) {
+        [self finishKeyRequest:pending keyData:keyData isLocal:NO];
+    }];
+    
+    // AVFoundation取消时只退出这次获取，其他播放器仍会拿到结果
+    [pending setCancelHandler:^{
+        [waiter cancel];
+    }];
+}
+
+- (void)finishKeyRequest:(M3U8PendingLoadingRequest *)pending keyData:(NSData *)keyData isLocal:(BOOL)isLocal {
+    NSString *url = pending.url;
+    [self finishPendingRequest:pending withBlock:^(AVAssetResourceLoadingRequest *loadingRequest) {
+        if (keyData) {
+            NSString *contentID = [self currentContentID];
+            if (!isLocal && contentID) {
+                // 只有网络播放时才存储密钥，相同的密钥不会重复写盘
+                [[M3U8KeyStore sharedStore] storeKeyData:keyData forContentID:contentID keyURI:url];
+            }
+            
+            // 设置响应
+            loadingRequest.contentInformationRequest.contentType = AVStreamingKeyDeliveryPersistentContentKeyType;
+            [[loadingRequest dataRequest] respondWithData:keyData];
+            [loadingRequest finishLoading];
+            
+            // 通知代理密钥获取成功
+            id<M3U8PlayerDelegate> delegate = self.delegate;
+            if ([delegate respondsToSelector:@selector(m3u8Player:didReceiveKeyData:forURL:)]) {
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    [delegate m3u8Player:nil didReceiveKeyData:keyData forURL:url];
+                });
+            }
         } else {
-            // 网络播放，请求新密钥
-            keyData = [self requestKeyDataForURL:url];
-        }
-        
-        dispatch_async(dispatch_get_main_queue(), ^{
-            if (keyData) {
-                if (!isLocal) {
-                    // 只有网络播放时才存储密钥
-                    [self storeKeyData:keyData forIdentifier:@"currentKey"];
-                }
-                
-                // 设置响应
-                loadingRequest.contentInformationRequest.contentType = AVStreamingKeyDeliveryPersistentContentKeyType;
-                [[loadingRequest dataRequest] respondWithData:keyData];
-                [loadingRequest finishLoading];
-                
-                // 通知代理密钥获取成功
-                if ([self.delegate respondsToSelector:@selector(m3u8Player:didReceiveKeyData:forURL:)]) {
-                    [self.delegate m3u8Player:nil didReceiveKeyData:keyData forURL:url];
-                }
-            } else {
-                NSError *error = [[NSError alloc] initWithDomain:NSURLErrorDomain 
-                                                            code:400 
-                                                        userInfo:@{NSLocalizedDescriptionKey: isLocal ? @"本地密钥不存在" : @"密钥请求失败"}];
-                [loadingRequest finishLoadingWithError:error];
-                
-                // 通知代理密钥获取失败
-                if ([self.delegate respondsToSelector:@selector(m3u8Player:didFailToLoadKeyForURL:error:)]) {
-                    [self.delegate m3u8Player:nil didFailToLoadKeyForURL:url error:error];
-                }
+            NSError *error = [[NSError alloc] initWithDomain:NSURLErrorDomain 
+                                                        code:400 
+                                                    userInfo:@{NSLocalizedDescriptionKey: isLocal ? @"本地密钥不存在" : @"密钥请求失败"}];
+            [loadingRequest finishLoadingWithError:error];
+            
+            // 通知代理密钥获取失败
+            id<M3U8PlayerDelegate> delegate = self.delegate;
+            if ([delegate respondsToSelector:@selector(m3u8Player:didFailToLoadKeyForURL:error:)]) {
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    [delegate m3u8Player:nil didFailToLoadKeyForURL:url error:error];
+                });
             }
-        });
-    });
+        }
+    }];
+}
+
+- (void)prefetchKeyForURI:(NSString *)keyURI {
+    [self prefetchKeyForURI:keyURI completion:nil];
 }
 
-- (NSData *)requestKeyDataForURL:(NSString *)url {
-    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
-    __block NSData *result = nil;
+- (void)prefetchKeyForURI:(NSString *)keyURI completion:(void(^)(NSError * _Nullable error))completion {
+    if (!self.keyPrefetchEnabled || self.isLocalMode || keyURI.length == 0) {
+        if (completion) {
+            completion(nil);
+        }
+        return;
+    }
     
+    NSLog(@"[M3U8KeyManager] 预取密钥: %@", keyURI);
+    [self requestKeyDataForURL:keyURI prefetch:YES completion:^(NSData * _Nullable keyData, NSError * _Nullable error) {
+        if (error) {
+            NSLog(@"[M3U8KeyManager] 密钥预取失败: %@", error.localizedDescription);
+        }
+        if (completion) {
+            completion(error);
+        }
+    }];
+}
+
+- (void)loadKeyDataForURL:(NSString *)url completion:(void(^)(NSData * _Nullable keyData, NSError * _Nullable error))completion {
+    [self requestKeyDataForURL:url completion:^(NSData * _Nullable keyData, NSError * _Nullable error) {
+        NSString *contentID = [self currentContentID];
+        if (keyData && contentID) {
+            // 与资源加载代理相同，网络获取到的密钥存入持久化存储
+            [[M3U8KeyStore sharedStore] storeKeyData:keyData forContentID:contentID keyURI:url];
+        }
+        completion(keyData, error);
+    }];
+}
+
+- (M3U8KeyFetchWaiter *)requestKeyDataForURL:(NSString *)url completion:(void(^)(NSData * _Nullable keyData, NSError * _Nullable error))completion {
+    return [self requestKeyDataForURL:url prefetch:NO completion:completion];
+}
+
+/**
+ * 获取密钥：先查内存缓存，未命中时加入同一密钥进行中的获取，没有时从密钥服务器获取并写入缓存
+ * @param prefetch 是否为解析阶段的预取；播放器请求命中预取的密钥时，记录节省的获取耗时
+ * @return 等待网络结果时返回等待者，可单独取消；同步完成时返回nil
+ */
+- (M3U8KeyFetchWaiter *)requestKeyDataForURL:(NSString *)url prefetch:(BOOL)prefetch completion:(void(^)(NSData * _Nullable keyData, NSError * _Nullable error))completion {
     // 获取授权配置
     M3U8AuthConfig *config = self.authConfig;
     
@@ -175,11 +594,96 @@
     
     if (!config) {
         NSLog(@"[M3U8KeyManager] 错误：未配置授权信息");
-        dispatch_semaphore_signal(semaphore);
+        completion(nil, [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorUserAuthenticationRequired userInfo:@{NSLocalizedDescriptionKey: @"未配置授权信息"}]);
+        return nil;
+    }
+    
+    // 切换清晰度、拖动进度时AVFoundation会重复请求同一密钥，优先使用内存缓存
+    NSString *cacheKey = [self keyCacheKeyForURL:url authConfig:config];
+    NSData *cachedKey = [self cachedKeyDataForCacheKey:cacheKey];
+    if (cachedKey) {
+        NSLog(@"[M3U8KeyManager] 密钥缓存命中: %@", url);
+        if (!prefetch) {
+            NSTimeInterval saved = [self consumePrefetchSavingForCacheKey:cacheKey];
+            if (saved > 0) {
+                [self.keyPrefetchSavedHistogram recordSeconds:saved];
+                NSLog(@"[M3U8KeyManager] 命中预取的密钥，起播链路节省%.0fms", saved * 1000);
+            }
+        }
+        completion(cachedKey, nil);
         return nil;
     }
     
-    // 构建完整的请求URL
+    // 同一密钥已在获取中时加入等待，共享一次网络请求和结果
+    M3U8KeyFetchWaiter *waiter = [[M3U8KeyFetchWaiter alloc] init];
+    waiter.completion = completion;
+    M3U8KeyFetchFlight *flight = nil;
+    BOOL joined = NO;
+    NSTimeInterval joinedPrefetchSaving = 0;
+    @synchronized (M3U8KeyFetchFlights()) {
+        flight = M3U8KeyFetchFlights()[cacheKey];
+        if (flight) {
+            joined = YES;
+            if (!prefetch && flight.prefetch) {
+                // 播放器请求赶上了进行中的预取，节省了预取已经花掉的时间
+                joinedPrefetchSaving = CFAbsoluteTimeGetCurrent() - flight.startTime;
+                flight.prefetch = NO;
+            }
+        } else {
+            flight = [[M3U8KeyFetchFlight alloc] init];
+            flight.cacheKey = cacheKey;
+            flight.startTime = CFAbsoluteTimeGetCurrent();
+            flight.prefetch = prefetch;
+            M3U8KeyFetchFlights()[cacheKey] = flight;
+        }
+        [flight.waiters addObject:waiter];
+        waiter.flight = flight;
+    }
+    
+    if (joined) {
+        [self.keyCoalescedCounter increment];
+        NSLog(@"[M3U8KeyManager] 密钥正在获取中，合并请求: %@", url);
+        if (joinedPrefetchSaving > 0) {
+            [self.keyPrefetchSavedHistogram recordSeconds:joinedPrefetchSaving];
+            NSLog(@"[M3U8KeyManager] 加入进行中的密钥预取，起播链路节省%.0fms", joinedPrefetchSaving * 1000);
+        }
+        return waiter;
+    }
+    
+    [self startKeyFetchFlight:flight url:url authConfig:config allowAuthRetry:YES];
+    return waiter;
+}
+
+/**
+ * 用可用的token发起密钥获取
+ * token有效时立即发起；即将过期时等待M3U8TokenManager的刷新完成后再发起
+ * @param allowAuthRetry 密钥服务器返回401/403时是否刷新token后重试一次
+ */
+- (void)startKeyFetchFlight:(M3U8KeyFetchFlight *)flight
+                        url:(NSString *)url
+                 authConfig:(M3U8AuthConfig *)authConfig
+             allowAuthRetry:(BOOL)allowAuthRetry {
+    [[M3U8TokenManager sharedManager] validAuthConfigForConfig:authConfig completion:^(M3U8AuthConfig * _Nullable config, NSError * _Nullable tokenError) {
+        if (!config) {
+            NSLog(@"[M3U8KeyManager] token已过期且刷新失败: %@", tokenError.localizedDescription);
+            [self finishKeyFetchFlight:flight keyData:nil error:tokenError];
+            return;
+        }
+        @synchronized (M3U8KeyFetchFlights()) {
+            if (flight.isCancelled) {
+                return;
+            }
+        }
+        [self performKeyFetchForFlight:flight url:url authConfig:config allowAuthRetry:allowAuthRetry];
+    }];
+}
+
+- (void)performKeyFetchForFlight:(M3U8KeyFetchFlight *)flight
+                             url:(NSString *)url
+                      authConfig:(M3U8AuthConfig *)config
+                  allowAuthRetry:(BOOL)allowAuthRetry {
+    // 构建完整的请求URL（记下本次使用的token，配置可能在请求期间被刷新）
+    NSString *requestToken = config.encryptToken;
     NSString *authParams = [config authParamsString];
     NSString *fullURL;
     if ([url containsString:@"?"]) {
@@ -191,77 +695,552 @@
     NSLog(@"[M3U8KeyManager] 请求密钥地址: %@", fullURL);
     
     // 发送请求
-    AFHTTPSessionManager *manager = [AFHTTPSessionManager manager];
-    manager.responseSerializer = [AFHTTPResponseSerializer serializer];
-    
-    [manager GET:fullURL parameters:nil headers:nil progress:nil success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject) {
-        result = responseObject;
-        NSLog(@"[M3U8KeyManager] 密钥获取成功，长度: %lu", (unsigned long)result.length);
-        dispatch_semaphore_signal(semaphore);
-    } failure:^(NSURLSessionDataTask * _Nullable task, NSError * _Nonnull error) {
-        NSLog(@"[M3U8KeyManager] 密钥请求失败: %@", error.localizedDescription);
-        result = nil;
-        dispatch_semaphore_signal(semaphore);
+    NSURL *requestURL = [NSURL URLWithString:fullURL];
+    if (!requestURL) {
+        NSLog(@"[M3U8KeyManager] 密钥地址无效: %@", fullURL);
+        [self finishKeyFetchFlight:flight keyData:nil error:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorBadURL userInfo:@{NSLocalizedDescriptionKey: @"密钥地址无效"}]];
+        return;
+    }
+    NSURLRequest *request = [NSURLRequest requestWithURL:requestURL];
+    NSString *cacheKey = flight.cacheKey;
+    
+    [self fetchKeyWithRequest:request attempt:1 flight:flight completion:^(NSData * _Nullable keyData, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        if (error) {
+            NSInteger statusCode = [response isKindOfClass:[NSHTTPURLResponse class]] ? ((NSHTTPURLResponse *)response).statusCode : 0;
+            if (allowAuthRetry && (statusCode == 401 || statusCode == 403)) {
+                if (![config.encryptToken isEqualToString:requestToken]) {
+                    // 请求期间token已经刷新，直接用新token重试
+                    [self startKeyFetchFlight:flight url:url authConfig:config allowAuthRetry:NO];
+                    return;
+                }
+                // token提前失效（例如被服务端吊销），刷新后重试一次
+                NSLog(@"[M3U8KeyManager] 密钥服务器拒绝token(%ld)，刷新token后重试", (long)statusCode);
+                [[M3U8TokenManager sharedManager] refreshTokenForConfig:config completion:^(M3U8AuthConfig * _Nullable refreshedConfig, NSError * _Nullable refreshError) {
+                    if (!refreshedConfig || [refreshedConfig.encryptToken isEqualToString:requestToken]) {
+                        [self finishKeyFetchFlight:flight keyData:nil error:error];
+                        return;
+                    }
+                    [self startKeyFetchFlight:flight url:url authConfig:refreshedConfig allowAuthRetry:NO];
+                }];
+                return;
+            }
+            NSLog(@"[M3U8KeyManager] 密钥请求失败: %@", error.localizedDescription);
+            [self finishKeyFetchFlight:flight keyData:nil error:error];
+            return;
+        }
+        
+        [[M3U8Metrics sharedMetrics] recordNetworkBytes:keyData.length];
+        NSLog(@"[M3U8KeyManager] 密钥获取成功，长度: %lu", (unsigned long)keyData.length);
+        BOOL stillPrefetch = NO;
+        @synchronized (M3U8KeyFetchFlights()) {
+            stillPrefetch = flight.prefetch;
+        }
+        [self cacheKeyData:keyData
+               forCacheKey:cacheKey
+            expirationDate:[self keyExpirationDateForResponse:response authConfig:config]
+          prefetchDuration:stillPrefetch ? CFAbsoluteTimeGetCurrent() - flight.startTime : 0];
+        [self finishKeyFetchFlight:flight keyData:keyData error:nil];
     }];
+}
+
+/**
+ * 结束一次密钥获取，把结果分发给所有仍在等待的请求
+ * 之后到达的同一密钥请求会重新走缓存或发起新的获取
+ */
+- (void)finishKeyFetchFlight:(M3U8KeyFetchFlight *)flight keyData:(NSData *)keyData error:(NSError *)error {
+    NSArray<M3U8KeyFetchWaiter *> *waiters = nil;
+    @synchronized (M3U8KeyFetchFlights()) {
+        if (M3U8KeyFetchFlights()[flight.cacheKey] == flight) {
+            [M3U8KeyFetchFlights() removeObjectForKey:flight.cacheKey];
+        }
+        waiters = [flight.waiters copy];
+        [flight.waiters removeAllObjects];
+        for (M3U8KeyFetchWaiter *waiter in waiters) {
+            waiter.flight = nil;
+        }
+    }
+    
+    if (waiters.count > 1) {
+        NSLog(@"[M3U8KeyManager] 密钥获取结果分发给%lu个等待者", (unsigned long)waiters.count);
+    }
+    for (M3U8KeyFetchWaiter *waiter in waiters) {
+        void(^completion)(NSData *, NSError *) = waiter.completion;
+        waiter.completion = nil;
+        if (completion) {
+            completion(keyData, error);
+        }
+    }
+}
+
+/**
+ * 发起一次密钥请求
+ * 耗时超过观测到的p95时发送对冲请求，先成功的胜出；全部失败且可重试时按退避策略重试
+ * 所属的Flight被取消后不再发起新的请求或重试
+ */
+- (void)fetchKeyWithRequest:(NSURLRequest *)request 
+                    attempt:(NSUInteger)attempt 
+                     flight:(M3U8KeyFetchFlight *)flight
+                 completion:(void(^)(NSData * _Nullable keyData, NSURLResponse * _Nullable response, NSError * _Nullable error))completion {
+    // 最近失败过的密钥URL或熔断中的密钥服务器直接失败，不再访问网络
+    M3U8CircuitBreaker *breaker = [M3U8CircuitBreaker sharedBreaker];
+    NSError *admissionError = [breaker admissionErrorForURL:request.URL];
+    if (admissionError) {
+        NSLog(@"[M3U8KeyManager] 密钥请求被拒绝: %@", admissionError.localizedDescription);
+        completion(nil, nil, admissionError);
+        return;
+    }
+    
+    M3U8RetryPolicy *policy = [M3U8RetryPolicy keyPolicy];
+    // 密钥服务器共享会话，复用已建立的连接
+    AFHTTPSessionManager *manager = [[M3U8SessionPool sharedPool] sessionManagerForHostClass:M3U8HostClassKeyServer];
+    CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+    
+    // 以下状态由@synchronized(tasks)保护
+    NSMutableArray<NSURLSessionTask *> *tasks = [NSMutableArray array];
+    NSMutableArray<M3U8SchedulerTicket *> *tickets = [NSMutableArray array];
+    __block BOOL settled = NO;
+    __block __weak NSURLSessionTask *hedgeTask = nil;
+    
+    void(^taskDidComplete)(NSURLSessionTask *, NSURLResponse *, id, NSError *) = ^(NSURLSessionTask *task, NSURLResponse *response, id responseObject, NSError *error) {
+        BOOL hedgeWon = NO;
+        NSArray<M3U8SchedulerTicket *> *pendingTickets = nil;
+        @synchronized (tasks) {
+            if (settled || !task || ![tasks containsObject:task]) {
+                return;
+            }
+            [tasks removeObject:task];
+            if (error && tasks.count > 0) {
+                // 对冲中的另一个请求仍在进行，由它决定结果
+                return;
+            }
+            settled = YES;
+            hedgeWon = (task == hedgeTask);
+            for (NSURLSessionTask *other in tasks) {
+                [other cancel];
+            }
+            [tasks removeAllObjects];
+            pendingTickets = [tickets copy];
+            [tickets removeAllObjects];
+        }
+        
+        // 还在排队的对冲请求不再需要，释放排队位置
+        for (M3U8SchedulerTicket *pendingTicket in pendingTickets) {
+            [pendingTicket cancel];
+        }
+        @synchronized (M3U8KeyFetchFlights()) {
+            [flight.tickets removeObjectsInArray:pendingTickets];
+        }
+        
+        if (error) {
+            [breaker recordFailure:error response:response forURL:request.URL];
+        } else {
+            [breaker recordSuccessForURL:request.URL];
+        }
+        
+        if (error) {
+            if ([policy shouldRetryError:error response:response attempt:attempt]) {
+                NSTimeInterval delay = [policy backoffDelayForAttempt:attempt];
+                NSLog(@"[M3U8KeyManager] 密钥请求失败(%@)，%.0fms后重试", error.localizedDescription, delay * 1000);
+                dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+                    @synchronized (M3U8KeyFetchFlights()) {
+                        if (flight.isCancelled) {
+                            return;
+                        }
+                    }
+                    [self fetchKeyWithRequest:request attempt:attempt + 1 flight:flight completion:completion];
+                });
+                return;
+            }
+            completion(nil, response, error);
+            return;
+        }
+        
+        [policy recordSuccessWithLatency:CFAbsoluteTimeGetCurrent() - startTime];
+        if (hedgeWon) {
+            NSLog(@"[M3U8KeyManager] 对冲请求胜出");
+            [policy recordHedgeWin];
+        }
+        completion(responseObject, response, nil);
+    };
+    
+    // 请求结束后释放并发名额，并从待取消列表中移除
+    void(^releaseTicket)(M3U8SchedulerTicket *) = ^(M3U8SchedulerTicket *ticket) {
+        [ticket finish];
+        @synchronized (M3U8KeyFetchFlights()) {
+            [flight.tickets removeObjectIdenticalTo:ticket];
+        }
+        @synchronized (tasks) {
+            [tickets removeObjectIdenticalTo:ticket];
+        }
+    };
+    
+    // 密钥优先于续播刷新和预加载，由调度器按密钥服务器并发数排队
+    void(^scheduleTask)(BOOL) = ^(BOOL hedge) {
+        M3U8SchedulerTicket *scheduledTicket = [[M3U8RequestScheduler sharedScheduler] scheduleRequestForURL:request.URL 
+                                                                                                      priority:M3U8RequestPriorityKey 
+                                                                                                         start:^(M3U8SchedulerTicket *ticket) {
+            // 排队期间Flight被取消或对冲中的另一个请求已有结果时不再创建task
+            BOOL cancelled = NO;
+            @synchronized (M3U8KeyFetchFlights()) {
+                cancelled = flight.isCancelled;
+            }
+            @synchronized (tasks) {
+                cancelled = cancelled || settled;
+            }
+            if (cancelled) {
+                releaseTicket(ticket);
+                return;
+            }
+            
+            // 密钥响应只有16字节，按密钥服务器观测到的延迟设置较短的期限
+            M3U8TimeoutEstimator *estimator = [M3U8TimeoutEstimator sharedEstimator];
+            M3U8RequestDeadlines deadlines = [estimator deadlinesForURL:request.URL hostClass:M3U8HostClassKeyServer];
+            
+            __block __weak NSURLSessionDataTask *weakTask = nil;
+            NSURLSessionDataTask *task = [manager dataTaskWithRequest:[estimator request:request withDeadlines:deadlines] uploadProgress:nil downloadProgress:nil completionHandler:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject, NSError * _Nullable error) {
+                releaseTicket(ticket);
+                taskDidComplete(weakTask, response, responseObject, [estimator errorForTask:weakTask error:error]);
+            }];
+            weakTask = task;
+            task.priority = ticket.taskPriority;
+            
+            // 创建task后仍可能被取消：未启动的task也要cancel，AFNetworking才会调用完成回调并释放它持有的Flight和回调
+            @synchronized (M3U8KeyFetchFlights()) {
+                cancelled = flight.isCancelled;
+                if (!cancelled) {
+                    [flight.tasks addObject:task];
+                }
+            }
+            if (!cancelled) {
+                @synchronized (tasks) {
+                    cancelled = settled;
+                    if (!cancelled) {
+                        [tasks addObject:task];
+                        if (hedge) {
+                            hedgeTask = task;
+                        }
+                    }
+                }
+                if (cancelled) {
+                    @synchronized (M3U8KeyFetchFlights()) {
+                        [flight.tasks removeObject:task];
+                    }
+                }
+            }
+            if (cancelled) {
+                [task cancel];
+                return;
+            }
+            [task resume];
+            [estimator watchTask:task deadlines:deadlines];
+        }];
+        
+        // 保留票据：Flight取消或已有结果时释放仍在排队的请求占用的名额
+        @synchronized (M3U8KeyFetchFlights()) {
+            if (flight.isCancelled) {
+                [scheduledTicket cancel];
+                return;
+            }
+            [flight.tickets addObject:scheduledTicket];
+        }
+        @synchronized (tasks) {
+            [tickets addObject:scheduledTicket];
+        }
+    };
+    
+    scheduleTask(NO);
+    
+    NSTimeInterval hedgeDelay = [policy hedgeDelay];
+    if (hedgeDelay > 0) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(hedgeDelay * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+            @synchronized (tasks) {
+                if (settled || tasks.count != 1) {
+                    return;
+                }
+            }
+            if ([policy acquireHedgeToken]) {
+                NSLog(@"[M3U8KeyManager] 密钥请求超过p95(%.0fms)未完成，发送对冲请求", hedgeDelay * 1000);
+                scheduleTask(YES);
+            }
+        });
+    }
+}
+
+#pragma mark - Key Cache
+
+- (NSString *)keyCacheKeyForURL:(NSString *)url authConfig:(M3U8AuthConfig *)config {
+    return [NSString stringWithFormat:@"%@|%@", url, [config authScope]];
+}
+
+- (NSData *)cachedKeyDataForCacheKey:(NSString *)cacheKey {
+    NSData *keyData = nil;
+    @synchronized (self.keyCache) {
+        M3U8CachedKey *entry = self.keyCache[cacheKey];
+        if (entry && [entry.expirationDate timeIntervalSinceNow] > 0) {
+            keyData = [self.keyArena dataAtSlot:entry.slot length:entry.length];
+        } else if (entry) {
+            [self evictCachedKeyForCacheKey:cacheKey];
+        }
+    }
+    
+    if (keyData) {
+        [self.keyCacheHitCounter increment];
+    } else {
+        [self.keyCacheMissCounter increment];
+    }
+    return keyData;
+}
+
+- (void)cacheKeyData:(NSData *)keyData
+         forCacheKey:(NSString *)cacheKey
+      expirationDate:(NSDate *)expirationDate
+    prefetchDuration:(NSTimeInterval)prefetchDuration {
+    if (keyData.length == 0 || [expirationDate timeIntervalSinceNow] <= 0) {
+        return;
+    }
+    
+    @synchronized (self.keyCache) {
+        if (self.keyCache[cacheKey]) {
+            [self evictCachedKeyForCacheKey:cacheKey];
+        }
+        if (self.keyCache.count >= kKeyCacheCapacity) {
+            // 容量满时淘汰最早过期的密钥
+            NSString *soonestKey = nil;
+            NSDate *soonestDate = nil;
+            for (NSString *key in self.keyCache) {
+                NSDate *date = self.keyCache[key].expirationDate;
+                if (!soonestDate || [date compare:soonestDate] == NSOrderedAscending) {
+                    soonestDate = date;
+                    soonestKey = key;
+                }
+            }
+            [self evictCachedKeyForCacheKey:soonestKey];
+        }
+        
+        NSInteger slot = [self.keyArena storeBytes:keyData.bytes length:keyData.length];
+        if (slot < 0) {
+            NSLog(@"[M3U8KeyManager] 密钥长度%lu超出缓存槽位，不缓存", (unsigned long)keyData.length);
+            return;
+        }
+        M3U8CachedKey *entry = [[M3U8CachedKey alloc] init];
+        entry.slot = slot;
+        entry.length = keyData.length;
+        entry.expirationDate = expirationDate;
+        entry.prefetchDuration = prefetchDuration;
+        self.keyCache[cacheKey] = entry;
+    }
+    NSLog(@"[M3U8KeyManager] 密钥已缓存，有效期至: %@", expirationDate);
+}
+
+- (NSTimeInterval)consumePrefetchSavingForCacheKey:(NSString *)cacheKey {
+    @synchronized (self.keyCache) {
+        M3U8CachedKey *entry = self.keyCache[cacheKey];
+        NSTimeInterval saved = entry.prefetchDuration;
+        entry.prefetchDuration = 0;
+        return saved;
+    }
+}
+
+/**
+ * 淘汰缓存的密钥并清零其内存（须在@synchronized(keyCache)中调用）
+ */
+- (void)evictCachedKeyForCacheKey:(NSString *)cacheKey {
+    M3U8CachedKey *entry = cacheKey ? self.keyCache[cacheKey] : nil;
+    if (!entry) {
+        return;
+    }
+    [self.keyArena freeSlot:entry.slot];
+    [self.keyCache removeObjectForKey:cacheKey];
+    [self.keyCacheEvictionCounter increment];
+}
+
+- (void)clearKeyCache {
+    @synchronized (self.keyCache) {
+        for (NSString *cacheKey in self.keyCache.allKeys) {
+            [self evictCachedKeyForCacheKey:cacheKey];
+        }
+    }
+    NSLog(@"[M3U8KeyManager] 密钥缓存已清空");
+}
+
+/**
+ * 密钥的缓存有效期
+ * 取响应头（Cache-Control: max-age / Expires）与encrypt_token时间戳中较早的一个，最长1小时；
+ * 响应头声明no-store/no-cache时不缓存；都没有给出时缓存5分钟
+ */
+- (NSDate *)keyExpirationDateForResponse:(NSURLResponse *)response authConfig:(M3U8AuthConfig *)config {
+    NSDate *now = [NSDate date];
+    NSDate *expiration = nil;
+    
+    NSDictionary *headers = [response isKindOfClass:[NSHTTPURLResponse class]] ? ((NSHTTPURLResponse *)response).allHeaderFields : nil;
+    NSString *cacheControl = [headers[@"Cache-Control"] lowercaseString];
+    if ([cacheControl containsString:@"no-store"] || [cacheControl containsString:@"no-cache"]) {
+        return now;
+    }
+    NSRange maxAgeRange = [cacheControl rangeOfString:@"max-age="];
+    if (maxAgeRange.location != NSNotFound) {
+        NSTimeInterval maxAge = [[cacheControl substringFromIndex:NSMaxRange(maxAgeRange)] doubleValue];
+        expiration = [now dateByAddingTimeInterval:maxAge];
+    } else if (headers[@"Expires"]) {
+        NSDateFormatter *formatter = [[NSDateFormatter alloc] init];
+        formatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+        formatter.timeZone = [NSTimeZone timeZoneWithAbbreviation:@"GMT"];
+        formatter.dateFormat = @"EEE, dd MMM yyyy HH:mm:ss zzz";
+        expiration = [formatter dateFromString:headers[@"Expires"]];
+    }
+    
+    NSDate *tokenExpiration = [config tokenExpirationDate];
+    if ([tokenExpiration timeIntervalSinceNow] > 0) {
+        expiration = expiration ? [expiration earlierDate:tokenExpiration] : tokenExpiration;
+    }
     
-    dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER);
-    return result;
+    if (!expiration) {
+        expiration = [now dateByAddingTimeInterval:kKeyCacheDefaultLifetime];
+    }
+    return [expiration earlierDate:[now dateByAddingTimeInterval:kKeyCacheMaxLifetime]];
+}
+
+- (NSDictionary *)keyCacheStatistics {
+    NSUInteger count = 0;
+    @synchronized (self.keyCache) {
+        count = self.keyCache.count;
+    }
+    return @{
+        @"entries": @(count),
+        @"capacity": @(kKeyCacheCapacity)
+    };
+}
+
+#pragma mark - Key Storage
+
+- (NSString *)currentContentID {
+    if (self.contentID.length > 0) {
+        return self.contentID;
+    }
+    NSString *scope = [self.authConfig authScope];
+    return scope.length > 0 ? scope : nil;
 }
 
 - (void)storeKeyData:(NSData *)keyData forIdentifier:(NSString *)identifier {
     if (keyData && identifier) {
-        [[NSUserDefaults standardUserDefaults] setObject:keyData forKey:identifier];
-        [[NSUserDefaults standardUserDefaults] synchronize];
+        // 以标识符为内容ID、空密钥URI保存
+        [[M3U8KeyStore sharedStore] storeKeyData:keyData forContentID:identifier keyURI:@""];
         NSLog(@"[M3U8KeyManager] 密钥已存储，标识符: %@", identifier);
     }
 }
 
 - (NSData *)getStoredKeyDataForIdentifier:(NSString *)identifier {
-    return [[NSUserDefaults standardUserDefaults] objectForKey:identifier];
+    M3U8KeyStore *store = [M3U8KeyStore sharedStore];
+    NSData *keyData = [store keyDataForContentID:identifier keyURI:@""];
+    if (keyData) {
+        return keyData;
+    }
+    
+    // 迁移旧版本保存在NSUserDefaults中的密钥
+    NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+    keyData = [defaults objectForKey:identifier];
+    if ([keyData isKindOfClass:[NSData class]]) {
+        [store storeKeyData:keyData forContentID:identifier keyURI:@""];
+        [defaults removeObjectForKey:identifier];
+        NSLog(@"[M3U8KeyManager] 已迁移旧版本存储的密钥，标识符: %@", identifier);
+        return keyData;
+    }
+    return nil;
+}
+
+- (NSData *)storedKeyDataForContentID:(NSString *)contentID keyURI:(NSString *)keyURI {
+    M3U8KeyStore *store = [M3U8KeyStore sharedStore];
+    NSData *keyData = contentID ? [store keyDataForContentID:contentID keyURI:keyURI] : nil;
+    if (!keyData) {
+        // 不知道内容ID或该内容下没有记录时，使用该密钥URI最近保存的密钥
+        keyData = [store keyDataForKeyURI:keyURI];
+    }
+    if (!keyData) {
+        // 升级前下载的内容只有旧版本保存的最后一个密钥
+        keyData = [self getStoredKeyDataForIdentifier:kLegacyStoredKeyIdentifier];
+    }
+    return keyData;
 }
 
 #pragma mark - Request Handlers
 
-- (void)handleM3U8Request:(AVAssetResourceLoadingRequest *)loadingRequest withURL:(NSString *)url {
+- (void)handleM3U8Request:(AVAssetResourceLoadingRequest *)loadingRequest withURL:(NSString *)url context:(M3U8ResourceLoaderContext *)context {
     NSLog(@"[M3U8KeyManager] 处理M3U8请求: %@", url);
     
-    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-        NSData *data = [self downloadDataFromURL:url];
+    M3U8PendingLoadingRequest *pending = [self registerLoadingRequest:loadingRequest url:url context:context];
+    NSString *authParams = self.authConfig ? [self.authConfig authParamsString] : @"";
+    NSString *rewrittenToken = [authParams stringByAppendingString:kRewrittenPlaylistTokenSuffix];
+    
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        // 优先使用已改写过的播放列表，命中时映射数据直接交给AVFoundation
+        NSData *modifiedData = [[CacheManager sharedManager] cachedDataForURL:url token:rewrittenToken];
+        if (modifiedData) {
+            [self finishM3U8Request:pending data:modifiedData];
+            return;
+        }
+        if (pending.isCancelled) {
+            return;
+        }
         
-        if (data) {
-            // 修改M3U8内容，将密钥URL替换为自定义scheme
-            NSString *content = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
-            NSString *modifiedContent = [content stringByReplacingOccurrencesOfString:@"https://" withString:@"m3u8-key://"];
-            
-            // 也需要将TS文件URL替换为自定义scheme
-            modifiedContent = [self replaceRelativeURLsInM3U8:modifiedContent withBaseURL:url];
-            
-            NSData *modifiedData = [modifiedContent dataUsingEncoding:NSUTF8StringEncoding];
+        // 未命中时由M3U8Loader异步下载，AVFoundation取消时一并取消下载
+        M3U8LoadRequest *loadRequest = [self.m3u8Loader loadM3U8DataWithURL:url completion:^(NSData * _Nullable data, NSError * _Nullable error) {
+            if (!data) {
+                NSLog(@"[M3U8KeyManager] 使用M3U8Loader下载失败: %@", error.localizedDescription);
+                [self finishM3U8Request:pending data:nil];
+                return;
+            }
+            NSLog(@"[M3U8KeyManager] 使用M3U8Loader下载成功，长度: %lu", (unsigned long)data.length);
             
-            dispatch_async(dispatch_get_main_queue(), ^{
-                [[loadingRequest dataRequest] respondWithData:modifiedData];
-                [loadingRequest finishLoading];
-                NSLog(@"[M3U8KeyManager] M3U8请求处理完成");
-            });
+            // 完成回调已在后台队列，直接改写
+            NSData *rewrittenData = [self rewrittenPlaylistData:data baseURL:url];
+            if (rewrittenData) {
+                [[CacheManager sharedManager] cacheData:rewrittenData forURL:url token:rewrittenToken];
+            }
+            [self finishM3U8Request:pending data:rewrittenData];
+        }];
+        [pending setCancelHandler:^{
+            [loadRequest cancel];
+        }];
+    });
+}
+
+- (void)finishM3U8Request:(M3U8PendingLoadingRequest *)pending data:(NSData *)data {
+    [self finishPendingRequest:pending withBlock:^(AVAssetResourceLoadingRequest *loadingRequest) {
+        if (data) {
+            [[loadingRequest dataRequest] respondWithData:data];
+            [loadingRequest finishLoading];
+            NSLog(@"[M3U8KeyManager] M3U8请求处理完成，耗时%.0fms", (CFAbsoluteTimeGetCurrent() - pending.startTime) * 1000);
         } else {
-            dispatch_async(dispatch_get_main_queue(), ^{
-                [self finishLoadingWithError:loadingRequest message:@"M3U8文件下载失败"];
-            });
+            [self finishLoadingWithError:loadingRequest message:@"M3U8文件下载失败"];
         }
-    });
+    }];
 }
 
 - (void)handleTSRequest:(AVAssetResourceLoadingRequest *)loadingRequest withURL:(NSString *)url {
     NSLog(@"[M3U8KeyManager] 处理TS请求: %@", url);
     
-    // 直接重定向到真实URL
-    NSURL *realURL = [NSURL URLWithString:url];
+    // 直接重定向到真实URL（改写到等价CDN主机中当前最优的一个）
+    NSURL *realURL = [[M3U8HostSelector sharedSelector] preferredURLForURL:[NSURL URLWithString:url]];
     NSURLRequest *redirect = [NSURLRequest requestWithURL:realURL];
     [loadingRequest setRedirect:redirect];
     [loadingRequest setResponse:[[NSHTTPURLResponse alloc] initWithURL:realURL statusCode:302 HTTPVersion:nil headerFields:nil]];
     [loadingRequest finishLoading];
 }
 
+- (NSData *)rewrittenPlaylistData:(NSData *)data baseURL:(NSString *)url {
+    // 修改M3U8内容，将密钥URL替换为自定义scheme
+    NSString *content = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+    if (!content) {
+        return nil;
+    }
+    NSString *modifiedContent = [content stringByReplacingOccurrencesOfString:@"https://" withString:@"m3u8-key://"];
+    
+    // 也需要将TS文件URL替换为自定义scheme
+    modifiedContent = [self replaceRelativeURLsInM3U8:modifiedContent withBaseURL:url];
+    
+    return [modifiedContent dataUsingEncoding:NSUTF8StringEncoding];
+}
+
 - (NSString *)replaceRelativeURLsInM3U8:(NSString *)content withBaseURL:(NSString *)baseURL {
     NSURL *base = [NSURL URLWithString:baseURL];
     NSString *baseURLString = [NSString stringWithFormat:@"%@://%@", base.scheme, base.host];
@@ -288,26 +1267,6 @@
     return [modifiedLines componentsJoinedByString:@"\n"];
 }
 
-- (NSData *)downloadDataFromURL:(NSString *)url {
-    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
-    __block NSData *result = nil;
-    
-    // 使用M3U8Loader下载数据
-    [self.m3u8Loader loadM3U8WithURL:url completion:^(NSString * _Nullable content, NSError * _Nullable error) {
-        if (content) {
-            result = [content dataUsingEncoding:NSUTF8StringEncoding];
-            NSLog(@"[M3U8KeyManager] 使用M3U8Loader下载成功，长度: %lu", (unsigned long)result.length);
-        } else {
-            NSLog(@"[M3U8KeyManager] 使用M3U8Loader下载失败: %@", error.localizedDescription);
-            result = nil;
-        }
-        dispatch_semaphore_signal(semaphore);
-    }];
-    
-    dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER);
-    return result;
-}
-
 - (void)finishLoadingWithError:(AVAssetResourceLoadingRequest *)loadingRequest message:(NSString *)message {
     NSError *error = [[NSError alloc] initWithDomain:NSURLErrorDomain 
                                                  code:400 
@@ -315,29 +1274,4 @@
     [loadingRequest finishLoadingWithError:error];
 }
 
-#pragma mark - M3U8LoaderDelegate
-
-- (void)loader:(M3U8Loader *)loader didLoadContent:(NSString *)content fromURL:(NSString *)url {
-    NSLog(@"[M3U8KeyManager] M3U8Loader加载成功: %@", url);
-    // 这里只是记录日志，实际的内容处理在完成回调中进行
-}
-
-- (void)loader:(M3U8Loader *)loader didFailWithError:(NSError *)error forURL:(NSString *)url {
-    NSLog(@"[M3U8KeyManager] M3U8Loader加载失败: %@ - %@", url, error.localizedDescription);
-    // 这里只是记录日志，实际的错误处理在完成回调中进行
-}
-
-- (void)loader:(M3U8Loader *)loader downloadProgress:(float)progress forURL:(NSString *)url {
-    NSLog(@"[M3U8KeyManager] M3U8下载进度: %.2f%% - %@", progress * 100, url);
-    // 密钥和M3U8文件下载进度
-}
-
-- (void)loader:(M3U8Loader *)loader cacheHitForURL:(NSString *)url {
-    NSLog(@"[M3U8KeyManager] M3U8缓存命中: %@", url);
-}
-
-- (void)loader:(M3U8Loader *)loader cacheMissForURL:(NSString *)url {
-    NSLog(@"[M3U8KeyManager] M3U8缓存未命中: %@", url);
-}
-
 @end
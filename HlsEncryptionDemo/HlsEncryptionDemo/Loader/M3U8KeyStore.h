@@ -0,0 +1,81 @@
+//
+//  M3U8KeyStore.h
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 持久化密钥存储（供离线播放使用）
+ * 按「内容ID + 密钥URI」索引，每个已下载的剧集各自保存密钥，查找为O(1)
+ * 写入先更新内存索引，再合并成一次批量落盘（临时文件 + fsync + rename）
+ * 密钥以AES-256-CTR加密存放，整个文件用HMAC-SHA256校验；主密钥保存在钥匙串中
+ * 文件格式为定长小端整数的二进制格式，不依赖plist或归档，其他平台可按格式说明直接读取
+ */
+@interface M3U8KeyStore : NSObject
+
+/**
+ * 存储文件路径
+ */
+@property (nonatomic, copy, readonly) NSString *path;
+
+/**
+ * 写入后合并落盘的延迟（秒），默认1秒
+ */
+@property (nonatomic, assign) NSTimeInterval flushDelay;
+
+/**
+ * 获取共享存储（Application Support/M3U8KeyStore/keys.bin）
+ */
++ (instancetype)sharedStore;
+
+/**
+ * 使用指定文件初始化
+ */
+- (instancetype)initWithPath:(NSString *)path;
+
+/**
+ * 保存密钥，与已保存的密钥相同时不触发写盘
+ * @param contentID 内容ID（如剧集与集数 "1071.1"）
+ * @param keyURI 密钥地址（不含授权参数）
+ */
+- (void)storeKeyData:(NSData *)keyData forContentID:(NSString *)contentID keyURI:(NSString *)keyURI;
+
+/**
+ * 获取指定内容的密钥
+ */
+- (NSData * _Nullable)keyDataForContentID:(NSString *)contentID keyURI:(NSString *)keyURI;
+
+/**
+ * 按密钥URI获取最近保存的密钥（不知道内容ID时使用）
+ */
+- (NSData * _Nullable)keyDataForKeyURI:(NSString *)keyURI;
+
+/**
+ * 删除指定内容的所有密钥（删除下载内容时调用）
+ */
+- (void)removeKeysForContentID:(NSString *)contentID;
+
+/**
+ * 删除所有密钥
+ */
+- (void)removeAllKeys;
+
+/**
+ * 立即把未落盘的修改写入文件
+ */
+- (void)flush;
+
+/**
+ * 存储统计
+ */
+- (NSDictionary *)statistics;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,635 @@
+//
+//  M3U8KeyStore.m
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import "M3U8KeyStore.h"
+#import "M3U8Metrics.h"
+#import <UIKit/UIKit.h>
+#import <Security/Security.h>
+#import <CommonCrypto/CommonCryptor.h>
+#import <CommonCrypto/CommonHMAC.h>
+#import <fcntl.h>
+#import <unistd.h>
+
+/*
+ * 文件格式（所有整数均为小端）：
+ *
+ *   magic        4字节  "M3KS"
+ *   version      uint32 当前为1
+ *   count        uint32 条目数
+ *   条目 × count：
+ *     contentID  uint16长度 + UTF-8
+ *     keyURI     uint16长度 + UTF-8
+ *     storedAt   int64  保存时间（Unix秒）
+ *     iv         16字节 AES-256-CTR初始计数器（大端计数）
+ *     ciphertext uint16长度 + 密文
+ *   mac          32字节 HMAC-SHA256(以上所有字节)
+ *
+ * 主密钥64字节：前32字节用于AES-256-CTR，后32字节用于HMAC-SHA256
+ */
+
+static const uint8_t kKeyStoreMagic[4] = {'M', '3', 'K', 'S'};
+static const uint32_t kKeyStoreVersion = 1;
+
+#define kKeyStoreMasterKeyLength 64
+#define kKeyStoreCipherKeyLength 32
+#define kKeyStoreIVLength 16
+
+// 钥匙串中保存主密钥的服务名
+static NSString * const kKeyStoreKeychainService = @"M3U8KeyStore";
+
+// MARK: - M3U8StoredKey
+
+@interface M3U8StoredKey : NSObject
+@property (nonatomic, copy) NSString *contentID;
+@property (nonatomic, copy) NSString *keyURI;
+@property (nonatomic, assign) int64_t storedAt;
+@property (nonatomic, strong) NSData *iv;
+@property (nonatomic, strong) NSData *ciphertext;   // 内存中也只保存密文，读取时解密
+@end
+
+@implementation M3U8StoredKey
+@end
+
+// MARK: - M3U8KeyStore
+
+@interface M3U8KeyStore ()
+
+@property (nonatomic, copy, readwrite) NSString *path;
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, strong) NSData *masterKey;
+
+// 以下状态只在queue上访问
+@property (nonatomic, strong) NSMutableDictionary<NSString *, M3U8StoredKey *> *entries;         // 内容ID|密钥URI -> 条目
+@property (nonatomic, strong) NSMutableDictionary<NSString *, M3U8StoredKey *> *latestByKeyURI;  // 密钥URI -> 最近保存的条目
+@property (nonatomic, assign) BOOL loaded;
+@property (nonatomic, assign) BOOL dirty;
+@property (nonatomic, assign) BOOL flushScheduled;
+
+@property (nonatomic, strong) M3U8MetricCounter *hitCounter;
+@property (nonatomic, strong) M3U8MetricCounter *missCounter;
+@property (nonatomic, strong) M3U8MetricCounter *flushCounter;
+
+@end
+
+@implementation M3U8KeyStore
+
++ (instancetype)sharedStore {
+    static M3U8KeyStore *instance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSString *supportDir = NSSearchPathForDirectoriesInDomains(NSApplicationSupportDirectory, NSUserDomainMask, YES).firstObject;
+        NSString *path = [[supportDir stringByAppendingPathComponent:@"M3U8KeyStore"] stringByAppendingPathComponent:@"keys.bin"];
+        instance = [[M3U8KeyStore alloc] initWithPath:path];
+    });
+    return instance;
+}
+
+- (instancetype)initWithPath:(NSString *)path {
+    self = [super init];
+    if (self) {
+        _path = [path copy];
+        _flushDelay = 1.0;
+        _queue = dispatch_queue_create("com.m3u8.keystore", DISPATCH_QUEUE_SERIAL);
+        _entries = [NSMutableDictionary dictionary];
+        _latestByKeyURI = [NSMutableDictionary dictionary];
+        M3U8Metrics *metrics = [M3U8Metrics sharedMetrics];
+        _hitCounter = [metrics counterNamed:@"m3u8_key_store_hits_total" labels:nil];
+        _missCounter = [metrics counterNamed:@"m3u8_key_store_misses_total" labels:nil];
+        _flushCounter = [metrics counterNamed:@"m3u8_key_store_flushes_total" labels:nil];
+        
+        // 进入后台或退出前把未落盘的修改写入文件
+        NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+        [center addObserver:self selector:@selector(flush) name:UIApplicationDidEnterBackgroundNotification object:nil];
+        [center addObserver:self selector:@selector(flush) name:UIApplicationWillTerminateNotification object:nil];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+#pragma mark - Public Methods
+
+- (void)storeKeyData:(NSData *)keyData forContentID:(NSString *)contentID keyURI:(NSString *)keyURI {
+    if (keyData.length == 0 || keyData.length > UINT16_MAX || !contentID || !keyURI ||
+        [contentID lengthOfBytesUsingEncoding:NSUTF8StringEncoding] > UINT16_MAX ||
+        [keyURI lengthOfBytesUsingEncoding:NSUTF8StringEncoding] > UINT16_MAX) {
+        return;
+    }
+    
+    dispatch_async(self.queue, ^{
+        [self loadIfNeeded];
+        NSString *entryKey = [self entryKeyForContentID:contentID keyURI:keyURI];
+        M3U8StoredKey *existing = self.entries[entryKey];
+        if (existing && [[self decryptEntry:existing] isEqualToData:keyData]) {
+            // 切换清晰度、拖动进度时反复拿到同一密钥，不重复写盘
+            return;
+        }
+        
+        M3U8StoredKey *entry = [self encryptKeyData:keyData];
+        if (!entry) {
+            return;
+        }
+        entry.contentID = contentID;
+        entry.keyURI = keyURI;
+        entry.storedAt = (int64_t)[[NSDate date] timeIntervalSince1970];
+        self.entries[entryKey] = entry;
+        self.latestByKeyURI[keyURI] = entry;
+        NSLog(@"[M3U8KeyStore] 密钥已保存，内容ID: %@, 密钥: %@", contentID, keyURI);
+        [self markDirty];
+    });
+}
+
+- (NSData *)keyDataForContentID:(NSString *)contentID keyURI:(NSString *)keyURI {
+    if (!contentID || !keyURI) {
+        return nil;
+    }
+    __block NSData *keyData = nil;
+    dispatch_sync(self.queue, ^{
+        [self loadIfNeeded];
+        M3U8StoredKey *entry = self.entries[[self entryKeyForContentID:contentID keyURI:keyURI]];
+        keyData = entry ? [self decryptEntry:entry] : nil;
+    });
+    [self recordLookup:keyData != nil];
+    return keyData;
+}
+
+- (NSData *)keyDataForKeyURI:(NSString *)keyURI {
+    if (!keyURI) {
+        return nil;
+    }
+    __block NSData *keyData = nil;
+    dispatch_sync(self.queue, ^{
+        [self loadIfNeeded];
+        M3U8StoredKey *entry = self.latestByKeyURI[keyURI];
+        keyData = entry ? [self decryptEntry:entry] : nil;
+    });
+    [self recordLookup:keyData != nil];
+    return keyData;
+}
+
+- (void)removeKeysForContentID:(NSString *)contentID {
+    dispatch_async(self.queue, ^{
+        [self loadIfNeeded];
+        NSMutableArray<NSString *> *removedKeyURIs = [NSMutableArray array];
+        for (NSString *entryKey in self.entries.allKeys) {
+            M3U8StoredKey *entry = self.entries[entryKey];
+            if ([entry.contentID isEqualToString:contentID]) {
+                [self.entries removeObjectForKey:entryKey];
+                [removedKeyURIs addObject:entry.keyURI];
+            }
+        }
+        if (removedKeyURIs.count == 0) {
+            return;
+        }
+        
+        // 按密钥URI的索引改指向其他内容中最近保存的条目
+        for (NSString *keyURI in removedKeyURIs) {
+            if (![self.latestByKeyURI[keyURI].contentID isEqualToString:contentID]) {
+                continue;
+            }
+            M3U8StoredKey *latest = nil;
+            for (M3U8StoredKey *entry in self.entries.allValues) {
+                if ([entry.keyURI isEqualToString:keyURI] && (!latest || entry.storedAt > latest.storedAt)) {
+                    latest = entry;
+                }
+            }
+            self.latestByKeyURI[keyURI] = latest;
+        }
+        NSLog(@"[M3U8KeyStore] 已删除内容的密钥: %@ (%lu个)", contentID, (unsigned long)removedKeyURIs.count);
+        [self markDirty];
+    });
+}
+
+- (void)removeAllKeys {
+    dispatch_async(self.queue, ^{
+        [self loadIfNeeded];
+        [self.entries removeAllObjects];
+        [self.latestByKeyURI removeAllObjects];
+        NSLog(@"[M3U8KeyStore] 已删除所有密钥");
+        [self markDirty];
+    });
+}
+
+- (void)flush {
+    dispatch_sync(self.queue, ^{
+        [self writeIfDirty];
+    });
+}
+
+- (NSDictionary *)statistics {
+    __block NSUInteger entryCount = 0;
+    __block NSUInteger contentCount = 0;
+    __block BOOL dirty = NO;
+    dispatch_sync(self.queue, ^{
+        [self loadIfNeeded];
+        entryCount = self.entries.count;
+        contentCount = [[NSSet setWithArray:[self.entries.allValues valueForKey:@"contentID"]] count];
+        dirty = self.dirty;
+    });
+    return @{
+        @"path": self.path,
+        @"entries": @(entryCount),
+        @"contents": @(contentCount),
+        @"pendingWrite": @(dirty)
+    };
+}
+
+#pragma mark - Private Methods
+
+- (NSString *)entryKeyForContentID:(NSString *)contentID keyURI:(NSString *)keyURI {
+    return [NSString stringWithFormat:@"%@|%@", contentID, keyURI];
+}
+
+- (void)recordLookup:(BOOL)hit {
+    if (hit) {
+        [self.hitCounter increment];
+    } else {
+        [self.missCounter increment];
+    }
+}
+
+/**
+ * 标记有未落盘的修改，延迟flushDelay后合并写入（须在queue上调用）
+ */
+- (void)markDirty {
+    self.dirty = YES;
+    if (self.flushScheduled) {
+        return;
+    }
+    self.flushScheduled = YES;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.flushDelay * NSEC_PER_SEC)), self.queue, ^{
+        self.flushScheduled = NO;
+        [self writeIfDirty];
+    });
+}
+
+#pragma mark - Crypto
+
+/**
+ * 获取主密钥，首次使用时生成并保存到钥匙串（仅本设备、首次解锁后可用）
+ * 只有钥匙串中确实没有主密钥时才生成新密钥；设备锁定（首次解锁前后台唤醒）等其他错误返回nil，
+ * 不缓存结果，稍后再次访问时重试，期间不读取也不覆盖密钥文件
+ */
+- (NSData *)masterKey {
+    if (_masterKey) {
+        return _masterKey;
+    }
+    
+    NSDictionary *query = @{
+        (__bridge id)kSecClass: (__bridge id)kSecClassGenericPassword,
+        (__bridge id)kSecAttrService: kKeyStoreKeychainService,
+        (__bridge id)kSecAttrAccount: self.path.lastPathComponent,
+        (__bridge id)kSecReturnData: @YES,
+        (__bridge id)kSecMatchLimit: (__bridge id)kSecMatchLimitOne
+    };
+    CFTypeRef result = NULL;
+    OSStatus status = SecItemCopyMatching((__bridge CFDictionaryRef)query, &result);
+    if (status == errSecSuccess && result) {
+        NSData *stored = (__bridge_transfer NSData *)result;
+        if (stored.length == kKeyStoreMasterKeyLength) {
+            _masterKey = stored;
+            return _masterKey;
+        }
+        // 长度不对的主密钥无法解密任何文件，按不存在处理
+        NSLog(@"[M3U8KeyStore] 钥匙串中的主密钥无效，重新生成");
+    } else if (status != errSecItemNotFound) {
+        NSLog(@"[M3U8KeyStore] 读取主密钥失败(%d)，稍后重试", (int)status);
+        return nil;
+    }
+    
+    NSMutableData *generated = [NSMutableData dataWithLength:kKeyStoreMasterKeyLength];
+    if (SecRandomCopyBytes(kSecRandomDefault, generated.length, generated.mutableBytes) != errSecSuccess) {
+        NSLog(@"[M3U8KeyStore] 生成主密钥失败");
+        return nil;
+    }
+    
+    NSDictionary *attributes = @{
+        (__bridge id)kSecClass: (__bridge id)kSecClassGenericPassword,
+        (__bridge id)kSecAttrService: kKeyStoreKeychainService,
+        (__bridge id)kSecAttrAccount: self.path.lastPathComponent,
+        (__bridge id)kSecAttrAccessible: (__bridge id)kSecAttrAccessibleAfterFirstUnlockThisDeviceOnly,
+        (__bridge id)kSecValueData: generated
+    };
+    SecItemDelete((__bridge CFDictionaryRef)@{
+        (__bridge id)kSecClass: (__bridge id)kSecClassGenericPassword,
+        (__bridge id)kSecAttrService: kKeyStoreKeychainService,
+        (__bridge id)kSecAttrAccount: self.path.lastPathComponent
+    });
+    status = SecItemAdd((__bridge CFDictionaryRef)attributes, NULL);
+    if (status != errSecSuccess) {
+        // 不使用无法保存的临时密钥，否则用它写入的文件下次启动无法解密
+        NSLog(@"[M3U8KeyStore] 主密钥写入钥匙串失败(%d)，稍后重试", (int)status);
+        return nil;
+    }
+    _masterKey = [generated copy];
+    return _masterKey;
+}
+
+/**
+ * AES-256-CTR加解密（两者相同）
+ */
+- (NSData *)cryptData:(NSData *)data iv:(NSData *)iv {
+    NSData *masterKey = self.masterKey;
+    if (!masterKey) {
+        return nil;
+    }
+    
+    CCCryptorRef cryptor = NULL;
+    CCCryptorStatus status = CCCryptorCreateWithMode(kCCEncrypt, kCCModeCTR, kCCAlgorithmAES, ccNoPadding,
+                                                     iv.bytes, masterKey.bytes, kKeyStoreCipherKeyLength,
+                                                     NULL, 0, 0, kCCModeOptionCTR_BE, &cryptor);
+    if (status != kCCSuccess) {
+        return nil;
+    }
+    
+    NSMutableData *output = [NSMutableData dataWithLength:data.length];
+    size_t moved = 0;
+    status = CCCryptorUpdate(cryptor, data.bytes, data.length, output.mutableBytes, output.length, &moved);
+    CCCryptorRelease(cryptor);
+    if (status != kCCSuccess || moved != data.length) {
+        return nil;
+    }
+    return output;
+}
+
+- (M3U8StoredKey *)encryptKeyData:(NSData *)keyData {
+    NSMutableData *iv = [NSMutableData dataWithLength:kKeyStoreIVLength];
+    if (SecRandomCopyBytes(kSecRandomDefault, iv.length, iv.mutableBytes) != errSecSuccess) {
+        return nil;
+    }
+    NSData *ciphertext = [self cryptData:keyData iv:iv];
+    if (!ciphertext) {
+        NSLog(@"[M3U8KeyStore] 密钥加密失败");
+        return nil;
+    }
+    M3U8StoredKey *entry = [[M3U8StoredKey alloc] init];
+    entry.iv = iv;
+    entry.ciphertext = ciphertext;
+    return entry;
+}
+
+- (NSData *)decryptEntry:(M3U8StoredKey *)entry {
+    return [self cryptData:entry.ciphertext iv:entry.iv];
+}
+
+- (NSData *)macForData:(NSData *)data {
+    NSData *masterKey = self.masterKey;
+    NSMutableData *mac = [NSMutableData dataWithLength:CC_SHA256_DIGEST_LENGTH];
+    CCHmac(kCCHmacAlgSHA256, (const uint8_t *)masterKey.bytes + kKeyStoreCipherKeyLength,
+           kKeyStoreMasterKeyLength - kKeyStoreCipherKeyLength, data.bytes, data.length, mac.mutableBytes);
+    return mac;
+}
+
+#pragma mark - File Format
+
+static void M3U8KeyStoreAppendUInt16(NSMutableData *data, uint16_t value) {
+    uint16_t le = CFSwapInt16HostToLittle(value);
+    [data appendBytes:&le length:sizeof(le)];
+}
+
+static void M3U8KeyStoreAppendUInt32(NSMutableData *data, uint32_t value) {
+    uint32_t le = CFSwapInt32HostToLittle(value);
+    [data appendBytes:&le length:sizeof(le)];
+}
+
+static void M3U8KeyStoreAppendInt64(NSMutableData *data, int64_t value) {
+    uint64_t le = CFSwapInt64HostToLittle((uint64_t)value);
+    [data appendBytes:&le length:sizeof(le)];
+}
+
+static void M3U8KeyStoreAppendField(NSMutableData *data, NSData *field) {
+    M3U8KeyStoreAppendUInt16(data, (uint16_t)field.length);
+    [data appendData:field];
+}
+
+/**
+ * 顺序读取文件内容，越界时返回NO
+ */
+typedef struct {
+    const uint8_t *bytes;
+    NSUInteger length;
+    NSUInteger offset;
+} M3U8KeyStoreReader;
+
+static BOOL M3U8KeyStoreReadBytes(M3U8KeyStoreReader *reader, void *out, NSUInteger length) {
+    if (reader->length - reader->offset < length) {
+        return NO;
+    }
+    memcpy(out, reader->bytes + reader->offset, length);
+    reader->offset += length;
+    return YES;
+}
+
+static BOOL M3U8KeyStoreReadUInt16(M3U8KeyStoreReader *reader, uint16_t *value) {
+    uint16_t le = 0;
+    if (!M3U8KeyStoreReadBytes(reader, &le, sizeof(le))) {
+        return NO;
+    }
+    *value = CFSwapInt16LittleToHost(le);
+    return YES;
+}
+
+static BOOL M3U8KeyStoreReadUInt32(M3U8KeyStoreReader *reader, uint32_t *value) {
+    uint32_t le = 0;
+    if (!M3U8KeyStoreReadBytes(reader, &le, sizeof(le))) {
+        return NO;
+    }
+    *value = CFSwapInt32LittleToHost(le);
+    return YES;
+}
+
+static BOOL M3U8KeyStoreReadInt64(M3U8KeyStoreReader *reader, int64_t *value) {
+    uint64_t le = 0;
+    if (!M3U8KeyStoreReadBytes(reader, &le, sizeof(le))) {
+        return NO;
+    }
+    *value = (int64_t)CFSwapInt64LittleToHost(le);
+    return YES;
+}
+
+static NSData *M3U8KeyStoreReadField(M3U8KeyStoreReader *reader) {
+    uint16_t length = 0;
+    if (!M3U8KeyStoreReadUInt16(reader, &length) || reader->length - reader->offset < length) {
+        return nil;
+    }
+    NSData *field = [NSData dataWithBytes:reader->bytes + reader->offset length:length];
+    reader->offset += length;
+    return field;
+}
+
+- (NSData *)serializedEntries {
+    NSMutableData *data = [NSMutableData data];
+    [data appendBytes:kKeyStoreMagic length:sizeof(kKeyStoreMagic)];
+    M3U8KeyStoreAppendUInt32(data, kKeyStoreVersion);
+    M3U8KeyStoreAppendUInt32(data, (uint32_t)self.entries.count);
+    for (M3U8StoredKey *entry in self.entries.allValues) {
+        M3U8KeyStoreAppendField(data, [entry.contentID dataUsingEncoding:NSUTF8StringEncoding]);
+        M3U8KeyStoreAppendField(data, [entry.keyURI dataUsingEncoding:NSUTF8StringEncoding]);
+        M3U8KeyStoreAppendInt64(data, entry.storedAt);
+        [data appendData:entry.iv];
+        M3U8KeyStoreAppendField(data, entry.ciphertext);
+    }
+    [data appendData:[self macForData:data]];
+    return data;
+}
+
+/**
+ * 首次访问时读取文件（须在queue上调用）
+ * 主密钥暂不可用时不标记为已加载，下次访问时重试；文件损坏或校验失败时视为空存储，下次落盘时覆盖
+ */
+- (void)loadIfNeeded {
+    if (self.loaded) {
+        return;
+    }
+    
+    NSData *data = [NSData dataWithContentsOfFile:self.path];
+    if (data.length == 0) {
+        self.loaded = YES;
+        return;
+    }
+    if (!self.masterKey) {
+        return;
+    }
+    self.loaded = YES;
+    if (data.length < sizeof(kKeyStoreMagic) + 8 + CC_SHA256_DIGEST_LENGTH) {
+        NSLog(@"[M3U8KeyStore] 密钥文件无效，忽略: %@", self.path);
+        return;
+    }
+    
+    // 先校验整个文件，再解析条目
+    NSUInteger bodyLength = data.length - CC_SHA256_DIGEST_LENGTH;
+    NSData *body = [data subdataWithRange:NSMakeRange(0, bodyLength)];
+    NSData *expectedMac = [self macForData:body];
+    const uint8_t *actualMac = (const uint8_t *)data.bytes + bodyLength;
+    uint8_t diff = 0;
+    for (NSUInteger i = 0; i < CC_SHA256_DIGEST_LENGTH; i++) {
+        diff |= ((const uint8_t *)expectedMac.bytes)[i] ^ actualMac[i];
+    }
+    if (diff != 0) {
+        NSLog(@"[M3U8KeyStore] 密钥文件校验失败，忽略: %@", self.path);
+        return;
+    }
+    
+    M3U8KeyStoreReader reader = {body.bytes, body.length, 0};
+    uint8_t magic[4] = {0};
+    uint32_t version = 0;
+    uint32_t count = 0;
+    if (!M3U8KeyStoreReadBytes(&reader, magic, sizeof(magic)) ||
+        memcmp(magic, kKeyStoreMagic, sizeof(magic)) != 0 ||
+        !M3U8KeyStoreReadUInt32(&reader, &version) || version != kKeyStoreVersion ||
+        !M3U8KeyStoreReadUInt32(&reader, &count)) {
+        NSLog(@"[M3U8KeyStore] 不支持的密钥文件格式，忽略: %@", self.path);
+        return;
+    }
+    
+    NSMutableDictionary<NSString *, M3U8StoredKey *> *entries = [NSMutableDictionary dictionaryWithCapacity:count];
+    NSMutableDictionary<NSString *, M3U8StoredKey *> *latestByKeyURI = [NSMutableDictionary dictionary];
+    for (uint32_t i = 0; i < count; i++) {
+        NSData *contentID = M3U8KeyStoreReadField(&reader);
+        NSData *keyURI = M3U8KeyStoreReadField(&reader);
+        int64_t storedAt = 0;
+        NSMutableData *iv = [NSMutableData dataWithLength:kKeyStoreIVLength];
+        if (!contentID || !keyURI || !M3U8KeyStoreReadInt64(&reader, &storedAt) ||
+            !M3U8KeyStoreReadBytes(&reader, iv.mutableBytes, iv.length)) {
+            NSLog(@"[M3U8KeyStore] 密钥文件条目截断，忽略: %@", self.path);
+            return;
+        }
+        NSData *ciphertext = M3U8KeyStoreReadField(&reader);
+        if (!ciphertext) {
+            NSLog(@"[M3U8KeyStore] 密钥文件条目截断，忽略: %@", self.path);
+            return;
+        }
+        
+        M3U8StoredKey *entry = [[M3U8StoredKey alloc] init];
+        entry.contentID = [[NSString alloc] initWithData:contentID encoding:NSUTF8StringEncoding] ?: @"";
+        entry.keyURI = [[NSString alloc] initWithData:keyURI encoding:NSUTF8StringEncoding] ?: @"";
+        entry.storedAt = storedAt;
+        entry.iv = iv;
+        entry.ciphertext = ciphertext;
+        entries[[self entryKeyForContentID:entry.contentID keyURI:entry.keyURI]] = entry;
+        M3U8StoredKey *latest = latestByKeyURI[entry.keyURI];
+        if (!latest || entry.storedAt >= latest.storedAt) {
+            latestByKeyURI[entry.keyURI] = entry;
+        }
+    }
+    
+    // 加载推迟期间内存中已有的条目更新，不被文件中的旧值覆盖
+    [entries enumerateKeysAndObjectsUsingBlock:^(NSString *entryKey, M3U8StoredKey *entry, BOOL *stop) {
+        if (!self.entries[entryKey]) {
+            self.entries[entryKey] = entry;
+        }
+    }];
+    [latestByKeyURI enumerateKeysAndObjectsUsingBlock:^(NSString *keyURI, M3U8StoredKey *entry, BOOL *stop) {
+        M3U8StoredKey *latest = self.latestByKeyURI[keyURI];
+        if (!latest || entry.storedAt > latest.storedAt) {
+            self.latestByKeyURI[keyURI] = entry;
+        }
+    }];
+    NSLog(@"[M3U8KeyStore] 已加载%lu个密钥", (unsigned long)entries.count);
+}
+
+/**
+ * 把内存中的条目写入文件（须在queue上调用）
+ * 先写临时文件并fsync，再rename替换，写入中途崩溃不会留下半个文件
+ */
+- (void)writeIfDirty {
+    // 文件尚未成功加载时不落盘，避免用内存中的部分条目覆盖已有文件
+    if (!self.dirty || !self.masterKey) {
+        return;
+    }
+    [self loadIfNeeded];
+    if (!self.loaded) {
+        return;
+    }
+    self.dirty = NO;
+    
+    NSString *directory = [self.path stringByDeletingLastPathComponent];
+    if (![[NSFileManager defaultManager] fileExistsAtPath:directory]) {
+        [[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:nil];
+        // 主密钥只保存在本设备，备份恢复到其他设备的文件无法解密，不参与备份
+        [[NSURL fileURLWithPath:directory] setResourceValue:@YES forKey:NSURLIsExcludedFromBackupKey error:nil];
+    }
+    
+    NSData *data = [self serializedEntries];
+    NSString *tempPath = [self.path stringByAppendingString:@".tmp"];
+    int fd = open(tempPath.fileSystemRepresentation, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        NSLog(@"[M3U8KeyStore] 无法创建密钥文件: %s", strerror(errno));
+        self.dirty = YES;
+        return;
+    }
+    
+    const uint8_t *bytes = data.bytes;
+    NSUInteger written = 0;
+    while (written < data.length) {
+        ssize_t result = write(fd, bytes + written, data.length - written);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        written += (NSUInteger)result;
+    }
+    BOOL succeeded = (written == data.length) && fsync(fd) == 0;
+    close(fd);
+    
+    if (!succeeded || rename(tempPath.fileSystemRepresentation, self.path.fileSystemRepresentation) != 0) {
+        NSLog(@"[M3U8KeyStore] 写入密钥文件失败: %s", strerror(errno));
+        unlink(tempPath.fileSystemRepresentation);
+        self.dirty = YES;
+        return;
+    }
+    
+    [self.flushCounter increment];
+    NSLog(@"[M3U8KeyStore] 密钥文件已写入，%lu个密钥", (unsigned long)self.entries.count);
+}
+
+@end
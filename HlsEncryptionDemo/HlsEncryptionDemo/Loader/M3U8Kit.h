@@ -21,5 +21,21 @@
 #import "M3U8Player.h" //播放器
 #import "M3U8Loader.h" //M3U8加载器
 #import "M3U8NewSystem.h" //M3U8新系统
+#import "M3U8Metrics.h" //运行指标
+#import "M3U8SessionPool.h" //共享HTTP会话池
+#import "M3U8RequestScheduler.h" //请求调度器
+#import "M3U8RetryPolicy.h" //重试与对冲策略
+#import "M3U8TimeoutEstimator.h" //自适应超时
+#import "M3U8BandwidthEstimator.h" //带宽估算
+#import "M3U8HostSelector.h" //CDN主机选择
+#import "M3U8Preconnector.h" //连接预热
+#import "M3U8CircuitBreaker.h" //负缓存与熔断
+#import "M3U8KeyStore.h" //持久化密钥存储
+#import "M3U8TokenManager.h" //token生命周期管理
+#import "M3U8SegmentDecryptor.h" //分片解密
+#import "M3U8ResourceRouter.h" //资源请求路由
+#import "M3U8LocalProxyServer.h" //本地HLS代理
+#import "M3U8ABRController.h" //自适应码率
+#import "M3U8SegmentCache.h" //本地代理分片缓存
 
 #endif /* M3U8Kit_h */
@@ -8,11 +8,36 @@
 
 #import <Foundation/Foundation.h>
 #import "M3U8AuthConfig.h"
+#import "M3U8RequestScheduler.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
 @class M3U8Loader;
 
+/**
+ * 单个加载请求的句柄
+ * 相同URL的请求在进程内合并为一次网络下载，每个请求可以单独取消；
+ * 只有最后一个等待者取消时才会真正取消网络请求
+ */
+@interface M3U8LoadRequest : NSObject
+
+@property (nonatomic, copy, readonly) NSString *url;
+@property (nonatomic, assign, readonly, getter=isCancelled) BOOL cancelled;
+@property (nonatomic, assign, readonly) M3U8RequestPriority priority;
+
+/**
+ * 提升优先级（例如预加载的内容被用户点击播放时提升为交互优先级）
+ * 只能提升，不能降低
+ */
+- (void)promoteToPriority:(M3U8RequestPriority)priority;
+
+/**
+ * 取消本次请求，完成回调会收到NSURLErrorCancelled错误
+ */
+- (void)cancel;
+
+@end
+
 /**
  * M3U8加载器代理协议
  */
@@ -67,6 +92,12 @@ NS_ASSUME_NONNULL_BEGIN
 
 @property (nonatomic, weak) id<M3U8LoaderDelegate> delegate;
 
+/**
+ * 完成回调所在的队列，默认主队列；代理回调始终在主队列
+ * 资源加载代理等不涉及UI的调用方可设为后台队列，避免占用主线程
+ */
+@property (nonatomic, strong, null_resettable) dispatch_queue_t completionQueue;
+
 
 /**
  * 配置授权信息
@@ -89,16 +120,47 @@ NS_ASSUME_NONNULL_BEGIN
              completion:(void(^)(NSString * _Nullable content, NSError * _Nullable error))completion;
 
 /**
- * 取消指定URL的加载请求
+ * 加载M3U8文件原始数据（带完成回调）
+ * 缓存命中时回调的数据直接来自内存映射的缓存文件，不做任何复制
+ * @param url M3U8文件URL
+ * @param completion 完成回调
+ * @return 请求句柄，可用于单独取消；URL无效或缓存命中时返回nil
+ */
+- (M3U8LoadRequest * _Nullable)loadM3U8DataWithURL:(NSString *)url 
+                                        completion:(void(^ _Nullable)(NSData * _Nullable data, NSError * _Nullable error))completion;
+
+/**
+ * 按指定优先级加载M3U8文件原始数据
+ * 网络请求由M3U8RequestScheduler按优先级和主机并发数调度；上面的方法使用交互优先级
+ * @param url M3U8文件URL
+ * @param priority 请求优先级
+ * @param completion 完成回调
+ * @return 请求句柄，可用于单独取消或提升优先级；URL无效或缓存命中时返回nil
+ */
+- (M3U8LoadRequest * _Nullable)loadM3U8DataWithURL:(NSString *)url 
+                                          priority:(M3U8RequestPriority)priority 
+                                        completion:(void(^ _Nullable)(NSData * _Nullable data, NSError * _Nullable error))completion;
+
+/**
+ * 取消本加载器发起的指定URL的加载请求
+ * 其他组件对同一URL的请求不受影响
  * @param url 要取消的URL
  */
 - (void)cancelLoadForURL:(NSString *)url;
 
 /**
- * 取消所有正在进行的加载请求
+ * 取消本加载器发起的所有加载请求
  */
 - (void)cancelAllLoads;
 
+/**
+ * 预热连接
+ * 在确定即将播放之前调用（如列表项出现在屏幕上），提前完成DNS解析和TCP/TLS握手：
+ * URL所在的CDN主机（改写到当前最优主机后），以及最近使用过的密钥服务器
+ * @param url M3U8播放地址
+ */
+- (void)preconnectForURL:(NSString *)url;
+
 /**
  * 清理缓存
  */
@@ -8,16 +8,204 @@
 
 #import "M3U8Loader.h"
 #import "CacheManager.h"
-#import "AFNetworking.h"
+#import "M3U8Metrics.h"
+#import "M3U8SessionPool.h"
+#import "M3U8RetryPolicy.h"
+#import "M3U8TimeoutEstimator.h"
+#import "M3U8HostSelector.h"
+#import "M3U8Preconnector.h"
+#import "M3U8CircuitBreaker.h"
+
+// 内存下载上限，超过时改用下载到临时文件（播放列表通常只有几KB）
+static const int64_t kM3U8InMemoryDownloadLimit = 1024 * 1024;
+
+@class M3U8LoaderFlight;
+
+@interface M3U8LoadRequest ()
+
+@property (nonatomic, copy, readwrite) NSString *url;
+@property (nonatomic, assign, readwrite, getter=isCancelled) BOOL cancelled;
+@property (nonatomic, assign, readwrite) M3U8RequestPriority priority;
+@property (nonatomic, assign) BOOL finished;
+@property (nonatomic, weak) M3U8Loader *loader;
+@property (nonatomic, assign) uintptr_t ownerID;  // 发起方加载器标识，加载器释放后仍可用于匹配
+@property (nonatomic, copy, nullable) void(^completion)(NSData * _Nullable data, NSError * _Nullable error);
+@property (nonatomic, strong, nullable) M3U8LoaderFlight *flight;
+
+@end
 
 @interface M3U8Loader ()
 
 @property (nonatomic, strong) M3U8AuthConfig *authConfig;
 @property (nonatomic, strong) CacheManager *cacheManager;
-@property (nonatomic, strong) NSMutableDictionary<NSString *, AFHTTPSessionManager *> *sessionManagers;
-@property (nonatomic, strong) NSMutableDictionary<NSString *, NSURLSessionDownloadTask *> *downloadTasks;
-@property (nonatomic, strong) NSMutableDictionary<NSString *, void(^)(NSString * _Nullable, NSError * _Nullable)> *completionBlocks;
-@property (nonatomic, strong) dispatch_queue_t loaderQueue;
+
+- (void)notifySuccess:(NSData *)data forURL:(NSString *)url completion:(void(^)(NSData * _Nullable, NSError * _Nullable))completion;
+- (void)notifyFailure:(NSError *)error forURL:(NSString *)url completion:(void(^)(NSData * _Nullable, NSError * _Nullable))completion;
+
+@end
+
+// MARK: - M3U8LoaderFlight
+
+/**
+ * 进行中的网络下载
+ * 相同URL+授权参数的请求在进程内共享同一个Flight，所有访问都在flightQueue上进行
+ */
+@interface M3U8LoaderFlight : NSObject
+@property (nonatomic, copy) NSString *key;
+@property (nonatomic, copy) NSString *url;
+@property (nonatomic, copy) NSString *token;
+@property (nonatomic, strong) NSMutableArray<M3U8LoadRequest *> *waiters;
+@property (nonatomic, strong) NSURLRequest *request;
+@property (nonatomic, assign) M3U8RequestPriority priority;
+@property (nonatomic, strong, nullable) M3U8SchedulerTicket *ticket;
+@property (nonatomic, strong, nullable) M3U8SchedulerTicket *hedgeTicket;  // 对冲请求单独占用一个主机并发名额
+@property (nonatomic, strong) NSMutableArray<NSURLSessionTask *> *tasks;  // 进行中的任务（对冲时为2个）
+@property (nonatomic, weak, nullable) NSURLSessionTask *hedgeTask;
+@property (nonatomic, assign) NSUInteger attempt;
+@property (nonatomic, assign) CFAbsoluteTime attemptStartTime;
+@property (nonatomic, copy, nullable) NSString *tempDir;  // 仅大文件落盘时使用
+@end
+
+@implementation M3U8LoaderFlight
+@end
+
+static void *const kM3U8LoaderFlightQueueKey = (void *)&kM3U8LoaderFlightQueueKey;
+
+static dispatch_queue_t M3U8LoaderFlightQueue(void) {
+    static dispatch_queue_t queue;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        queue = dispatch_queue_create("com.m3u8loader.flights", DISPATCH_QUEUE_SERIAL);
+        dispatch_queue_set_specific(queue, kM3U8LoaderFlightQueueKey, kM3U8LoaderFlightQueueKey, NULL);
+    });
+    return queue;
+}
+
+/**
+ * 在flightQueue上同步执行（已在队列上时直接执行，避免加载器在队列上释放时死锁）
+ */
+static void M3U8LoaderFlightSync(dispatch_block_t block) {
+    if (dispatch_get_specific(kM3U8LoaderFlightQueueKey)) {
+        block();
+    } else {
+        dispatch_sync(M3U8LoaderFlightQueue(), block);
+    }
+}
+
+/**
+ * 进程内所有进行中的下载，键为 URL|授权参数，只能在flightQueue上访问
+ */
+static NSMutableDictionary<NSString *, M3U8LoaderFlight *> *M3U8LoaderFlights(void) {
+    static NSMutableDictionary *flights;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        flights = [NSMutableDictionary dictionary];
+    });
+    return flights;
+}
+
+/**
+ * 释放对冲请求的并发名额，排队中的对冲请求不再执行（须在flightQueue上调用）
+ */
+static void M3U8LoaderFlightReleaseHedgeTicket(M3U8LoaderFlight *flight) {
+    [flight.hedgeTicket cancel];
+    flight.hedgeTicket = nil;
+}
+
+/**
+ * 从Flight上摘除等待者（须在flightQueue上调用）
+ * 最后一个等待者离开时取消网络请求并清理临时文件
+ */
+static void M3U8LoaderFlightDetachWaiter(M3U8LoaderFlight *flight, M3U8LoadRequest *waiter) {
+    [flight.waiters removeObject:waiter];
+    waiter.flight = nil;
+    
+    if (flight.waiters.count > 0) {
+        return;
+    }
+    
+    NSLog(@"[M3U8Loader] 已无等待者，取消网络下载: %@", flight.url);
+    if (M3U8LoaderFlights()[flight.key] == flight) {
+        [M3U8LoaderFlights() removeObjectForKey:flight.key];
+    }
+    [flight.ticket cancel];
+    M3U8LoaderFlightReleaseHedgeTicket(flight);
+    for (NSURLSessionTask *task in flight.tasks) {
+        [task cancel];
+    }
+    [flight.tasks removeAllObjects];
+    if (flight.tempDir) {
+        [[NSFileManager defaultManager] removeItemAtPath:flight.tempDir error:nil];
+    }
+}
+
+/**
+ * 按等待者中最高的优先级提升Flight（须在flightQueue上调用）
+ * 排队中的请求重新排序，已开始的请求同步更新task.priority
+ */
+static void M3U8LoaderFlightPromote(M3U8LoaderFlight *flight, M3U8RequestPriority priority) {
+    if (priority >= flight.priority) {
+        return;
+    }
+    
+    NSLog(@"[M3U8Loader] 提升请求优先级: %@ -> %@", flight.url, [M3U8RequestScheduler nameForPriority:priority]);
+    flight.priority = priority;
+    [flight.ticket promoteToPriority:priority];
+    [flight.hedgeTicket promoteToPriority:priority];
+    for (NSURLSessionTask *task in flight.tasks) {
+        task.priority = [M3U8RequestScheduler taskPriorityForPriority:priority];
+    }
+}
+
+static NSError *M3U8LoaderCancelledError(void) {
+    return [NSError errorWithDomain:NSURLErrorDomain 
+                               code:NSURLErrorCancelled 
+                           userInfo:@{NSLocalizedDescriptionKey: @"请求已被取消"}];
+}
+
+// MARK: - M3U8LoadRequest
+
+@implementation M3U8LoadRequest
+
+- (void)promoteToPriority:(M3U8RequestPriority)priority {
+    M3U8LoaderFlightSync(^{
+        if (priority >= self.priority || self.finished || self.cancelled) {
+            return;
+        }
+        self.priority = priority;
+        if (self.flight) {
+            M3U8LoaderFlightPromote(self.flight, priority);
+        }
+    });
+}
+
+- (void)cancel {
+    __block BOOL detached = NO;
+    M3U8LoaderFlightSync(^{
+        if (self.cancelled || self.finished) {
+            return;
+        }
+        self.cancelled = YES;
+        if (self.flight) {
+            M3U8LoaderFlightDetachWaiter(self.flight, self);
+            detached = YES;
+        }
+    });
+    
+    if (!detached) {
+        return;
+    }
+    
+    NSLog(@"[M3U8Loader] 请求已取消: %@", self.url);
+    void(^completion)(NSData *, NSError *) = self.completion;
+    self.completion = nil;
+    if (completion) {
+        NSError *cancelError = M3U8LoaderCancelledError();
+        dispatch_async(self.loader.completionQueue ?: dispatch_get_main_queue(), ^{
+            completion(nil, cancelError);
+        });
+    }
+}
 
 @end
 
@@ -38,14 +226,15 @@
     self = [super init];
     if (self) {
         _cacheManager = [CacheManager sharedManager];
-        _sessionManagers = [NSMutableDictionary dictionary];
-        _downloadTasks = [NSMutableDictionary dictionary];
-        _completionBlocks = [NSMutableDictionary dictionary];
-        _loaderQueue = dispatch_queue_create("com.m3u8loader.queue", DISPATCH_QUEUE_CONCURRENT);
+        _completionQueue = dispatch_get_main_queue();
     }
     return self;
 }
 
+- (void)setCompletionQueue:(dispatch_queue_t)completionQueue {
+    _completionQueue = completionQueue ?: dispatch_get_main_queue();
+}
+
 - (void)dealloc {
     [self cancelAllLoads];
 }
@@ -63,13 +252,44 @@
 
 - (void)loadM3U8WithURL:(NSString *)url 
              completion:(void(^)(NSString * _Nullable content, NSError * _Nullable error))completion {
+    if (!completion) {
+        [self loadM3U8DataWithURL:url completion:nil];
+        return;
+    }
+    
+    [self loadM3U8DataWithURL:url completion:^(NSData * _Nullable data, NSError * _Nullable error) {
+        if (!data) {
+            completion(nil, error);
+            return;
+        }
+        
+        NSString *content = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+        if (content) {
+            completion(content, nil);
+        } else {
+            NSError *parseError = [NSError errorWithDomain:@"M3U8Loader" 
+                                                    code:1004 
+                                                userInfo:@{NSLocalizedDescriptionKey: @"M3U8文件编码解析失败"}];
+            completion(nil, parseError);
+        }
+    }];
+}
+
+- (M3U8LoadRequest *)loadM3U8DataWithURL:(NSString *)url 
+                              completion:(void(^)(NSData * _Nullable data, NSError * _Nullable error))completion {
+    return [self loadM3U8DataWithURL:url priority:M3U8RequestPriorityInteractive completion:completion];
+}
+
+- (M3U8LoadRequest *)loadM3U8DataWithURL:(NSString *)url 
+                                priority:(M3U8RequestPriority)priority 
+                              completion:(void(^)(NSData * _Nullable data, NSError * _Nullable error))completion {
     
     if (!url || url.length == 0) {
         NSError *error = [NSError errorWithDomain:@"M3U8Loader" 
                                            code:1001 
                                        userInfo:@{NSLocalizedDescriptionKey: @"URL不能为空"}];
         [self notifyFailure:error forURL:url completion:completion];
-        return;
+        return nil;
     }
     
     NSLog(@"[M3U8Loader] 开始加载M3U8文件: %@", url);
@@ -89,9 +309,8 @@
             });
         }
         
-        NSString *content = [[NSString alloc] initWithData:cachedData encoding:NSUTF8StringEncoding];
-        [self notifySuccess:content forURL:url completion:completion];
-        return;
+        [self notifySuccess:cachedData forURL:url completion:completion];
+        return nil;
     }
     
     // 缓存未命中，从网络下载
@@ -104,29 +323,50 @@
         });
     }
     
-    // 检查是否已经有相同URL的请求在进行
-    if (self.downloadTasks[url] || self.sessionManagers[url]) {
-        NSLog(@"[M3U8Loader] URL已在下载中，忽略重复请求: %@", url);
-        if (completion) {
-            // 如果已有请求在进行，将回调添加到待处理列表
-            // 这里简化处理：直接返回错误，让上层重试
-            NSError *error = [NSError errorWithDomain:@"M3U8Loader" 
-                                               code:1004 
-                                           userInfo:@{NSLocalizedDescriptionKey: @"相同URL的请求正在进行中"}];
-            dispatch_async(dispatch_get_main_queue(), ^{
-                completion(nil, error);
-            });
-        }
-        return;
+    NSURL *requestURL = [NSURL URLWithString:url];
+    if (!requestURL) {
+        NSError *error = [NSError errorWithDomain:@"M3U8Loader" 
+                                           code:1002 
+                                       userInfo:@{NSLocalizedDescriptionKey: @"无效的URL"}];
+        [self notifyFailure:error forURL:url completion:completion];
+        return nil;
     }
     
-    // 保存完成回调
-    if (completion) {
-        self.completionBlocks[url] = completion;
-    }
+    M3U8LoadRequest *request = [[M3U8LoadRequest alloc] init];
+    request.url = url;
+    request.loader = self;
+    request.ownerID = (uintptr_t)self;
+    request.priority = priority;
+    request.completion = completion;
+    
+    // 相同URL+授权参数的请求合并为一次网络下载
+    NSString *flightKey = [NSString stringWithFormat:@"%@|%@", url, token];
+    M3U8LoaderFlightSync(^{
+        M3U8LoaderFlight *flight = M3U8LoaderFlights()[flightKey];
+        if (flight) {
+            NSLog(@"[M3U8Loader] 合并到进行中的请求: %@ (等待者: %lu)", url, (unsigned long)flight.waiters.count + 1);
+            [[[M3U8Metrics sharedMetrics] counterNamed:@"m3u8_loader_coalesced_requests_total" labels:nil] increment];
+            [flight.waiters addObject:request];
+            request.flight = flight;
+            // 用户正在等待的请求合并到排队中的预加载时，提升整个Flight的优先级
+            M3U8LoaderFlightPromote(flight, priority);
+            return;
+        }
+        
+        flight = [[M3U8LoaderFlight alloc] init];
+        flight.key = flightKey;
+        flight.url = url;
+        flight.token = token;
+        flight.priority = priority;
+        flight.waiters = [NSMutableArray arrayWithObject:request];
+        request.flight = flight;
+        M3U8LoaderFlights()[flightKey] = flight;
+        
+        // 开始网络下载
+        [M3U8Loader performNetworkDownloadForFlight:flight requestURL:requestURL];
+    });
     
-    // 开始网络下载
-    [self performNetworkDownload:url token:token];
+    return request;
 }
 
 - (void)cancelLoadForURL:(NSString *)url {
@@ -134,50 +374,42 @@
     
     NSLog(@"[M3U8Loader] 取消加载: %@", url);
     
-    // 取消下载任务
-    NSURLSessionDownloadTask *task = self.downloadTasks[url];
-    if (task) {
-        [task cancel];
-        [self.downloadTasks removeObjectForKey:url];
-    }
-    
-    // 清理Session管理器
-    AFHTTPSessionManager *sessionManager = self.sessionManagers[url];
-    if (sessionManager) {
-        [sessionManager.session invalidateAndCancel];
-        [self.sessionManagers removeObjectForKey:url];
+    // 只取消本加载器发起的请求，其他组件对同一URL的等待不受影响
+    for (M3U8LoadRequest *request in [self pendingRequestsForURL:url]) {
+        [request cancel];
     }
-    
-    // 通知取消并清理完成回调
-    void(^completion)(NSString *, NSError *) = self.completionBlocks[url];
-    if (completion) {
-        NSError *cancelError = [NSError errorWithDomain:NSURLErrorDomain 
-                                                 code:NSURLErrorCancelled 
-                                             userInfo:@{NSLocalizedDescriptionKey: @"请求已被取消"}];
-        dispatch_async(dispatch_get_main_queue(), ^{
-            completion(nil, cancelError);
-        });
-    }
-    [self.completionBlocks removeObjectForKey:url];
 }
 
 - (void)cancelAllLoads {
     NSLog(@"[M3U8Loader] 取消所有加载请求");
     
-    // 取消所有下载任务
-    for (NSURLSessionDownloadTask *task in self.downloadTasks.allValues) {
-        [task cancel];
+    // 静默摘除本加载器的所有等待者（不触发完成回调）
+    uintptr_t ownerID = (uintptr_t)self;
+    M3U8LoaderFlightSync(^{
+        for (M3U8LoaderFlight *flight in M3U8LoaderFlights().allValues) {
+            for (M3U8LoadRequest *request in [flight.waiters copy]) {
+                if (request.ownerID != ownerID) continue;
+                request.cancelled = YES;
+                request.completion = nil;
+                M3U8LoaderFlightDetachWaiter(flight, request);
+            }
+        }
+    });
+}
+
+- (void)preconnectForURL:(NSString *)url {
+    NSURL *requestURL = [NSURL URLWithString:url];
+    if (!requestURL.host) {
+        NSLog(@"[M3U8Loader] 无效的预热URL: %@", url);
+        return;
     }
-    [self.downloadTasks removeAllObjects];
     
-    // 清理所有Session管理器
-    for (AFHTTPSessionManager *sessionManager in self.sessionManagers.allValues) {
-        [sessionManager.session invalidateAndCancel];
+    M3U8Preconnector *preconnector = [M3U8Preconnector sharedPreconnector];
+    [preconnector preconnectToURL:[[M3U8HostSelector sharedSelector] preferredURLForURL:requestURL] hostClass:M3U8HostClassCDN];
+    NSURL *keyServerURL = [preconnector knownKeyServerURL];
+    if (keyServerURL) {
+        [preconnector preconnectToURL:keyServerURL hostClass:M3U8HostClassKeyServer];
     }
-    [self.sessionManagers removeAllObjects];
-    
-    // 清理所有完成回调
-    [self.completionBlocks removeAllObjects];
 }
 
 - (void)clearCache {
@@ -192,7 +424,8 @@
         @"totalSize": @(stats.totalSize),
         @"hitCount": @(stats.hitCount),
         @"missCount": @(stats.missCount),
-        @"hitRate": @(stats.hitRate)
+        @"hitRate": @(stats.hitRate),
+        @"metrics": [[M3U8Metrics sharedMetrics] snapshot]
     };
 }
 
@@ -202,28 +435,46 @@
 
 #pragma mark - Private Methods
 
-- (void)performNetworkDownload:(NSString *)url token:(NSString *)token {
-    // 创建临时文件路径
-    NSString *tempDir = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
-    [[NSFileManager defaultManager] createDirectoryAtPath:tempDir withIntermediateDirectories:YES attributes:nil error:nil];
-    NSString *tempFilePath = [tempDir stringByAppendingPathComponent:@"m3u8_file.m3u8"];
-    
-    // 配置Session
-    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration defaultSessionConfiguration];
-    configuration.timeoutIntervalForRequest = 30.0;
-    configuration.timeoutIntervalForResource = 60.0;
-    
-    AFHTTPSessionManager *sessionManager = [[AFHTTPSessionManager alloc] initWithSessionConfiguration:configuration];
-    self.sessionManagers[url] = sessionManager;
-    
-    // 创建请求
-    NSURL *requestURL = [NSURL URLWithString:url];
-    if (!requestURL) {
-        NSError *error = [NSError errorWithDomain:@"M3U8Loader" 
-                                           code:1002 
-                                       userInfo:@{NSLocalizedDescriptionKey: @"无效的URL"}];
-        [self notifyFailure:error forURL:url completion:self.completionBlocks[url]];
-        [self cleanupForURL:url tempDir:tempDir];
+- (NSArray<M3U8LoadRequest *> *)pendingRequestsForURL:(NSString *)url {
+    NSMutableArray<M3U8LoadRequest *> *requests = [NSMutableArray array];
+    uintptr_t ownerID = (uintptr_t)self;
+    M3U8LoaderFlightSync(^{
+        for (M3U8LoaderFlight *flight in M3U8LoaderFlights().allValues) {
+            if (![flight.url isEqualToString:url]) continue;
+            for (M3U8LoadRequest *request in flight.waiters) {
+                if (request.ownerID == ownerID) {
+                    [requests addObject:request];
+                }
+            }
+        }
+    });
+    return requests;
+}
+
+/**
+ * 为Flight发起网络下载（须在flightQueue上调用）
+ * 请求先进入调度器按优先级和主机并发数排队；获得名额后用数据任务直接下载到内存，
+ * 响应超过内存上限时改为下载到临时文件
+ * 可重试的错误按退避策略重试；耗时超过观测到的p95时发送对冲请求
+ * 下载结果写入缓存后分发给所有仍在等待的请求
+ */
++ (void)performNetworkDownloadForFlight:(M3U8LoaderFlight *)flight requestURL:(NSURL *)requestURL {
+    // 改写到等价CDN主机中当前最优的一个
+    requestURL = [[M3U8HostSelector sharedSelector] preferredURLForURL:requestURL];
+    
+    // 最近失败过的URL或熔断中的主机直接失败；主机熔断时先尝试组内其他主机
+    M3U8CircuitBreaker *breaker = [M3U8CircuitBreaker sharedBreaker];
+    NSError *admissionError = [breaker admissionErrorForURL:requestURL];
+    if (admissionError.code == M3U8CircuitBreakerErrorCircuitOpen) {
+        NSURL *failoverURL = [[M3U8HostSelector sharedSelector] failoverURLForURL:requestURL];
+        if (failoverURL && ![breaker admissionErrorForURL:failoverURL]) {
+            requestURL = failoverURL;
+            admissionError = nil;
+        }
+    }
+    if (admissionError) {
+        NSLog(@"[M3U8Loader] 请求被拒绝: %@ - %@", flight.url, admissionError.localizedDescription);
+        [self handleDownloadCompletion:nil data:nil error:admissionError flight:flight];
         return;
     }
     
@@ -232,101 +483,395 @@
     [request setValue:@"*/*" forHTTPHeaderField:@"Accept"];
     [request setValue:@"gzip, deflate" forHTTPHeaderField:@"Accept-Encoding"];
     [request setCachePolicy:NSURLRequestReloadIgnoringCacheData];
+    flight.request = request;
+    flight.tasks = [NSMutableArray array];
     
-    NSLog(@"[M3U8Loader] 创建下载请求 - URL: %@", requestURL);
+    NSLog(@"[M3U8Loader] 创建下载请求 - URL: %@, 优先级: %@", requestURL, [M3U8RequestScheduler nameForPriority:flight.priority]);
     
-    __weak typeof(self) weakSelf = self;
-    NSURLSessionDownloadTask *task = [sessionManager downloadTaskWithRequest:request 
-                                                                     progress:^(NSProgress * _Nonnull downloadProgress) {
-        // 通知下载进度
-        float progress = downloadProgress.fractionCompleted;
-        NSLog(@"[M3U8Loader] 下载进度: %.2f%% (%lld/%lld bytes)", 
-              progress * 100, downloadProgress.completedUnitCount, downloadProgress.totalUnitCount);
+    [self scheduleFlight:flight];
+}
+
+/**
+ * 申请主机并发名额（须在flightQueue上调用）
+ */
++ (void)scheduleFlight:(M3U8LoaderFlight *)flight {
+    flight.ticket = [[M3U8RequestScheduler sharedScheduler] scheduleRequestForURL:flight.request.URL
+                                                                         priority:flight.priority
+                                                                            start:^(M3U8SchedulerTicket *ticket) {
+        M3U8LoaderFlightSync(^{
+            if (flight.ticket != ticket || flight.waiters.count == 0) {
+                [ticket finish];
+                return;
+            }
+            [M3U8Loader startDataTaskForFlight:flight hedge:NO];
+        });
+    }];
+}
+
+/**
+ * 小文件直接下载到内存（须在flightQueue上调用）
+ * @param hedge 是否为对冲请求（与原请求并行，先完成的胜出）
+ */
++ (void)startDataTaskForFlight:(M3U8LoaderFlight *)flight hedge:(BOOL)hedge {
+    // 使用CDN共享会话，复用已建立的连接
+    AFHTTPSessionManager *sessionManager = [[M3U8SessionPool sharedPool] sessionManagerForHostClass:M3U8HostClassCDN];
+    
+    // 按该主机观测到的延迟计算期限，卡住的请求几秒内就会被取消并进入重试
+    M3U8TimeoutEstimator *estimator = [M3U8TimeoutEstimator sharedEstimator];
+    M3U8RequestDeadlines deadlines = [estimator deadlinesForURL:flight.request.URL hostClass:M3U8HostClassCDN];
+    NSURLRequest *request = [estimator request:flight.request withDeadlines:deadlines];
+    
+    __block __weak NSURLSessionDataTask *weakTask = nil;
+    NSURLSessionDataTask *task = [sessionManager dataTaskWithRequest:request uploadProgress:nil downloadProgress:^(NSProgress * _Nonnull downloadProgress) {
+        // 响应声明的长度或已接收的字节数超过上限时，改为下载到临时文件
+        if (downloadProgress.totalUnitCount > kM3U8InMemoryDownloadLimit ||
+            downloadProgress.completedUnitCount > kM3U8InMemoryDownloadLimit) {
+            [M3U8Loader switchFlight:flight toFileDownloadFromTask:weakTask];
+            return;
+        }
+        [M3U8Loader notifyProgress:downloadProgress forFlight:flight];
+    } completionHandler:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject, NSError * _Nullable error) {
+        NSData *data = [responseObject isKindOfClass:[NSData class]] ? responseObject : nil;
+        if (!error && !data) {
+            data = [NSData data];
+        }
+        [M3U8Loader completeTask:weakTask flight:flight response:response data:data error:[estimator errorForTask:weakTask error:error]];
+    }];
+    weakTask = task;
+    task.priority = [M3U8RequestScheduler taskPriorityForPriority:flight.priority];
+    
+    // 保存下载任务
+    [flight.tasks addObject:task];
+    if (hedge) {
+        flight.hedgeTask = task;
+    } else {
+        flight.attempt += 1;
+        flight.attemptStartTime = CFAbsoluteTimeGetCurrent();
+    }
+    
+    // 开始下载
+    [task resume];
+    [estimator watchTask:task deadlines:deadlines];
+    NSLog(@"[M3U8Loader] 下载任务已启动%@: %@ (第%lu次尝试)", hedge ? @"（对冲）" : @"", flight.url, (unsigned long)flight.attempt);
+    
+    if (!hedge) {
+        [self scheduleHedgeForFlight:flight primaryTask:task];
+    }
+}
+
+/**
+ * 原请求超过观测到的p95仍未完成时，发送一个对冲请求（须在flightQueue上调用）
+ */
++ (void)scheduleHedgeForFlight:(M3U8LoaderFlight *)flight primaryTask:(NSURLSessionTask *)primaryTask {
+    NSTimeInterval hedgeDelay = [[M3U8RetryPolicy playlistPolicy] hedgeDelay];
+    if (hedgeDelay <= 0) {
+        return;
+    }
+    
+    __weak NSURLSessionTask *weakPrimaryTask = primaryTask;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(hedgeDelay * NSEC_PER_SEC)), M3U8LoaderFlightQueue(), ^{
+        NSURLSessionTask *task = weakPrimaryTask;
+        if (!task || flight.tasks.count != 1 || flight.tasks.firstObject != task || flight.waiters.count == 0) {
+            return;
+        }
+        if (![[M3U8RetryPolicy playlistPolicy] acquireHedgeToken]) {
+            return;
+        }
+        NSLog(@"[M3U8Loader] 请求超过p95(%.0fms)未完成，发送对冲请求: %@", hedgeDelay * 1000, flight.url);
+        [M3U8Loader scheduleHedgeRequestForFlight:flight primaryTask:task];
+    });
+}
+
+/**
+ * 对冲请求同样经过调度器，占用自己的主机并发名额，不超过该主机的并发上限（须在flightQueue上调用）
+ */
++ (void)scheduleHedgeRequestForFlight:(M3U8LoaderFlight *)flight primaryTask:(NSURLSessionTask *)primaryTask {
+    __weak NSURLSessionTask *weakPrimaryTask = primaryTask;
+    flight.hedgeTicket = [[M3U8RequestScheduler sharedScheduler] scheduleRequestForURL:flight.request.URL
+                                                                              priority:flight.priority
+                                                                                 start:^(M3U8SchedulerTicket *ticket) {
+        M3U8LoaderFlightSync(^{
+            // 排队期间原请求已结束、已切换为文件下载或等待者都已取消
+            NSURLSessionTask *task = weakPrimaryTask;
+            if (flight.hedgeTicket != ticket || !task || flight.tasks.count != 1 || flight.tasks.firstObject != task || flight.waiters.count == 0) {
+                [ticket finish];
+                return;
+            }
+            [M3U8Loader startDataTaskForFlight:flight hedge:YES];
+        });
+    }];
+}
+
+/**
+ * 单个任务结束
+ * 对冲中先成功的任务胜出并取消其余任务；全部失败时按重试策略重试或通知失败
+ */
++ (void)completeTask:(NSURLSessionTask *)task
+              flight:(M3U8LoaderFlight *)flight
+            response:(NSURLResponse *)response
+                data:(NSData *)data
+               error:(NSError *)error {
+    __block BOOL superseded = NO;
+    __block BOOL hedgeWon = NO;
+    __block NSUInteger attempt = 0;
+    __block CFAbsoluteTime attemptStartTime = 0;
+    M3U8LoaderFlightSync(^{
+        if (!task || ![flight.tasks containsObject:task]) {
+            // 已切换为文件下载、对冲中落败，或所有等待者都已取消
+            superseded = YES;
+            return;
+        }
+        [flight.tasks removeObject:task];
+        if (error && flight.tasks.count > 0) {
+            // 对冲中的另一个任务仍在进行，由它决定结果
+            if (task == flight.hedgeTask) {
+                M3U8LoaderFlightReleaseHedgeTicket(flight);
+            }
+            superseded = YES;
+            return;
+        }
         
-        if ([weakSelf.delegate respondsToSelector:@selector(loader:downloadProgress:forURL:)]) {
-            dispatch_async(dispatch_get_main_queue(), ^{
-                [weakSelf.delegate loader:weakSelf downloadProgress:progress forURL:url];
-            });
+        hedgeWon = (task == flight.hedgeTask);
+        for (NSURLSessionTask *other in flight.tasks) {
+            [other cancel];
+        }
+        [flight.tasks removeAllObjects];
+        flight.hedgeTask = nil;
+        M3U8LoaderFlightReleaseHedgeTicket(flight);
+        attempt = flight.attempt;
+        attemptStartTime = flight.attemptStartTime;
+    });
+    if (superseded) {
+        return;
+    }
+    
+    M3U8RetryPolicy *policy = [M3U8RetryPolicy playlistPolicy];
+    NSURL *taskURL = task.originalRequest.URL ?: flight.request.URL;
+    if (error) {
+        [[M3U8CircuitBreaker sharedBreaker] recordFailure:error response:response forURL:taskURL];
+        if ([M3U8RetryPolicy classifyError:error response:response] == M3U8ErrorClassTransient) {
+            [[M3U8HostSelector sharedSelector] recordFailureForURL:taskURL];
+        }
+        if ([policy shouldRetryError:error response:response attempt:attempt]) {
+            [self retryFlight:flight afterError:error attempt:attempt];
+            return;
+        }
+    } else {
+        [[M3U8CircuitBreaker sharedBreaker] recordSuccessForURL:taskURL];
+        [policy recordSuccessWithLatency:CFAbsoluteTimeGetCurrent() - attemptStartTime];
+        if (hedgeWon) {
+            NSLog(@"[M3U8Loader] 对冲请求胜出: %@", flight.url);
+            [policy recordHedgeWin];
+        }
+    }
+    
+    [self handleDownloadCompletion:response data:data error:error flight:flight];
+}
+
++ (void)retryFlight:(M3U8LoaderFlight *)flight afterError:(NSError *)error attempt:(NSUInteger)attempt {
+    // 有等价主机可用时立即切换过去重试，否则按退避策略等待后重试原主机
+    __block NSURL *failoverURL = nil;
+    M3U8LoaderFlightSync(^{
+        failoverURL = [[M3U8HostSelector sharedSelector] failoverURLForURL:flight.request.URL];
+    });
+    NSTimeInterval delay = failoverURL ? 0 : [[M3U8RetryPolicy playlistPolicy] backoffDelayForAttempt:attempt];
+    NSLog(@"[M3U8Loader] 请求失败(%@)，%.0fms后重试%@: %@", error.localizedDescription, delay * 1000,
+          failoverURL ? [NSString stringWithFormat:@"（切换到%@）", failoverURL.host] : @"", flight.url);
+    
+    M3U8LoaderFlightSync(^{
+        // 退避期间释放主机并发名额
+        [flight.ticket finish];
+        flight.ticket = nil;
+        M3U8LoaderFlightReleaseHedgeTicket(flight);
+        if (failoverURL) {
+            NSMutableURLRequest *request = [flight.request mutableCopy];
+            request.URL = failoverURL;
+            flight.request = request;
+        }
+    });
+    
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), M3U8LoaderFlightQueue(), ^{
+        if (flight.waiters.count == 0 || M3U8LoaderFlights()[flight.key] != flight) {
+            return;
+        }
+        // 退避期间主机可能已经熔断，不再继续打到故障的源站
+        NSError *admissionError = [[M3U8CircuitBreaker sharedBreaker] admissionErrorForURL:flight.request.URL];
+        if (admissionError) {
+            NSLog(@"[M3U8Loader] 重试被拒绝: %@ - %@", flight.url, admissionError.localizedDescription);
+            [M3U8Loader handleDownloadCompletion:nil data:nil error:admissionError flight:flight];
+            return;
+        }
+        [M3U8Loader scheduleFlight:flight];
+    });
+}
+
++ (void)switchFlight:(M3U8LoaderFlight *)flight toFileDownloadFromTask:(NSURLSessionTask *)task {
+    M3U8LoaderFlightSync(^{
+        if (!task || ![flight.tasks containsObject:task]) {
+            return;
+        }
+        NSLog(@"[M3U8Loader] 响应超过内存下载上限(%lld bytes)，改为下载到临时文件: %@",
+              kM3U8InMemoryDownloadLimit, flight.url);
+        for (NSURLSessionTask *other in flight.tasks) {
+            [other cancel];
+        }
+        [flight.tasks removeAllObjects];
+        flight.hedgeTask = nil;
+        M3U8LoaderFlightReleaseHedgeTicket(flight);
+        if (flight.waiters.count > 0) {
+            [M3U8Loader startFileDownloadForFlight:flight];
         }
+    });
+}
+
+/**
+ * 大文件下载到临时文件（须在flightQueue上调用）
+ */
++ (void)startFileDownloadForFlight:(M3U8LoaderFlight *)flight {
+    // 创建临时文件路径
+    NSString *tempDir = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    [[NSFileManager defaultManager] createDirectoryAtPath:tempDir withIntermediateDirectories:YES attributes:nil error:nil];
+    NSString *tempFilePath = [tempDir stringByAppendingPathComponent:@"m3u8_file.m3u8"];
+    flight.tempDir = tempDir;
+    
+    AFHTTPSessionManager *sessionManager = [[M3U8SessionPool sharedPool] sessionManagerForHostClass:M3U8HostClassCDN];
+    
+    // 大文件只限制空闲超时，不设总期限
+    M3U8TimeoutEstimator *estimator = [M3U8TimeoutEstimator sharedEstimator];
+    M3U8RequestDeadlines deadlines = [estimator deadlinesForURL:flight.request.URL hostClass:M3U8HostClassCDN];
+    NSURLRequest *request = [estimator request:flight.request withDeadlines:deadlines];
+    
+    __block __weak NSURLSessionDownloadTask *weakTask = nil;
+    NSURLSessionDownloadTask *task = [sessionManager downloadTaskWithRequest:request
+                                                                     progress:^(NSProgress * _Nonnull downloadProgress) {
+        [M3U8Loader notifyProgress:downloadProgress forFlight:flight];
     } destination:^NSURL * _Nonnull(NSURL * _Nonnull targetPath, NSURLResponse * _Nonnull response) {
         return [NSURL fileURLWithPath:tempFilePath];
     } completionHandler:^(NSURLResponse * _Nonnull response, NSURL * _Nullable filePath, NSError * _Nullable error) {
-        __strong typeof(weakSelf) strongSelf = weakSelf;
-        if (!strongSelf) return;
+        NSData *data = nil;
+        NSError *readError = error;
+        if (!error) {
+            // 读取下载的文件（映射读取，临时目录删除后数据仍然有效）
+            data = [NSData dataWithContentsOfFile:filePath.path options:NSDataReadingMappedIfSafe error:nil];
+            if (!data) {
+                readError = [NSError errorWithDomain:@"M3U8Loader"
+                                                code:1003
+                                            userInfo:@{NSLocalizedDescriptionKey: @"无法读取下载的M3U8文件"}];
+            }
+        }
+        [M3U8Loader completeTask:weakTask flight:flight response:response data:data error:readError];
         
-        [strongSelf handleDownloadCompletion:response filePath:filePath error:error url:url token:token tempDir:tempDir];
+        // 清理临时文件
+        [[NSFileManager defaultManager] removeItemAtPath:tempDir error:nil];
     }];
+    weakTask = task;
     
-    // 保存下载任务
-    self.downloadTasks[url] = task;
-    
-    // 开始下载
+    task.priority = [M3U8RequestScheduler taskPriorityForPriority:flight.priority];
+    [flight.tasks addObject:task];
     [task resume];
-    NSLog(@"[M3U8Loader] 下载任务已启动: %@", url);
+    NSLog(@"[M3U8Loader] 文件下载任务已启动: %@", flight.url);
+}
+
++ (void)notifyProgress:(NSProgress *)downloadProgress forFlight:(M3U8LoaderFlight *)flight {
+    // 通知下载进度
+    float progress = downloadProgress.fractionCompleted;
+    NSLog(@"[M3U8Loader] 下载进度: %.2f%% (%lld/%lld bytes)",
+          progress * 100, downloadProgress.completedUnitCount, downloadProgress.totalUnitCount);
+    
+    NSString *url = flight.url;
+    for (M3U8Loader *loader in [M3U8Loader waitingLoadersForFlight:flight]) {
+        if ([loader.delegate respondsToSelector:@selector(loader:downloadProgress:forURL:)]) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                [loader.delegate loader:loader downloadProgress:progress forURL:url];
+            });
+        }
+    }
+}
+
++ (NSArray<M3U8Loader *> *)waitingLoadersForFlight:(M3U8LoaderFlight *)flight {
+    NSMutableArray<M3U8Loader *> *loaders = [NSMutableArray array];
+    M3U8LoaderFlightSync(^{
+        for (M3U8LoadRequest *request in flight.waiters) {
+            M3U8Loader *loader = request.loader;
+            if (loader && ![loaders containsObject:loader]) {
+                [loaders addObject:loader];
+            }
+        }
+    });
+    return loaders;
 }
 
-- (void)handleDownloadCompletion:(NSURLResponse *)response 
-                        filePath:(NSURL *)filePath 
-                           error:(NSError *)error 
-                             url:(NSString *)url 
-                           token:(NSString *)token 
-                         tempDir:(NSString *)tempDir {
++ (void)handleDownloadCompletion:(NSURLResponse *)response
+                            data:(NSData *)data
+                           error:(NSError *)error
+                          flight:(M3U8LoaderFlight *)flight {
     
+    NSString *url = flight.url;
     NSLog(@"[M3U8Loader] 下载完成回调 - URL: %@", url);
     
-    // 清理下载任务（但暂时保留session以避免影响其他请求）
-    [self.downloadTasks removeObjectForKey:url];
+    // 摘下所有等待者，之后到达的同URL请求会重新走缓存或发起新下载
+    __block NSArray<M3U8LoadRequest *> *waiters = nil;
+    M3U8LoaderFlightSync(^{
+        if (M3U8LoaderFlights()[flight.key] == flight) {
+            [M3U8LoaderFlights() removeObjectForKey:flight.key];
+        }
+        waiters = [flight.waiters copy];
+        [flight.waiters removeAllObjects];
+        for (M3U8LoadRequest *waiter in waiters) {
+            waiter.flight = nil;
+            waiter.finished = YES;
+        }
+        [flight.tasks removeAllObjects];
+        
+        // 释放主机并发名额
+        [flight.ticket finish];
+        flight.ticket = nil;
+        M3U8LoaderFlightReleaseHedgeTicket(flight);
+    });
     
-    // 立即清理Session管理器（每个URL使用独立的session，不会影响其他请求）
-    AFHTTPSessionManager *sessionManager = self.sessionManagers[url];
-    if (sessionManager) {
-        [sessionManager.session finishTasksAndInvalidate];
-        [self.sessionManagers removeObjectForKey:url];
+    if (waiters.count == 0) {
+        // 所有等待者都已取消
+        return;
     }
     
     if (error) {
         NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *)response;
-        NSLog(@"[M3U8Loader] 下载失败 - URL: %@, 错误: %@, HTTP状态码: %ld", 
+        NSLog(@"[M3U8Loader] 下载失败 - URL: %@, 错误: %@, HTTP状态码: %ld",
               url, error.localizedDescription, httpResponse ? (long)httpResponse.statusCode : 0);
+        data = nil;
+    } else {
+        NSLog(@"[M3U8Loader] M3U8文件下载成功 - URL: %@, 大小: %lu bytes, 等待者: %lu",
+              url, (unsigned long)data.length, (unsigned long)waiters.count);
+        [[M3U8Metrics sharedMetrics] recordNetworkBytes:data.length];
         
-        [self notifyFailure:error forURL:url completion:self.completionBlocks[url]];
-        [self cleanupForURL:url tempDir:tempDir];
-        return;
-    }
-    
-    // 读取下载的文件
-    NSData *data = [NSData dataWithContentsOfFile:filePath.path];
-    if (!data) {
-        NSError *readError = [NSError errorWithDomain:@"M3U8Loader" 
-                                               code:1003 
-                                           userInfo:@{NSLocalizedDescriptionKey: @"无法读取下载的M3U8文件"}];
-        [self notifyFailure:readError forURL:url completion:self.completionBlocks[url]];
-        [self cleanupForURL:url tempDir:tempDir];
-        return;
+        // 缓存数据（只写一次）
+        [[CacheManager sharedManager] cacheData:data forURL:url token:flight.token];
     }
     
-    NSLog(@"[M3U8Loader] M3U8文件下载成功 - URL: %@, 大小: %lu bytes", url, (unsigned long)data.length);
-    
-    // 缓存数据
-    [self.cacheManager cacheData:data forURL:url token:token];
-    
-    // 解析内容
-    NSString *content = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
-    if (content) {
-        [self notifySuccess:content forURL:url completion:self.completionBlocks[url]];
-    } else {
-        NSError *parseError = [NSError errorWithDomain:@"M3U8Loader" 
-                                                code:1004 
-                                            userInfo:@{NSLocalizedDescriptionKey: @"M3U8文件编码解析失败"}];
-        [self notifyFailure:parseError forURL:url completion:self.completionBlocks[url]];
+    // 分发给每个等待者
+    for (M3U8LoadRequest *waiter in waiters) {
+        void(^completion)(NSData *, NSError *) = waiter.completion;
+        waiter.completion = nil;
+        M3U8Loader *loader = waiter.loader;
+        
+        if (loader) {
+            if (data) {
+                [loader notifySuccess:data forURL:url completion:completion];
+            } else {
+                [loader notifyFailure:error forURL:url completion:completion];
+            }
+        } else if (completion) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completion(data, error);
+            });
+        }
     }
-    
-    [self cleanupForURL:url tempDir:tempDir];
 }
 
-- (void)notifySuccess:(NSString *)content forURL:(NSString *)url completion:(void(^)(NSString * _Nullable, NSError * _Nullable))completion {
-    // 通知代理
+- (void)notifySuccess:(NSData *)data forURL:(NSString *)url completion:(void(^)(NSData * _Nullable, NSError * _Nullable))completion {
+    // 通知代理（只有代理需要文本内容时才解码）
     if ([self.delegate respondsToSelector:@selector(loader:didLoadContent:fromURL:)]) {
+        NSString *content = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding] ?: @"";
         dispatch_async(dispatch_get_main_queue(), ^{
             [self.delegate loader:self didLoadContent:content fromURL:url];
         });
@@ -334,13 +879,13 @@
     
     // 执行完成回调
     if (completion) {
-        dispatch_async(dispatch_get_main_queue(), ^{
-            completion(content, nil);
+        dispatch_async(self.completionQueue, ^{
+            completion(data, nil);
         });
     }
 }
 
-- (void)notifyFailure:(NSError *)error forURL:(NSString *)url completion:(void(^)(NSString * _Nullable, NSError * _Nullable))completion {
+- (void)notifyFailure:(NSError *)error forURL:(NSString *)url completion:(void(^)(NSData * _Nullable, NSError * _Nullable))completion {
     // 通知代理
     if ([self.delegate respondsToSelector:@selector(loader:didFailWithError:forURL:)]) {
         dispatch_async(dispatch_get_main_queue(), ^{
@@ -350,18 +895,10 @@
     
     // 执行完成回调
     if (completion) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(self.completionQueue, ^{
             completion(nil, error);
         });
     }
 }
 
-- (void)cleanupForURL:(NSString *)url tempDir:(NSString *)tempDir {
-    // 清理完成回调
-    [self.completionBlocks removeObjectForKey:url];
-    
-    // 清理临时文件
-    [[NSFileManager defaultManager] removeItemAtPath:tempDir error:nil];
-}
-
 @end
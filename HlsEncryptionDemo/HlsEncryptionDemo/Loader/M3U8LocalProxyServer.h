@@ -0,0 +1,124 @@
+//
+//  M3U8LocalProxyServer.h
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "M3U8AuthConfig.h"
+#import "M3U8KeyManager.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+extern NSString * const M3U8LocalProxyServerErrorDomain;
+
+typedef NS_ENUM(NSInteger, M3U8LocalProxyServerError) {
+    M3U8LocalProxyServerErrorSocket = 1301,    // 创建监听套接字失败
+    M3U8LocalProxyServerErrorBind = 1302,      // 绑定端口失败（端口被占用）
+    M3U8LocalProxyServerErrorListen = 1303     // 监听失败
+};
+
+/**
+ * 本地环回HLS代理（HTTP/1.1，只监听127.0.0.1）
+ * 作为AVAssetResourceLoader拦截的替代方案：播放器直接请求本地代理，代理负责
+ * - 播放列表：通过M3U8Loader下载（共用缓存与授权），改写其中的子播放列表、密钥和分片地址指向代理
+ * - 密钥：通过M3U8KeyManager获取（共用密钥缓存、请求合并和token刷新）
+ * - 分片：命中M3U8SegmentCache时用sendfile直接从缓存文件发送；未命中时从CDN边下载边转发，下载完成后写入缓存，
+ *   未命中的Range请求原样转发给源站
+ * 支持Range请求（单个范围）、HEAD和keep-alive；内存中的数据直接写出，不做复制
+ *
+ * 代理地址格式：/playlist.m3u8?url=、/key?url=、/segment.<扩展名>?url=，参数为百分号编码的原始地址
+ * 只代理允许的源站：proxyURLForPlaylistURL:生成的播放列表和其中改写过的地址所在主机、HostSelector的等价主机组、
+ * 最近使用的密钥服务器，以及addAllowedHost:添加的主机；Host头不是127.0.0.1:<port>的请求一律拒绝(403)，
+ * 避免本机其他进程借代理把授权参数发往任意主机或读取密钥
+ * 可以在模拟器、macOS或Linux上用curl验证（完整检查见Scripts/proxy_curl_check.sh），例如：
+ * curl -v "http://127.0.0.1:<port>/playlist.m3u8?url=https%3A%2F%2Fexample.com%2Findex.m3u8"
+ */
+@interface M3U8LocalProxyServer : NSObject
+
+/**
+ * 监听端口，未启动时为0
+ */
+@property (nonatomic, assign, readonly) uint16_t port;
+
+/**
+ * 是否正在运行
+ */
+@property (nonatomic, assign, readonly, getter=isRunning) BOOL running;
+
+/**
+ * 是否把下载的分片写入M3U8SegmentCache，默认YES
+ */
+@property (nonatomic, assign) BOOL cachesSegments;
+
+/**
+ * 默认上下文（proxyURLForPlaylistURL:生成的地址）获取密钥使用的密钥管理器，默认为代理自己创建的实例
+ * 播放器管理器通过proxyURLForPlaylistURL:keyManager:authConfig:注册自己的上下文，不修改此属性
+ */
+@property (atomic, strong) M3U8KeyManager *keyManager;
+
+/**
+ * 获取共享实例
+ */
++ (instancetype)sharedServer;
+
+/**
+ * 启动代理
+ * @param port 监听端口，传0时由系统分配
+ * @param error 失败时返回错误
+ * @return 是否启动成功（已在运行时直接返回YES）
+ */
+- (BOOL)startWithPort:(uint16_t)port error:(NSError **)error;
+
+/**
+ * 停止代理，关闭所有连接
+ */
+- (void)stop;
+
+/**
+ * 监听套接字失效时在原端口重新启动，已发出的代理地址继续可用
+ * 应用挂起期间系统可能回收监听套接字，由M3U8PlayerManager在回到前台时调用
+ */
+- (void)restartIfNeeded;
+
+/**
+ * 配置默认上下文的授权信息（播放列表和密钥请求使用）
+ */
+- (void)configureWithAuthConfig:(M3U8AuthConfig * _Nullable)authConfig;
+
+/**
+ * 允许代理的源站主机
+ * @param host "host" 或 "host:port"（不区分大小写）
+ */
+- (void)addAllowedHost:(NSString *)host;
+
+/**
+ * 播放列表的代理地址（默认上下文），同时允许该播放列表所在的主机
+ * @param url 原始播放列表地址
+ * @return 代理地址，代理未运行时返回nil
+ */
+- (NSURL * _Nullable)proxyURLForPlaylistURL:(NSString *)url;
+
+/**
+ * 播放列表的代理地址，该播放列表及其改写出的子播放列表、密钥请求使用指定的密钥管理器和授权信息
+ * 多个播放器管理器（如预加载与当前播放）共用代理时互不影响；同一密钥管理器再次调用时复用上下文并更新授权信息，
+ * 密钥管理器释放后这些代理地址返回404
+ * @param url 原始播放列表地址
+ * @param keyManager 密钥管理器（代理只弱引用）
+ * @param authConfig 播放列表请求使用的授权信息
+ * @return 代理地址，代理未运行时返回nil
+ */
+- (NSURL * _Nullable)proxyURLForPlaylistURL:(NSString *)url
+                                 keyManager:(M3U8KeyManager *)keyManager
+                                 authConfig:(M3U8AuthConfig * _Nullable)authConfig;
+
+/**
+ * 代理统计
+ */
+- (NSDictionary *)statistics;
+
+@end
+
+NS_ASSUME_NONNULL_END
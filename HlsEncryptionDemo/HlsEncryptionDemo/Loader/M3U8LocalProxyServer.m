@@ -0,0 +1,1258 @@
+//
+//  M3U8LocalProxyServer.m
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import "M3U8LocalProxyServer.h"
+#import "M3U8Loader.h"
+#import "M3U8SegmentCache.h"
+#import "M3U8Metrics.h"
+#import "M3U8SessionPool.h"
+#import "M3U8HostSelector.h"
+#import "M3U8Preconnector.h"
+#import "M3U8ResourceRouter.h"
+#import <sys/socket.h>
+#import <sys/stat.h>
+#import <sys/uio.h>
+#ifndef __APPLE__
+#import <sys/sendfile.h>
+#endif
+#import <netinet/in.h>
+#import <netinet/tcp.h>
+#import <fcntl.h>
+#import <unistd.h>
+
+NSString * const M3U8LocalProxyServerErrorDomain = @"M3U8LocalProxyServer";
+
+// 请求头的最大长度与每次读取的字节数
+#define kProxyMaxHeaderLength (16 * 1024)
+#define kProxyReadBufferSize 4096
+
+// keep-alive连接的空闲超时，也是单次写入的超时（秒）
+static const NSTimeInterval kProxyIdleTimeout = 15.0;
+
+// 停止时等待监听套接字关闭的最长时间（秒）
+static const NSTimeInterval kProxyStopTimeout = 1.0;
+
+/**
+ * Range头的解析结果
+ */
+typedef NS_ENUM(NSInteger, M3U8ProxyRange) {
+    M3U8ProxyRangeNone = 0,          // 没有Range头或无法识别（如多个范围），返回完整内容
+    M3U8ProxyRangeValid,             // 单个有效范围
+    M3U8ProxyRangeUnsatisfiable      // 范围超出内容长度
+};
+
+static NSError *M3U8LocalProxyServerMakeError(M3U8LocalProxyServerError code, NSString *description) {
+    return [NSError errorWithDomain:M3U8LocalProxyServerErrorDomain
+                               code:code
+                           userInfo:@{NSLocalizedDescriptionKey: description}];
+}
+
+static NSString *M3U8ProxyStatusText(NSInteger status) {
+    switch (status) {
+        case 200: return @"OK";
+        case 206: return @"Partial Content";
+        case 400: return @"Bad Request";
+        case 403: return @"Forbidden";
+        case 404: return @"Not Found";
+        case 405: return @"Method Not Allowed";
+        case 416: return @"Range Not Satisfiable";
+        case 502: return @"Bad Gateway";
+        default: return @"Error";
+    }
+}
+
+static NSString *M3U8ProxyContentTypeForExtension(NSString *pathExtension) {
+    static NSDictionary<NSString *, NSString *> *types = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        types = @{
+            @"ts": @"video/mp2t",
+            @"aac": @"audio/aac",
+            @"mp4": @"video/mp4",
+            @"m4s": @"video/iso.segment",
+            @"m4a": @"audio/mp4",
+            @"vtt": @"text/vtt",
+            @"webvtt": @"text/vtt"
+        };
+    });
+    return types[pathExtension.lowercaseString] ?: @"application/octet-stream";
+}
+
+static NSCharacterSet *M3U8ProxyQueryValueAllowedCharacters(void) {
+    static NSCharacterSet *characters = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        characters = [NSCharacterSet characterSetWithCharactersInString:@"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-._~"];
+    });
+    return characters;
+}
+
+static BOOL M3U8ProxyParseUInt64(NSString *string, unsigned long long *value) {
+    if (string.length == 0 || [string rangeOfCharacterFromSet:[[NSCharacterSet decimalDigitCharacterSet] invertedSet]].location != NSNotFound) {
+        return NO;
+    }
+    return [[NSScanner scannerWithString:string] scanUnsignedLongLong:value];
+}
+
+/**
+ * 解析单个字节范围：bytes=start-end、bytes=start-、bytes=-suffix
+ */
+static M3U8ProxyRange M3U8ProxyParseRange(NSString *header, unsigned long long total, unsigned long long *start, unsigned long long *length) {
+    NSString *spec = [header stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+    if (![spec.lowercaseString hasPrefix:@"bytes="] || [spec containsString:@","]) {
+        return M3U8ProxyRangeNone;
+    }
+    spec = [spec substringFromIndex:6];
+    NSRange dash = [spec rangeOfString:@"-"];
+    if (dash.location == NSNotFound) {
+        return M3U8ProxyRangeNone;
+    }
+    NSString *first = [spec substringToIndex:dash.location];
+    NSString *last = [spec substringFromIndex:NSMaxRange(dash)];
+    
+    unsigned long long firstValue = 0;
+    unsigned long long lastValue = 0;
+    if (first.length == 0) {
+        // 最后N个字节
+        if (!M3U8ProxyParseUInt64(last, &lastValue)) {
+            return M3U8ProxyRangeNone;
+        }
+        if (lastValue == 0 || total == 0) {
+            return M3U8ProxyRangeUnsatisfiable;
+        }
+        *start = total > lastValue ? total - lastValue : 0;
+        *length = total - *start;
+        return M3U8ProxyRangeValid;
+    }
+    
+    if (!M3U8ProxyParseUInt64(first, &firstValue)) {
+        return M3U8ProxyRangeNone;
+    }
+    if (firstValue >= total) {
+        return M3U8ProxyRangeUnsatisfiable;
+    }
+    unsigned long long end = total - 1;
+    if (last.length > 0) {
+        if (!M3U8ProxyParseUInt64(last, &lastValue) || lastValue < firstValue) {
+            return M3U8ProxyRangeNone;
+        }
+        end = MIN(lastValue, total - 1);
+    }
+    *start = firstValue;
+    *length = end - firstValue + 1;
+    return M3U8ProxyRangeValid;
+}
+
+// Darwin在套接字上设置SO_NOSIGPIPE，Linux没有该选项，改为每次发送时传MSG_NOSIGNAL
+#ifdef __APPLE__
+static const int kProxySendFlags = 0;
+#else
+static const int kProxySendFlags = MSG_NOSIGNAL;
+#endif
+
+static BOOL M3U8ProxyWriteAll(int socket, const uint8_t *bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = send(socket, bytes, length, kProxySendFlags);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return NO;
+        }
+        bytes += written;
+        length -= (size_t)written;
+    }
+    return YES;
+}
+
+#ifdef __APPLE__
+static BOOL M3U8ProxySendFile(int file, int socket, off_t offset, off_t length) {
+    while (length > 0) {
+        off_t sent = length;
+        int result = sendfile(file, socket, offset, &sent, NULL, 0);
+        if (result != 0) {
+            // 被信号中断或发送超时时sent为已发送的字节数，有进展就继续
+            if (!(errno == EINTR || (errno == EAGAIN && sent > 0))) {
+                return NO;
+            }
+        } else if (sent == 0) {
+            // 文件比预期短（被截断）
+            return NO;
+        }
+        offset += sent;
+        length -= sent;
+    }
+    return YES;
+}
+#else
+/**
+ * Linux：sendfile(2)参数顺序与Darwin不同，并由内核推进offset；
+ * 不支持sendfile的文件系统（EINVAL/ENOSYS）退回pread + send
+ */
+static BOOL M3U8ProxySendFile(int file, int socket, off_t offset, off_t length) {
+    while (length > 0) {
+        ssize_t sent = sendfile(socket, file, &offset, (size_t)MIN(length, (off_t)0x7ffff000));
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EINVAL && errno != ENOSYS) {
+                return NO;
+            }
+            uint8_t buffer[64 * 1024];
+            while (length > 0) {
+                ssize_t count = pread(file, buffer, (size_t)MIN(length, (off_t)sizeof(buffer)), offset);
+                if (count < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (count <= 0 || !M3U8ProxyWriteAll(socket, buffer, (size_t)count)) {
+                    return NO;
+                }
+                offset += count;
+                length -= count;
+            }
+            return YES;
+        }
+        if (sent == 0) {
+            // 文件比预期短（被截断）
+            return NO;
+        }
+        length -= sent;
+    }
+    return YES;
+}
+#endif
+
+// MARK: - M3U8ProxyRequest
+
+@interface M3U8ProxyRequest : NSObject
+@property (nonatomic, copy) NSString *method;
+@property (nonatomic, copy) NSString *path;                                   // 不含查询参数
+@property (nonatomic, copy, nullable) NSString *targetURL;                    // url参数（已解码）
+@property (nonatomic, copy, nullable) NSString *contextID;                    // ctx参数，没有时使用默认上下文
+@property (nonatomic, copy) NSDictionary<NSString *, NSString *> *headers;    // 头名称为小写
+@property (nonatomic, assign) BOOL keepAlive;
+@property (nonatomic, assign, readonly) BOOL isHead;
+@end
+
+@implementation M3U8ProxyRequest
+
+- (BOOL)isHead {
+    return [self.method isEqualToString:@"HEAD"];
+}
+
+@end
+
+// MARK: - M3U8ProxyContext
+
+/**
+ * 通过proxyURLForPlaylistURL:keyManager:authConfig:注册的代理上下文
+ * 代理地址带上ctx=<标识>，播放列表改写时沿用，同一路播放的播放列表和密钥请求都使用注册时的密钥管理器和授权信息
+ */
+@interface M3U8ProxyContext : NSObject
+@property (nonatomic, copy) NSString *identifier;
+@property (nonatomic, weak, nullable) M3U8KeyManager *keyManager;  // 密钥管理器释放后上下文失效
+@property (nonatomic, strong) M3U8Loader *playlistLoader;
+@end
+
+@implementation M3U8ProxyContext
+@end
+
+// MARK: - M3U8ProxyStream
+
+/**
+ * 边下载边转发的分片响应，除task外的状态只在连接队列上访问
+ */
+@interface M3U8ProxyStream : NSObject
+@property (nonatomic, strong) M3U8ProxyRequest *request;
+@property (nonatomic, strong) M3U8ProxyConnection *connection;
+@property (nonatomic, weak, nullable) NSURLSessionTask *task;
+@property (nonatomic, copy) NSString *contentType;
+@property (nonatomic, assign) BOOL headerSent;
+@property (nonatomic, assign) BOOL failed;     // 写入客户端失败，连接已关闭
+@property (nonatomic, assign) BOOL keepAlive;  // 源站未声明长度时只能写完后关闭连接
+@end
+
+@implementation M3U8ProxyStream
+@end
+
+// MARK: - M3U8ProxyConnection
+
+/**
+ * 一个客户端连接
+ * 读写都在连接自己的串行队列上进行（阻塞套接字 + 超时）；环回连接很少（AVPlayer通常2～4个）
+ */
+@interface M3U8ProxyConnection : NSObject
+@property (nonatomic, assign, readonly) int socket;
+@property (nonatomic, strong, readonly) dispatch_queue_t queue;
+@property (nonatomic, strong, readonly) NSMutableData *buffer;  // 已读取但尚未解析的数据
+- (instancetype)initWithSocket:(int)socket;
+- (void)shutdown;
+- (void)close;
+@end
+
+@implementation M3U8ProxyConnection {
+    BOOL _closed;
+}
+
+- (instancetype)initWithSocket:(int)socket {
+    self = [super init];
+    if (self) {
+        _socket = socket;
+        dispatch_queue_attr_t attr = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INITIATED, 0);
+        _queue = dispatch_queue_create("com.m3u8.proxy.connection", attr);
+        _buffer = [NSMutableData data];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self close];
+}
+
+/**
+ * 中断阻塞中的读写（可在任意线程调用），套接字由连接队列关闭
+ */
+- (void)shutdown {
+    @synchronized (self) {
+        if (!_closed) {
+            shutdown(_socket, SHUT_RDWR);
+        }
+    }
+}
+
+- (void)close {
+    @synchronized (self) {
+        if (_closed) {
+            return;
+        }
+        _closed = YES;
+        close(_socket);
+    }
+}
+
+@end
+
+@interface M3U8LocalProxyServer ()
+@property (nonatomic, assign, readwrite) uint16_t port;
+@property (nonatomic, assign, readwrite, getter=isRunning) BOOL running;
+@property (nonatomic, assign) int listenSocket;
+@property (nonatomic, strong, nullable) dispatch_source_t acceptSource;
+@property (nonatomic, strong, nullable) dispatch_semaphore_t listenClosed;
+@property (nonatomic, strong) dispatch_queue_t acceptQueue;
+@property (nonatomic, strong) NSMutableSet<M3U8ProxyConnection *> *connections;  // 仅在acceptQueue上访问
+@property (nonatomic, strong) M3U8Loader *playlistLoader;
+@property (nonatomic, copy) NSDictionary<NSString *, NSNumber *> *routes;         // 路径名 -> M3U8ResourceRoute
+@property (nonatomic, copy) NSDictionary<NSString *, NSNumber *> *uriTagRoutes;   // 带URI属性的标签 -> M3U8ResourceRoute
+@property (nonatomic, strong) NSMutableSet<NSString *> *allowedAuthorities;       // 允许代理的源站（host或host:port），@synchronized保护
+@property (nonatomic, strong) NSMutableDictionary<NSString *, M3U8ProxyContext *> *contexts;  // 标识 -> 上下文，@synchronized保护
+@property (nonatomic, assign) NSUInteger nextContextID;
+@property (nonatomic, copy) NSDictionary<NSNumber *, M3U8MetricCounter *> *requestCounters;
+@property (nonatomic, strong) M3U8MetricCounter *bytesSentCounter;
+@property (nonatomic, strong) M3U8MetricCounter *segmentCacheHitCounter;
+@property (nonatomic, strong) M3U8MetricCounter *segmentCacheMissCounter;
+@end
+
+@implementation M3U8LocalProxyServer
+
++ (instancetype)sharedServer {
+    static M3U8LocalProxyServer *instance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        instance = [[M3U8LocalProxyServer alloc] init];
+    });
+    return instance;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _listenSocket = -1;
+        _acceptQueue = dispatch_queue_create("com.m3u8.proxy.accept", DISPATCH_QUEUE_SERIAL);
+        _connections = [NSMutableSet set];
+        _allowedAuthorities = [NSMutableSet set];
+        _contexts = [NSMutableDictionary dictionary];
+        _cachesSegments = YES;
+        _keyManager = [M3U8KeyManager new];
+        _playlistLoader = [M3U8Loader new];
+        _playlistLoader.completionQueue = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+        
+        _routes = @{
+            @"playlist": @(M3U8ResourceRoutePlaylist),
+            @"key": @(M3U8ResourceRouteKey),
+            @"segment": @(M3U8ResourceRouteSegment)
+        };
+        _uriTagRoutes = @{
+            @"#EXT-X-KEY:": @(M3U8ResourceRouteKey),
+            @"#EXT-X-SESSION-KEY:": @(M3U8ResourceRouteKey),
+            @"#EXT-X-MAP:": @(M3U8ResourceRouteSegment),
+            @"#EXT-X-MEDIA:": @(M3U8ResourceRoutePlaylist),
+            @"#EXT-X-I-FRAME-STREAM-INF:": @(M3U8ResourceRoutePlaylist)
+        };
+        
+        M3U8Metrics *metrics = [M3U8Metrics sharedMetrics];
+        _requestCounters = @{
+            @(M3U8ResourceRoutePlaylist): [metrics counterNamed:@"m3u8_proxy_requests_total" labels:@{@"route": @"playlist"}],
+            @(M3U8ResourceRouteKey): [metrics counterNamed:@"m3u8_proxy_requests_total" labels:@{@"route": @"key"}],
+            @(M3U8ResourceRouteSegment): [metrics counterNamed:@"m3u8_proxy_requests_total" labels:@{@"route": @"segment"}],
+            @(M3U8ResourceRouteNone): [metrics counterNamed:@"m3u8_proxy_requests_total" labels:@{@"route": @"other"}]
+        };
+        _bytesSentCounter = [metrics counterNamed:@"m3u8_proxy_bytes_sent_total" labels:nil];
+        _segmentCacheHitCounter = [metrics counterNamed:@"m3u8_proxy_segment_cache_hits_total" labels:nil];
+        _segmentCacheMissCounter = [metrics counterNamed:@"m3u8_proxy_segment_cache_misses_total" labels:nil];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self stop];
+}
+
+#pragma mark - Public Methods
+
+- (BOOL)startWithPort:(uint16_t)port error:(NSError **)error {
+    @synchronized (self) {
+        if (self.running) {
+            return YES;
+        }
+        
+        int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (fd < 0) {
+            if (error) {
+                *error = M3U8LocalProxyServerMakeError(M3U8LocalProxyServerErrorSocket,
+                                                       [NSString stringWithFormat:@"创建套接字失败: %s", strerror(errno)]);
+            }
+            return NO;
+        }
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        
+        // 只监听环回地址，其他设备无法访问
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+#ifdef __APPLE__
+        address.sin_len = sizeof(address);
+#endif
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+            if (error) {
+                *error = M3U8LocalProxyServerMakeError(M3U8LocalProxyServerErrorBind,
+                                                       [NSString stringWithFormat:@"绑定端口%u失败: %s", port, strerror(errno)]);
+            }
+            close(fd);
+            return NO;
+        }
+        if (listen(fd, SOMAXCONN) != 0) {
+            if (error) {
+                *error = M3U8LocalProxyServerMakeError(M3U8LocalProxyServerErrorListen,
+                                                       [NSString stringWithFormat:@"监听失败: %s", strerror(errno)]);
+            }
+            close(fd);
+            return NO;
+        }
+        socklen_t addressLength = sizeof(address);
+        getsockname(fd, (struct sockaddr *)&address, &addressLength);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        
+        dispatch_semaphore_t listenClosed = dispatch_semaphore_create(0);
+        dispatch_source_t source = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, (uintptr_t)fd, 0, self.acceptQueue);
+        __weak typeof(self) weakSelf = self;
+        dispatch_source_set_event_handler(source, ^{
+            [weakSelf acceptConnectionsOnSocket:fd];
+        });
+        dispatch_source_set_cancel_handler(source, ^{
+            close(fd);
+            dispatch_semaphore_signal(listenClosed);
+        });
+        dispatch_resume(source);
+        
+        self.listenSocket = fd;
+        self.acceptSource = source;
+        self.listenClosed = listenClosed;
+        self.port = ntohs(address.sin_port);
+        self.running = YES;
+        NSLog(@"[M3U8LocalProxyServer] 代理已启动: 127.0.0.1:%u", self.port);
+        return YES;
+    }
+}
+
+- (void)stop {
+    @synchronized (self) {
+        if (!self.running) {
+            return;
+        }
+        self.running = NO;
+        dispatch_source_cancel(self.acceptSource);
+        self.acceptSource = nil;
+        self.listenSocket = -1;
+        
+        // 等监听套接字真正关闭，之后可以立即在同一端口重新启动
+        dispatch_semaphore_wait(self.listenClosed, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kProxyStopTimeout * NSEC_PER_SEC)));
+        self.listenClosed = nil;
+        
+        dispatch_async(self.acceptQueue, ^{
+            for (M3U8ProxyConnection *connection in self.connections) {
+                [connection shutdown];
+            }
+            [self.connections removeAllObjects];
+        });
+        NSLog(@"[M3U8LocalProxyServer] 代理已停止: 127.0.0.1:%u", self.port);
+        self.port = 0;
+    }
+}
+
+- (void)restartIfNeeded {
+    @synchronized (self) {
+        if (!self.running) {
+            return;
+        }
+        // 应用挂起期间系统可能回收监听套接字，失效时在原端口重新启动，已发出的代理地址继续可用
+        int socketError = 0;
+        socklen_t length = sizeof(socketError);
+        if (getsockopt(self.listenSocket, SOL_SOCKET, SO_ERROR, &socketError, &length) == 0 && socketError == 0) {
+            return;
+        }
+        uint16_t port = self.port;
+        NSLog(@"[M3U8LocalProxyServer] 监听套接字已失效，在端口%u重新启动", port);
+        [self stop];
+        NSError *error = nil;
+        if (![self startWithPort:port error:&error]) {
+            NSLog(@"[M3U8LocalProxyServer] 重新启动失败: %@", error.localizedDescription);
+        }
+    }
+}
+
+- (void)configureWithAuthConfig:(M3U8AuthConfig *)authConfig {
+    [self.playlistLoader configureWithAuthConfig:authConfig];
+    [self.keyManager configureWithAuthConfig:authConfig];
+}
+
+- (void)addAllowedHost:(NSString *)host {
+    if (host.length == 0) {
+        return;
+    }
+    @synchronized (self.allowedAuthorities) {
+        [self.allowedAuthorities addObject:host.lowercaseString];
+    }
+}
+
+- (NSURL *)proxyURLForPlaylistURL:(NSString *)url {
+    return [self proxyURLForPlaylistURL:url contextID:nil];
+}
+
+- (NSURL *)proxyURLForPlaylistURL:(NSString *)url
+                       keyManager:(M3U8KeyManager *)keyManager
+                       authConfig:(M3U8AuthConfig *)authConfig {
+    M3U8ProxyContext *context = nil;
+    @synchronized (self.contexts) {
+        // 顺带清理密钥管理器已释放的上下文
+        for (NSString *identifier in self.contexts.allKeys) {
+            M3U8ProxyContext *existing = self.contexts[identifier];
+            if (!existing.keyManager) {
+                [self.contexts removeObjectForKey:identifier];
+            } else if (existing.keyManager == keyManager) {
+                context = existing;
+            }
+        }
+        if (!context) {
+            context = [[M3U8ProxyContext alloc] init];
+            context.identifier = [NSString stringWithFormat:@"%lu", (unsigned long)++self.nextContextID];
+            context.keyManager = keyManager;
+            context.playlistLoader = [M3U8Loader new];
+            context.playlistLoader.completionQueue = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+            self.contexts[context.identifier] = context;
+        }
+    }
+    [context.playlistLoader configureWithAuthConfig:authConfig];
+    return [self proxyURLForPlaylistURL:url contextID:context.identifier];
+}
+
+- (NSURL *)proxyURLForPlaylistURL:(NSString *)url contextID:(NSString *)contextID {
+    uint16_t port = self.port;
+    if (!self.running || port == 0) {
+        return nil;
+    }
+    NSString *path = [self proxyPathForURL:[NSURL URLWithString:url] route:M3U8ResourceRoutePlaylist contextID:contextID];
+    if (!path) {
+        return nil;
+    }
+    return [NSURL URLWithString:[NSString stringWithFormat:@"http://127.0.0.1:%u%@", port, path]];
+}
+
+/**
+ * 查找仍然有效的上下文
+ */
+- (M3U8ProxyContext *)contextForIdentifier:(NSString *)identifier {
+    @synchronized (self.contexts) {
+        M3U8ProxyContext *context = self.contexts[identifier];
+        return context.keyManager ? context : nil;
+    }
+}
+
+- (NSDictionary *)statistics {
+    __block NSUInteger connectionCount = 0;
+    dispatch_sync(self.acceptQueue, ^{
+        connectionCount = self.connections.count;
+    });
+    
+    NSMutableDictionary *requests = [NSMutableDictionary dictionary];
+    for (NSNumber *route in self.requestCounters) {
+        M3U8MetricCounter *counter = self.requestCounters[route];
+        requests[counter.labels[@"route"]] = @(counter.value);
+    }
+    
+    NSUInteger contextCount = 0;
+    @synchronized (self.contexts) {
+        contextCount = self.contexts.count;
+    }
+    
+    return @{
+        @"running": @(self.running),
+        @"port": @(self.port),
+        @"connections": @(connectionCount),
+        @"contexts": @(contextCount),
+        @"requests": requests,
+        @"bytesSent": @(self.bytesSentCounter.value),
+        @"segmentCacheHits": @(self.segmentCacheHitCounter.value),
+        @"segmentCacheMisses": @(self.segmentCacheMissCounter.value),
+        @"cachesSegments": @(self.cachesSegments)
+    };
+}
+
+#pragma mark - Connections
+
+- (void)acceptConnectionsOnSocket:(int)listenSocket {
+    while (YES) {
+        int client = accept(listenSocket, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // 没有更多等待的连接
+            return;
+        }
+        
+        // 接受的套接字继承了非阻塞标志，连接上使用阻塞读写 + 超时
+        fcntl(client, F_SETFL, fcntl(client, F_GETFL) & ~O_NONBLOCK);
+        int yes = 1;
+#ifdef __APPLE__
+        setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+#endif
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        struct timeval timeout = {.tv_sec = (long)kProxyIdleTimeout, .tv_usec = 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        
+        M3U8ProxyConnection *connection = [[M3U8ProxyConnection alloc] initWithSocket:client];
+        [self.connections addObject:connection];
+        [self readNextRequestOnConnection:connection];
+    }
+}
+
+- (void)closeConnection:(M3U8ProxyConnection *)connection {
+    [connection close];
+    dispatch_async(self.acceptQueue, ^{
+        [self.connections removeObject:connection];
+    });
+}
+
+- (void)readNextRequestOnConnection:(M3U8ProxyConnection *)connection {
+    dispatch_async(connection.queue, ^{
+        M3U8ProxyRequest *request = [self readRequestOnConnection:connection];
+        if (!request) {
+            // 对端关闭、空闲超时、请求无法解析或代理已停止
+            [self closeConnection:connection];
+            return;
+        }
+        [self handleRequest:request onConnection:connection];
+    });
+}
+
+/**
+ * 读取并解析一个请求头（须在连接队列上调用）
+ * GET/HEAD请求没有请求体，请求头之后的数据属于下一个请求，留在缓冲区中
+ */
+- (M3U8ProxyRequest *)readRequestOnConnection:(M3U8ProxyConnection *)connection {
+    NSData *terminator = [NSData dataWithBytes:"\r\n\r\n" length:4];
+    NSMutableData *buffer = connection.buffer;
+    while (YES) {
+        NSRange end = [buffer rangeOfData:terminator options:0 range:NSMakeRange(0, buffer.length)];
+        if (end.location != NSNotFound) {
+            NSData *headerData = [buffer subdataWithRange:NSMakeRange(0, end.location)];
+            [buffer replaceBytesInRange:NSMakeRange(0, NSMaxRange(end)) withBytes:NULL length:0];
+            return [self requestFromHeaderData:headerData];
+        }
+        if (buffer.length > kProxyMaxHeaderLength) {
+            return nil;
+        }
+        
+        uint8_t chunk[kProxyReadBufferSize];
+        ssize_t received = recv(connection.socket, chunk, sizeof(chunk), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return nil;
+        }
+        [buffer appendBytes:chunk length:(NSUInteger)received];
+    }
+}
+
+- (M3U8ProxyRequest *)requestFromHeaderData:(NSData *)headerData {
+    NSString *header = [[NSString alloc] initWithData:headerData encoding:NSUTF8StringEncoding];
+    NSArray<NSString *> *lines = [header componentsSeparatedByString:@"\r\n"];
+    NSArray<NSString *> *parts = [lines.firstObject componentsSeparatedByString:@" "];
+    if (parts.count != 3) {
+        return nil;
+    }
+    NSURLComponents *components = [NSURLComponents componentsWithString:parts[1]];
+    if (!components) {
+        return nil;
+    }
+    
+    M3U8ProxyRequest *request = [[M3U8ProxyRequest alloc] init];
+    request.method = parts[0].uppercaseString;
+    request.path = components.path ?: @"/";
+    for (NSURLQueryItem *item in components.queryItems) {
+        if ([item.name isEqualToString:@"url"]) {
+            request.targetURL = item.value;
+        } else if ([item.name isEqualToString:@"ctx"]) {
+            request.contextID = item.value;
+        }
+    }
+    
+    NSMutableDictionary<NSString *, NSString *> *headers = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 1; i < lines.count; i++) {
+        NSString *line = lines[i];
+        NSRange colon = [line rangeOfString:@":"];
+        if (colon.location == NSNotFound) {
+            continue;
+        }
+        NSString *name = [[line substringToIndex:colon.location] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+        NSString *value = [[line substringFromIndex:NSMaxRange(colon)] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+        headers[name.lowercaseString] = value;
+    }
+    request.headers = headers;
+    
+    // HTTP/1.1默认保持连接，HTTP/1.0需要显式声明
+    NSString *connectionHeader = headers[@"connection"].lowercaseString;
+    if ([parts[2] isEqualToString:@"HTTP/1.1"]) {
+        request.keepAlive = ![connectionHeader isEqualToString:@"close"];
+    } else {
+        request.keepAlive = [connectionHeader isEqualToString:@"keep-alive"];
+    }
+    return request;
+}
+
+#pragma mark - Request Handlers
+
+/**
+ * 按路径分发请求（在连接队列上调用）
+ */
+- (void)handleRequest:(M3U8ProxyRequest *)request onConnection:(M3U8ProxyConnection *)connection {
+    NSNumber *routeNumber = self.routes[request.path.lastPathComponent.stringByDeletingPathExtension];
+    M3U8ResourceRoute route = routeNumber ? routeNumber.integerValue : M3U8ResourceRouteNone;
+    [self.requestCounters[@(route)] increment];
+    
+    // 只接受发往代理地址本身的请求，拒绝通过其他主机名（如DNS重绑定）转发来的请求
+    NSString *expectedHost = [NSString stringWithFormat:@"127.0.0.1:%u", self.port];
+    if (![[request.headers[@"host"] lowercaseString] isEqualToString:expectedHost]) {
+        [self sendStatus:403 forRequest:request onConnection:connection];
+        return;
+    }
+    if (![request.method isEqualToString:@"GET"] && !request.isHead) {
+        [self sendStatus:405 forRequest:request onConnection:connection];
+        return;
+    }
+    if (route == M3U8ResourceRouteNone) {
+        [self sendStatus:404 forRequest:request onConnection:connection];
+        return;
+    }
+    
+    // 只代理http/https地址
+    NSURL *targetURL = [NSURL URLWithString:request.targetURL];
+    NSString *scheme = targetURL.scheme.lowercaseString;
+    if (![scheme isEqualToString:@"http"] && ![scheme isEqualToString:@"https"]) {
+        [self sendStatus:400 forRequest:request onConnection:connection];
+        return;
+    }
+    if (![self isAllowedTargetURL:targetURL]) {
+        NSLog(@"[M3U8LocalProxyServer] 拒绝代理未允许的主机: %@", targetURL.host);
+        [self sendStatus:403 forRequest:request onConnection:connection];
+        return;
+    }
+    
+    // 带ctx参数的请求使用注册时的密钥管理器和授权信息，上下文已失效（播放器管理器已释放）时返回404
+    M3U8ProxyContext *context = nil;
+    if (request.contextID) {
+        context = [self contextForIdentifier:request.contextID];
+        if (!context) {
+            [self sendStatus:404 forRequest:request onConnection:connection];
+            return;
+        }
+    }
+    
+    switch (route) {
+        case M3U8ResourceRoutePlaylist:
+            [self handlePlaylistRequest:request context:context onConnection:connection];
+            break;
+        case M3U8ResourceRouteKey:
+            [self handleKeyRequest:request context:context onConnection:connection];
+            break;
+        case M3U8ResourceRouteSegment:
+            [self handleSegmentRequest:request onConnection:connection];
+            break;
+        case M3U8ResourceRouteNone:
+            break;
+    }
+}
+
+- (void)handlePlaylistRequest:(M3U8ProxyRequest *)request context:(M3U8ProxyContext *)context onConnection:(M3U8ProxyConnection *)connection {
+    NSString *url = request.targetURL;
+    M3U8Loader *loader = context ? context.playlistLoader : self.playlistLoader;
+    [loader loadM3U8DataWithURL:url completion:^(NSData * _Nullable data, NSError * _Nullable error) {
+        NSString *content = data ? [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding] : nil;
+        if (!content) {
+            NSLog(@"[M3U8LocalProxyServer] 播放列表加载失败: %@ - %@", url, error.localizedDescription);
+            [self sendStatus:502 forRequest:request onConnection:connection];
+            return;
+        }
+        NSString *rewritten = [self rewrittenPlaylist:content baseURL:[NSURL URLWithString:url] contextID:context.identifier];
+        [self sendData:[rewritten dataUsingEncoding:NSUTF8StringEncoding]
+           contentType:@"application/vnd.apple.mpegurl"
+            forRequest:request
+          onConnection:connection];
+    }];
+}
+
+- (void)handleKeyRequest:(M3U8ProxyRequest *)request context:(M3U8ProxyContext *)context onConnection:(M3U8ProxyConnection *)connection {
+    NSString *url = request.targetURL;
+    M3U8KeyManager *keyManager = context ? context.keyManager : self.keyManager;
+    if (!keyManager) {
+        [self sendStatus:404 forRequest:request onConnection:connection];
+        return;
+    }
+    [keyManager loadKeyDataForURL:url completion:^(NSData * _Nullable keyData, NSError * _Nullable error) {
+        if (!keyData) {
+            NSLog(@"[M3U8LocalProxyServer] 密钥获取失败: %@ - %@", url, error.localizedDescription);
+            [self sendStatus:502 forRequest:request onConnection:connection];
+            return;
+        }
+        [self sendData:keyData contentType:@"application/octet-stream" forRequest:request onConnection:connection];
+    }];
+}
+
+/**
+ * 分片：缓存命中时用sendfile发送缓存文件；未命中时从CDN边下载边转发，完整分片下载完成后写入缓存
+ * 未命中的Range请求原样转发给源站，只取需要的部分，响应不写入缓存
+ */
+- (void)handleSegmentRequest:(M3U8ProxyRequest *)request onConnection:(M3U8ProxyConnection *)connection {
+    NSString *url = request.targetURL;
+    NSString *contentType = M3U8ProxyContentTypeForExtension([NSURL URLWithString:url].pathExtension);
+    NSString *rangeHeader = request.headers[@"range"];
+    BOOL cachesSegments = self.cachesSegments;
+    
+    if (cachesSegments) {
+        NSString *filePath = [[M3U8SegmentCache sharedCache] filePathForURL:url];
+        if (filePath && [self sendFileAtPath:filePath contentType:contentType forRequest:request onConnection:connection]) {
+            [self.segmentCacheHitCounter increment];
+            return;
+        }
+    }
+    [self.segmentCacheMissCounter increment];
+    
+    // 改写到等价CDN主机中当前最优的一个，走CDN共享会话复用连接
+    NSURL *realURL = [[M3U8HostSelector sharedSelector] preferredURLForURL:[NSURL URLWithString:url]];
+    NSMutableURLRequest *upstreamRequest = [NSMutableURLRequest requestWithURL:realURL];
+    // 不接受压缩编码，Content-Length才是转发给播放器的实际长度
+    [upstreamRequest setValue:@"identity" forHTTPHeaderField:@"Accept-Encoding"];
+    if (rangeHeader) {
+        [upstreamRequest setValue:rangeHeader forHTTPHeaderField:@"Range"];
+    }
+    BOOL storesSegment = cachesSegments && !rangeHeader;
+    
+    M3U8ProxyStream *stream = [[M3U8ProxyStream alloc] init];
+    stream.request = request;
+    stream.connection = connection;
+    stream.contentType = contentType;
+    
+    M3U8SessionPool *pool = [M3U8SessionPool sharedPool];
+    AFHTTPSessionManager *sessionManager = [pool sessionManagerForHostClass:M3U8HostClassCDN];
+    __block __weak NSURLSessionDataTask *weakTask = nil;
+    NSURLSessionDataTask *task = [sessionManager dataTaskWithRequest:upstreamRequest uploadProgress:nil downloadProgress:nil completionHandler:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject, NSError * _Nullable error) {
+        NSData *data = [responseObject isKindOfClass:[NSData class]] ? responseObject : nil;
+        if (error) {
+            NSLog(@"[M3U8LocalProxyServer] 分片下载失败: %@ - %@", realURL, error.localizedDescription);
+        } else if (storesSegment && data && ((NSHTTPURLResponse *)response).statusCode == 200) {
+            [[M3U8SegmentCache sharedCache] storeData:data forURL:url];
+        }
+        dispatch_async(connection.queue, ^{
+            [self finishStream:stream response:(NSHTTPURLResponse *)response error:error];
+        });
+    }];
+    weakTask = task;
+    stream.task = task;
+    
+    // 数据到达后立即交给连接队列写出，首字节不必等整个分片下载完
+    [pool setDataHandler:^(NSData *data) {
+        NSHTTPURLResponse *response = (NSHTTPURLResponse *)weakTask.response;
+        if (response.statusCode < 200 || response.statusCode >= 300) {
+            // 错误响应体不转发，完成时返回502
+            return;
+        }
+        dispatch_async(connection.queue, ^{
+            [self stream:stream didReceiveData:data response:response];
+        });
+    } forTask:task];
+    [task resume];
+}
+
+#pragma mark - Segment Streaming
+
+/**
+ * 写出一块分片数据，第一块之前先写响应头（须在连接队列上调用）
+ */
+- (void)stream:(M3U8ProxyStream *)stream didReceiveData:(NSData *)data response:(NSHTTPURLResponse *)response {
+    if (stream.failed) {
+        return;
+    }
+    if (!stream.headerSent && ![self writeHeaderForStream:stream response:response status:response.statusCode]) {
+        [self failStream:stream];
+        return;
+    }
+    if (stream.request.isHead) {
+        return;
+    }
+    if (!M3U8ProxyWriteAll(stream.connection.socket, data.bytes, data.length)) {
+        [self failStream:stream];
+        return;
+    }
+    [self.bytesSentCounter add:(int64_t)data.length];
+}
+
+/**
+ * 源站下载结束（须在连接队列上调用）
+ * 尚未写出任何数据时返回502（源站416原样返回）；已开始转发后出错只能断开连接，由播放器重试
+ */
+- (void)finishStream:(M3U8ProxyStream *)stream response:(NSHTTPURLResponse *)response error:(NSError *)error {
+    if (stream.failed) {
+        return;
+    }
+    M3U8ProxyRequest *request = stream.request;
+    M3U8ProxyConnection *connection = stream.connection;
+    
+    if (error && stream.headerSent) {
+        [self closeConnection:connection];
+        return;
+    }
+    if (error && response.statusCode != 416) {
+        [self writeStatus:502 forRequest:request onConnection:connection];
+        return;
+    }
+    
+    // 空响应体或源站416时还没有写出响应头
+    if (!stream.headerSent && ![self writeHeaderForStream:stream response:response status:error ? 416 : response.statusCode]) {
+        [self closeConnection:connection];
+        return;
+    }
+    if (stream.keepAlive) {
+        [self readNextRequestOnConnection:connection];
+    } else {
+        [self closeConnection:connection];
+    }
+}
+
+/**
+ * 按源站响应写出响应头：状态码、Content-Length和Content-Range与源站一致（须在连接队列上调用）
+ */
+- (BOOL)writeHeaderForStream:(M3U8ProxyStream *)stream response:(NSHTTPURLResponse *)response status:(NSInteger)status {
+    stream.headerSent = YES;
+    long long contentLength = (status == 416) ? 0 : response.expectedContentLength;
+    stream.keepAlive = stream.request.keepAlive && contentLength >= 0;
+    
+    NSMutableString *header = [NSMutableString stringWithFormat:@"HTTP/1.1 %ld %@\r\n", (long)status, M3U8ProxyStatusText(status)];
+    [header appendFormat:@"Content-Type: %@\r\n", stream.contentType];
+    if (contentLength >= 0) {
+        [header appendFormat:@"Content-Length: %lld\r\n", contentLength];
+    }
+    [header appendString:@"Accept-Ranges: bytes\r\n"];
+    NSString *contentRange = [response valueForHTTPHeaderField:@"Content-Range"];
+    if (contentRange) {
+        [header appendFormat:@"Content-Range: %@\r\n", contentRange];
+    }
+    [header appendFormat:@"Connection: %@\r\n\r\n", stream.keepAlive ? @"keep-alive" : @"close"];
+    
+    const char *headerBytes = header.UTF8String;
+    return M3U8ProxyWriteAll(stream.connection.socket, (const uint8_t *)headerBytes, strlen(headerBytes));
+}
+
+/**
+ * 写入客户端失败：取消源站下载并关闭连接（须在连接队列上调用）
+ */
+- (void)failStream:(M3U8ProxyStream *)stream {
+    stream.failed = YES;
+    [stream.task cancel];
+    [self closeConnection:stream.connection];
+}
+
+#pragma mark - Allowed Hosts
+
+- (NSString *)authorityForURL:(NSURL *)url {
+    NSString *host = url.host.lowercaseString;
+    if (host.length == 0) {
+        return nil;
+    }
+    return url.port ? [NSString stringWithFormat:@"%@:%@", host, url.port] : host;
+}
+
+/**
+ * 目标地址是否属于允许代理的源站
+ */
+- (BOOL)isAllowedTargetURL:(NSURL *)url {
+    NSString *authority = [self authorityForURL:url];
+    if (!authority) {
+        return NO;
+    }
+    @synchronized (self.allowedAuthorities) {
+        if ([self.allowedAuthorities containsObject:authority]) {
+            return YES;
+        }
+    }
+    if ([[M3U8HostSelector sharedSelector] containsHostForURL:url]) {
+        return YES;
+    }
+    NSURL *keyServerURL = [[M3U8Preconnector sharedPreconnector] knownKeyServerURL];
+    return keyServerURL && [[self authorityForURL:keyServerURL] isEqualToString:authority];
+}
+
+#pragma mark - Responses
+
+- (void)sendData:(NSData *)data
+     contentType:(NSString *)contentType
+      forRequest:(M3U8ProxyRequest *)request
+    onConnection:(M3U8ProxyConnection *)connection {
+    dispatch_async(connection.queue, ^{
+        // 直接从数据所在的内存写出，不再复制到发送缓冲区
+        const uint8_t *bytes = data.bytes;
+        int socket = connection.socket;
+        [self writeResponseForRequest:request
+                         onConnection:connection
+                               status:200
+                          contentType:contentType
+                          totalLength:data.length
+                                 body:^BOOL(unsigned long long offset, unsigned long long length) {
+            return M3U8ProxyWriteAll(socket, bytes + offset, (size_t)length);
+        }];
+    });
+}
+
+/**
+ * 用sendfile发送文件，数据不经过用户态（须在连接队列上调用）
+ * @return 文件无法打开时返回NO，此时尚未写出任何数据
+ */
+- (BOOL)sendFileAtPath:(NSString *)filePath
+           contentType:(NSString *)contentType
+            forRequest:(M3U8ProxyRequest *)request
+          onConnection:(M3U8ProxyConnection *)connection {
+    int file = open(filePath.fileSystemRepresentation, O_RDONLY);
+    if (file < 0) {
+        return NO;
+    }
+    struct stat fileStat;
+    if (fstat(file, &fileStat) != 0) {
+        close(file);
+        return NO;
+    }
+    
+    int socket = connection.socket;
+    [self writeResponseForRequest:request
+                     onConnection:connection
+                           status:200
+                      contentType:contentType
+                      totalLength:(unsigned long long)fileStat.st_size
+                             body:^BOOL(unsigned long long offset, unsigned long long length) {
+        return M3U8ProxySendFile(file, socket, (off_t)offset, (off_t)length);
+    }];
+    close(file);
+    return YES;
+}
+
+- (void)sendStatus:(NSInteger)status forRequest:(M3U8ProxyRequest *)request onConnection:(M3U8ProxyConnection *)connection {
+    dispatch_async(connection.queue, ^{
+        [self writeStatus:status forRequest:request onConnection:connection];
+    });
+}
+
+/**
+ * 写出只有状态文本的响应（须在连接队列上调用）
+ */
+- (void)writeStatus:(NSInteger)status forRequest:(M3U8ProxyRequest *)request onConnection:(M3U8ProxyConnection *)connection {
+    NSData *body = [M3U8ProxyStatusText(status) dataUsingEncoding:NSUTF8StringEncoding];
+    int socket = connection.socket;
+    [self writeResponseForRequest:request
+                     onConnection:connection
+                           status:status
+                      contentType:@"text/plain; charset=utf-8"
+                      totalLength:body.length
+                             body:^BOOL(unsigned long long offset, unsigned long long length) {
+        return M3U8ProxyWriteAll(socket, (const uint8_t *)body.bytes + offset, (size_t)length);
+    }];
+}
+
+/**
+ * 写出响应头和响应体，然后读取同一连接上的下一个请求（须在连接队列上调用）
+ * 200响应按Range头返回206或416；HEAD请求只写响应头
+ * @param body 写出指定范围的内容，返回是否成功
+ */
+- (void)writeResponseForRequest:(M3U8ProxyRequest *)request
+                   onConnection:(M3U8ProxyConnection *)connection
+                         status:(NSInteger)status
+                    contentType:(NSString *)contentType
+                    totalLength:(unsigned long long)totalLength
+                           body:(BOOL(^)(unsigned long long offset, unsigned long long length))body {
+    unsigned long long start = 0;
+    unsigned long long length = totalLength;
+    NSString *contentRange = nil;
+    
+    NSString *rangeHeader = request.headers[@"range"];
+    if (status == 200 && rangeHeader) {
+        switch (M3U8ProxyParseRange(rangeHeader, totalLength, &start, &length)) {
+            case M3U8ProxyRangeValid:
+                status = 206;
+                contentRange = [NSString stringWithFormat:@"bytes %llu-%llu/%llu", start, start + length - 1, totalLength];
+                break;
+            case M3U8ProxyRangeUnsatisfiable:
+                status = 416;
+                contentRange = [NSString stringWithFormat:@"bytes */%llu", totalLength];
+                start = 0;
+                length = 0;
+                break;
+            case M3U8ProxyRangeNone:
+                break;
+        }
+    }
+    
+    NSMutableString *header = [NSMutableString stringWithFormat:@"HTTP/1.1 %ld %@\r\n", (long)status, M3U8ProxyStatusText(status)];
+    [header appendFormat:@"Content-Type: %@\r\n", contentType];
+    [header appendFormat:@"Content-Length: %llu\r\n", length];
+    [header appendString:@"Accept-Ranges: bytes\r\n"];
+    if (contentRange) {
+        [header appendFormat:@"Content-Range: %@\r\n", contentRange];
+    }
+    [header appendFormat:@"Connection: %@\r\n\r\n", request.keepAlive ? @"keep-alive" : @"close"];
+    
+    const char *headerBytes = header.UTF8String;
+    BOOL succeeded = M3U8ProxyWriteAll(connection.socket, (const uint8_t *)headerBytes, strlen(headerBytes));
+    if (succeeded && !request.isHead && length > 0) {
+        succeeded = body(start, length);
+        if (succeeded) {
+            [self.bytesSentCounter add:(int64_t)length];
+        }
+    }
+    
+    if (succeeded && request.keepAlive) {
+        [self readNextRequestOnConnection:connection];
+    } else {
+        [self closeConnection:connection];
+    }
+}
+
+#pragma mark - Playlist Rewriting
+
+/**
+ * 把播放列表中的子播放列表、密钥、初始化分片和媒体分片地址改写为代理地址
+ * 使用以 / 开头的路径，与代理端口无关；非http(s)地址（如skd://）保持不变
+ * 播放列表来自允许的源站，其中引用的主机随改写一并允许；改写后的地址沿用播放列表的上下文标识
+ */
+- (NSString *)rewrittenPlaylist:(NSString *)content baseURL:(NSURL *)baseURL contextID:(NSString *)contextID {
+    NSMutableArray<NSString *> *lines = [NSMutableArray array];
+    BOOL nextIsVariant = NO;
+    
+    for (NSString *rawLine in [content componentsSeparatedByString:@"\n"]) {
+        NSString *line = [rawLine stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
+        if (line.length == 0) {
+            [lines addObject:line];
+            continue;
+        }
+        
+        if ([line hasPrefix:@"#"]) {
+            if ([line hasPrefix:@"#EXT-X-STREAM-INF:"]) {
+                nextIsVariant = YES;
+            }
+            NSRange colon = [line rangeOfString:@":"];
+            NSNumber *uriRoute = colon.location != NSNotFound ? self.uriTagRoutes[[line substringToIndex:NSMaxRange(colon)]] : nil;
+            if (uriRoute) {
+                line = [self line:line rewritingURIWithRoute:uriRoute.integerValue baseURL:baseURL contextID:contextID];
+            }
+            [lines addObject:line];
+            continue;
+        }
+        
+        // URI行：#EXT-X-STREAM-INF之后是子播放列表，其余是媒体分片
+        NSURL *resolvedURL = [NSURL URLWithString:line relativeToURL:baseURL].absoluteURL;
+        BOOL isPlaylist = nextIsVariant || [resolvedURL.pathExtension.lowercaseString isEqualToString:@"m3u8"];
+        nextIsVariant = NO;
+        NSString *proxyPath = [self proxyPathForURL:resolvedURL route:isPlaylist ? M3U8ResourceRoutePlaylist : M3U8ResourceRouteSegment contextID:contextID];
+        [lines addObject:proxyPath ?: line];
+    }
+    
+    return [lines componentsJoinedByString:@"\n"];
+}
+
+- (NSString *)line:(NSString *)line rewritingURIWithRoute:(M3U8ResourceRoute)route baseURL:(NSURL *)baseURL contextID:(NSString *)contextID {
+    NSRange attribute = [line rangeOfString:@"URI=\""];
+    if (attribute.location == NSNotFound) {
+        return line;
+    }
+    NSUInteger valueStart = NSMaxRange(attribute);
+    NSRange quote = [line rangeOfString:@"\"" options:0 range:NSMakeRange(valueStart, line.length - valueStart)];
+    if (quote.location == NSNotFound) {
+        return line;
+    }
+    NSRange valueRange = NSMakeRange(valueStart, quote.location - valueStart);
+    NSURL *resolvedURL = [NSURL URLWithString:[line substringWithRange:valueRange] relativeToURL:baseURL].absoluteURL;
+    NSString *proxyPath = [self proxyPathForURL:resolvedURL route:route contextID:contextID];
+    if (!proxyPath) {
+        return line;
+    }
+    return [line stringByReplacingCharactersInRange:valueRange withString:proxyPath];
+}
+
+- (NSString *)proxyPathForURL:(NSURL *)url route:(M3U8ResourceRoute)route contextID:(NSString *)contextID {
+    NSString *scheme = url.scheme.lowercaseString;
+    NSString *authority = [self authorityForURL:url];
+    if ((![scheme isEqualToString:@"http"] && ![scheme isEqualToString:@"https"]) || !authority) {
+        return nil;
+    }
+    [self addAllowedHost:authority];
+    
+    NSString *path = nil;
+    switch (route) {
+        case M3U8ResourceRoutePlaylist:
+            path = @"/playlist.m3u8";
+            break;
+        case M3U8ResourceRouteKey:
+            path = @"/key";
+            break;
+        default: {
+            // 保留原扩展名，播放器据此判断分片格式
+            NSString *pathExtension = url.pathExtension.lowercaseString;
+            path = [@"/segment." stringByAppendingString:pathExtension.length > 0 ? pathExtension : @"ts"];
+            break;
+        }
+    }
+    NSString *encodedURL = [url.absoluteString stringByAddingPercentEncodingWithAllowedCharacters:M3U8ProxyQueryValueAllowedCharacters()];
+    if (contextID) {
+        return [NSString stringWithFormat:@"%@?url=%@&ctx=%@", path, encodedURL, contextID];
+    }
+    return [NSString stringWithFormat:@"%@?url=%@", path, encodedURL];
+}
+
+@end
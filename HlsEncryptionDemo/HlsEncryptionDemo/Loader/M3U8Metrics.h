@@ -0,0 +1,148 @@
+//
+//  M3U8Metrics.h
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 缓存层级
+ */
+typedef NS_ENUM(NSInteger, M3U8CacheTier) {
+    M3U8CacheTierMemory = 0,   // 内存缓存
+    M3U8CacheTierDisk,         // 磁盘缓存
+    M3U8CacheTierCount
+};
+
+/**
+ * 缓存淘汰原因
+ */
+typedef NS_ENUM(NSInteger, M3U8EvictionReason) {
+    M3U8EvictionReasonExpired = 0,     // 过期
+    M3U8EvictionReasonFileCount,       // 超过文件数限制
+    M3U8EvictionReasonSize,            // 超过容量限制
+    M3U8EvictionReasonMissingFile,     // 缓存文件丢失
+    M3U8EvictionReasonCleared,         // 手动清空
+    M3U8EvictionReasonCount
+};
+
+/**
+ * 网络请求阶段
+ */
+typedef NS_ENUM(NSInteger, M3U8RequestPhase) {
+    M3U8RequestPhaseDNS = 0,       // 域名解析
+    M3U8RequestPhaseConnect,       // TCP连接
+    M3U8RequestPhaseTLS,           // TLS握手
+    M3U8RequestPhaseTTFB,          // 首字节时间
+    M3U8RequestPhaseTransfer,      // 数据传输
+    M3U8RequestPhaseTotal,         // 请求总耗时
+    M3U8RequestPhaseCount
+};
+
+/**
+ * 单调递增计数器 / 仪表盘数值
+ * 读写均为原子操作，不加锁
+ */
+@interface M3U8MetricCounter : NSObject
+@property (nonatomic, copy, readonly) NSString *name;
+@property (nonatomic, copy, readonly) NSDictionary<NSString *, NSString *> *labels;
+@property (nonatomic, assign, readonly) int64_t value;
+
+- (void)increment;
+- (void)add:(int64_t)delta;
+- (void)setValue:(int64_t)value;
+@end
+
+/**
+ * 延迟直方图（秒）
+ * 固定桶边界，记录为原子操作，不加锁
+ */
+@interface M3U8LatencyHistogram : NSObject
+@property (nonatomic, copy, readonly) NSString *name;
+@property (nonatomic, copy, readonly) NSDictionary<NSString *, NSString *> *labels;
+@property (nonatomic, assign, readonly) int64_t count;
+@property (nonatomic, assign, readonly) NSTimeInterval sum;
+
+- (void)recordSeconds:(NSTimeInterval)seconds;
+
+/**
+ * 按直方图估算分位数
+ * @param quantile 分位（0.0 - 1.0）
+ * @return 估算值（秒），没有样本时返回0
+ */
+- (NSTimeInterval)estimatedQuantile:(double)quantile;
+@end
+
+/**
+ * 缓存与加载器指标中心
+ * 热路径只做原子加法；快照可导出为JSON或Prometheus文本格式
+ */
+@interface M3U8Metrics : NSObject
+
+/**
+ * 获取共享指标实例
+ */
++ (instancetype)sharedMetrics;
+
+#pragma mark - 缓存指标
+
+- (void)recordCacheHitForTier:(M3U8CacheTier)tier latency:(NSTimeInterval)latency;
+- (void)recordCacheMissForTier:(M3U8CacheTier)tier;
+- (void)recordBytesRead:(NSUInteger)bytes forTier:(M3U8CacheTier)tier;
+- (void)recordBytesWritten:(NSUInteger)bytes forTier:(M3U8CacheTier)tier;
+- (void)recordEvictions:(NSUInteger)count reason:(M3U8EvictionReason)reason;
+
+#pragma mark - 网络指标
+
+/**
+ * 记录一次网络请求的分阶段耗时（DNS/连接/TLS/首字节/传输）
+ */
+- (void)recordTaskMetrics:(NSURLSessionTaskMetrics *)metrics;
+
+/**
+ * 记录网络下载字节数
+ */
+- (void)recordNetworkBytes:(NSUInteger)bytes;
+
+/**
+ * 获取指定阶段的延迟直方图
+ */
+- (M3U8LatencyHistogram *)histogramForPhase:(M3U8RequestPhase)phase;
+
+#pragma mark - 自定义指标
+
+/**
+ * 获取（不存在时注册）命名计数器，调用方应持有返回值以避免重复查找
+ */
+- (M3U8MetricCounter *)counterNamed:(NSString *)name labels:(NSDictionary<NSString *, NSString *> * _Nullable)labels;
+
+/**
+ * 获取（不存在时注册）命名直方图
+ */
+- (M3U8LatencyHistogram *)histogramNamed:(NSString *)name labels:(NSDictionary<NSString *, NSString *> * _Nullable)labels;
+
+#pragma mark - 导出
+
+/**
+ * 当前所有指标的快照
+ */
+- (NSDictionary *)snapshot;
+
+/**
+ * 以JSON格式导出快照
+ */
+- (NSString *)JSONString;
+
+/**
+ * 以Prometheus文本格式导出快照
+ */
+- (NSString *)prometheusText;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,424 @@
+//
+//  M3U8Metrics.m
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import "M3U8Metrics.h"
+#import <stdatomic.h>
+#import <os/lock.h>
+
+// 直方图桶上边界（秒），最后一个桶为 +Inf
+static const double kHistogramBounds[] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0};
+#define kHistogramBoundCount ((NSInteger)(sizeof(kHistogramBounds) / sizeof(kHistogramBounds[0])))
+
+static NSString *M3U8CacheTierName(M3U8CacheTier tier) {
+    switch (tier) {
+        case M3U8CacheTierMemory: return @"memory";
+        case M3U8CacheTierDisk: return @"disk";
+        default: return @"unknown";
+    }
+}
+
+static NSString *M3U8EvictionReasonName(M3U8EvictionReason reason) {
+    switch (reason) {
+        case M3U8EvictionReasonExpired: return @"expired";
+        case M3U8EvictionReasonFileCount: return @"file_count";
+        case M3U8EvictionReasonSize: return @"size";
+        case M3U8EvictionReasonMissingFile: return @"missing_file";
+        case M3U8EvictionReasonCleared: return @"cleared";
+        default: return @"unknown";
+    }
+}
+
+static NSString *M3U8RequestPhaseName(M3U8RequestPhase phase) {
+    switch (phase) {
+        case M3U8RequestPhaseDNS: return @"dns";
+        case M3U8RequestPhaseConnect: return @"connect";
+        case M3U8RequestPhaseTLS: return @"tls";
+        case M3U8RequestPhaseTTFB: return @"ttfb";
+        case M3U8RequestPhaseTransfer: return @"transfer";
+        case M3U8RequestPhaseTotal: return @"total";
+        default: return @"unknown";
+    }
+}
+
+static NSString *M3U8MetricKey(NSString *name, NSDictionary<NSString *, NSString *> *labels) {
+    if (labels.count == 0) {
+        return name;
+    }
+    NSMutableArray *pairs = [NSMutableArray arrayWithCapacity:labels.count];
+    for (NSString *key in [labels.allKeys sortedArrayUsingSelector:@selector(compare:)]) {
+        [pairs addObject:[NSString stringWithFormat:@"%@=\"%@\"", key, labels[key]]];
+    }
+    return [NSString stringWithFormat:@"%@{%@}", name, [pairs componentsJoinedByString:@","]];
+}
+
+@interface M3U8MetricCounter ()
+- (instancetype)initWithName:(NSString *)name labels:(NSDictionary<NSString *, NSString *> * _Nullable)labels;
+@end
+
+@interface M3U8LatencyHistogram ()
+- (instancetype)initWithName:(NSString *)name labels:(NSDictionary<NSString *, NSString *> * _Nullable)labels;
+- (NSArray<NSNumber *> *)bucketCounts;
+@end
+
+// MARK: - M3U8MetricCounter Implementation
+@implementation M3U8MetricCounter {
+    atomic_llong _atomicValue;
+}
+
+- (instancetype)initWithName:(NSString *)name labels:(NSDictionary<NSString *, NSString *> *)labels {
+    self = [super init];
+    if (self) {
+        _name = [name copy];
+        _labels = [labels copy] ?: @{};
+        atomic_init(&_atomicValue, 0);
+    }
+    return self;
+}
+
+- (int64_t)value {
+    return atomic_load_explicit(&_atomicValue, memory_order_relaxed);
+}
+
+- (void)increment {
+    atomic_fetch_add_explicit(&_atomicValue, 1, memory_order_relaxed);
+}
+
+- (void)add:(int64_t)delta {
+    atomic_fetch_add_explicit(&_atomicValue, delta, memory_order_relaxed);
+}
+
+- (void)setValue:(int64_t)value {
+    atomic_store_explicit(&_atomicValue, value, memory_order_relaxed);
+}
+
+@end
+
+// MARK: - M3U8LatencyHistogram Implementation
+@implementation M3U8LatencyHistogram {
+    atomic_llong _buckets[kHistogramBoundCount + 1];
+    atomic_llong _count;
+    atomic_llong _sumMicros;
+}
+
+- (instancetype)initWithName:(NSString *)name labels:(NSDictionary<NSString *, NSString *> *)labels {
+    self = [super init];
+    if (self) {
+        _name = [name copy];
+        _labels = [labels copy] ?: @{};
+        for (NSInteger i = 0; i <= kHistogramBoundCount; i++) {
+            atomic_init(&_buckets[i], 0);
+        }
+        atomic_init(&_count, 0);
+        atomic_init(&_sumMicros, 0);
+    }
+    return self;
+}
+
+- (void)recordSeconds:(NSTimeInterval)seconds {
+    if (seconds < 0 || isnan(seconds)) return;
+    
+    NSInteger index = kHistogramBoundCount;
+    for (NSInteger i = 0; i < kHistogramBoundCount; i++) {
+        if (seconds <= kHistogramBounds[i]) {
+            index = i;
+            break;
+        }
+    }
+    atomic_fetch_add_explicit(&_buckets[index], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&_sumMicros, (long long)(seconds * 1000000.0), memory_order_relaxed);
+}
+
+- (int64_t)count {
+    return atomic_load_explicit(&_count, memory_order_relaxed);
+}
+
+- (NSTimeInterval)sum {
+    return atomic_load_explicit(&_sumMicros, memory_order_relaxed) / 1000000.0;
+}
+
+- (NSArray<NSNumber *> *)bucketCounts {
+    NSMutableArray *counts = [NSMutableArray arrayWithCapacity:kHistogramBoundCount + 1];
+    for (NSInteger i = 0; i <= kHistogramBoundCount; i++) {
+        [counts addObject:@(atomic_load_explicit(&_buckets[i], memory_order_relaxed))];
+    }
+    return counts;
+}
+
+- (NSTimeInterval)estimatedQuantile:(double)quantile {
+    NSArray<NSNumber *> *counts = [self bucketCounts];
+    int64_t total = 0;
+    for (NSNumber *count in counts) {
+        total += count.longLongValue;
+    }
+    if (total == 0) return 0;
+    
+    int64_t target = (int64_t)ceil(MAX(0.0, MIN(1.0, quantile)) * total);
+    int64_t cumulative = 0;
+    for (NSInteger i = 0; i <= kHistogramBoundCount; i++) {
+        int64_t bucketCount = counts[i].longLongValue;
+        if (bucketCount == 0) continue;
+        
+        if (cumulative + bucketCount >= target) {
+            // 桶内线性插值
+            double lower = (i == 0) ? 0.0 : kHistogramBounds[i - 1];
+            double upper = (i < kHistogramBoundCount) ? kHistogramBounds[i] : kHistogramBounds[kHistogramBoundCount - 1] * 2;
+            double fraction = (double)(target - cumulative) / bucketCount;
+            return lower + (upper - lower) * fraction;
+        }
+        cumulative += bucketCount;
+    }
+    return kHistogramBounds[kHistogramBoundCount - 1];
+}
+
+@end
+
+// MARK: - M3U8Metrics Implementation
+@interface M3U8Metrics ()
+@property (nonatomic, strong) NSMutableDictionary<NSString *, M3U8MetricCounter *> *counters;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, M3U8LatencyHistogram *> *histograms;
+@end
+
+@implementation M3U8Metrics {
+    os_unfair_lock _registryLock;
+    
+    // 热路径指标预先注册，直接按下标访问
+    M3U8MetricCounter *_cacheHits[M3U8CacheTierCount];
+    M3U8MetricCounter *_cacheMisses[M3U8CacheTierCount];
+    M3U8MetricCounter *_bytesRead[M3U8CacheTierCount];
+    M3U8MetricCounter *_bytesWritten[M3U8CacheTierCount];
+    M3U8LatencyHistogram *_cacheHitLatency[M3U8CacheTierCount];
+    M3U8MetricCounter *_evictions[M3U8EvictionReasonCount];
+    M3U8LatencyHistogram *_phaseLatency[M3U8RequestPhaseCount];
+    M3U8MetricCounter *_networkBytes;
+    M3U8MetricCounter *_networkRequests;
+    M3U8MetricCounter *_reusedConnections;
+}
+
++ (instancetype)sharedMetrics {
+    static M3U8Metrics *instance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        instance = [[M3U8Metrics alloc] init];
+    });
+    return instance;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _registryLock = OS_UNFAIR_LOCK_INIT;
+        _counters = [[NSMutableDictionary alloc] init];
+        _histograms = [[NSMutableDictionary alloc] init];
+        
+        for (NSInteger tier = 0; tier < M3U8CacheTierCount; tier++) {
+            NSDictionary *labels = @{@"tier": M3U8CacheTierName(tier)};
+            _cacheHits[tier] = [self counterNamed:@"m3u8_cache_hits_total" labels:labels];
+            _cacheMisses[tier] = [self counterNamed:@"m3u8_cache_misses_total" labels:labels];
+            _bytesRead[tier] = [self counterNamed:@"m3u8_cache_bytes_read_total" labels:labels];
+            _bytesWritten[tier] = [self counterNamed:@"m3u8_cache_bytes_written_total" labels:labels];
+            _cacheHitLatency[tier] = [self histogramNamed:@"m3u8_cache_hit_latency_seconds" labels:labels];
+        }
+        for (NSInteger reason = 0; reason < M3U8EvictionReasonCount; reason++) {
+            _evictions[reason] = [self counterNamed:@"m3u8_cache_evictions_total"
+                                             labels:@{@"reason": M3U8EvictionReasonName(reason)}];
+        }
+        for (NSInteger phase = 0; phase < M3U8RequestPhaseCount; phase++) {
+            _phaseLatency[phase] = [self histogramNamed:@"m3u8_request_latency_seconds"
+                                                 labels:@{@"phase": M3U8RequestPhaseName(phase)}];
+        }
+        _networkBytes = [self counterNamed:@"m3u8_network_bytes_total" labels:nil];
+        _networkRequests = [self counterNamed:@"m3u8_network_requests_total" labels:nil];
+        _reusedConnections = [self counterNamed:@"m3u8_network_reused_connections_total" labels:nil];
+    }
+    return self;
+}
+
+#pragma mark - 缓存指标
+
+- (void)recordCacheHitForTier:(M3U8CacheTier)tier latency:(NSTimeInterval)latency {
+    if (tier < 0 || tier >= M3U8CacheTierCount) return;
+    [_cacheHits[tier] increment];
+    [_cacheHitLatency[tier] recordSeconds:latency];
+}
+
+- (void)recordCacheMissForTier:(M3U8CacheTier)tier {
+    if (tier < 0 || tier >= M3U8CacheTierCount) return;
+    [_cacheMisses[tier] increment];
+}
+
+- (void)recordBytesRead:(NSUInteger)bytes forTier:(M3U8CacheTier)tier {
+    if (tier < 0 || tier >= M3U8CacheTierCount) return;
+    [_bytesRead[tier] add:(int64_t)bytes];
+}
+
+- (void)recordBytesWritten:(NSUInteger)bytes forTier:(M3U8CacheTier)tier {
+    if (tier < 0 || tier >= M3U8CacheTierCount) return;
+    [_bytesWritten[tier] add:(int64_t)bytes];
+}
+
+- (void)recordEvictions:(NSUInteger)count reason:(M3U8EvictionReason)reason {
+    if (count == 0 || reason < 0 || reason >= M3U8EvictionReasonCount) return;
+    [_evictions[reason] add:(int64_t)count];
+}
+
+#pragma mark - 网络指标
+
+- (void)recordTaskMetrics:(NSURLSessionTaskMetrics *)metrics {
+    if (!metrics) return;
+    
+    [_networkRequests increment];
+    [_phaseLatency[M3U8RequestPhaseTotal] recordSeconds:metrics.taskInterval.duration];
+    
+    NSURLSessionTaskTransactionMetrics *transaction = metrics.transactionMetrics.lastObject;
+    if (!transaction) return;
+    
+    if (transaction.isReusedConnection) {
+        [_reusedConnections increment];
+    }
+    
+    // 复用连接时DNS/连接/TLS阶段的时间戳为空，不计入
+    [self recordPhase:M3U8RequestPhaseDNS from:transaction.domainLookupStartDate to:transaction.domainLookupEndDate];
+    [self recordPhase:M3U8RequestPhaseConnect from:transaction.connectStartDate to:transaction.connectEndDate];
+    [self recordPhase:M3U8RequestPhaseTLS from:transaction.secureConnectionStartDate to:transaction.secureConnectionEndDate];
+    [self recordPhase:M3U8RequestPhaseTTFB from:transaction.requestStartDate to:transaction.responseStartDate];
+    [self recordPhase:M3U8RequestPhaseTransfer from:transaction.responseStartDate to:transaction.responseEndDate];
+}
+
+- (void)recordPhase:(M3U8RequestPhase)phase from:(NSDate *)start to:(NSDate *)end {
+    if (!start || !end) return;
+    [_phaseLatency[phase] recordSeconds:[end timeIntervalSinceDate:start]];
+}
+
+- (void)recordNetworkBytes:(NSUInteger)bytes {
+    [_networkBytes add:(int64_t)bytes];
+}
+
+- (M3U8LatencyHistogram *)histogramForPhase:(M3U8RequestPhase)phase {
+    if (phase < 0 || phase >= M3U8RequestPhaseCount) {
+        phase = M3U8RequestPhaseTotal;
+    }
+    return _phaseLatency[phase];
+}
+
+#pragma mark - 自定义指标
+
+- (M3U8MetricCounter *)counterNamed:(NSString *)name labels:(NSDictionary<NSString *, NSString *> *)labels {
+    NSString *key = M3U8MetricKey(name, labels);
+    
+    os_unfair_lock_lock(&_registryLock);
+    M3U8MetricCounter *counter = self.counters[key];
+    if (!counter) {
+        counter = [[M3U8MetricCounter alloc] initWithName:name labels:labels];
+        self.counters[key] = counter;
+    }
+    os_unfair_lock_unlock(&_registryLock);
+    
+    return counter;
+}
+
+- (M3U8LatencyHistogram *)histogramNamed:(NSString *)name labels:(NSDictionary<NSString *, NSString *> *)labels {
+    NSString *key = M3U8MetricKey(name, labels);
+    
+    os_unfair_lock_lock(&_registryLock);
+    M3U8LatencyHistogram *histogram = self.histograms[key];
+    if (!histogram) {
+        histogram = [[M3U8LatencyHistogram alloc] initWithName:name labels:labels];
+        self.histograms[key] = histogram;
+    }
+    os_unfair_lock_unlock(&_registryLock);
+    
+    return histogram;
+}
+
+#pragma mark - 导出
+
+- (void)copyCounters:(NSArray<M3U8MetricCounter *> **)counters histograms:(NSArray<M3U8LatencyHistogram *> **)histograms {
+    os_unfair_lock_lock(&_registryLock);
+    *counters = [self.counters.allValues copy];
+    *histograms = [self.histograms.allValues copy];
+    os_unfair_lock_unlock(&_registryLock);
+}
+
+- (NSDictionary *)snapshot {
+    NSArray<M3U8MetricCounter *> *counters = nil;
+    NSArray<M3U8LatencyHistogram *> *histograms = nil;
+    [self copyCounters:&counters histograms:&histograms];
+    
+    NSMutableDictionary *counterValues = [NSMutableDictionary dictionaryWithCapacity:counters.count];
+    for (M3U8MetricCounter *counter in counters) {
+        counterValues[M3U8MetricKey(counter.name, counter.labels)] = @(counter.value);
+    }
+    
+    NSMutableDictionary *histogramValues = [NSMutableDictionary dictionaryWithCapacity:histograms.count];
+    for (M3U8LatencyHistogram *histogram in histograms) {
+        histogramValues[M3U8MetricKey(histogram.name, histogram.labels)] = @{
+            @"count": @(histogram.count),
+            @"sum": @(histogram.sum),
+            @"p50": @([histogram estimatedQuantile:0.5]),
+            @"p95": @([histogram estimatedQuantile:0.95]),
+            @"p99": @([histogram estimatedQuantile:0.99])
+        };
+    }
+    
+    return @{
+        @"timestamp": @([[NSDate date] timeIntervalSince1970]),
+        @"counters": counterValues,
+        @"histograms": histogramValues
+    };
+}
+
+- (NSString *)JSONString {
+    NSData *data = [NSJSONSerialization dataWithJSONObject:[self snapshot]
+                                                   options:NSJSONWritingSortedKeys
+                                                     error:nil];
+    return data ? [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding] : @"{}";
+}
+
+- (NSString *)prometheusText {
+    NSArray<M3U8MetricCounter *> *counters = nil;
+    NSArray<M3U8LatencyHistogram *> *histograms = nil;
+    [self copyCounters:&counters histograms:&histograms];
+    
+    NSSortDescriptor *byName = [NSSortDescriptor sortDescriptorWithKey:@"name" ascending:YES];
+    counters = [counters sortedArrayUsingDescriptors:@[byName]];
+    histograms = [histograms sortedArrayUsingDescriptors:@[byName]];
+    
+    NSMutableString *output = [NSMutableString string];
+    NSString *lastName = nil;
+    for (M3U8MetricCounter *counter in counters) {
+        if (![counter.name isEqualToString:lastName]) {
+            [output appendFormat:@"# TYPE %@ %@\n", counter.name, [counter.name hasSuffix:@"_total"] ? @"counter" : @"gauge"];
+            lastName = counter.name;
+        }
+        [output appendFormat:@"%@ %lld\n", M3U8MetricKey(counter.name, counter.labels), counter.value];
+    }
+    
+    lastName = nil;
+    for (M3U8LatencyHistogram *histogram in histograms) {
+        if (![histogram.name isEqualToString:lastName]) {
+            [output appendFormat:@"# TYPE %@ histogram\n", histogram.name];
+            lastName = histogram.name;
+        }
+        
+        NSArray<NSNumber *> *buckets = [histogram bucketCounts];
+        int64_t cumulative = 0;
+        for (NSInteger i = 0; i <= kHistogramBoundCount; i++) {
+            cumulative += buckets[i].longLongValue;
+            NSMutableDictionary *labels = [histogram.labels mutableCopy];
+            labels[@"le"] = (i < kHistogramBoundCount) ? [NSString stringWithFormat:@"%g", kHistogramBounds[i]] : @"+Inf";
+            [output appendFormat:@"%@ %lld\n", M3U8MetricKey([histogram.name stringByAppendingString:@"_bucket"], labels), cumulative];
+        }
+        [output appendFormat:@"%@ %f\n", M3U8MetricKey([histogram.name stringByAppendingString:@"_sum"], histogram.labels), histogram.sum];
+        [output appendFormat:@"%@ %lld\n", M3U8MetricKey([histogram.name stringByAppendingString:@"_count"], histogram.labels), histogram.count];
+    }
+    
+    return output;
+}
+
+@end
@@ -23,6 +23,9 @@ NS_ASSUME_NONNULL_BEGIN
                             iv:(NSString *)iv 
                      keyFormat:(NSString *)keyFormat;
 
+// 是否加密（METHOD为NONE或没有密钥URI时为NO）
+- (BOOL)isEncrypted;
+
 @end
 
 // MARK: - TS片段信息类
@@ -30,7 +33,9 @@ NS_ASSUME_NONNULL_BEGIN
 
 @property (nonatomic, assign) NSTimeInterval duration; // 片段时长
 @property (nonatomic, strong) NSString *url;           // 片段URL
-@property (nonatomic, assign) NSInteger sequence;      // 序号
+@property (nonatomic, assign) NSInteger sequence;      // 序号（媒体序列号）
+@property (nonatomic, assign) NSTimeInterval startTime; // 片段在播放列表中的起始时间
+@property (nonatomic, assign) NSInteger encryptionIndex; // 在MediaPlaylist.encryptionInfos中的下标，未加密为-1
 
 - (instancetype)initWithDuration:(NSTimeInterval)duration 
                              url:(NSString *)url 
@@ -44,9 +49,15 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, assign) NSInteger version;                       // 版本号
 @property (nonatomic, assign) NSTimeInterval targetDuration;           // 目标时长
 @property (nonatomic, strong) NSString *playlistType;                  // 播放列表类型 (VOD/LIVE)
-@property (nonatomic, strong, nullable) EncryptionInfo *encryptionInfo; // 加密信息
+@property (nonatomic, strong, nullable) EncryptionInfo *encryptionInfo; // 第一个加密信息（判断是否加密用）
 @property (nonatomic, strong) NSArray<SegmentInfo *> *segments;        // TS片段列表
 @property (nonatomic, assign) BOOL isEndList;                          // 是否结束列表
+@property (nonatomic, assign) NSInteger mediaSequence;                 // 第一个片段的媒体序列号
+
+// 去重后的加密信息表，片段通过encryptionIndex引用
+@property (nonatomic, strong, readonly) NSArray<EncryptionInfo *> *encryptionInfos;
+// 密钥切换点：加密信息与前一个片段不同的片段下标（升序）
+@property (nonatomic, strong, readonly) NSArray<NSNumber *> *keyChangeSegmentIndices;
 
 - (instancetype)initWithVersion:(NSInteger)version 
                  targetDuration:(NSTimeInterval)targetDuration 
@@ -55,6 +66,28 @@ NS_ASSUME_NONNULL_BEGIN
 - (void)addSegment:(SegmentInfo *)segment;
 - (NSTimeInterval)totalDuration; // 计算总时长
 
+/**
+ * 登记加密信息并返回它在encryptionInfos中的下标，相同的加密信息只保存一份
+ * 未加密（METHOD=NONE）时返回-1
+ */
+- (NSInteger)indexOfEncryptionInfo:(EncryptionInfo *)encryptionInfo;
+
+// 片段使用的加密信息，未加密时返回nil
+- (EncryptionInfo * _Nullable)encryptionInfoForSegment:(SegmentInfo *)segment;
+
+// 包含指定时间的片段下标，超出范围时返回最近的片段，没有片段时返回NSNotFound
+- (NSUInteger)segmentIndexAtTime:(NSTimeInterval)time;
+
+// 是否轮换密钥（使用了不止一个密钥）
+- (BOOL)hasKeyRotation;
+
+/**
+ * 从指定时间起一段时间内需要的密钥：当前片段的密钥，以及窗口内各个密钥切换点的新密钥
+ * @param time 播放位置
+ * @param lookahead 向前查看的时长
+ */
+- (NSArray<EncryptionInfo *> *)encryptionInfosFromTime:(NSTimeInterval)time lookahead:(NSTimeInterval)lookahead;
+
 // 打印详细信息
 - (void)printDetailedInfo;
 
@@ -101,10 +134,12 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, strong) NSArray<StreamInfo *> *streams;              // 子流列表
 @property (nonatomic, strong) NSMutableDictionary *metadata;               // 元数据
 @property (nonatomic, assign) BOOL hasIndependentSegments;                 // 是否有独立片段
+@property (nonatomic, strong) NSArray<EncryptionInfo *> *sessionKeys;      // #EXT-X-SESSION-KEY声明的密钥
 
 - (instancetype)initWithVersion:(NSInteger)version;
 
 - (void)addStream:(StreamInfo *)stream;
+- (void)addSessionKey:(EncryptionInfo *)sessionKey;
 - (void)setMetadata:(NSString *)key value:(NSString *)value;
 
 // 根据清晰度偏好选择最合适的子流
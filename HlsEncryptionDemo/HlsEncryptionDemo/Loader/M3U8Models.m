@@ -25,6 +25,10 @@
     return self;
 }
 
+- (BOOL)isEncrypted {
+    return self.uri.length > 0 && ![self.method isEqualToString:@"NONE"];
+}
+
 - (NSString *)description {
     return [NSString stringWithFormat:@"EncryptionInfo: method=%@, uri=%@, iv=%@, keyFormat=%@", 
             self.method, self.uri, self.iv, self.keyFormat];
@@ -43,6 +47,7 @@
         _duration = duration;
         _url = url;
         _sequence = sequence;
+        _encryptionIndex = -1;
     }
     return self;
 }
@@ -55,6 +60,13 @@
 @end
 
 // MARK: - MediaPlaylist Implementation
+@interface MediaPlaylist ()
+@property (nonatomic, strong) NSMutableArray<EncryptionInfo *> *mutableEncryptionInfos;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSNumber *> *encryptionInfoIndexes;  // 方法|URI|IV|格式 -> 下标
+@property (nonatomic, strong) NSMutableArray<NSNumber *> *mutableKeyChangeSegmentIndices;
+@property (nonatomic, assign) NSTimeInterval accumulatedDuration;
+@end
+
 @implementation MediaPlaylist
 
 - (instancetype)initWithVersion:(NSInteger)version 
@@ -67,16 +79,119 @@
         _playlistType = playlistType;
         _segments = [[NSMutableArray alloc] init];
         _isEndList = NO;
+        _mutableEncryptionInfos = [[NSMutableArray alloc] init];
+        _encryptionInfoIndexes = [[NSMutableDictionary alloc] init];
+        _mutableKeyChangeSegmentIndices = [[NSMutableArray alloc] init];
     }
     return self;
 }
 
 - (void)addSegment:(SegmentInfo *)segment {
+    // 与前一个片段使用不同的加密信息时记为密钥切换点
+    SegmentInfo *previous = self.segments.lastObject;
+    if (previous ? previous.encryptionIndex != segment.encryptionIndex : segment.encryptionIndex >= 0) {
+        [self.mutableKeyChangeSegmentIndices addObject:@(self.segments.count)];
+    }
+    segment.startTime = self.accumulatedDuration;
+    self.accumulatedDuration += segment.duration;
+    
     NSMutableArray *mutableSegments = [self.segments mutableCopy];
     [mutableSegments addObject:segment];
     _segments = [mutableSegments copy];
 }
 
+- (NSArray<EncryptionInfo *> *)encryptionInfos {
+    return [self.mutableEncryptionInfos copy];
+}
+
+- (NSArray<NSNumber *> *)keyChangeSegmentIndices {
+    return [self.mutableKeyChangeSegmentIndices copy];
+}
+
+- (NSInteger)indexOfEncryptionInfo:(EncryptionInfo *)encryptionInfo {
+    if (![encryptionInfo isEncrypted]) {
+        return -1;
+    }
+    NSString *identity = [NSString stringWithFormat:@"%@|%@|%@|%@",
+                          encryptionInfo.method, encryptionInfo.uri, encryptionInfo.iv, encryptionInfo.keyFormat];
+    NSNumber *index = self.encryptionInfoIndexes[identity];
+    if (index) {
+        return index.integerValue;
+    }
+    [self.mutableEncryptionInfos addObject:encryptionInfo];
+    self.encryptionInfoIndexes[identity] = @(self.mutableEncryptionInfos.count - 1);
+    return self.mutableEncryptionInfos.count - 1;
+}
+
+- (EncryptionInfo *)encryptionInfoForSegment:(SegmentInfo *)segment {
+    if (segment.encryptionIndex < 0 || segment.encryptionIndex >= (NSInteger)self.mutableEncryptionInfos.count) {
+        return nil;
+    }
+    return self.mutableEncryptionInfos[segment.encryptionIndex];
+}
+
+- (NSUInteger)segmentIndexAtTime:(NSTimeInterval)time {
+    NSArray<SegmentInfo *> *segments = self.segments;
+    if (segments.count == 0) {
+        return NSNotFound;
+    }
+    // 二分查找最后一个起始时间不晚于time的片段
+    NSUInteger low = 0;
+    NSUInteger high = segments.count - 1;
+    while (low < high) {
+        NSUInteger mid = (low + high + 1) / 2;
+        if (segments[mid].startTime <= time) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+- (BOOL)hasKeyRotation {
+    return self.mutableEncryptionInfos.count > 1;
+}
+
+- (NSArray<EncryptionInfo *> *)encryptionInfosFromTime:(NSTimeInterval)time lookahead:(NSTimeInterval)lookahead {
+    NSUInteger currentIndex = [self segmentIndexAtTime:time];
+    if (currentIndex == NSNotFound) {
+        return @[];
+    }
+    
+    NSArray<SegmentInfo *> *segments = self.segments;
+    NSMutableArray<EncryptionInfo *> *result = [NSMutableArray array];
+    EncryptionInfo *current = [self encryptionInfoForSegment:segments[currentIndex]];
+    if (current) {
+        [result addObject:current];
+    }
+    
+    // 二分查找当前片段之后的第一个密钥切换点，再依次取窗口内的切换点
+    NSArray<NSNumber *> *changes = self.mutableKeyChangeSegmentIndices;
+    NSUInteger low = 0;
+    NSUInteger high = changes.count;
+    while (low < high) {
+        NSUInteger mid = (low + high) / 2;
+        if (changes[mid].unsignedIntegerValue <= currentIndex) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    NSTimeInterval windowEnd = time + lookahead;
+    for (NSUInteger i = low; i < changes.count; i++) {
+        SegmentInfo *segment = segments[changes[i].unsignedIntegerValue];
+        if (segment.startTime > windowEnd) {
+            break;
+        }
+        EncryptionInfo *info = [self encryptionInfoForSegment:segment];
+        if (info && ![result containsObject:info]) {
+            [result addObject:info];
+        }
+    }
+    return result;
+}
+
 - (NSTimeInterval)totalDuration {
     NSTimeInterval total = 0.0;
     for (SegmentInfo *segment in self.segments) {
@@ -94,7 +209,13 @@
     NSLog(@"[MediaPlaylist] 是否结束列表: %@", self.isEndList ? @"是" : @"否");
     
     // 加密信息
-    if (self.encryptionInfo) {
+    if (self.hasKeyRotation) {
+        NSLog(@"[MediaPlaylist] ----- 加密信息（轮换%lu个密钥，%lu个切换点）-----",
+              (unsigned long)self.mutableEncryptionInfos.count, (unsigned long)self.mutableKeyChangeSegmentIndices.count);
+        for (EncryptionInfo *info in self.mutableEncryptionInfos) {
+            NSLog(@"  - %@ %@", info.method, info.uri);
+        }
+    } else if (self.encryptionInfo) {
         NSLog(@"[MediaPlaylist] ----- 加密信息 -----");
         NSLog(@"  - 加密方法: %@", self.encryptionInfo.method);
         NSLog(@"  - 密钥URI: %@", self.encryptionInfo.uri);
@@ -267,6 +388,7 @@
         _streams = [[NSMutableArray alloc] init];
         _metadata = [[NSMutableDictionary alloc] init];
         _hasIndependentSegments = NO;
+        _sessionKeys = @[];
     }
     return self;
 }
@@ -288,6 +410,10 @@
     _streams = [mutableStreams copy];
 }
 
+- (void)addSessionKey:(EncryptionInfo *)sessionKey {
+    _sessionKeys = [self.sessionKeys arrayByAddingObject:sessionKey];
+}
+
 - (void)setMetadata:(NSString *)key value:(NSString *)value {
     [self.metadata setObject:value forKey:key];
 }
@@ -9,6 +9,22 @@
 #import "M3U8NewSystem.h"
 #import "CacheConfig.h"
 #import "CacheManager.h"
+#import "M3U8Metrics.h"
+#import "M3U8SessionPool.h"
+#import "M3U8RequestScheduler.h"
+#import "M3U8RetryPolicy.h"
+#import "M3U8TimeoutEstimator.h"
+#import "M3U8BandwidthEstimator.h"
+#import "M3U8HostSelector.h"
+#import "M3U8Preconnector.h"
+#import "M3U8CircuitBreaker.h"
+#import "M3U8KeyStore.h"
+#import "M3U8TokenManager.h"
+#import "M3U8SegmentDecryptor.h"
+#import "M3U8ResourceRouter.h"
+#import "M3U8LocalProxyServer.h"
+#import "M3U8ABRController.h"
+#import "M3U8SegmentCache.h"
 
 @implementation M3U8NewSystem
 
@@ -28,7 +44,23 @@
             @"CacheManager", 
             @"M3U8Parser",
             @"QualitySelector",
-            @"M3U8PlayerManager"
+            @"M3U8PlayerManager",
+            @"M3U8Metrics",
+            @"M3U8SessionPool",
+            @"M3U8RequestScheduler",
+            @"M3U8RetryPolicy",
+            @"M3U8TimeoutEstimator",
+            @"M3U8BandwidthEstimator",
+            @"M3U8HostSelector",
+            @"M3U8Preconnector",
+            @"M3U8CircuitBreaker",
+            @"M3U8KeyStore",
+            @"M3U8TokenManager",
+            @"M3U8SegmentDecryptor",
+            @"M3U8ResourceRouter",
+            @"M3U8LocalProxyServer",
+            @"M3U8ABRController",
+            @"M3U8SegmentCache"
         ],
         @"cacheConfig": @{
             @"maxFileCount": @(cacheConfig.maxFileCount),
@@ -42,7 +74,23 @@
             @"hitCount": @(cacheStats.hitCount),
             @"missCount": @(cacheStats.missCount),
             @"hitRate": @(cacheStats.hitRate)
-        }
+        },
+        @"sessions": [[M3U8SessionPool sharedPool] statistics],
+        @"scheduler": [[M3U8RequestScheduler sharedScheduler] statistics],
+        @"timeouts": [[M3U8TimeoutEstimator sharedEstimator] statistics],
+        @"retry": @{
+            @"playlist": [[M3U8RetryPolicy playlistPolicy] statistics],
+            @"key": [[M3U8RetryPolicy keyPolicy] statistics]
+        },
+        @"bandwidth": [[M3U8BandwidthEstimator sharedEstimator] statistics],
+        @"hosts": [[M3U8HostSelector sharedSelector] statistics],
+        @"preconnect": [[M3U8Preconnector sharedPreconnector] statistics],
+        @"circuitBreaker": [[M3U8CircuitBreaker sharedBreaker] statistics],
+        @"keyStore": [[M3U8KeyStore sharedStore] statistics],
+        @"token": [[M3U8TokenManager sharedManager] statistics],
+        @"proxy": [[M3U8LocalProxyServer sharedServer] statistics],
+        @"segmentCache": [[M3U8SegmentCache sharedCache] statistics],
+        @"metrics": [[M3U8Metrics sharedMetrics] snapshot]
     };
 }
 
@@ -32,6 +32,13 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (void)parser:(id)parser didFailWithError:(NSError *)error;
 
+/**
+ * 解析到加密信息（媒体播放列表的第一个#EXT-X-KEY或主播放列表的#EXT-X-SESSION-KEY）
+ * 在解析所在的线程上立即回调，不等整个播放列表解析完成，可用于提前获取密钥
+ * 轮换密钥的播放列表只通知第一个密钥，后续密钥见MediaPlaylist.encryptionInfos
+ */
+- (void)parser:(id)parser didFindEncryptionInfo:(EncryptionInfo *)encryptionInfo;
+
 @end
 
 /**
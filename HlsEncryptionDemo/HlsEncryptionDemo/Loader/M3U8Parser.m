@@ -54,6 +54,11 @@
         else if ([trimmedLine hasPrefix:@"#EXT-X-STREAM-INF:"]) {
             currentStreamInfo = [self parseStreamInfLine:trimmedLine];
         }
+        else if ([trimmedLine hasPrefix:@"#EXT-X-SESSION-KEY:"]) {
+            EncryptionInfo *sessionKey = [self parseKeyLine:trimmedLine baseURL:baseURL];
+            [masterPlaylist addSessionKey:sessionKey];
+            [self notifyEncryptionInfo:sessionKey];
+        }
         else if (currentStreamInfo && ![trimmedLine hasPrefix:@"#"] && trimmedLine.length > 0) {
             // 这是子流URL
             NSString *streamURL = [self resolveURL:trimmedLine baseURL:baseURL];
@@ -90,6 +95,7 @@
     BOOL isValidM3U8 = NO;
     NSTimeInterval currentSegmentDuration = 0;
     NSInteger segmentSequence = 0;
+    NSInteger currentEncryptionIndex = -1;  // 之后的片段使用的加密信息下标
     
     for (NSString *line in lines) {
         NSString *trimmedLine = [line stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
@@ -111,9 +117,20 @@
             NSString *typeStr = [trimmedLine substringFromIndex:[@"#EXT-X-PLAYLIST-TYPE:" length]];
             mediaPlaylist.playlistType = typeStr;
         }
+        else if ([trimmedLine hasPrefix:@"#EXT-X-MEDIA-SEQUENCE:"]) {
+            NSString *sequenceStr = [trimmedLine substringFromIndex:[@"#EXT-X-MEDIA-SEQUENCE:" length]];
+            mediaPlaylist.mediaSequence = [sequenceStr integerValue];
+            segmentSequence = mediaPlaylist.mediaSequence;
+        }
         else if ([trimmedLine hasPrefix:@"#EXT-X-KEY:"]) {
-            EncryptionInfo *encryptionInfo = [self parseKeyLine:trimmedLine];
-            mediaPlaylist.encryptionInfo = encryptionInfo;
+            // #EXT-X-KEY作用于之后的所有片段，直到下一个#EXT-X-KEY（密钥轮换）
+            EncryptionInfo *encryptionInfo = [self parseKeyLine:trimmedLine baseURL:baseURL];
+            currentEncryptionIndex = [mediaPlaylist indexOfEncryptionInfo:encryptionInfo];
+            if (currentEncryptionIndex >= 0 && !mediaPlaylist.encryptionInfo) {
+                // 只提前通知第一个密钥，轮换的后续密钥由播放器在接近切换点时获取
+                mediaPlaylist.encryptionInfo = encryptionInfo;
+                [self notifyEncryptionInfo:encryptionInfo];
+            }
         }
         else if ([trimmedLine hasPrefix:@"#EXTINF:"]) {
             NSString *infStr = [trimmedLine substringFromIndex:[@"#EXTINF:" length]];
@@ -132,6 +149,7 @@
             SegmentInfo *segment = [[SegmentInfo alloc] initWithDuration:currentSegmentDuration 
                                                                      url:segmentURL 
                                                                 sequence:segmentSequence++];
+            segment.encryptionIndex = currentEncryptionIndex;
             [mediaPlaylist addSegment:segment];
             currentSegmentDuration = 0;
         }
@@ -142,8 +160,9 @@
         return nil;
     }
     
-    NSLog(@"[M3U8Parser] 媒体播放列表解析完成，包含%lu个片段，总时长%.1f秒", 
-          (unsigned long)mediaPlaylist.segments.count, [mediaPlaylist totalDuration]);
+    NSLog(@"[M3U8Parser] 媒体播放列表解析完成，包含%lu个片段，总时长%.1f秒，%lu个密钥", 
+          (unsigned long)mediaPlaylist.segments.count, [mediaPlaylist totalDuration],
+          (unsigned long)mediaPlaylist.encryptionInfos.count);
     return mediaPlaylist;
 }
 
@@ -253,9 +272,9 @@
     return streamInfo;
 }
 
-- (EncryptionInfo *)parseKeyLine:(NSString *)line {
-    // 解析 #EXT-X-KEY: 行
-    NSString *attributes = [line substringFromIndex:[@"#EXT-X-KEY:" length]];
+- (EncryptionInfo *)parseKeyLine:(NSString *)line baseURL:(NSString *)baseURL {
+    // 解析 #EXT-X-KEY: / #EXT-X-SESSION-KEY: 行，两者属性相同
+    NSString *attributes = [line substringFromIndex:[line rangeOfString:@":"].location + 1];
     NSMutableDictionary *keyInfo = [[NSMutableDictionary alloc] init];
     
     // 使用正则表达式解析属性
@@ -282,13 +301,28 @@
         }
     }
     
+    // 相对路径的密钥URI按播放列表地址解析
+    NSString *uri = keyInfo[@"URI"];
+    if (uri.length > 0) {
+        uri = [self resolveURL:uri baseURL:baseURL];
+    }
+    
     EncryptionInfo *encryptionInfo = [[EncryptionInfo alloc] initWithMethod:keyInfo[@"METHOD"] ?: @"" 
-                                                                        uri:keyInfo[@"URI"] ?: @"" 
+                                                                        uri:uri ?: @"" 
                                                                          iv:keyInfo[@"IV"] ?: @"" 
                                                                   keyFormat:keyInfo[@"KEYFORMAT"] ?: @"identity"];
     return encryptionInfo;
 }
 
+- (void)notifyEncryptionInfo:(EncryptionInfo *)encryptionInfo {
+    if (encryptionInfo.uri.length == 0 || [encryptionInfo.method isEqualToString:@"NONE"]) {
+        return;
+    }
+    if ([self.delegate respondsToSelector:@selector(parser:didFindEncryptionInfo:)]) {
+        [self.delegate parser:self didFindEncryptionInfo:encryptionInfo];
+    }
+}
+
 - (StreamInfo *)createStreamInfoFromDictionary:(NSDictionary *)dict {
     NSInteger bandwidth = [dict[@"BANDWIDTH"] integerValue];
     NSInteger averageBandwidth = [dict[@"AVERAGE-BANDWIDTH"] integerValue];
@@ -10,6 +10,7 @@
 #import <AVFoundation/AVFoundation.h>
 #import "M3U8Models.h"
 #import "M3U8AuthConfig.h"
+#import "M3U8ABRController.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -74,6 +75,29 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, strong, readonly) StreamInfo *currentStream;
 @property (nonatomic, strong, readonly) MediaPlaylist *currentMediaPlaylist;
 
+/**
+ * 密钥轮换时提前获取下一个密钥的时长（秒），默认10秒，设为0关闭
+ * 播放位置距离密钥切换点小于该时长时，在后台获取新密钥，避免播放到切换点时卡顿
+ */
+@property (nonatomic, assign) NSTimeInterval keyLookaheadDuration;
+
+/**
+ * 是否通过本地环回代理（M3U8LocalProxyServer）播放，默认NO
+ * 开启后播放器直接请求本地代理，不再使用自定义scheme拦截；代理启动失败时自动回退到拦截方式
+ */
+@property (nonatomic, assign) BOOL useLocalProxy;
+
+/**
+ * 自适应码率控制器，可按网络类型调整参数
+ */
+@property (nonatomic, strong, readonly) M3U8ABRController *abrController;
+
+/**
+ * 是否在播放中按带宽自动切换清晰度
+ * playVideoWithURL:preferredQuality: 传nil时开启、指定清晰度时关闭；调用switchToQuality:手动切换后关闭
+ */
+@property (nonatomic, assign) BOOL adaptiveQualityEnabled;
+
 /**
  * 获取共享实例
  */
@@ -87,12 +111,18 @@ NS_ASSUME_NONNULL_BEGIN
 /**
  * 播放M3U8视频
  * @param url M3U8播放地址
- * @param preferredQuality 偏好清晰度 ("标清"/"高清"/"超清"/"蓝光")
+ * @param preferredQuality 偏好清晰度 ("标清"/"高清"/"超清"/"蓝光")，传nil时按带宽估算自动选择
+ */
+- (void)playVideoWithURL:(NSString *)url preferredQuality:(NSString * _Nullable)preferredQuality;
+
+/**
+ * 预热即将播放的视频所需的连接（CDN与密钥服务器）
+ * @param url M3U8播放地址
  */
-- (void)playVideoWithURL:(NSString *)url preferredQuality:(NSString *)preferredQuality;
+- (void)preconnectForURL:(NSString *)url;
 
 /**
- * 切换清晰度（无缝切换，保持播放进度）
+ * 切换清晰度（无缝切换，保持播放进度），同时关闭自适应码率
  */
 - (void)switchToQuality:(NSString *)quality;
 
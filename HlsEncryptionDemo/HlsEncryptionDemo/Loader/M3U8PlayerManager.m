@@ -11,7 +11,13 @@
 #import "QualitySelector.h"
 #import "M3U8KeyManager.h"
 #import "M3U8Loader.h"
+#import "CacheManager.h"
+#import "M3U8BandwidthEstimator.h"
+#import "M3U8Preconnector.h"
+#import "M3U8Metrics.h"
+#import "M3U8LocalProxyServer.h"
 #import "AFNetworking.h"
+#import <UIKit/UIKit.h>
 
 @interface M3U8PlayerManager () <M3U8ParserDelegate, QualitySelectorDelegate, M3U8LoaderDelegate>
 
@@ -29,6 +35,7 @@
 
 @property (nonatomic, strong) NSString *currentVideoURL;
 @property (nonatomic, strong) NSString *preferredQuality;
+@property (nonatomic, strong, nullable) NSString *pinnedCacheGroup;  // 当前播放期间固定的缓存分组
 
 // 无缝切换相关属性
 @property (nonatomic, assign) CMTime savedPlayTime;  // 切换清晰度时保存的播放时间
@@ -38,6 +45,21 @@
 @property (nonatomic, strong) MediaPlaylist *switchMediaPlaylist;  // 用于切换的新媒体播放列表
 @property(nonatomic, strong) AVPlayer *switchPlayer;
 
+// 带宽估算相关属性（TS分片由AVPlayer直接下载，从访问日志中取增量）
+@property (nonatomic, assign) NSUInteger accessLogEventCount;
+@property (nonatomic, assign) int64_t accessLogBytes;
+@property (nonatomic, assign) NSTimeInterval accessLogDuration;
+
+// 起播耗时（TTFF）统计
+@property (nonatomic, assign) CFAbsoluteTime playStartTime;
+
+// 密钥轮换预取
+@property (nonatomic, strong) id keyLookaheadObserver;
+@property (nonatomic, strong) NSMutableSet<NSString *> *lookaheadKeyURIs;  // 本次播放已提前获取的密钥
+
+// 自适应码率
+@property (nonatomic, strong, readwrite) M3U8ABRController *abrController;
+
 @end
 
 @implementation M3U8PlayerManager
@@ -60,6 +82,8 @@
         _switchPlayerItem = nil;
         _switchStream = nil;
         _switchMediaPlaylist = nil;
+        _keyLookaheadDuration = 10.0;
+        _lookaheadKeyURIs = [NSMutableSet set];
         
         [self setupComponents];
     }
@@ -77,10 +101,32 @@
     _keyManager = [M3U8KeyManager new];
     _m3u8Loader = [M3U8Loader new];
     _m3u8Loader.delegate = self;
+    _abrController = [[M3U8ABRController alloc] init];
     
     // 初始化播放器
     _player = [[AVPlayer alloc] init];
     
+    // 每秒检查一次是否接近密钥切换点，以及是否需要按带宽切换清晰度
+    __weak typeof(self) weakSelf = self;
+    _keyLookaheadObserver = [_player addPeriodicTimeObserverForInterval:CMTimeMakeWithSeconds(1.0, NSEC_PER_SEC)
+                                                                  queue:dispatch_get_main_queue()
+                                                             usingBlock:^(CMTime time) {
+        [weakSelf prefetchUpcomingKeysForMediaPlaylist:weakSelf.currentMediaPlaylist atTime:CMTimeGetSeconds(time)];
+        [weakSelf evaluateAdaptiveQualityAtTime:time];
+    }];
+    
+    // TS分片的传输量和耗时喂给带宽估算器
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(playerItemDidAddAccessLogEntry:)
+                                                 name:AVPlayerItemNewAccessLogEntryNotification
+                                               object:nil];
+    
+    // 回到前台时检查本地代理的监听套接字
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(applicationWillEnterForeground:)
+                                                 name:UIApplicationWillEnterForegroundNotification
+                                               object:nil];
+    
     NSLog(@"[M3U8PlayerManager] 组件初始化完成");
 }
 
@@ -98,15 +144,46 @@
     
     self.currentVideoURL = url;
     self.preferredQuality = preferredQuality;
+    self.adaptiveQualityEnabled = (preferredQuality.length == 0);
     
     // 清理之前的播放状态
     [self cleanupCurrentPlayback];
+    [self.abrController reset];
+    
+    // 播放期间固定当前剧集的缓存分组，避免主/子播放列表被淘汰
+    self.pinnedCacheGroup = [[CacheManager sharedManager] groupKeyForURL:url];
+    if (self.pinnedCacheGroup) {
+        [[CacheManager sharedManager] pinGroup:self.pinnedCacheGroup];
+    }
+    
+    self.playStartTime = CFAbsoluteTimeGetCurrent();
+    
+    // 密钥服务器的握手与主播放列表下载并行进行，不再排在起播链路之后
+    M3U8Preconnector *preconnector = [M3U8Preconnector sharedPreconnector];
+    [preconnector beginPlay];
+    NSURL *keyServerURL = [preconnector knownKeyServerURL];
+    if (keyServerURL) {
+        [preconnector preconnectToURL:keyServerURL hostClass:M3U8HostClassKeyServer];
+    }
     
     // 下载并解析主M3U8
     [self downloadAndParseMasterPlaylist:url];
 }
 
+- (void)preconnectForURL:(NSString *)url {
+    [self.m3u8Loader preconnectForURL:url];
+}
+
 - (void)switchToQuality:(NSString *)quality {
+    // 用户手动选择的清晰度优先，不再自动切换
+    self.adaptiveQualityEnabled = NO;
+    [self beginQualitySwitchToQuality:quality];
+}
+
+/**
+ * 无缝切换到指定清晰度（手动切换和自适应码率共用）
+ */
+- (void)beginQualitySwitchToQuality:(NSString *)quality {
     if (!self.currentMasterPlaylist) {
         NSLog(@"[M3U8PlayerManager] 没有可用的主播放列表，无法切换清晰度");
         return;
@@ -209,6 +286,12 @@
     // 取消所有M3U8下载请求
     [self.m3u8Loader cancelAllLoads];
     
+    // 释放当前剧集的缓存固定
+    if (self.pinnedCacheGroup) {
+        [[CacheManager sharedManager] unpinGroup:self.pinnedCacheGroup];
+        self.pinnedCacheGroup = nil;
+    }
+    
     if (self.currentPlayerItem) {
         [self.currentPlayerItem removeObserver:self forKeyPath:@"status"];
         self.currentPlayerItem = nil;
@@ -222,6 +305,7 @@
     self.currentMasterPlaylist = nil;
     self.currentStream = nil;
     self.currentMediaPlaylist = nil;
+    [self.lookaheadKeyURIs removeAllObjects];
 }
 
 
@@ -367,17 +451,19 @@
     
     // 设置播放器
     NSString *playURL = stream.url;
+    NSURL *proxyURL = self.useLocalProxy ? [self localProxyURLForStreamURL:playURL] : nil;
     
-    // 如果有加密信息，需要使用自定义scheme让KeyManager拦截
-    if (mediaPlaylist.encryptionInfo) {
+    // 如果有加密信息且不走本地代理，需要使用自定义scheme让KeyManager拦截
+    BOOL interceptsRequests = mediaPlaylist.encryptionInfo && !proxyURL;
+    if (interceptsRequests) {
         playURL = [playURL stringByReplacingOccurrencesOfString:@"https://" withString:@"m3u8-custom://"];
     }
     
-    NSURL *url = [NSURL URLWithString:playURL];
+    NSURL *url = proxyURL ?: [NSURL URLWithString:playURL];
     AVURLAsset *asset = [AVURLAsset URLAssetWithURL:url options:nil];
     
     // 配置密钥管理器
-    if (mediaPlaylist.encryptionInfo) {
+    if (interceptsRequests) {
         [self.keyManager setupResourceLoaderForAsset:asset];
     }
     
@@ -394,6 +480,29 @@
     [self.player play];
 }
 
+/**
+ * 通过本地代理播放时使用的地址
+ * 代理与本管理器共用密钥管理器和授权配置；启动失败时返回nil，回退到自定义scheme拦截
+ */
+- (NSURL *)localProxyURLForStreamURL:(NSString *)streamURL {
+    M3U8LocalProxyServer *server = [M3U8LocalProxyServer sharedServer];
+    NSError *error = nil;
+    if (![server startWithPort:0 error:&error]) {
+        NSLog(@"[M3U8PlayerManager] 本地代理启动失败，使用自定义scheme拦截: %@", error.localizedDescription);
+        return nil;
+    }
+    // 按本管理器的密钥管理器注册上下文，与预加载等其他管理器的令牌和密钥互不影响
+    NSURL *proxyURL = [server proxyURLForPlaylistURL:streamURL keyManager:self.keyManager authConfig:self.authConfig];
+    NSLog(@"[M3U8PlayerManager] 使用本地代理播放: %@", proxyURL);
+    return proxyURL;
+}
+
+- (void)applicationWillEnterForeground:(NSNotification *)notification {
+    if (self.useLocalProxy) {
+        [[M3U8LocalProxyServer sharedServer] restartIfNeeded];
+    }
+}
+
 - (void)setupSwitchPlayerItemWithMediaPlaylist:(MediaPlaylist *)mediaPlaylist stream:(StreamInfo *)stream {
     NSLog(@"[M3U8PlayerManager] 设置切换用的PlayerItem，流URL: %@", stream.url);
     
@@ -403,22 +512,27 @@
     
     // 设置播放器
     NSString *playURL = stream.url;
+    NSURL *proxyURL = self.useLocalProxy ? [self localProxyURLForStreamURL:playURL] : nil;
     
-    // 如果有加密信息，需要使用自定义scheme让KeyManager拦截
-    if (mediaPlaylist.encryptionInfo) {
+    // 如果有加密信息且不走本地代理，需要使用自定义scheme让KeyManager拦截
+    BOOL interceptsRequests = mediaPlaylist.encryptionInfo && !proxyURL;
+    if (interceptsRequests) {
         playURL = [playURL stringByReplacingOccurrencesOfString:@"https://" withString:@"m3u8-custom://"];
         NSLog(@"[M3U8PlayerManager] 检测到加密信息，使用自定义scheme: %@", playURL);
     }
     
-    NSURL *url = [NSURL URLWithString:playURL];
+    NSURL *url = proxyURL ?: [NSURL URLWithString:playURL];
     AVURLAsset *asset = [AVURLAsset URLAssetWithURL:url options:nil];
     
     // 配置密钥管理器
-    if (mediaPlaylist.encryptionInfo) {
+    if (interceptsRequests) {
         [self.keyManager setupResourceLoaderForAsset:asset];
         NSLog(@"[M3U8PlayerManager] 为切换PlayerItem配置密钥管理器");
     }
     
+    // 新清晰度可能使用不同的密钥，提前获取切换位置附近需要的密钥
+    [self prefetchUpcomingKeysForMediaPlaylist:mediaPlaylist atTime:CMTIME_IS_VALID(self.savedPlayTime) ? CMTimeGetSeconds(self.savedPlayTime) : 0];
+    
     // 创建切换用的播放项
     self.switchPlayerItem = [AVPlayerItem playerItemWithAsset:asset];
     NSLog(@"[M3U8PlayerManager] 创建switchPlayerItem: %p", self.switchPlayerItem);
@@ -463,7 +577,9 @@
             
             switch (status) {
                 case AVPlayerItemStatusReadyToPlay:
-                    NSLog(@"[M3U8PlayerManager] 当前播放器准备就绪");
+                    NSLog(@"[M3U8PlayerManager] 当前播放器准备就绪，复用预热连接节省握手%.0fms",
+                          [[M3U8Preconnector sharedPreconnector] savedHandshakeTimeForCurrentPlay] * 1000);
+                    [self recordTimeToFirstFrame];
                     break;
                 case AVPlayerItemStatusFailed:
                     NSLog(@"[M3U8PlayerManager] 当前播放器失败: %@", self.currentPlayerItem.error);
@@ -658,6 +774,11 @@
     [mediaPlaylist printDetailedInfo];
 }
 
+- (void)parser:(id)parser didFindEncryptionInfo:(EncryptionInfo *)encryptionInfo {
+    // 解析到密钥信息时立即预取，AVFoundation请求密钥时直接从内存返回
+    [self.keyManager prefetchKeyForURI:encryptionInfo.uri];
+}
+
 - (void)parser:(id)parser didFailWithError:(NSError *)error {
     NSLog(@"[M3U8PlayerManager] 解析失败: %@", error.localizedDescription);
     if ([self.delegate respondsToSelector:@selector(playerManager:didFailWithError:)]) {
@@ -712,7 +833,123 @@
     }
 }
 
+#pragma mark - Startup Metrics
+
+/**
+ * 记录从开始播放到播放器就绪的耗时，按是否开启密钥预取分别统计，便于对比
+ */
+- (void)recordTimeToFirstFrame {
+    if (self.playStartTime <= 0) {
+        return;
+    }
+    NSTimeInterval ttff = CFAbsoluteTimeGetCurrent() - self.playStartTime;
+    self.playStartTime = 0;
+    
+    NSString *prefetch = self.keyManager.keyPrefetchEnabled ? @"on" : @"off";
+    [[[M3U8Metrics sharedMetrics] histogramNamed:@"m3u8_ttff_seconds" labels:@{@"key_prefetch": prefetch}] recordSeconds:ttff];
+    NSLog(@"[M3U8PlayerManager] 起播耗时: %.0fms (密钥预取: %@)", ttff * 1000, prefetch);
+}
+
+#pragma mark - Key Rotation
+
+/**
+ * 提前获取播放位置之后keyLookaheadDuration内需要的密钥
+ * 只处理轮换密钥的播放列表，第一个密钥在解析时已经预取
+ */
+- (void)prefetchUpcomingKeysForMediaPlaylist:(MediaPlaylist *)mediaPlaylist atTime:(NSTimeInterval)time {
+    if (!mediaPlaylist.hasKeyRotation || self.keyLookaheadDuration <= 0 || isnan(time)) {
+        return;
+    }
+    
+    for (EncryptionInfo *info in [mediaPlaylist encryptionInfosFromTime:time lookahead:self.keyLookaheadDuration]) {
+        if ([self.lookaheadKeyURIs containsObject:info.uri]) {
+            continue;
+        }
+        // 获取进行中时先占位，避免每秒重复发起；失败时移除，下次检查时重试
+        NSString *keyURI = info.uri;
+        [self.lookaheadKeyURIs addObject:keyURI];
+        NSLog(@"[M3U8PlayerManager] 接近密钥切换点(%.1f秒)，提前获取密钥: %@", time, keyURI);
+        __weak typeof(self) weakSelf = self;
+        [self.keyManager prefetchKeyForURI:keyURI completion:^(NSError * _Nullable error) {
+            if (!error) {
+                return;
+            }
+            dispatch_async(dispatch_get_main_queue(), ^{
+                [weakSelf.lookaheadKeyURIs removeObject:keyURI];
+            });
+        }];
+    }
+}
+
+#pragma mark - Adaptive Bitrate
+
+/**
+ * 由自适应码率控制器决定是否切换清晰度，切换进行中或播放器未就绪时跳过
+ */
+- (void)evaluateAdaptiveQualityAtTime:(CMTime)time {
+    if (!self.adaptiveQualityEnabled || self.isQualitySwitching || !self.currentStream || !self.currentMasterPlaylist ||
+        self.currentPlayerItem.status != AVPlayerItemStatusReadyToPlay) {
+        return;
+    }
+    
+    NSString *quality = [self.abrController qualityToSwitchFromStream:self.currentStream
+                                                     inMasterPlaylist:self.currentMasterPlaylist
+                                                     bufferedDuration:[self bufferedDurationAtTime:time]];
+    if (quality) {
+        NSLog(@"[M3U8PlayerManager] 自适应码率切换清晰度: %@ -> %@", [self.currentStream qualityLevel], quality);
+        [self beginQualitySwitchToQuality:quality];
+    }
+}
+
+/**
+ * 播放位置之后连续缓冲的时长，无法确定时返回-1
+ */
+- (NSTimeInterval)bufferedDurationAtTime:(CMTime)time {
+    if (!CMTIME_IS_VALID(time)) {
+        return -1;
+    }
+    for (NSValue *value in self.currentPlayerItem.loadedTimeRanges) {
+        CMTimeRange range = [value CMTimeRangeValue];
+        if (CMTimeRangeContainsTime(range, time)) {
+            return CMTimeGetSeconds(CMTimeSubtract(CMTimeRangeGetEnd(range), time));
+        }
+    }
+    return 0;
+}
+
+#pragma mark - Bandwidth Estimation
+
+- (void)playerItemDidAddAccessLogEntry:(NSNotification *)notification {
+    AVPlayerItem *playerItem = notification.object;
+    if (playerItem != self.currentPlayerItem) {
+        return;
+    }
+    
+    NSArray<AVPlayerItemAccessLogEvent *> *events = playerItem.accessLog.events;
+    AVPlayerItemAccessLogEvent *event = events.lastObject;
+    if (!event) {
+        return;
+    }
+    
+    // 访问日志的最后一条事件是累计值，新事件开始时从零计算增量
+    if (events.count != self.accessLogEventCount) {
+        self.accessLogEventCount = events.count;
+        self.accessLogBytes = 0;
+        self.accessLogDuration = 0;
+    }
+    int64_t bytes = event.numberOfBytesTransferred - self.accessLogBytes;
+    NSTimeInterval duration = event.transferDuration - self.accessLogDuration;
+    self.accessLogBytes = event.numberOfBytesTransferred;
+    self.accessLogDuration = event.transferDuration;
+    
+    [[M3U8BandwidthEstimator sharedEstimator] recordTransferOfBytes:bytes duration:duration];
+}
+
 - (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    if (_keyLookaheadObserver) {
+        [_player removeTimeObserver:_keyLookaheadObserver];
+    }
     [self cleanupCurrentPlayback];
 }
 
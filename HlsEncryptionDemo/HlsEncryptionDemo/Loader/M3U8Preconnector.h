@@ -0,0 +1,73 @@
+//
+//  M3U8Preconnector.h
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "M3U8SessionPool.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 连接预热器
+ * 提前解析DNS并通过共享会话向目标主机发送一个HEAD请求，建立好TCP/TLS连接，
+ * 起播时的播放列表和密钥请求直接复用，省去握手耗时
+ * 每次预热记录握手耗时；真实请求复用到预热的连接时计为节省的时间
+ * 预热后超过空闲预算仍未使用的连接计入过期统计，连接由NSURLSession按空闲超时关闭
+ */
+@interface M3U8Preconnector : NSObject
+
+/**
+ * 预热连接的空闲预算（秒），默认30秒
+ */
+@property (nonatomic, assign) NSTimeInterval idleBudget;
+
+/**
+ * 获取共享预热器
+ */
++ (instancetype)sharedPreconnector;
+
+/**
+ * 预热到URL所在主机的连接
+ * 同一主机在空闲预算内已预热过时不重复预热
+ * @param url 目标URL（只使用scheme、主机和端口）
+ * @param hostClass 主机类别，决定使用哪个共享会话
+ */
+- (void)preconnectToURL:(NSURL *)url hostClass:(M3U8HostClass)hostClass;
+
+/**
+ * 记住密钥服务器地址（持久化），之后的预热会同时预热它
+ */
+- (void)rememberKeyServerURL:(NSURL *)url;
+
+/**
+ * 最近一次使用的密钥服务器地址
+ */
+- (NSURL * _Nullable)knownKeyServerURL;
+
+/**
+ * 处理共享会话的任务指标（由会话池调用）
+ */
+- (void)recordTaskMetrics:(NSURLSessionTaskMetrics *)metrics forTask:(NSURLSessionTask *)task;
+
+/**
+ * 开始一次播放，重置本次播放节省的握手时间
+ */
+- (void)beginPlay;
+
+/**
+ * 本次播放因复用预热连接节省的握手时间（秒）
+ */
+- (NSTimeInterval)savedHandshakeTimeForCurrentPlay;
+
+/**
+ * 预热统计
+ */
+- (NSDictionary *)statistics;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,257 @@
+//
+//  M3U8Preconnector.m
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import "M3U8Preconnector.h"
+#import "M3U8Metrics.h"
+#import <os/lock.h>
+#import <netdb.h>
+
+// 预热任务的taskDescription，用于在指标回调中区分预热与真实请求
+static NSString * const kPreconnectTaskDescription = @"M3U8Preconnect";
+
+// 持久化的密钥服务器地址
+static NSString * const kKnownKeyServerDefaultsKey = @"M3U8KnownKeyServerURL";
+
+// MARK: - M3U8WarmConnection
+
+/**
+ * 一次预热的状态
+ */
+@interface M3U8WarmConnection : NSObject
+@property (nonatomic, copy) NSString *origin;
+@property (nonatomic, assign) M3U8HostClass hostClass;
+@property (nonatomic, assign) CFAbsoluteTime warmedAt;
+@property (nonatomic, assign) NSTimeInterval handshakeTime;   // DNS+TCP+TLS耗时，预热完成后才有值
+@property (nonatomic, assign) BOOL used;
+@end
+
+@implementation M3U8WarmConnection
+@end
+
+// MARK: - M3U8Preconnector
+
+@interface M3U8Preconnector () {
+    os_unfair_lock _lock;
+}
+
+@property (nonatomic, strong) NSMutableDictionary<NSString *, M3U8WarmConnection *> *warmConnections;
+@property (nonatomic, assign) NSTimeInterval currentPlaySavedTime;
+@property (nonatomic, strong) M3U8MetricCounter *preconnectCounter;
+@property (nonatomic, strong) M3U8MetricCounter *hitCounter;
+@property (nonatomic, strong) M3U8MetricCounter *expiredCounter;
+@property (nonatomic, strong) M3U8LatencyHistogram *savedHistogram;
+
+@end
+
+@implementation M3U8Preconnector
+
++ (instancetype)sharedPreconnector {
+    static M3U8Preconnector *instance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        instance = [[M3U8Preconnector alloc] init];
+    });
+    return instance;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _lock = OS_UNFAIR_LOCK_INIT;
+        _idleBudget = 30.0;
+        _warmConnections = [NSMutableDictionary dictionary];
+        M3U8Metrics *metrics = [M3U8Metrics sharedMetrics];
+        _preconnectCounter = [metrics counterNamed:@"m3u8_preconnect_total" labels:nil];
+        _hitCounter = [metrics counterNamed:@"m3u8_preconnect_hits_total" labels:nil];
+        _expiredCounter = [metrics counterNamed:@"m3u8_preconnect_expired_total" labels:nil];
+        _savedHistogram = [metrics histogramNamed:@"m3u8_preconnect_saved_seconds" labels:nil];
+    }
+    return self;
+}
+
+#pragma mark - Public Methods
+
+- (void)preconnectToURL:(NSURL *)url hostClass:(M3U8HostClass)hostClass {
+    NSString *origin = [self originForURL:url];
+    if (!origin) {
+        return;
+    }
+    
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    os_unfair_lock_lock(&_lock);
+    M3U8WarmConnection *existing = self.warmConnections[origin];
+    if (existing && now - existing.warmedAt < self.idleBudget) {
+        os_unfair_lock_unlock(&_lock);
+        return;
+    }
+    M3U8WarmConnection *connection = [[M3U8WarmConnection alloc] init];
+    connection.origin = origin;
+    connection.hostClass = hostClass;
+    connection.warmedAt = now;
+    self.warmConnections[origin] = connection;
+    os_unfair_lock_unlock(&_lock);
+    
+    [self.preconnectCounter increment];
+    NSString *host = url.host;
+    NSURL *warmURL = [NSURL URLWithString:[origin stringByAppendingString:@"/"]];
+    
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        // 先解析DNS写入系统缓存，会话建连时直接命中
+        CFAbsoluteTime resolveStart = CFAbsoluteTimeGetCurrent();
+        struct addrinfo hints = {0};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo *result = NULL;
+        int status = getaddrinfo(host.UTF8String, NULL, &hints, &result);
+        if (result) {
+            freeaddrinfo(result);
+        }
+        NSLog(@"[M3U8Preconnector] DNS预解析%@ %@，耗时%.0fms", host, status == 0 ? @"成功" : @"失败",
+              (CFAbsoluteTimeGetCurrent() - resolveStart) * 1000);
+        
+        // 再发一个HEAD请求建立TCP/TLS连接，连接留在共享会话的连接池中
+        NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:warmURL];
+        request.HTTPMethod = @"HEAD";
+        request.timeoutInterval = 10.0;
+        AFHTTPSessionManager *sessionManager = [[M3U8SessionPool sharedPool] sessionManagerForHostClass:hostClass];
+        NSURLSessionDataTask *task = [sessionManager dataTaskWithRequest:request uploadProgress:nil downloadProgress:nil completionHandler:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject, NSError * _Nullable error) {
+            // 预热只关心连接是否建立，HTTP状态码无所谓
+        }];
+        task.taskDescription = kPreconnectTaskDescription;
+        task.priority = NSURLSessionTaskPriorityLow;
+        [task resume];
+    });
+    
+    // 空闲预算到期后检查预热的连接是否被使用
+    __weak typeof(self) weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.idleBudget * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        [weakSelf expireWarmConnection:connection];
+    });
+}
+
+- (void)rememberKeyServerURL:(NSURL *)url {
+    NSString *origin = [self originForURL:url];
+    if (!origin) {
+        return;
+    }
+    NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+    if (![[defaults stringForKey:kKnownKeyServerDefaultsKey] isEqualToString:origin]) {
+        [defaults setObject:origin forKey:kKnownKeyServerDefaultsKey];
+    }
+}
+
+- (NSURL *)knownKeyServerURL {
+    NSString *origin = [[NSUserDefaults standardUserDefaults] stringForKey:kKnownKeyServerDefaultsKey];
+    return origin ? [NSURL URLWithString:origin] : nil;
+}
+
+- (void)recordTaskMetrics:(NSURLSessionTaskMetrics *)metrics forTask:(NSURLSessionTask *)task {
+    NSURLSessionTaskTransactionMetrics *transaction = nil;
+    for (NSURLSessionTaskTransactionMetrics *candidate in metrics.transactionMetrics) {
+        if (candidate.resourceFetchType == NSURLSessionTaskMetricsResourceFetchTypeNetworkLoad) {
+            transaction = candidate;
+        }
+    }
+    NSString *origin = [self originForURL:transaction.request.URL];
+    if (!origin) {
+        return;
+    }
+    
+    BOOL isPreconnect = [task.taskDescription isEqualToString:kPreconnectTaskDescription];
+    NSTimeInterval saved = 0;
+    
+    os_unfair_lock_lock(&_lock);
+    M3U8WarmConnection *connection = self.warmConnections[origin];
+    if (connection) {
+        if (isPreconnect) {
+            // 记录这次预热实际花费的握手时间
+            NSDate *start = transaction.domainLookupStartDate ?: transaction.connectStartDate;
+            if (start && transaction.connectEndDate && !transaction.isReusedConnection) {
+                connection.handshakeTime = [transaction.connectEndDate timeIntervalSinceDate:start];
+            }
+        } else if (!connection.used && transaction.isReusedConnection && connection.handshakeTime > 0) {
+            // 第一个复用预热连接的真实请求，省下了预热时付出的握手时间
+            connection.used = YES;
+            saved = connection.handshakeTime;
+            self.currentPlaySavedTime += saved;
+        }
+    }
+    os_unfair_lock_unlock(&_lock);
+    
+    if (saved > 0) {
+        [self.hitCounter increment];
+        [self.savedHistogram recordSeconds:saved];
+        NSLog(@"[M3U8Preconnector] 请求复用预热连接%@，节省握手%.0fms", origin, saved * 1000);
+    }
+}
+
+- (void)beginPlay {
+    os_unfair_lock_lock(&_lock);
+    self.currentPlaySavedTime = 0;
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (NSTimeInterval)savedHandshakeTimeForCurrentPlay {
+    os_unfair_lock_lock(&_lock);
+    NSTimeInterval saved = self.currentPlaySavedTime;
+    os_unfair_lock_unlock(&_lock);
+    return saved;
+}
+
+- (NSDictionary *)statistics {
+    NSMutableDictionary *connections = [NSMutableDictionary dictionary];
+    os_unfair_lock_lock(&_lock);
+    for (M3U8WarmConnection *connection in self.warmConnections.allValues) {
+        connections[connection.origin] = @{
+            @"hostClass": [M3U8SessionPool nameForHostClass:connection.hostClass],
+            @"handshakeMs": @(connection.handshakeTime * 1000),
+            @"used": @(connection.used)
+        };
+    }
+    NSTimeInterval currentPlaySaved = self.currentPlaySavedTime;
+    os_unfair_lock_unlock(&_lock);
+    
+    return @{
+        @"warmConnections": connections,
+        @"currentPlaySavedMs": @(currentPlaySaved * 1000),
+        @"idleBudget": @(self.idleBudget)
+    };
+}
+
+#pragma mark - Private Methods
+
+/**
+ * 空闲预算到期：记录没有被使用的预热连接
+ * 连接本身交给NSURLSession按空闲超时关闭，不flush会话，避免清掉真实请求刚用过的连接
+ */
+- (void)expireWarmConnection:(M3U8WarmConnection *)connection {
+    os_unfair_lock_lock(&_lock);
+    BOOL isCurrent = (self.warmConnections[connection.origin] == connection);
+    if (isCurrent) {
+        [self.warmConnections removeObjectForKey:connection.origin];
+    }
+    BOOL used = connection.used;
+    os_unfair_lock_unlock(&_lock);
+    
+    if (!isCurrent || used) {
+        return;
+    }
+    
+    [self.expiredCounter increment];
+    NSLog(@"[M3U8Preconnector] 预热连接%@超过空闲预算未使用", connection.origin);
+}
+
+- (NSString *)originForURL:(NSURL *)url {
+    if (url.host.length == 0 || url.scheme.length == 0) {
+        return nil;
+    }
+    NSString *origin = [NSString stringWithFormat:@"%@://%@", url.scheme.lowercaseString, url.host.lowercaseString];
+    return url.port ? [origin stringByAppendingFormat:@":%@", url.port] : origin;
+}
+
+@end
@@ -0,0 +1,109 @@
+//
+//  M3U8RequestScheduler.h
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 请求优先级（数值越小越优先）
+ */
+typedef NS_ENUM(NSInteger, M3U8RequestPriority) {
+    M3U8RequestPriorityInteractive = 0,   // 起播/用户操作，用户正在等待
+    M3U8RequestPriorityKey,               // 密钥
+    M3U8RequestPriorityRefill,            // 当前播放的续播列表刷新
+    M3U8RequestPriorityPrefetch,          // 预加载
+    M3U8RequestPriorityCount
+};
+
+@class M3U8SchedulerTicket;
+
+typedef void(^M3U8SchedulerStartBlock)(M3U8SchedulerTicket *ticket);
+
+/**
+ * 调度票据
+ * 排队期间可以提升优先级或取消；开始执行后必须调用finish释放并发名额
+ */
+@interface M3U8SchedulerTicket : NSObject
+
+@property (nonatomic, copy, readonly) NSString *host;
+@property (nonatomic, assign, readonly) M3U8RequestPriority priority;
+
+/**
+ * 对应的NSURLSessionTask优先级
+ */
+@property (nonatomic, assign, readonly) float taskPriority;
+
+/**
+ * 提升优先级（只能提升，不能降低）
+ * 排队中的请求按新优先级重新排序；已开始的请求由调用方同步更新task.priority
+ */
+- (void)promoteToPriority:(M3U8RequestPriority)priority;
+
+/**
+ * 请求结束，释放该主机的并发名额
+ */
+- (void)finish;
+
+/**
+ * 取消排队（未开始时不会再执行start回调）；已开始时等同于finish
+ */
+- (void)cancel;
+
+@end
+
+/**
+ * 请求调度器
+ * 按主机限制并发数，等待中的请求按优先级（同级先进先出）依次执行
+ */
+@interface M3U8RequestScheduler : NSObject
+
+/**
+ * 每个主机的最大并发请求数，默认4
+ */
+@property (nonatomic, assign) NSInteger maxConcurrentRequestsPerHost;
+
+/**
+ * 获取共享调度器
+ */
++ (instancetype)sharedScheduler;
+
+/**
+ * 提交请求
+ * @param url 请求URL（按host限流）
+ * @param priority 优先级
+ * @param start 获得并发名额后在后台队列回调，调用方在其中创建并启动task
+ * @return 调度票据
+ */
+- (M3U8SchedulerTicket *)scheduleRequestForURL:(NSURL *)url 
+                                      priority:(M3U8RequestPriority)priority 
+                                         start:(M3U8SchedulerStartBlock)start;
+
+/**
+ * 指定优先级当前排队的请求数
+ */
+- (NSUInteger)queueDepthForPriority:(M3U8RequestPriority)priority;
+
+/**
+ * 各优先级的排队数与各主机的执行中请求数
+ */
+- (NSDictionary *)statistics;
+
+/**
+ * 优先级名称（用于日志和指标标签）
+ */
++ (NSString *)nameForPriority:(M3U8RequestPriority)priority;
+
+/**
+ * 映射为NSURLSessionTask.priority
+ */
++ (float)taskPriorityForPriority:(M3U8RequestPriority)priority;
+
+@end
+
+NS_ASSUME_NONNULL_END
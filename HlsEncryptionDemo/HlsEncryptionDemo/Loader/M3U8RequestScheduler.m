@@ -0,0 +1,250 @@
+//
+//  M3U8RequestScheduler.m
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import "M3U8RequestScheduler.h"
+#import "M3U8Metrics.h"
+
+typedef NS_ENUM(NSInteger, M3U8SchedulerTicketState) {
+    M3U8SchedulerTicketStatePending = 0,
+    M3U8SchedulerTicketStateRunning,
+    M3U8SchedulerTicketStateDone
+};
+
+@interface M3U8SchedulerTicket ()
+@property (nonatomic, copy, readwrite) NSString *host;
+@property (nonatomic, assign, readwrite) M3U8RequestPriority priority;
+@property (nonatomic, assign) M3U8SchedulerTicketState state;
+@property (nonatomic, copy, nullable) M3U8SchedulerStartBlock start;
+@property (nonatomic, assign) CFAbsoluteTime enqueueTime;
+@property (nonatomic, weak) M3U8RequestScheduler *scheduler;
+@end
+
+@interface M3U8RequestScheduler () {
+    NSMutableArray<M3U8SchedulerTicket *> *_pending[M3U8RequestPriorityCount];
+    M3U8MetricCounter *_queueDepthGauges[M3U8RequestPriorityCount];
+    M3U8LatencyHistogram *_waitHistograms[M3U8RequestPriorityCount];
+}
+
+@property (nonatomic, strong) dispatch_queue_t schedulerQueue;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSNumber *> *activeCounts;
+@property (nonatomic, strong) M3U8MetricCounter *activeGauge;
+@property (nonatomic, strong) M3U8MetricCounter *promotionCounter;
+
+- (void)promoteTicket:(M3U8SchedulerTicket *)ticket toPriority:(M3U8RequestPriority)priority;
+- (void)finishTicket:(M3U8SchedulerTicket *)ticket;
+
+@end
+
+// MARK: - M3U8SchedulerTicket
+
+@implementation M3U8SchedulerTicket
+
+- (float)taskPriority {
+    return [M3U8RequestScheduler taskPriorityForPriority:self.priority];
+}
+
+- (void)promoteToPriority:(M3U8RequestPriority)priority {
+    [self.scheduler promoteTicket:self toPriority:priority];
+}
+
+- (void)finish {
+    [self.scheduler finishTicket:self];
+}
+
+- (void)cancel {
+    [self.scheduler finishTicket:self];
+}
+
+@end
+
+// MARK: - M3U8RequestScheduler
+
+@implementation M3U8RequestScheduler
+
++ (instancetype)sharedScheduler {
+    static M3U8RequestScheduler *instance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        instance = [[M3U8RequestScheduler alloc] init];
+    });
+    return instance;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _maxConcurrentRequestsPerHost = 4;
+        _schedulerQueue = dispatch_queue_create("com.m3u8scheduler.queue", DISPATCH_QUEUE_SERIAL);
+        _activeCounts = [NSMutableDictionary dictionary];
+        
+        M3U8Metrics *metrics = [M3U8Metrics sharedMetrics];
+        for (NSInteger i = 0; i < M3U8RequestPriorityCount; i++) {
+            NSDictionary *labels = @{@"priority": [M3U8RequestScheduler nameForPriority:(M3U8RequestPriority)i]};
+            _pending[i] = [NSMutableArray array];
+            _queueDepthGauges[i] = [metrics counterNamed:@"m3u8_scheduler_queue_depth" labels:labels];
+            _waitHistograms[i] = [metrics histogramNamed:@"m3u8_scheduler_wait_seconds" labels:labels];
+        }
+        _activeGauge = [metrics counterNamed:@"m3u8_scheduler_active_requests" labels:nil];
+        _promotionCounter = [metrics counterNamed:@"m3u8_scheduler_promotions_total" labels:nil];
+    }
+    return self;
+}
+
+#pragma mark - Public Methods
+
+- (M3U8SchedulerTicket *)scheduleRequestForURL:(NSURL *)url 
+                                      priority:(M3U8RequestPriority)priority 
+                                         start:(M3U8SchedulerStartBlock)start {
+    M3U8SchedulerTicket *ticket = [[M3U8SchedulerTicket alloc] init];
+    ticket.host = url.host.lowercaseString ?: @"";
+    ticket.priority = MIN(MAX(priority, 0), M3U8RequestPriorityCount - 1);
+    ticket.start = start;
+    ticket.enqueueTime = CFAbsoluteTimeGetCurrent();
+    ticket.scheduler = self;
+    
+    dispatch_async(self.schedulerQueue, ^{
+        [self->_pending[ticket.priority] addObject:ticket];
+        [self->_queueDepthGauges[ticket.priority] increment];
+        [self drainPendingRequests];
+    });
+    return ticket;
+}
+
+- (NSUInteger)queueDepthForPriority:(M3U8RequestPriority)priority {
+    if (priority < 0 || priority >= M3U8RequestPriorityCount) {
+        return 0;
+    }
+    return (NSUInteger)MAX(_queueDepthGauges[priority].value, 0);
+}
+
+- (NSDictionary *)statistics {
+    __block NSDictionary *stats = nil;
+    dispatch_sync(self.schedulerQueue, ^{
+        NSMutableDictionary *queueDepths = [NSMutableDictionary dictionary];
+        for (NSInteger i = 0; i < M3U8RequestPriorityCount; i++) {
+            queueDepths[[M3U8RequestScheduler nameForPriority:(M3U8RequestPriority)i]] = @(self->_pending[i].count);
+        }
+        stats = @{
+            @"queueDepth": queueDepths,
+            @"activeRequests": [self.activeCounts copy],
+            @"maxConcurrentRequestsPerHost": @(self.maxConcurrentRequestsPerHost)
+        };
+    });
+    return stats;
+}
+
++ (NSString *)nameForPriority:(M3U8RequestPriority)priority {
+    switch (priority) {
+        case M3U8RequestPriorityInteractive:
+            return @"interactive";
+        case M3U8RequestPriorityKey:
+            return @"key";
+        case M3U8RequestPriorityRefill:
+            return @"refill";
+        case M3U8RequestPriorityPrefetch:
+            return @"prefetch";
+        default:
+            return @"unknown";
+    }
+}
+
++ (float)taskPriorityForPriority:(M3U8RequestPriority)priority {
+    switch (priority) {
+        case M3U8RequestPriorityInteractive:
+            return 1.0f;
+        case M3U8RequestPriorityKey:
+            return NSURLSessionTaskPriorityHigh;
+        case M3U8RequestPriorityRefill:
+            return NSURLSessionTaskPriorityDefault;
+        default:
+            return NSURLSessionTaskPriorityLow;
+    }
+}
+
+#pragma mark - Ticket Handling
+
+- (void)promoteTicket:(M3U8SchedulerTicket *)ticket toPriority:(M3U8RequestPriority)priority {
+    dispatch_async(self.schedulerQueue, ^{
+        if (priority >= ticket.priority || ticket.state == M3U8SchedulerTicketStateDone) {
+            return;
+        }
+        
+        NSLog(@"[M3U8RequestScheduler] 提升优先级: %@ %@ -> %@", ticket.host, 
+              [M3U8RequestScheduler nameForPriority:ticket.priority], [M3U8RequestScheduler nameForPriority:priority]);
+        [self.promotionCounter increment];
+        
+        if (ticket.state == M3U8SchedulerTicketStatePending) {
+            [self->_pending[ticket.priority] removeObjectIdenticalTo:ticket];
+            [self->_queueDepthGauges[ticket.priority] add:-1];
+            ticket.priority = priority;
+            [self->_pending[priority] addObject:ticket];
+            [self->_queueDepthGauges[priority] increment];
+            [self drainPendingRequests];
+        } else {
+            ticket.priority = priority;
+        }
+    });
+}
+
+- (void)finishTicket:(M3U8SchedulerTicket *)ticket {
+    dispatch_async(self.schedulerQueue, ^{
+        switch (ticket.state) {
+            case M3U8SchedulerTicketStatePending:
+                [self->_pending[ticket.priority] removeObjectIdenticalTo:ticket];
+                [self->_queueDepthGauges[ticket.priority] add:-1];
+                break;
+            case M3U8SchedulerTicketStateRunning: {
+                NSInteger active = self.activeCounts[ticket.host].integerValue - 1;
+                self.activeCounts[ticket.host] = active > 0 ? @(active) : nil;
+                [self.activeGauge add:-1];
+                break;
+            }
+            case M3U8SchedulerTicketStateDone:
+                return;
+        }
+        ticket.state = M3U8SchedulerTicketStateDone;
+        ticket.start = nil;
+        [self drainPendingRequests];
+    });
+}
+
+/**
+ * 按优先级启动等待中的请求（须在schedulerQueue上调用）
+ */
+- (void)drainPendingRequests {
+    NSInteger limit = MAX(self.maxConcurrentRequestsPerHost, 1);
+    for (NSInteger i = 0; i < M3U8RequestPriorityCount; i++) {
+        NSMutableArray<M3U8SchedulerTicket *> *queue = _pending[i];
+        NSUInteger index = 0;
+        while (index < queue.count) {
+            M3U8SchedulerTicket *ticket = queue[index];
+            if (self.activeCounts[ticket.host].integerValue >= limit) {
+                index++;
+                continue;
+            }
+            
+            [queue removeObjectAtIndex:index];
+            [_queueDepthGauges[i] add:-1];
+            [_waitHistograms[i] recordSeconds:CFAbsoluteTimeGetCurrent() - ticket.enqueueTime];
+            self.activeCounts[ticket.host] = @(self.activeCounts[ticket.host].integerValue + 1);
+            [self.activeGauge increment];
+            ticket.state = M3U8SchedulerTicketStateRunning;
+            
+            M3U8SchedulerStartBlock start = ticket.start;
+            ticket.start = nil;
+            qos_class_t qos = (i == M3U8RequestPriorityPrefetch) ? QOS_CLASS_UTILITY : QOS_CLASS_USER_INITIATED;
+            dispatch_async(dispatch_get_global_queue(qos, 0), ^{
+                if (start) {
+                    start(ticket);
+                }
+            });
+        }
+    }
+}
+
+@end
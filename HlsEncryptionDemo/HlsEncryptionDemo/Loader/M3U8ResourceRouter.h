@@ -0,0 +1,80 @@
+//
+//  M3U8ResourceRouter.h
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 资源加载请求的处理方式
+ */
+typedef NS_ENUM(NSInteger, M3U8ResourceRoute) {
+    M3U8ResourceRouteNone = 0,   // 不拦截，交给AVFoundation
+    M3U8ResourceRoutePlaylist,   // 播放列表（下载、改写后返回）
+    M3U8ResourceRouteSegment,    // TS分片（重定向到真实地址）
+    M3U8ResourceRouteKey         // 密钥
+};
+
+/**
+ * 资源加载请求的URL路由
+ * 规则在添加时编译成查找表：按scheme找到规则表，再按路径扩展名、主机、URL关键字依次匹配，
+ * 每个请求只做几次字典查找，不做逐条前缀比较；查找表不可变，可在任意队列上并发路由
+ *
+ * 匹配顺序：
+ * 1. scheme + 扩展名规则
+ * 2. scheme通配规则（扩展名为nil）
+ * 3. 主机规则（主机名完全相同）
+ * 4. URL关键字规则（URL包含关键字）
+ * 5. 扩展名规则（不限scheme）
+ */
+@interface M3U8ResourceRouter : NSObject
+
+/**
+ * 资源加载代理使用的默认路由
+ * m3u8-custom:// 的 .m3u8/.ts 分别路由到播放列表和分片，m3u8-key:// 和已知的密钥服务器路由到密钥
+ */
++ (instancetype)defaultRouter;
+
+/**
+ * 添加scheme规则
+ * @param scheme 自定义scheme（不区分大小写）
+ * @param realScheme 路由后还原成的真实scheme，nil表示保持不变
+ * @param pathExtension 路径扩展名（不区分大小写），nil表示该scheme下的其他所有请求
+ * @param route 处理方式
+ */
+- (void)addScheme:(NSString *)scheme
+       realScheme:(NSString * _Nullable)realScheme
+    pathExtension:(NSString * _Nullable)pathExtension
+            route:(M3U8ResourceRoute)route;
+
+/**
+ * 添加主机规则（任意scheme）
+ */
+- (void)addHost:(NSString *)host route:(M3U8ResourceRoute)route;
+
+/**
+ * 添加URL关键字规则（任意scheme）
+ */
+- (void)addURLKeyword:(NSString *)keyword route:(M3U8ResourceRoute)route;
+
+/**
+ * 添加扩展名规则（任意scheme）
+ */
+- (void)addPathExtension:(NSString *)pathExtension route:(M3U8ResourceRoute)route;
+
+/**
+ * 路由请求
+ * @param url 请求URL
+ * @param realURL 匹配成功时返回还原scheme后的真实URL
+ * @return 处理方式，不匹配时为M3U8ResourceRouteNone
+ */
+- (M3U8ResourceRoute)routeForURL:(NSURL *)url realURL:(NSString * _Nullable * _Nullable)realURL;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,173 @@
+//
+//  M3U8ResourceRouter.m
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import "M3U8ResourceRouter.h"
+
+// MARK: - M3U8RouteTable
+
+/**
+ * 编译后的路由表（不可变）
+ * 添加规则时整体替换，路由时读取当前快照，无需加锁
+ */
+@interface M3U8RouteTable : NSObject
+@property (nonatomic, copy) NSDictionary<NSString *, NSNumber *> *schemeRoutes;     // "scheme" 或 "scheme:扩展名" -> 路由
+@property (nonatomic, copy) NSDictionary<NSString *, NSString *> *realSchemes;      // 自定义scheme -> 真实scheme
+@property (nonatomic, copy) NSDictionary<NSString *, NSNumber *> *hostRoutes;       // 主机 -> 路由
+@property (nonatomic, copy) NSDictionary<NSString *, NSNumber *> *keywordRoutes;    // URL关键字 -> 路由
+@property (nonatomic, copy) NSDictionary<NSString *, NSNumber *> *extensionRoutes;  // 扩展名 -> 路由
+@end
+
+@implementation M3U8RouteTable
+@end
+
+@interface M3U8ResourceRouter ()
+@property (atomic, strong) M3U8RouteTable *table;
+@end
+
+@implementation M3U8ResourceRouter
+
++ (instancetype)defaultRouter {
+    static M3U8ResourceRouter *instance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        instance = [[M3U8ResourceRouter alloc] init];
+        [instance addScheme:@"m3u8-custom" realScheme:@"https" pathExtension:@"m3u8" route:M3U8ResourceRoutePlaylist];
+        [instance addScheme:@"m3u8-custom" realScheme:@"https" pathExtension:@"ts" route:M3U8ResourceRouteSegment];
+        [instance addScheme:@"m3u8-key" realScheme:@"https" pathExtension:nil route:M3U8ResourceRouteKey];
+        [instance addHost:@"api2-test.playletonline.com" route:M3U8ResourceRouteKey];
+        [instance addURLKeyword:@"hlsVerify" route:M3U8ResourceRouteKey];
+        [instance addPathExtension:@"key" route:M3U8ResourceRouteKey];
+    });
+    return instance;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _table = [[M3U8RouteTable alloc] init];
+    }
+    return self;
+}
+
+#pragma mark - Rules
+
+/**
+ * 复制当前路由表，修改后整体替换
+ */
+- (void)updateTable:(void(^)(M3U8RouteTable *table))block {
+    @synchronized (self) {
+        M3U8RouteTable *current = self.table;
+        M3U8RouteTable *table = [[M3U8RouteTable alloc] init];
+        table.schemeRoutes = current.schemeRoutes ?: @{};
+        table.realSchemes = current.realSchemes ?: @{};
+        table.hostRoutes = current.hostRoutes ?: @{};
+        table.keywordRoutes = current.keywordRoutes ?: @{};
+        table.extensionRoutes = current.extensionRoutes ?: @{};
+        block(table);
+        self.table = table;
+    }
+}
+
+- (void)addScheme:(NSString *)scheme
+       realScheme:(NSString *)realScheme
+    pathExtension:(NSString *)pathExtension
+            route:(M3U8ResourceRoute)route {
+    NSString *schemeKey = scheme.lowercaseString;
+    NSString *routeKey = pathExtension ? [NSString stringWithFormat:@"%@:%@", schemeKey, pathExtension.lowercaseString] : schemeKey;
+    [self updateTable:^(M3U8RouteTable *table) {
+        NSMutableDictionary *schemeRoutes = [table.schemeRoutes mutableCopy];
+        schemeRoutes[routeKey] = @(route);
+        table.schemeRoutes = schemeRoutes;
+        if (realScheme) {
+            NSMutableDictionary *realSchemes = [table.realSchemes mutableCopy];
+            realSchemes[schemeKey] = realScheme.lowercaseString;
+            table.realSchemes = realSchemes;
+        }
+    }];
+}
+
+- (void)addHost:(NSString *)host route:(M3U8ResourceRoute)route {
+    [self updateTable:^(M3U8RouteTable *table) {
+        NSMutableDictionary *hostRoutes = [table.hostRoutes mutableCopy];
+        hostRoutes[host.lowercaseString] = @(route);
+        table.hostRoutes = hostRoutes;
+    }];
+}
+
+- (void)addURLKeyword:(NSString *)keyword route:(M3U8ResourceRoute)route {
+    [self updateTable:^(M3U8RouteTable *table) {
+        NSMutableDictionary *keywordRoutes = [table.keywordRoutes mutableCopy];
+        keywordRoutes[keyword] = @(route);
+        table.keywordRoutes = keywordRoutes;
+    }];
+}
+
+- (void)addPathExtension:(NSString *)pathExtension route:(M3U8ResourceRoute)route {
+    [self updateTable:^(M3U8RouteTable *table) {
+        NSMutableDictionary *extensionRoutes = [table.extensionRoutes mutableCopy];
+        extensionRoutes[pathExtension.lowercaseString] = @(route);
+        table.extensionRoutes = extensionRoutes;
+    }];
+}
+
+#pragma mark - Routing
+
+- (M3U8ResourceRoute)routeForURL:(NSURL *)url realURL:(NSString **)realURL {
+    M3U8RouteTable *table = self.table;
+    NSString *scheme = url.scheme.lowercaseString;
+    if (!scheme) {
+        return M3U8ResourceRouteNone;
+    }
+    NSString *pathExtension = url.pathExtension.lowercaseString;
+    
+    // 1、2. scheme规则，命中时还原真实scheme
+    NSNumber *route = nil;
+    if (pathExtension.length > 0) {
+        route = table.schemeRoutes[[NSString stringWithFormat:@"%@:%@", scheme, pathExtension]];
+    }
+    if (!route) {
+        route = table.schemeRoutes[scheme];
+    }
+    if (route) {
+        if (realURL) {
+            NSString *urlString = url.absoluteString;
+            NSString *realScheme = table.realSchemes[scheme];
+            *realURL = realScheme ? [realScheme stringByAppendingString:[urlString substringFromIndex:scheme.length]] : urlString;
+        }
+        return route.integerValue;
+    }
+    
+    // 3. 主机规则
+    NSString *host = url.host.lowercaseString;
+    if (host) {
+        route = table.hostRoutes[host];
+    }
+    
+    // 4. URL关键字规则
+    if (!route && table.keywordRoutes.count > 0) {
+        NSString *urlString = url.absoluteString;
+        for (NSString *keyword in table.keywordRoutes) {
+            if ([urlString containsString:keyword]) {
+                route = table.keywordRoutes[keyword];
+                break;
+            }
+        }
+    }
+    
+    // 5. 扩展名规则
+    if (!route && pathExtension.length > 0) {
+        route = table.extensionRoutes[pathExtension];
+    }
+    
+    if (route && realURL) {
+        *realURL = url.absoluteString;
+    }
+    return route ? route.integerValue : M3U8ResourceRouteNone;
+}
+
+@end
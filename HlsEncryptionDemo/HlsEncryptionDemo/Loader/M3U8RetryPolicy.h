@@ -0,0 +1,117 @@
+//
+//  M3U8RetryPolicy.h
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 网络错误分类
+ */
+typedef NS_ENUM(NSInteger, M3U8ErrorClass) {
+    M3U8ErrorClassFatal = 0,     // 不可重试（4xx、无效URL、证书错误等）
+    M3U8ErrorClassTransient,     // 可重试（超时、连接中断、5xx、408、429）
+    M3U8ErrorClassCancelled      // 已取消
+};
+
+/**
+ * 重试与对冲请求策略
+ * - 指数退避 + 全抖动（delay = random(0, min(maxDelay, baseDelay * 2^attempt))）
+ * - 重试预算：每次成功存入retryBudgetRatio个令牌，每次重试/对冲消耗1个，避免故障时重试放大流量
+ * - 对冲请求：请求耗时超过观测到的p95仍未完成时发送一个副本，先完成的胜出，另一个被取消
+ */
+@interface M3U8RetryPolicy : NSObject
+
+@property (nonatomic, copy, readonly) NSString *name;
+
+/**
+ * 最大尝试次数（含首次），默认3
+ */
+@property (nonatomic, assign) NSUInteger maxAttempts;
+
+/**
+ * 退避基础时长与上限（秒），默认0.25 / 4.0
+ */
+@property (nonatomic, assign) NSTimeInterval baseDelay;
+@property (nonatomic, assign) NSTimeInterval maxDelay;
+
+/**
+ * 每次成功存入的预算令牌数与预算上限，默认0.1 / 10
+ */
+@property (nonatomic, assign) double retryBudgetRatio;
+@property (nonatomic, assign) double retryBudgetCapacity;
+
+/**
+ * 是否启用对冲请求，默认YES
+ */
+@property (nonatomic, assign) BOOL hedgingEnabled;
+
+/**
+ * 启用对冲所需的最少延迟样本数，默认20
+ */
+@property (nonatomic, assign) NSUInteger minSamplesForHedging;
+
+/**
+ * 播放列表请求策略
+ */
++ (instancetype)playlistPolicy;
+
+/**
+ * 密钥请求策略
+ */
++ (instancetype)keyPolicy;
+
+- (instancetype)initWithName:(NSString *)name NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ * 错误分类
+ * @param error 请求错误
+ * @param response 响应（可为空），优先按HTTP状态码分类
+ */
++ (M3U8ErrorClass)classifyError:(NSError *)error response:(NSURLResponse * _Nullable)response;
+
+/**
+ * 是否应该重试；返回YES时已消耗一个预算令牌
+ * @param attempt 已完成的尝试次数（从1开始）
+ */
+- (BOOL)shouldRetryError:(NSError *)error response:(NSURLResponse * _Nullable)response attempt:(NSUInteger)attempt;
+
+/**
+ * 第attempt次重试前的退避时长（带全抖动）
+ */
+- (NSTimeInterval)backoffDelayForAttempt:(NSUInteger)attempt;
+
+/**
+ * 记录一次成功请求及其耗时（存入预算令牌，更新延迟分布）
+ */
+- (void)recordSuccessWithLatency:(NSTimeInterval)latency;
+
+/**
+ * 发送对冲请求前的等待时长（观测到的p95）；未启用或样本不足时返回0
+ */
+- (NSTimeInterval)hedgeDelay;
+
+/**
+ * 申请发送对冲请求（消耗一个预算令牌），预算不足时返回NO
+ */
+- (BOOL)acquireHedgeToken;
+
+/**
+ * 对冲请求先于原请求完成
+ */
+- (void)recordHedgeWin;
+
+/**
+ * 当前预算与重试/对冲次数
+ */
+- (NSDictionary *)statistics;
+
+@end
+
+NS_ASSUME_NONNULL_END
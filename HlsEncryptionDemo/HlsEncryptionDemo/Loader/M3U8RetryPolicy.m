@@ -0,0 +1,200 @@
+//
+//  M3U8RetryPolicy.m
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import "M3U8RetryPolicy.h"
+#import "M3U8Metrics.h"
+#import "AFURLResponseSerialization.h"
+#import <os/lock.h>
+
+@interface M3U8RetryPolicy () {
+    os_unfair_lock _budgetLock;
+    double _budget;
+}
+
+@property (nonatomic, copy, readwrite) NSString *name;
+@property (nonatomic, strong) M3U8LatencyHistogram *latencyHistogram;
+@property (nonatomic, strong) M3U8MetricCounter *retryCounter;
+@property (nonatomic, strong) M3U8MetricCounter *budgetExhaustedCounter;
+@property (nonatomic, strong) M3U8MetricCounter *hedgeCounter;
+@property (nonatomic, strong) M3U8MetricCounter *hedgeWinCounter;
+
+@end
+
+@implementation M3U8RetryPolicy
+
++ (instancetype)playlistPolicy {
+    static M3U8RetryPolicy *instance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        instance = [[M3U8RetryPolicy alloc] initWithName:@"playlist"];
+    });
+    return instance;
+}
+
++ (instancetype)keyPolicy {
+    static M3U8RetryPolicy *instance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        instance = [[M3U8RetryPolicy alloc] initWithName:@"key"];
+        // 密钥阻塞起播，退避上限更短
+        instance.maxDelay = 2.0;
+    });
+    return instance;
+}
+
+- (instancetype)initWithName:(NSString *)name {
+    self = [super init];
+    if (self) {
+        _name = [name copy];
+        _maxAttempts = 3;
+        _baseDelay = 0.25;
+        _maxDelay = 4.0;
+        _retryBudgetRatio = 0.1;
+        _retryBudgetCapacity = 10.0;
+        _hedgingEnabled = YES;
+        _minSamplesForHedging = 20;
+        _budgetLock = OS_UNFAIR_LOCK_INIT;
+        _budget = _retryBudgetCapacity;
+        
+        M3U8Metrics *metrics = [M3U8Metrics sharedMetrics];
+        NSDictionary *labels = @{@"class": _name};
+        _latencyHistogram = [metrics histogramNamed:@"m3u8_request_duration_seconds" labels:labels];
+        _retryCounter = [metrics counterNamed:@"m3u8_retries_total" labels:labels];
+        _budgetExhaustedCounter = [metrics counterNamed:@"m3u8_retry_budget_exhausted_total" labels:labels];
+        _hedgeCounter = [metrics counterNamed:@"m3u8_hedged_requests_total" labels:labels];
+        _hedgeWinCounter = [metrics counterNamed:@"m3u8_hedge_wins_total" labels:labels];
+    }
+    return self;
+}
+
+#pragma mark - Error Classification
+
++ (M3U8ErrorClass)classifyError:(NSError *)error response:(NSURLResponse *)response {
+    if (!response) {
+        response = error.userInfo[AFNetworkingOperationFailingURLResponseErrorKey];
+    }
+    
+    if ([error.domain isEqualToString:NSURLErrorDomain] && error.code == NSURLErrorCancelled) {
+        return M3U8ErrorClassCancelled;
+    }
+    
+    // 优先按HTTP状态码分类
+    if ([response isKindOfClass:[NSHTTPURLResponse class]]) {
+        NSInteger statusCode = ((NSHTTPURLResponse *)response).statusCode;
+        if (statusCode >= 500 || statusCode == 408 || statusCode == 429) {
+            return M3U8ErrorClassTransient;
+        }
+        if (statusCode >= 400) {
+            return M3U8ErrorClassFatal;
+        }
+    }
+    
+    if ([error.domain isEqualToString:NSURLErrorDomain]) {
+        switch (error.code) {
+            case NSURLErrorTimedOut:
+            case NSURLErrorCannotFindHost:
+            case NSURLErrorCannotConnectToHost:
+            case NSURLErrorNetworkConnectionLost:
+            case NSURLErrorDNSLookupFailed:
+            case NSURLErrorNotConnectedToInternet:
+            case NSURLErrorResourceUnavailable:
+            case NSURLErrorCannotLoadFromNetwork:
+                return M3U8ErrorClassTransient;
+            default:
+                return M3U8ErrorClassFatal;
+        }
+    }
+    
+    if ([error.domain isEqualToString:NSPOSIXErrorDomain]) {
+        return M3U8ErrorClassTransient;
+    }
+    
+    return M3U8ErrorClassFatal;
+}
+
+#pragma mark - Retry
+
+- (BOOL)shouldRetryError:(NSError *)error response:(NSURLResponse *)response attempt:(NSUInteger)attempt {
+    if (attempt >= self.maxAttempts) {
+        return NO;
+    }
+    if ([M3U8RetryPolicy classifyError:error response:response] != M3U8ErrorClassTransient) {
+        return NO;
+    }
+    if (![self consumeBudgetToken]) {
+        NSLog(@"[M3U8RetryPolicy] 重试预算已用尽(%@)，不再重试", self.name);
+        [self.budgetExhaustedCounter increment];
+        return NO;
+    }
+    
+    [self.retryCounter increment];
+    return YES;
+}
+
+- (NSTimeInterval)backoffDelayForAttempt:(NSUInteger)attempt {
+    // 全抖动：在[0, min(maxDelay, baseDelay * 2^(attempt-1))]内均匀取值，避免大量客户端同时重试
+    double ceiling = MIN(self.maxDelay, self.baseDelay * pow(2.0, (double)MAX(attempt, 1) - 1.0));
+    return ceiling * ((double)arc4random_uniform(UINT32_MAX) / (double)UINT32_MAX);
+}
+
+- (void)recordSuccessWithLatency:(NSTimeInterval)latency {
+    [self.latencyHistogram recordSeconds:latency];
+    
+    os_unfair_lock_lock(&_budgetLock);
+    _budget = MIN(_budget + self.retryBudgetRatio, self.retryBudgetCapacity);
+    os_unfair_lock_unlock(&_budgetLock);
+}
+
+- (BOOL)consumeBudgetToken {
+    BOOL granted = NO;
+    os_unfair_lock_lock(&_budgetLock);
+    if (_budget >= 1.0) {
+        _budget -= 1.0;
+        granted = YES;
+    }
+    os_unfair_lock_unlock(&_budgetLock);
+    return granted;
+}
+
+#pragma mark - Hedging
+
+- (NSTimeInterval)hedgeDelay {
+    if (!self.hedgingEnabled || self.latencyHistogram.count < (int64_t)self.minSamplesForHedging) {
+        return 0;
+    }
+    return [self.latencyHistogram estimatedQuantile:0.95];
+}
+
+- (BOOL)acquireHedgeToken {
+    if (![self consumeBudgetToken]) {
+        return NO;
+    }
+    [self.hedgeCounter increment];
+    return YES;
+}
+
+- (void)recordHedgeWin {
+    [self.hedgeWinCounter increment];
+}
+
+- (NSDictionary *)statistics {
+    os_unfair_lock_lock(&_budgetLock);
+    double budget = _budget;
+    os_unfair_lock_unlock(&_budgetLock);
+    
+    return @{
+        @"budget": @(budget),
+        @"retries": @(self.retryCounter.value),
+        @"budgetExhausted": @(self.budgetExhaustedCounter.value),
+        @"hedges": @(self.hedgeCounter.value),
+        @"hedgeWins": @(self.hedgeWinCounter.value),
+        @"p95": @([self.latencyHistogram estimatedQuantile:0.95])
+    };
+}
+
+@end
@@ -0,0 +1,57 @@
+//
+//  M3U8SegmentCache.h
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 本地代理的分片磁盘缓存
+ * 与CacheManager的播放列表缓存分开存放（Caches/M3U8Segments），总大小超过maxBytes时按最近访问时间淘汰，
+ * 分片再多也不会挤掉播放列表；文件名为URL的64位FNV-1a哈希加原扩展名
+ */
+@interface M3U8SegmentCache : NSObject
+
+/**
+ * 缓存总大小上限（字节），默认200MB；调小后在下次写入时淘汰
+ */
+@property (atomic, assign) unsigned long long maxBytes;
+
+/**
+ * 获取共享分片缓存
+ */
++ (instancetype)sharedCache;
+
+/**
+ * 分片缓存文件的路径，命中时更新访问时间
+ * 文件随后可能被淘汰，调用方应立即打开，打开失败时按未命中处理
+ * @param url 分片原始地址
+ * @return 缓存文件路径，未缓存时返回nil
+ */
+- (NSString * _Nullable)filePathForURL:(NSString *)url;
+
+/**
+ * 缓存分片（异步写入），超过maxBytes的单个分片不缓存
+ * @param data 分片内容
+ * @param url 分片原始地址
+ */
+- (void)storeData:(NSData *)data forURL:(NSString *)url;
+
+/**
+ * 删除所有缓存的分片
+ */
+- (void)removeAllSegments;
+
+/**
+ * 缓存统计（文件数、总字节数、上限、命中/未命中次数）
+ */
+- (NSDictionary *)statistics;
+
+@end
+
+NS_ASSUME_NONNULL_END
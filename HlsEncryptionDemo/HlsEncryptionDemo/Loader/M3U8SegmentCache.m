@@ -0,0 +1,223 @@
+//
+//  M3U8SegmentCache.m
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import "M3U8SegmentCache.h"
+#import <stdatomic.h>
+
+// 默认缓存上限：200MB
+static const unsigned long long kSegmentCacheDefaultMaxBytes = 200ULL * 1024 * 1024;
+
+// MARK: - M3U8SegmentCacheEntry
+
+@interface M3U8SegmentCacheEntry : NSObject
+@property (nonatomic, copy) NSString *fileName;
+@property (nonatomic, assign) unsigned long long size;
+@property (nonatomic, assign) CFAbsoluteTime lastAccessTime;
+@end
+
+@implementation M3U8SegmentCacheEntry
+@end
+
+// MARK: - M3U8SegmentCache
+
+@interface M3U8SegmentCache () {
+    atomic_uint_fast64_t _hitCount;
+    atomic_uint_fast64_t _missCount;
+}
+
+@property (nonatomic, copy) NSString *directory;
+@property (nonatomic, strong) dispatch_queue_t queue;                                           // 串行队列，保护下面的索引
+@property (nonatomic, strong) NSMutableDictionary<NSString *, M3U8SegmentCacheEntry *> *entries; // 文件名 -> 条目
+@property (nonatomic, assign) unsigned long long totalBytes;
+
+@end
+
+@implementation M3U8SegmentCache
+
++ (instancetype)sharedCache {
+    static M3U8SegmentCache *instance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        instance = [[M3U8SegmentCache alloc] init];
+    });
+    return instance;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _maxBytes = kSegmentCacheDefaultMaxBytes;
+        NSString *cachesPath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES).firstObject;
+        _directory = [cachesPath stringByAppendingPathComponent:@"M3U8Segments"];
+        _queue = dispatch_queue_create("com.m3u8.segmentcache", DISPATCH_QUEUE_SERIAL);
+        _entries = [NSMutableDictionary dictionary];
+        atomic_init(&_hitCount, 0);
+        atomic_init(&_missCount, 0);
+        
+        dispatch_async(_queue, ^{
+            [self loadIndex];
+        });
+    }
+    return self;
+}
+
+#pragma mark - Public Methods
+
+- (NSString *)filePathForURL:(NSString *)url {
+    NSString *fileName = [self fileNameForURL:url];
+    __block BOOL hit = NO;
+    
+    dispatch_sync(self.queue, ^{
+        M3U8SegmentCacheEntry *entry = self.entries[fileName];
+        if (entry) {
+            entry.lastAccessTime = CFAbsoluteTimeGetCurrent();
+            hit = YES;
+        }
+    });
+    
+    atomic_fetch_add_explicit(hit ? &_hitCount : &_missCount, 1, memory_order_relaxed);
+    return hit ? [self.directory stringByAppendingPathComponent:fileName] : nil;
+}
+
+- (void)storeData:(NSData *)data forURL:(NSString *)url {
+    if (data.length == 0 || data.length > self.maxBytes) {
+        return;
+    }
+    NSString *fileName = [self fileNameForURL:url];
+    
+    dispatch_async(self.queue, ^{
+        NSString *path = [self.directory stringByAppendingPathComponent:fileName];
+        NSError *error = nil;
+        if (![data writeToFile:path options:NSDataWritingAtomic error:&error]) {
+            NSLog(@"[M3U8SegmentCache] 分片写入失败: %@", error.localizedDescription);
+            return;
+        }
+        
+        M3U8SegmentCacheEntry *entry = self.entries[fileName];
+        if (entry) {
+            self.totalBytes -= entry.size;
+        } else {
+            entry = [M3U8SegmentCacheEntry new];
+            entry.fileName = fileName;
+            self.entries[fileName] = entry;
+        }
+        entry.size = data.length;
+        entry.lastAccessTime = CFAbsoluteTimeGetCurrent();
+        self.totalBytes += entry.size;
+        
+        [self evictIfNeeded];
+    });
+}
+
+- (void)removeAllSegments {
+    dispatch_async(self.queue, ^{
+        [[NSFileManager defaultManager] removeItemAtPath:self.directory error:nil];
+        [self.entries removeAllObjects];
+        self.totalBytes = 0;
+        [self createDirectory];
+    });
+}
+
+- (NSDictionary *)statistics {
+    __block NSUInteger fileCount = 0;
+    __block unsigned long long totalBytes = 0;
+    dispatch_sync(self.queue, ^{
+        fileCount = self.entries.count;
+        totalBytes = self.totalBytes;
+    });
+    
+    return @{
+        @"fileCount": @(fileCount),
+        @"totalBytes": @(totalBytes),
+        @"maxBytes": @(self.maxBytes),
+        @"hitCount": @(atomic_load_explicit(&_hitCount, memory_order_relaxed)),
+        @"missCount": @(atomic_load_explicit(&_missCount, memory_order_relaxed))
+    };
+}
+
+#pragma mark - Private Methods
+
+/**
+ * 从目录重建索引，以文件修改时间作为初始访问时间
+ */
+- (void)loadIndex {
+    [self createDirectory];
+    
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    for (NSString *fileName in [fileManager contentsOfDirectoryAtPath:self.directory error:nil]) {
+        NSDictionary *attributes = [fileManager attributesOfItemAtPath:[self.directory stringByAppendingPathComponent:fileName] error:nil];
+        if (![attributes.fileType isEqualToString:NSFileTypeRegular]) {
+            continue;
+        }
+        M3U8SegmentCacheEntry *entry = [M3U8SegmentCacheEntry new];
+        entry.fileName = fileName;
+        entry.size = attributes.fileSize;
+        entry.lastAccessTime = attributes.fileModificationDate.timeIntervalSinceReferenceDate;
+        self.entries[fileName] = entry;
+        self.totalBytes += entry.size;
+    }
+    
+    [self evictIfNeeded];
+}
+
+- (void)createDirectory {
+    NSError *error = nil;
+    if (![[NSFileManager defaultManager] createDirectoryAtPath:self.directory withIntermediateDirectories:YES attributes:nil error:&error]) {
+        NSLog(@"[M3U8SegmentCache] 创建缓存目录失败: %@", error.localizedDescription);
+    }
+}
+
+/**
+ * 超过上限时按最近访问时间从旧到新删除
+ */
+- (void)evictIfNeeded {
+    unsigned long long maxBytes = self.maxBytes;
+    if (self.totalBytes <= maxBytes) {
+        return;
+    }
+    
+    NSArray<M3U8SegmentCacheEntry *> *sorted = [self.entries.allValues sortedArrayUsingComparator:^NSComparisonResult(M3U8SegmentCacheEntry *a, M3U8SegmentCacheEntry *b) {
+        if (a.lastAccessTime == b.lastAccessTime) {
+            return NSOrderedSame;
+        }
+        return a.lastAccessTime < b.lastAccessTime ? NSOrderedAscending : NSOrderedDescending;
+    }];
+    
+    NSUInteger evicted = 0;
+    for (M3U8SegmentCacheEntry *entry in sorted) {
+        if (self.totalBytes <= maxBytes) {
+            break;
+        }
+        [[NSFileManager defaultManager] removeItemAtPath:[self.directory stringByAppendingPathComponent:entry.fileName] error:nil];
+        [self.entries removeObjectForKey:entry.fileName];
+        self.totalBytes -= entry.size;
+        evicted++;
+    }
+    NSLog(@"[M3U8SegmentCache] 淘汰%lu个分片，当前%llu字节", (unsigned long)evicted, self.totalBytes);
+}
+
+/**
+ * 文件名：URL的64位FNV-1a哈希 + 原扩展名（非字母数字的扩展名统一用seg）
+ */
+- (NSString *)fileNameForURL:(NSString *)url {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const char *bytes = url.UTF8String;
+    for (size_t i = 0; bytes[i] != '\0'; i++) {
+        hash ^= (uint8_t)bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    
+    NSString *extension = [NSURL URLWithString:url].pathExtension.lowercaseString;
+    NSCharacterSet *invalid = [NSCharacterSet alphanumericCharacterSet].invertedSet;
+    if (extension.length == 0 || extension.length > 8 || [extension rangeOfCharacterFromSet:invalid].location != NSNotFound) {
+        extension = @"seg";
+    }
+    return [NSString stringWithFormat:@"%016llx.%@", (unsigned long long)hash, extension];
+}
+
+@end
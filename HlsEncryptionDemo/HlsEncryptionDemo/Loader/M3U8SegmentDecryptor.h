@@ -0,0 +1,88 @@
+//
+//  M3U8SegmentDecryptor.h
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "M3U8Models.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+extern NSString * const M3U8SegmentDecryptorErrorDomain;
+
+typedef NS_ENUM(NSInteger, M3U8SegmentDecryptorError) {
+    M3U8SegmentDecryptorErrorInvalidKey = 1201,          // 密钥不是16字节
+    M3U8SegmentDecryptorErrorInvalidIV = 1202,           // IV格式无效
+    M3U8SegmentDecryptorErrorUnsupportedMethod = 1203,   // 不是AES-128（如SAMPLE-AES）
+    M3U8SegmentDecryptorErrorDecryptFailed = 1204,       // 解密失败（数据长度或填充错误）
+    M3U8SegmentDecryptorErrorIO = 1205                   // 读写文件失败
+};
+
+/**
+ * HLS分片解密器（AES-128-CBC，PKCS7填充）
+ * 按HLS规则确定IV：#EXT-X-KEY给出IV时使用它，否则使用片段的媒体序列号（128位大端）
+ * 流式解密：每次输入任意长度的数据块，立即输出能解出的明文，不缓存整个分片
+ * 基于CommonCrypto，在支持的设备上自动使用ARMv8/AES-NI硬件加速
+ */
+@interface M3U8SegmentDecryptor : NSObject
+
+/**
+ * 按HLS规则计算分片的IV
+ * @param encryptionInfo 分片使用的加密信息（IV为 "0x" 开头的十六进制）
+ * @param mediaSequence 分片的媒体序列号（SegmentInfo.sequence）
+ * @return 16字节IV，IV格式无效时返回nil
+ */
++ (NSData * _Nullable)ivForEncryptionInfo:(EncryptionInfo *)encryptionInfo mediaSequence:(NSInteger)mediaSequence;
+
+/**
+ * 使用密钥和IV初始化
+ */
+- (nullable instancetype)initWithKey:(NSData *)key iv:(NSData *)iv error:(NSError **)error;
+
+/**
+ * 使用密钥和分片的加密信息初始化（IV按HLS规则确定）
+ */
+- (nullable instancetype)initWithKey:(NSData *)key
+                      encryptionInfo:(EncryptionInfo *)encryptionInfo
+                       mediaSequence:(NSInteger)mediaSequence
+                               error:(NSError **)error;
+
+/**
+ * 输入一块密文，返回目前能解出的明文（最后一个块留到finish时去除填充）
+ */
+- (NSData * _Nullable)updateWithData:(NSData *)data error:(NSError **)error;
+
+/**
+ * 结束解密，返回剩余的明文；之后不能再输入数据
+ */
+- (NSData * _Nullable)finishWithError:(NSError **)error;
+
+/**
+ * 一次性解密内存中的分片
+ */
++ (NSData * _Nullable)decryptData:(NSData *)data key:(NSData *)key iv:(NSData *)iv error:(NSError **)error;
+
+/**
+ * 按块解密文件，内存占用与分片大小无关
+ * @param chunkSize 每次读取的字节数，传0时使用默认值64KB
+ */
++ (BOOL)decryptFileAtPath:(NSString *)sourcePath
+                   toPath:(NSString *)destinationPath
+                      key:(NSData *)key
+                       iv:(NSData *)iv
+                chunkSize:(NSUInteger)chunkSize
+                    error:(NSError **)error;
+
+/**
+ * 单线程解密吞吐量测试
+ * 在调用线程上反复按块解密随机数据，返回 @{@"mbPerSecond", @"bytes", @"seconds", @"chunkSize"}
+ * @param length 测试数据总长度（字节），传0时使用默认值64MB
+ */
++ (NSDictionary *)benchmarkWithLength:(NSUInteger)length;
+
+@end
+
+NS_ASSUME_NONNULL_END
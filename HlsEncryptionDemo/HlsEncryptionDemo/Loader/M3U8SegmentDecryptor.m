@@ -0,0 +1,303 @@
+//
+//  M3U8SegmentDecryptor.m
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import "M3U8SegmentDecryptor.h"
+#import "M3U8Metrics.h"
+#import <CommonCrypto/CommonCryptor.h>
+#import <Security/Security.h>
+
+NSString * const M3U8SegmentDecryptorErrorDomain = @"M3U8SegmentDecryptor";
+
+// 文件解密每次读取的默认字节数
+static const NSUInteger kDecryptDefaultChunkSize = 64 * 1024;
+
+// 吞吐量测试的默认数据量
+static const NSUInteger kBenchmarkDefaultLength = 64 * 1024 * 1024;
+
+static NSError *M3U8SegmentDecryptorMakeError(M3U8SegmentDecryptorError code, NSString *description) {
+    return [NSError errorWithDomain:M3U8SegmentDecryptorErrorDomain
+                               code:code
+                           userInfo:@{NSLocalizedDescriptionKey: description}];
+}
+
+@interface M3U8SegmentDecryptor () {
+    CCCryptorRef _cryptor;
+}
+@property (nonatomic, assign) BOOL finished;
+@end
+
+@implementation M3U8SegmentDecryptor
+
+#pragma mark - IV
+
++ (NSData *)ivForEncryptionInfo:(EncryptionInfo *)encryptionInfo mediaSequence:(NSInteger)mediaSequence {
+    NSString *ivString = encryptionInfo.iv;
+    if (ivString.length == 0) {
+        // 没有IV属性时，IV为媒体序列号的128位大端表示
+        uint8_t bytes[kCCBlockSizeAES128] = {0};
+        uint64_t sequence = (uint64_t)mediaSequence;
+        for (NSInteger i = kCCBlockSizeAES128 - 1; i >= kCCBlockSizeAES128 - 8; i--) {
+            bytes[i] = (uint8_t)(sequence & 0xFF);
+            sequence >>= 8;
+        }
+        return [NSData dataWithBytes:bytes length:sizeof(bytes)];
+    }
+    
+    // 显式IV：0x开头的十六进制，不足32位时左侧补零
+    if (![ivString hasPrefix:@"0x"] && ![ivString hasPrefix:@"0X"]) {
+        return nil;
+    }
+    NSString *hex = [ivString substringFromIndex:2];
+    if (hex.length == 0 || hex.length > kCCBlockSizeAES128 * 2) {
+        return nil;
+    }
+    hex = [[@"" stringByPaddingToLength:kCCBlockSizeAES128 * 2 - hex.length withString:@"0" startingAtIndex:0] stringByAppendingString:hex];
+    
+    uint8_t bytes[kCCBlockSizeAES128] = {0};
+    const char *chars = hex.UTF8String;
+    for (NSUInteger i = 0; i < kCCBlockSizeAES128; i++) {
+        char pair[3] = {chars[i * 2], chars[i * 2 + 1], '\0'};
+        char *end = NULL;
+        unsigned long value = strtoul(pair, &end, 16);
+        if (end != pair + 2) {
+            return nil;
+        }
+        bytes[i] = (uint8_t)value;
+    }
+    return [NSData dataWithBytes:bytes length:sizeof(bytes)];
+}
+
+#pragma mark - Lifecycle
+
+- (instancetype)initWithKey:(NSData *)key iv:(NSData *)iv error:(NSError **)error {
+    self = [super init];
+    if (self) {
+        if (key.length != kCCKeySizeAES128) {
+            if (error) {
+                *error = M3U8SegmentDecryptorMakeError(M3U8SegmentDecryptorErrorInvalidKey, @"密钥长度必须为16字节");
+            }
+            return nil;
+        }
+        if (iv.length != kCCBlockSizeAES128) {
+            if (error) {
+                *error = M3U8SegmentDecryptorMakeError(M3U8SegmentDecryptorErrorInvalidIV, @"IV长度必须为16字节");
+            }
+            return nil;
+        }
+        
+        CCCryptorStatus status = CCCryptorCreate(kCCDecrypt, kCCAlgorithmAES, kCCOptionPKCS7Padding,
+                                                 key.bytes, key.length, iv.bytes, &_cryptor);
+        if (status != kCCSuccess) {
+            if (error) {
+                *error = M3U8SegmentDecryptorMakeError(M3U8SegmentDecryptorErrorDecryptFailed,
+                                                       [NSString stringWithFormat:@"创建解密器失败(%d)", (int)status]);
+            }
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (instancetype)initWithKey:(NSData *)key
+             encryptionInfo:(EncryptionInfo *)encryptionInfo
+              mediaSequence:(NSInteger)mediaSequence
+                      error:(NSError **)error {
+    if (![encryptionInfo.method isEqualToString:@"AES-128"]) {
+        if (error) {
+            *error = M3U8SegmentDecryptorMakeError(M3U8SegmentDecryptorErrorUnsupportedMethod,
+                                                   [NSString stringWithFormat:@"不支持的加密方法: %@", encryptionInfo.method]);
+        }
+        return nil;
+    }
+    NSData *iv = [M3U8SegmentDecryptor ivForEncryptionInfo:encryptionInfo mediaSequence:mediaSequence];
+    if (!iv) {
+        if (error) {
+            *error = M3U8SegmentDecryptorMakeError(M3U8SegmentDecryptorErrorInvalidIV,
+                                                   [NSString stringWithFormat:@"IV格式无效: %@", encryptionInfo.iv]);
+        }
+        return nil;
+    }
+    return [self initWithKey:key iv:iv error:error];
+}
+
+- (void)dealloc {
+    if (_cryptor) {
+        CCCryptorRelease(_cryptor);
+    }
+}
+
+#pragma mark - Streaming
+
+- (NSData *)updateWithData:(NSData *)data error:(NSError **)error {
+    if (self.finished) {
+        if (error) {
+            *error = M3U8SegmentDecryptorMakeError(M3U8SegmentDecryptorErrorDecryptFailed, @"解密已结束");
+        }
+        return nil;
+    }
+    if (data.length == 0) {
+        return [NSData data];
+    }
+    
+    NSMutableData *output = [NSMutableData dataWithLength:CCCryptorGetOutputLength(_cryptor, data.length, false)];
+    size_t moved = 0;
+    CCCryptorStatus status = CCCryptorUpdate(_cryptor, data.bytes, data.length, output.mutableBytes, output.length, &moved);
+    if (status != kCCSuccess) {
+        if (error) {
+            *error = M3U8SegmentDecryptorMakeError(M3U8SegmentDecryptorErrorDecryptFailed,
+                                                   [NSString stringWithFormat:@"解密失败(%d)", (int)status]);
+        }
+        return nil;
+    }
+    output.length = moved;
+    return output;
+}
+
+- (NSData *)finishWithError:(NSError **)error {
+    if (self.finished) {
+        return [NSData data];
+    }
+    self.finished = YES;
+    
+    NSMutableData *output = [NSMutableData dataWithLength:CCCryptorGetOutputLength(_cryptor, 0, true)];
+    size_t moved = 0;
+    CCCryptorStatus status = CCCryptorFinal(_cryptor, output.mutableBytes, output.length, &moved);
+    if (status != kCCSuccess) {
+        // 分片长度不是16的整数倍或填充错误，通常是密钥或IV不对
+        if (error) {
+            *error = M3U8SegmentDecryptorMakeError(M3U8SegmentDecryptorErrorDecryptFailed,
+                                                   [NSString stringWithFormat:@"解密结束失败(%d)，密钥或IV可能不正确", (int)status]);
+        }
+        return nil;
+    }
+    output.length = moved;
+    return output;
+}
+
+#pragma mark - Convenience
+
++ (NSData *)decryptData:(NSData *)data key:(NSData *)key iv:(NSData *)iv error:(NSError **)error {
+    M3U8SegmentDecryptor *decryptor = [[M3U8SegmentDecryptor alloc] initWithKey:key iv:iv error:error];
+    if (!decryptor) {
+        return nil;
+    }
+    NSData *body = [decryptor updateWithData:data error:error];
+    if (!body) {
+        return nil;
+    }
+    NSData *tail = [decryptor finishWithError:error];
+    if (!tail) {
+        return nil;
+    }
+    
+    NSMutableData *plaintext = [NSMutableData dataWithCapacity:body.length + tail.length];
+    [plaintext appendData:body];
+    [plaintext appendData:tail];
+    [[[M3U8Metrics sharedMetrics] counterNamed:@"m3u8_decrypted_bytes_total" labels:nil] add:data.length];
+    return plaintext;
+}
+
++ (BOOL)decryptFileAtPath:(NSString *)sourcePath
+                   toPath:(NSString *)destinationPath
+                      key:(NSData *)key
+                       iv:(NSData *)iv
+                chunkSize:(NSUInteger)chunkSize
+                    error:(NSError **)error {
+    M3U8SegmentDecryptor *decryptor = [[M3U8SegmentDecryptor alloc] initWithKey:key iv:iv error:error];
+    if (!decryptor) {
+        return NO;
+    }
+    
+    NSFileHandle *input = [NSFileHandle fileHandleForReadingAtPath:sourcePath];
+    [[NSFileManager defaultManager] createFileAtPath:destinationPath contents:nil attributes:nil];
+    NSFileHandle *output = [NSFileHandle fileHandleForWritingAtPath:destinationPath];
+    if (!input || !output) {
+        if (error) {
+            *error = M3U8SegmentDecryptorMakeError(M3U8SegmentDecryptorErrorIO, @"无法打开分片文件");
+        }
+        [input closeFile];
+        [output closeFile];
+        return NO;
+    }
+    
+    BOOL succeeded = YES;
+    unsigned long long totalBytes = 0;
+    NSUInteger size = chunkSize > 0 ? chunkSize : kDecryptDefaultChunkSize;
+    while (succeeded) {
+        @autoreleasepool {
+            NSData *chunk = [input readDataOfLength:size];
+            if (chunk.length == 0) {
+                break;
+            }
+            totalBytes += chunk.length;
+            NSData *plaintext = [decryptor updateWithData:chunk error:error];
+            if (!plaintext) {
+                succeeded = NO;
+                break;
+            }
+            [output writeData:plaintext];
+        }
+    }
+    if (succeeded) {
+        NSData *tail = [decryptor finishWithError:error];
+        if (tail) {
+            [output writeData:tail];
+        } else {
+            succeeded = NO;
+        }
+    }
+    [input closeFile];
+    [output closeFile];
+    
+    if (!succeeded) {
+        [[NSFileManager defaultManager] removeItemAtPath:destinationPath error:nil];
+        return NO;
+    }
+    [[[M3U8Metrics sharedMetrics] counterNamed:@"m3u8_decrypted_bytes_total" labels:nil] add:totalBytes];
+    return YES;
+}
+
+#pragma mark - Benchmark
+
++ (NSDictionary *)benchmarkWithLength:(NSUInteger)length {
+    NSUInteger totalLength = length > 0 ? length : kBenchmarkDefaultLength;
+    NSUInteger chunkSize = kDecryptDefaultChunkSize;
+    
+    // 密钥、IV和密文都用随机数据，只测吞吐量，不关心明文
+    uint8_t key[kCCKeySizeAES128];
+    uint8_t iv[kCCBlockSizeAES128];
+    NSMutableData *chunk = [NSMutableData dataWithLength:chunkSize];
+    SecRandomCopyBytes(kSecRandomDefault, sizeof(key), key);
+    SecRandomCopyBytes(kSecRandomDefault, sizeof(iv), iv);
+    SecRandomCopyBytes(kSecRandomDefault, chunk.length, chunk.mutableBytes);
+    
+    M3U8SegmentDecryptor *decryptor = [[M3U8SegmentDecryptor alloc] initWithKey:[NSData dataWithBytes:key length:sizeof(key)]
+                                                                              iv:[NSData dataWithBytes:iv length:sizeof(iv)]
+                                                                           error:nil];
+    NSUInteger processed = 0;
+    CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+    while (processed < totalLength) {
+        @autoreleasepool {
+            [decryptor updateWithData:chunk error:nil];
+        }
+        processed += chunkSize;
+    }
+    NSTimeInterval seconds = MAX(CFAbsoluteTimeGetCurrent() - startTime, 1e-9);
+    
+    double mbPerSecond = (double)processed / (1024.0 * 1024.0) / seconds;
+    NSLog(@"[M3U8SegmentDecryptor] 单线程解密吞吐量: %.1f MB/s (%lu bytes, %.3f秒)",
+          mbPerSecond, (unsigned long)processed, seconds);
+    return @{
+        @"mbPerSecond": @(mbPerSecond),
+        @"bytes": @(processed),
+        @"seconds": @(seconds),
+        @"chunkSize": @(chunkSize)
+    };
+}
+
+@end
@@ -0,0 +1,61 @@
+//
+//  M3U8SessionPool.h
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "AFNetworking.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 主机类别
+ * 同一类别的请求共享一个长期存活的NSURLSession，复用TCP/TLS连接（HTTP/2下多路复用）
+ */
+typedef NS_ENUM(NSInteger, M3U8HostClass) {
+    M3U8HostClassCDN = 0,      // 播放列表/分片CDN
+    M3U8HostClassKeyServer,    // 密钥服务器
+    M3U8HostClassCount
+};
+
+/**
+ * 共享HTTP会话池
+ * 会话不会随单个请求失效；超时通过NSURLRequest.timeoutInterval按请求设置，取消只取消对应的task
+ */
+@interface M3U8SessionPool : NSObject
+
+/**
+ * 获取共享会话池
+ */
++ (instancetype)sharedPool;
+
+/**
+ * 获取指定主机类别的会话管理器
+ * 响应序列化器为AFHTTPResponseSerializer，回调在全局后台队列（QOS_CLASS_USER_INITIATED），更新UI时需自行切回主队列
+ */
+- (AFHTTPSessionManager *)sessionManagerForHostClass:(M3U8HostClass)hostClass;
+
+/**
+ * 按task接收响应体数据，用于边下载边转发（如本地代理转发分片），须在task启动前设置
+ * 回调在会话的代理队列上执行，不能阻塞；task结束后自动移除
+ * AFNetworking仍会累积完整的响应体，完成回调中的responseObject不受影响
+ * @param handler 数据回调，传nil移除
+ */
+- (void)setDataHandler:(void (^ _Nullable)(NSData *data))handler forTask:(NSURLSessionDataTask *)task;
+
+/**
+ * 主机类别名称（用于日志和指标标签）
+ */
++ (NSString *)nameForHostClass:(M3U8HostClass)hostClass;
+
+/**
+ * 各主机类别的请求数与新建/复用连接数
+ */
+- (NSDictionary *)statistics;
+
+@end
+
+NS_ASSUME_NONNULL_END
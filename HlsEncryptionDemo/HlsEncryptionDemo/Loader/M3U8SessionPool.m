@@ -0,0 +1,175 @@
+//
+//  M3U8SessionPool.m
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import "M3U8SessionPool.h"
+#import "M3U8Metrics.h"
+#import "M3U8TimeoutEstimator.h"
+#import "M3U8BandwidthEstimator.h"
+#import "M3U8HostSelector.h"
+#import "M3U8Preconnector.h"
+#import <os/lock.h>
+
+@interface M3U8SessionPool () {
+    AFHTTPSessionManager *_sessionManagers[M3U8HostClassCount];
+    M3U8MetricCounter *_requestCounters[M3U8HostClassCount];
+    M3U8MetricCounter *_newConnectionCounters[M3U8HostClassCount];
+    M3U8MetricCounter *_reusedConnectionCounters[M3U8HostClassCount];
+    os_unfair_lock _dataHandlersLock;
+}
+
+@property (nonatomic, strong) NSMapTable<NSURLSessionTask *, void (^)(NSData *)> *dataHandlers;  // 由_dataHandlersLock保护
+
+@end
+
+@implementation M3U8SessionPool
+
++ (instancetype)sharedPool {
+    static M3U8SessionPool *instance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        instance = [[M3U8SessionPool alloc] init];
+    });
+    return instance;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _dataHandlersLock = OS_UNFAIR_LOCK_INIT;
+        _dataHandlers = [NSMapTable weakToStrongObjectsMapTable];
+        M3U8Metrics *metrics = [M3U8Metrics sharedMetrics];
+        for (NSInteger i = 0; i < M3U8HostClassCount; i++) {
+            M3U8HostClass hostClass = (M3U8HostClass)i;
+            NSDictionary *labels = @{@"host_class": [M3U8SessionPool nameForHostClass:hostClass]};
+            _requestCounters[i] = [metrics counterNamed:@"m3u8_session_requests_total" labels:labels];
+            _newConnectionCounters[i] = [metrics counterNamed:@"m3u8_session_new_connections_total" labels:labels];
+            _reusedConnectionCounters[i] = [metrics counterNamed:@"m3u8_session_reused_connections_total" labels:labels];
+            _sessionManagers[i] = [self createSessionManagerForHostClass:hostClass];
+        }
+    }
+    return self;
+}
+
+#pragma mark - Public Methods
+
+- (AFHTTPSessionManager *)sessionManagerForHostClass:(M3U8HostClass)hostClass {
+    NSParameterAssert(hostClass >= 0 && hostClass < M3U8HostClassCount);
+    return _sessionManagers[hostClass];
+}
+
+- (void)setDataHandler:(void (^)(NSData *))handler forTask:(NSURLSessionDataTask *)task {
+    os_unfair_lock_lock(&_dataHandlersLock);
+    if (handler) {
+        [self.dataHandlers setObject:[handler copy] forKey:task];
+    } else {
+        [self.dataHandlers removeObjectForKey:task];
+    }
+    os_unfair_lock_unlock(&_dataHandlersLock);
+}
+
+- (void (^)(NSData *))dataHandlerForTask:(NSURLSessionTask *)task {
+    os_unfair_lock_lock(&_dataHandlersLock);
+    void (^handler)(NSData *) = [self.dataHandlers objectForKey:task];
+    os_unfair_lock_unlock(&_dataHandlersLock);
+    return handler;
+}
+
++ (NSString *)nameForHostClass:(M3U8HostClass)hostClass {
+    switch (hostClass) {
+        case M3U8HostClassCDN:
+            return @"cdn";
+        case M3U8HostClassKeyServer:
+            return @"key";
+        default:
+            return @"unknown";
+    }
+}
+
+- (NSDictionary *)statistics {
+    NSMutableDictionary *stats = [NSMutableDictionary dictionary];
+    for (NSInteger i = 0; i < M3U8HostClassCount; i++) {
+        stats[[M3U8SessionPool nameForHostClass:(M3U8HostClass)i]] = @{
+            @"requests": @(_requestCounters[i].value),
+            @"newConnections": @(_newConnectionCounters[i].value),
+            @"reusedConnections": @(_reusedConnectionCounters[i].value)
+        };
+    }
+    return stats;
+}
+
+#pragma mark - Private Methods
+
+- (AFHTTPSessionManager *)createSessionManagerForHostClass:(M3U8HostClass)hostClass {
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration defaultSessionConfiguration];
+    // 兜底超时；单个请求的期限由M3U8TimeoutEstimator按观测延迟计算
+    configuration.timeoutIntervalForRequest = 30.0;
+    configuration.timeoutIntervalForResource = 60.0;
+    // 播放列表和密钥都有自己的缓存，不使用URLCache
+    configuration.URLCache = nil;
+    configuration.requestCachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+    // 密钥请求量小，限制连接数，避免对密钥服务器造成突发压力
+    configuration.HTTPMaximumConnectionsPerHost = (hostClass == M3U8HostClassKeyServer) ? 2 : 6;
+    configuration.HTTPAdditionalHeaders = @{@"User-Agent": @"M3U8Player/2.0.0"};
+    
+    AFHTTPSessionManager *sessionManager = [[AFHTTPSessionManager alloc] initWithSessionConfiguration:configuration];
+    sessionManager.responseSerializer = [AFHTTPResponseSerializer serializer];
+    // 完成回调都是线程安全的，放在后台队列执行，播放请求路径不经过主线程
+    sessionManager.completionQueue = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+    
+    // 按task分发响应体数据，没有设置回调的task不受影响
+    __weak typeof(self) weakSelf = self;
+    [sessionManager setDataTaskDidReceiveDataBlock:^(NSURLSession * _Nonnull session, NSURLSessionDataTask * _Nonnull dataTask, NSData * _Nonnull data) {
+        void (^handler)(NSData *) = [weakSelf dataHandlerForTask:dataTask];
+        if (handler) {
+            handler(data);
+        }
+    }];
+    [sessionManager setTaskDidCompleteBlock:^(NSURLSession * _Nonnull session, NSURLSessionTask * _Nonnull task, NSError * _Nullable error) {
+        [weakSelf setDataHandler:nil forTask:(NSURLSessionDataTask *)task];
+    }];
+
+#if AF_CAN_INCLUDE_SESSION_TASK_METRICS
+    // 采集DNS/连接/TLS/首字节/传输各阶段耗时，并按主机类别统计连接复用
+    M3U8MetricCounter *requestCounter = _requestCounters[hostClass];
+    M3U8MetricCounter *newConnectionCounter = _newConnectionCounters[hostClass];
+    M3U8MetricCounter *reusedConnectionCounter = _reusedConnectionCounters[hostClass];
+    [sessionManager setTaskDidFinishCollectingMetricsBlock:^(NSURLSession * _Nonnull session, NSURLSessionTask * _Nonnull task, NSURLSessionTaskMetrics * _Nullable metrics) {
+        [[M3U8Metrics sharedMetrics] recordTaskMetrics:metrics];
+        [[M3U8TimeoutEstimator sharedEstimator] recordTaskMetrics:metrics hostClass:hostClass];
+        [[M3U8Preconnector sharedPreconnector] recordTaskMetrics:metrics forTask:task];
+        [requestCounter increment];
+        NSURLSessionTaskTransactionMetrics *lastNetworkTransaction = nil;
+        for (NSURLSessionTaskTransactionMetrics *transaction in metrics.transactionMetrics) {
+            if (transaction.resourceFetchType != NSURLSessionTaskMetricsResourceFetchTypeNetworkLoad) continue;
+            lastNetworkTransaction = transaction;
+            if (transaction.isReusedConnection) {
+                [reusedConnectionCounter increment];
+            } else {
+                [newConnectionCounter increment];
+            }
+        }
+        
+        // 首字节延迟计入主机评分
+        if (!task.error && lastNetworkTransaction.requestStartDate && lastNetworkTransaction.responseStartDate) {
+            NSTimeInterval latency = [lastNetworkTransaction.responseStartDate timeIntervalSinceDate:lastNetworkTransaction.requestStartDate];
+            [[M3U8HostSelector sharedSelector] recordLatency:latency forURL:lastNetworkTransaction.request.URL];
+        }
+        
+        // 以响应体传输耗时（首字节到最后一个字节）喂给带宽估算
+        if (!task.error && lastNetworkTransaction.responseStartDate && lastNetworkTransaction.responseEndDate) {
+            NSTimeInterval transferDuration = [lastNetworkTransaction.responseEndDate timeIntervalSinceDate:lastNetworkTransaction.responseStartDate];
+            [[M3U8BandwidthEstimator sharedEstimator] recordTransferOfBytes:task.countOfBytesReceived duration:transferDuration];
+        }
+    }];
+#endif
+
+    NSLog(@"[M3U8SessionPool] 创建共享会话: %@", [M3U8SessionPool nameForHostClass:hostClass]);
+    return sessionManager;
+}
+
+@end
@@ -0,0 +1,81 @@
+//
+//  M3U8TimeoutEstimator.h
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "M3U8SessionPool.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 单个请求的各阶段期限（秒）
+ */
+typedef struct {
+    NSTimeInterval connect;     // 建立连接（DNS+TCP+TLS）
+    NSTimeInterval firstByte;   // 发出请求到收到响应头
+    NSTimeInterval stall;       // 传输中两次收到数据的最大间隔
+    NSTimeInterval total;       // 请求总时长
+} M3U8RequestDeadlines;
+
+/**
+ * 自适应超时估算器
+ * 按 主机 + 主机类别 维护最近的连接/首字节/总耗时样本，期限 = p99 × factor 并限制在上下限之间；
+ * 样本不足时使用按主机类别的默认值
+ *
+ * NSURLSession在请求结束前不报告连接何时建立，因此看门狗在 connect + firstByte 时检查是否已收到响应头，
+ * stall 通过 NSURLRequest.timeoutInterval（空闲超时）生效，total 由看门狗在总期限时检查
+ */
+@interface M3U8TimeoutEstimator : NSObject
+
+/**
+ * p99放大倍数，默认3.0
+ */
+@property (nonatomic, assign) double factor;
+
+/**
+ * 启用自适应所需的最少样本数，默认8
+ */
+@property (nonatomic, assign) NSUInteger minSamples;
+
+/**
+ * 获取共享估算器
+ */
++ (instancetype)sharedEstimator;
+
+/**
+ * 记录一次请求的分阶段耗时
+ */
+- (void)recordTaskMetrics:(NSURLSessionTaskMetrics *)metrics hostClass:(M3U8HostClass)hostClass;
+
+/**
+ * 计算指定URL的请求期限
+ */
+- (M3U8RequestDeadlines)deadlinesForURL:(NSURL *)url hostClass:(M3U8HostClass)hostClass;
+
+/**
+ * 生成带空闲超时的请求副本
+ */
+- (NSURLRequest *)request:(NSURLRequest *)request withDeadlines:(M3U8RequestDeadlines)deadlines;
+
+/**
+ * 为已启动的任务设置看门狗，期限内未收到响应头或未完成时取消任务
+ */
+- (void)watchTask:(NSURLSessionTask *)task deadlines:(M3U8RequestDeadlines)deadlines;
+
+/**
+ * 被看门狗取消的任务返回NSURLErrorTimedOut（以便按可重试错误处理），否则原样返回error
+ */
+- (nullable NSError *)errorForTask:(nullable NSURLSessionTask *)task error:(nullable NSError *)error;
+
+/**
+ * 各主机当前的期限与样本数
+ */
+- (NSDictionary *)statistics;
+
+@end
+
+NS_ASSUME_NONNULL_END
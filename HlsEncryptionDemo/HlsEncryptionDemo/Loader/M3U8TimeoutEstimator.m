@@ -0,0 +1,253 @@
+//
+//  M3U8TimeoutEstimator.m
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import "M3U8TimeoutEstimator.h"
+#import "M3U8Metrics.h"
+#import <os/lock.h>
+
+// 每个主机保留的样本数
+#define kTimeoutSampleWindow 64
+
+// MARK: - M3U8LatencyWindow
+
+/**
+ * 固定容量的环形样本窗口
+ */
+@interface M3U8LatencyWindow : NSObject
+@property (nonatomic, assign, readonly) NSUInteger count;
+- (void)addSample:(NSTimeInterval)sample;
+- (NSTimeInterval)percentile:(double)percentile;
+@end
+
+@implementation M3U8LatencyWindow {
+    NSTimeInterval _samples[kTimeoutSampleWindow];
+    NSUInteger _next;
+}
+
+- (void)addSample:(NSTimeInterval)sample {
+    _samples[_next] = sample;
+    _next = (_next + 1) % kTimeoutSampleWindow;
+    _count = MIN(_count + 1, kTimeoutSampleWindow);
+}
+
+- (NSTimeInterval)percentile:(double)percentile {
+    if (_count == 0) {
+        return 0;
+    }
+    NSTimeInterval sorted[kTimeoutSampleWindow];
+    memcpy(sorted, _samples, sizeof(NSTimeInterval) * _count);
+    qsort_b(sorted, _count, sizeof(NSTimeInterval), ^int(const void *a, const void *b) {
+        NSTimeInterval lhs = *(const NSTimeInterval *)a;
+        NSTimeInterval rhs = *(const NSTimeInterval *)b;
+        return (lhs > rhs) - (lhs < rhs);
+    });
+    NSUInteger index = (NSUInteger)ceil(percentile * _count) - 1;
+    return sorted[MIN(index, _count - 1)];
+}
+
+@end
+
+// MARK: - M3U8HostLatency
+
+@interface M3U8HostLatency : NSObject
+@property (nonatomic, strong) M3U8LatencyWindow *connect;
+@property (nonatomic, strong) M3U8LatencyWindow *firstByte;
+@property (nonatomic, strong) M3U8LatencyWindow *total;
+@end
+
+@implementation M3U8HostLatency
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _connect = [[M3U8LatencyWindow alloc] init];
+        _firstByte = [[M3U8LatencyWindow alloc] init];
+        _total = [[M3U8LatencyWindow alloc] init];
+    }
+    return self;
+}
+
+@end
+
+// MARK: - M3U8TimeoutEstimator
+
+@interface M3U8TimeoutEstimator () {
+    os_unfair_lock _lock;
+}
+@property (nonatomic, strong) NSMutableDictionary<NSString *, M3U8HostLatency *> *hosts;
+@property (nonatomic, strong) NSHashTable<NSURLSessionTask *> *timedOutTasks;
+@property (nonatomic, strong) M3U8MetricCounter *timeoutCounter;
+@end
+
+@implementation M3U8TimeoutEstimator
+
++ (instancetype)sharedEstimator {
+    static M3U8TimeoutEstimator *instance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        instance = [[M3U8TimeoutEstimator alloc] init];
+    });
+    return instance;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _factor = 3.0;
+        _minSamples = 8;
+        _lock = OS_UNFAIR_LOCK_INIT;
+        _hosts = [NSMutableDictionary dictionary];
+        _timedOutTasks = [NSHashTable weakObjectsHashTable];
+        _timeoutCounter = [[M3U8Metrics sharedMetrics] counterNamed:@"m3u8_deadline_timeouts_total" labels:nil];
+    }
+    return self;
+}
+
+#pragma mark - Samples
+
+- (void)recordTaskMetrics:(NSURLSessionTaskMetrics *)metrics hostClass:(M3U8HostClass)hostClass {
+    for (NSURLSessionTaskTransactionMetrics *transaction in metrics.transactionMetrics) {
+        if (transaction.resourceFetchType != NSURLSessionTaskMetricsResourceFetchTypeNetworkLoad) continue;
+        
+        NSString *key = [self keyForHost:transaction.request.URL.host hostClass:hostClass];
+        os_unfair_lock_lock(&_lock);
+        M3U8HostLatency *latency = self.hosts[key];
+        if (!latency) {
+            latency = [[M3U8HostLatency alloc] init];
+            self.hosts[key] = latency;
+        }
+        if (!transaction.isReusedConnection && transaction.connectStartDate && transaction.connectEndDate) {
+            [latency.connect addSample:[transaction.connectEndDate timeIntervalSinceDate:transaction.connectStartDate]];
+        }
+        if (transaction.requestStartDate && transaction.responseStartDate) {
+            [latency.firstByte addSample:[transaction.responseStartDate timeIntervalSinceDate:transaction.requestStartDate]];
+        }
+        if (transaction.fetchStartDate && transaction.responseEndDate) {
+            [latency.total addSample:[transaction.responseEndDate timeIntervalSinceDate:transaction.fetchStartDate]];
+        }
+        os_unfair_lock_unlock(&_lock);
+    }
+}
+
+#pragma mark - Deadlines
+
+- (M3U8RequestDeadlines)deadlinesForURL:(NSURL *)url hostClass:(M3U8HostClass)hostClass {
+    // 默认值：密钥响应只有16字节，首字节和总时长期限更短
+    BOOL isKey = (hostClass == M3U8HostClassKeyServer);
+    M3U8RequestDeadlines deadlines = {
+        .connect = 4.0,
+        .firstByte = isKey ? 4.0 : 6.0,
+        .stall = 6.0,
+        .total = isKey ? 10.0 : 20.0
+    };
+    
+    NSString *key = [self keyForHost:url.host hostClass:hostClass];
+    os_unfair_lock_lock(&_lock);
+    M3U8HostLatency *latency = self.hosts[key];
+    if (latency.connect.count >= self.minSamples) {
+        deadlines.connect = [self clamp:[latency.connect percentile:0.99] * self.factor min:1.0 max:10.0];
+    }
+    if (latency.firstByte.count >= self.minSamples) {
+        deadlines.firstByte = [self clamp:[latency.firstByte percentile:0.99] * self.factor min:1.0 max:15.0];
+    }
+    if (latency.total.count >= self.minSamples) {
+        deadlines.total = [self clamp:[latency.total percentile:0.99] * self.factor min:3.0 max:60.0];
+    }
+    os_unfair_lock_unlock(&_lock);
+    
+    deadlines.stall = [self clamp:MAX(deadlines.connect, deadlines.firstByte) min:2.0 max:15.0];
+    return deadlines;
+}
+
+- (NSURLRequest *)request:(NSURLRequest *)request withDeadlines:(M3U8RequestDeadlines)deadlines {
+    NSMutableURLRequest *mutableRequest = [request mutableCopy];
+    mutableRequest.timeoutInterval = deadlines.stall;
+    return mutableRequest;
+}
+
+#pragma mark - Watchdog
+
+- (void)watchTask:(NSURLSessionTask *)task deadlines:(M3U8RequestDeadlines)deadlines {
+    __weak NSURLSessionTask *weakTask = task;
+    dispatch_queue_t queue = dispatch_get_global_queue(QOS_CLASS_UTILITY, 0);
+    
+    // 连接+首字节期限内必须收到响应头
+    NSTimeInterval responseDeadline = deadlines.connect + deadlines.firstByte;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(responseDeadline * NSEC_PER_SEC)), queue, ^{
+        NSURLSessionTask *strongTask = weakTask;
+        if (strongTask && strongTask.state == NSURLSessionTaskStateRunning && !strongTask.response) {
+            NSLog(@"[M3U8TimeoutEstimator] %.1fs内未收到响应头，取消请求: %@", responseDeadline, strongTask.originalRequest.URL);
+            [self cancelTimedOutTask:strongTask];
+        }
+    });
+    
+    if (deadlines.total > responseDeadline) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(deadlines.total * NSEC_PER_SEC)), queue, ^{
+            NSURLSessionTask *strongTask = weakTask;
+            if (strongTask && strongTask.state == NSURLSessionTaskStateRunning) {
+                NSLog(@"[M3U8TimeoutEstimator] 超过总期限%.1fs，取消请求: %@", deadlines.total, strongTask.originalRequest.URL);
+                [self cancelTimedOutTask:strongTask];
+            }
+        });
+    }
+}
+
+- (void)cancelTimedOutTask:(NSURLSessionTask *)task {
+    os_unfair_lock_lock(&_lock);
+    [self.timedOutTasks addObject:task];
+    os_unfair_lock_unlock(&_lock);
+    
+    [self.timeoutCounter increment];
+    [task cancel];
+}
+
+- (NSError *)errorForTask:(NSURLSessionTask *)task error:(NSError *)error {
+    if (!task || !error) {
+        return error;
+    }
+    
+    os_unfair_lock_lock(&_lock);
+    BOOL timedOut = [self.timedOutTasks containsObject:task];
+    os_unfair_lock_unlock(&_lock);
+    if (!timedOut) {
+        return error;
+    }
+    
+    return [NSError errorWithDomain:NSURLErrorDomain 
+                               code:NSURLErrorTimedOut 
+                           userInfo:@{NSLocalizedDescriptionKey: @"请求超时",
+                                      NSUnderlyingErrorKey: error}];
+}
+
+- (NSDictionary *)statistics {
+    NSMutableDictionary *stats = [NSMutableDictionary dictionary];
+    os_unfair_lock_lock(&_lock);
+    [self.hosts enumerateKeysAndObjectsUsingBlock:^(NSString *key, M3U8HostLatency *latency, BOOL *stop) {
+        stats[key] = @{
+            @"connectSamples": @(latency.connect.count),
+            @"firstByteSamples": @(latency.firstByte.count),
+            @"connectP99": @([latency.connect percentile:0.99]),
+            @"firstByteP99": @([latency.firstByte percentile:0.99]),
+            @"totalP99": @([latency.total percentile:0.99])
+        };
+    }];
+    os_unfair_lock_unlock(&_lock);
+    return stats;
+}
+
+#pragma mark - Private Methods
+
+- (NSString *)keyForHost:(NSString *)host hostClass:(M3U8HostClass)hostClass {
+    return [NSString stringWithFormat:@"%@|%@", [M3U8SessionPool nameForHostClass:hostClass], host.lowercaseString ?: @""];
+}
+
+- (NSTimeInterval)clamp:(NSTimeInterval)value min:(NSTimeInterval)minValue max:(NSTimeInterval)maxValue {
+    return MIN(MAX(value, minValue), maxValue);
+}
+
+@end
@@ -0,0 +1,94 @@
+//
+//  M3U8TokenManager.h
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "M3U8AuthConfig.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class M3U8TokenManager;
+
+/**
+ * token提供者（由业务方实现，通常请求业务服务器换取新的encrypt_token）
+ */
+@protocol M3U8TokenProvider <NSObject>
+
+/**
+ * 为授权配置换取新的encrypt_token
+ * 可在任意线程回调；新token的授权范围（剧集与集数）应与原token相同
+ * @param config 当前的授权配置
+ * @param completion 完成回调，成功时传入新token
+ */
+- (void)tokenManager:(M3U8TokenManager *)manager
+ refreshTokenForConfig:(M3U8AuthConfig *)config
+           completion:(void(^)(NSString * _Nullable encryptToken, NSError * _Nullable error))completion;
+
+@end
+
+/**
+ * encrypt_token生命周期管理
+ * 从token中解析过期时间，在过期前通过provider异步刷新，刷新结果直接写回所有登记过的授权配置；
+ * 密钥请求拿到的token即将过期时，等待进行中的刷新而不是直接失败
+ * token有效时（常见情况）同步返回，不产生任何等待
+ */
+@interface M3U8TokenManager : NSObject
+
+/**
+ * token提供者，未设置时不刷新，过期的token原样返回
+ */
+@property (nonatomic, weak, nullable) id<M3U8TokenProvider> provider;
+
+/**
+ * 提前刷新的时长（秒），默认60秒
+ */
+@property (nonatomic, assign) NSTimeInterval refreshLeadTime;
+
+/**
+ * token剩余有效期小于该值时视为不可用，请求需等待刷新（秒），默认5秒
+ */
+@property (nonatomic, assign) NSTimeInterval minimumValidity;
+
+/**
+ * 等待provider回调的超时时间（秒），默认10秒
+ */
+@property (nonatomic, assign) NSTimeInterval refreshTimeout;
+
+/**
+ * 获取共享实例
+ */
++ (instancetype)sharedManager;
+
+/**
+ * 登记授权配置，按token过期时间安排刷新
+ * 同一授权范围的配置共享一次刷新，刷新后的token写回每一个登记过的配置
+ */
+- (void)registerAuthConfig:(M3U8AuthConfig *)config;
+
+/**
+ * 获取可用的授权配置
+ * token有效时在调用线程上立即回调；即将过期时等待刷新完成后回调（未登记的配置会自动登记）
+ * @param completion 刷新失败且token已过期时config为nil
+ */
+- (void)validAuthConfigForConfig:(M3U8AuthConfig *)config
+                      completion:(void(^)(M3U8AuthConfig * _Nullable config, NSError * _Nullable error))completion;
+
+/**
+ * 立即刷新token（例如密钥服务器返回401/403时），完成后回调
+ * 同一授权范围已在刷新时加入等待，不重复刷新
+ */
+- (void)refreshTokenForConfig:(M3U8AuthConfig *)config
+                   completion:(void(^ _Nullable)(M3U8AuthConfig * _Nullable config, NSError * _Nullable error))completion;
+
+/**
+ * token统计
+ */
+- (NSDictionary *)statistics;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,324 @@
+//
+//  M3U8TokenManager.m
+//  HlsEncryptionDemo
+//
+//  Created by Assistant on 2024/12/19.
+//  Copyright © 2024 ChaiLu. All rights reserved.
+//
+
+#import "M3U8TokenManager.h"
+#import "M3U8Metrics.h"
+
+// 刷新失败后的重试间隔（秒），按失败次数翻倍
+static const NSTimeInterval kTokenRetryBaseDelay = 5.0;
+static const NSTimeInterval kTokenRetryMaxDelay = 60.0;
+
+// MARK: - M3U8TokenState
+
+/**
+ * 一个授权范围（剧集与集数）的token状态
+ */
+@interface M3U8TokenState : NSObject
+@property (nonatomic, copy) NSString *scope;
+@property (nonatomic, strong) NSHashTable<M3U8AuthConfig *> *configs;   // 登记过的配置（弱引用）
+@property (nonatomic, copy) NSString *encryptToken;
+@property (nonatomic, strong, nullable) NSDate *expirationDate;
+@property (nonatomic, assign) BOOL refreshing;
+@property (nonatomic, assign) NSUInteger refreshGeneration;   // 每次刷新递增，超时后迟到的回调被忽略
+@property (nonatomic, assign) NSUInteger scheduleGeneration;  // 每次安排刷新递增，旧的定时不再执行
+@property (nonatomic, assign) NSUInteger failureCount;
+@property (nonatomic, strong) NSMutableArray<void(^)(M3U8AuthConfig *, NSError *)> *waiters;
+@end
+
+@implementation M3U8TokenState
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _configs = [NSHashTable weakObjectsHashTable];
+        _waiters = [NSMutableArray array];
+    }
+    return self;
+}
+
+@end
+
+// MARK: - M3U8TokenManager
+
+@interface M3U8TokenManager ()
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, M3U8TokenState *> *states;  // 授权范围 -> 状态，只在queue上访问
+@property (nonatomic, strong) M3U8MetricCounter *refreshSuccessCounter;
+@property (nonatomic, strong) M3U8MetricCounter *refreshFailureCounter;
+@property (nonatomic, strong) M3U8LatencyHistogram *waitHistogram;
+@end
+
+@implementation M3U8TokenManager
+
++ (instancetype)sharedManager {
+    static M3U8TokenManager *instance = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        instance = [[M3U8TokenManager alloc] init];
+    });
+    return instance;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _refreshLeadTime = 60.0;
+        _minimumValidity = 5.0;
+        _refreshTimeout = 10.0;
+        _queue = dispatch_queue_create("com.m3u8.token", DISPATCH_QUEUE_SERIAL);
+        _states = [NSMutableDictionary dictionary];
+        M3U8Metrics *metrics = [M3U8Metrics sharedMetrics];
+        _refreshSuccessCounter = [metrics counterNamed:@"m3u8_token_refresh_total" labels:@{@"result": @"success"}];
+        _refreshFailureCounter = [metrics counterNamed:@"m3u8_token_refresh_total" labels:@{@"result": @"failure"}];
+        _waitHistogram = [metrics histogramNamed:@"m3u8_token_wait_seconds" labels:nil];
+    }
+    return self;
+}
+
+#pragma mark - Public Methods
+
+- (void)setProvider:(id<M3U8TokenProvider>)provider {
+    _provider = provider;
+    // 设置提供者后为已登记的token安排刷新
+    dispatch_async(self.queue, ^{
+        for (M3U8TokenState *state in self.states.allValues) {
+            [self scheduleRefreshForState:state];
+        }
+    });
+}
+
+- (void)registerAuthConfig:(M3U8AuthConfig *)config {
+    if (config.encryptToken.length == 0) {
+        return;
+    }
+    dispatch_async(self.queue, ^{
+        [self stateForConfig:config];
+    });
+}
+
+- (void)validAuthConfigForConfig:(M3U8AuthConfig *)config
+                      completion:(void(^)(M3U8AuthConfig * _Nullable config, NSError * _Nullable error))completion {
+    // 常见情况：token仍然有效（或格式无法解析、没有提供者），直接返回
+    NSDate *expirationDate = [config tokenExpirationDate];
+    if (!expirationDate || [expirationDate timeIntervalSinceNow] > self.minimumValidity || !self.provider) {
+        completion(config, nil);
+        return;
+    }
+    
+    CFAbsoluteTime waitStartTime = CFAbsoluteTimeGetCurrent();
+    dispatch_async(self.queue, ^{
+        M3U8TokenState *state = [self stateForConfig:config];
+        if ([[config tokenExpirationDate] timeIntervalSinceNow] > self.minimumValidity) {
+            // 登记时已经拿到了更新的token
+            dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+                completion(config, nil);
+            });
+            return;
+        }
+        
+        NSLog(@"[M3U8TokenManager] token即将过期，等待刷新: %@", state.scope);
+        [state.waiters addObject:^(M3U8AuthConfig *refreshedConfig, NSError *error) {
+            [self.waitHistogram recordSeconds:CFAbsoluteTimeGetCurrent() - waitStartTime];
+            completion(refreshedConfig, error);
+        }];
+        [self startRefreshForState:state];
+    });
+}
+
+- (void)refreshTokenForConfig:(M3U8AuthConfig *)config
+                   completion:(void(^)(M3U8AuthConfig * _Nullable config, NSError * _Nullable error))completion {
+    dispatch_async(self.queue, ^{
+        M3U8TokenState *state = [self stateForConfig:config];
+        if (completion) {
+            [state.waiters addObject:[completion copy]];
+        }
+        [self startRefreshForState:state];
+    });
+}
+
+- (NSDictionary *)statistics {
+    NSMutableDictionary *scopes = [NSMutableDictionary dictionary];
+    dispatch_sync(self.queue, ^{
+        [self.states enumerateKeysAndObjectsUsingBlock:^(NSString *scope, M3U8TokenState *state, BOOL *stop) {
+            scopes[scope] = @{
+                @"expiresIn": state.expirationDate ? @((NSInteger)[state.expirationDate timeIntervalSinceNow]) : [NSNull null],
+                @"refreshing": @(state.refreshing),
+                @"failures": @(state.failureCount),
+                @"waiters": @(state.waiters.count)
+            };
+        }];
+    });
+    return @{
+        @"hasProvider": @(self.provider != nil),
+        @"refreshLeadTime": @(self.refreshLeadTime),
+        @"scopes": scopes
+    };
+}
+
+#pragma mark - Private Methods
+
+/**
+ * 获取配置所在授权范围的状态，不存在时创建并安排刷新（须在queue上调用）
+ * 同一范围内以过期时间较晚的token为准，并同步到所有配置
+ */
+- (M3U8TokenState *)stateForConfig:(M3U8AuthConfig *)config {
+    NSString *scope = [config authScope];
+    M3U8TokenState *state = self.states[scope];
+    NSString *token = config.encryptToken;
+    NSDate *expirationDate = [config tokenExpirationDate];
+    
+    if (!state) {
+        state = [[M3U8TokenState alloc] init];
+        state.scope = scope;
+        state.encryptToken = token;
+        state.expirationDate = expirationDate;
+        [state.configs addObject:config];
+        self.states[scope] = state;
+        [self scheduleRefreshForState:state];
+        return state;
+    }
+    
+    [state.configs addObject:config];
+    if (![token isEqualToString:state.encryptToken]) {
+        if (expirationDate && (!state.expirationDate || [expirationDate compare:state.expirationDate] == NSOrderedDescending)) {
+            // 业务方传入了更新的token
+            [self applyToken:token expirationDate:expirationDate toState:state];
+            [self scheduleRefreshForState:state];
+        } else {
+            config.encryptToken = state.encryptToken;
+        }
+    }
+    return state;
+}
+
+- (void)applyToken:(NSString *)token expirationDate:(NSDate *)expirationDate toState:(M3U8TokenState *)state {
+    state.encryptToken = token;
+    state.expirationDate = expirationDate;
+    for (M3U8AuthConfig *config in state.configs.allObjects) {
+        config.encryptToken = token;
+    }
+}
+
+/**
+ * 在过期前refreshLeadTime安排刷新；刷新失败时按退避间隔重试（须在queue上调用）
+ */
+- (void)scheduleRefreshForState:(M3U8TokenState *)state {
+    if (!state.expirationDate || !self.provider) {
+        return;
+    }
+    
+    NSTimeInterval delay = [state.expirationDate timeIntervalSinceNow] - self.refreshLeadTime;
+    if (state.failureCount > 0) {
+        NSTimeInterval backoff = MIN(kTokenRetryBaseDelay * pow(2, state.failureCount - 1), kTokenRetryMaxDelay);
+        delay = MAX(delay, backoff);
+    }
+    delay = MAX(delay, 0);
+    
+    NSUInteger generation = ++state.scheduleGeneration;
+    NSString *scope = state.scope;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), self.queue, ^{
+        if (self.states[scope] != state || state.scheduleGeneration != generation) {
+            return;
+        }
+        if (state.configs.count == 0) {
+            // 配置都已释放，不再维护这个范围
+            [self.states removeObjectForKey:scope];
+            return;
+        }
+        [self startRefreshForState:state];
+    });
+}
+
+/**
+ * 通过provider刷新token，同一范围同时只有一次刷新（须在queue上调用）
+ */
+- (void)startRefreshForState:(M3U8TokenState *)state {
+    if (state.refreshing) {
+        return;
+    }
+    
+    id<M3U8TokenProvider> provider = self.provider;
+    M3U8AuthConfig *config = state.configs.anyObject;
+    if (!provider || !config) {
+        [self finishRefreshForState:state
+                              token:nil
+                              error:[NSError errorWithDomain:NSURLErrorDomain
+                                                        code:NSURLErrorUserAuthenticationRequired
+                                                    userInfo:@{NSLocalizedDescriptionKey: @"未设置token提供者"}]];
+        return;
+    }
+    
+    state.refreshing = YES;
+    NSUInteger generation = ++state.refreshGeneration;
+    NSLog(@"[M3U8TokenManager] 开始刷新token: %@ (剩余%.0f秒)", state.scope, [state.expirationDate timeIntervalSinceNow]);
+    
+    void(^done)(NSString *, NSError *) = ^(NSString *token, NSError *error) {
+        dispatch_async(self.queue, ^{
+            if (!state.refreshing || state.refreshGeneration != generation) {
+                return;
+            }
+            [self finishRefreshForState:state token:token error:error];
+        });
+    };
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [provider tokenManager:self refreshTokenForConfig:config completion:done];
+    });
+    
+    // provider迟迟不回调时按失败处理，避免密钥请求一直等待
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.refreshTimeout * NSEC_PER_SEC)), self.queue, ^{
+        if (!state.refreshing || state.refreshGeneration != generation) {
+            return;
+        }
+        [self finishRefreshForState:state
+                              token:nil
+                              error:[NSError errorWithDomain:NSURLErrorDomain
+                                                        code:NSURLErrorTimedOut
+                                                    userInfo:@{NSLocalizedDescriptionKey: @"token刷新超时"}]];
+    });
+}
+
+/**
+ * 刷新结束，写回新token并通知等待者（须在queue上调用）
+ * 失败时token尚未过期的等待者仍拿到原配置，已过期的拿到错误
+ */
+- (void)finishRefreshForState:(M3U8TokenState *)state token:(NSString *)token error:(NSError *)error {
+    state.refreshing = NO;
+    NSArray *waiters = [state.waiters copy];
+    [state.waiters removeAllObjects];
+    
+    M3U8AuthConfig *result = state.configs.anyObject;
+    NSError *resultError = nil;
+    if (token.length > 0) {
+        NSDate *expirationDate = [[M3U8AuthConfig configWithEncryptToken:token] tokenExpirationDate];
+        [self applyToken:token expirationDate:expirationDate toState:state];
+        state.failureCount = 0;
+        [self.refreshSuccessCounter increment];
+        NSLog(@"[M3U8TokenManager] token刷新成功: %@ (有效期%.0f秒)", state.scope, [expirationDate timeIntervalSinceNow]);
+    } else {
+        state.failureCount += 1;
+        [self.refreshFailureCounter increment];
+        NSLog(@"[M3U8TokenManager] token刷新失败(第%lu次): %@, %@",
+              (unsigned long)state.failureCount, state.scope, error.localizedDescription);
+        if (state.expirationDate && [state.expirationDate timeIntervalSinceNow] <= 0) {
+            result = nil;
+            resultError = error;
+        }
+    }
+    [self scheduleRefreshForState:state];
+    
+    if (waiters.count == 0) {
+        return;
+    }
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        for (void(^waiter)(M3U8AuthConfig *, NSError *) in waiters) {
+            waiter(result, resultError);
+        }
+    });
+}
+
+@end
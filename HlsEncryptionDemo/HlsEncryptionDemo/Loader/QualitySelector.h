@@ -39,16 +39,16 @@ NS_ASSUME_NONNULL_BEGIN
 
 /**
  * 根据偏好清晰度选择流
- * @param preferredQuality 偏好清晰度 ("标清"/"高清"/"超清"/"蓝光")
+ * @param preferredQuality 偏好清晰度 ("标清"/"高清"/"超清"/"蓝光")，为空时按带宽估算自动选择
  * @param masterPlaylist 主播放列表
  * @return 选择的流，如果没有合适的返回nil
  */
-- (StreamInfo * _Nullable)selectStreamForQuality:(NSString *)preferredQuality 
+- (StreamInfo * _Nullable)selectStreamForQuality:(NSString * _Nullable)preferredQuality 
                                 fromMasterPlaylist:(MasterPlaylist *)masterPlaylist;
 
 /**
  * 根据带宽和分辨率自动选择最佳清晰度
- * @param availableBandwidth 可用带宽（kbps）
+ * @param availableBandwidth 可用带宽（kbps），传0时使用M3U8BandwidthEstimator的估算值
  * @param preferredResolution 偏好分辨率（可选）
  * @param masterPlaylist 主播放列表
  * @return 选择的流
@@ -7,6 +7,7 @@
 //
 
 #import "QualitySelector.h"
+#import "M3U8BandwidthEstimator.h"
 
 @implementation QualitySelector
 
@@ -19,6 +20,11 @@
         return nil;
     }
     
+    if (preferredQuality.length == 0) {
+        // 未指定清晰度时按带宽估算自动选择
+        return [self selectOptimalStreamForBandwidth:0 preferredResolution:nil fromMasterPlaylist:masterPlaylist];
+    }
+    
     StreamInfo *selectedStream = [masterPlaylist selectStreamForQuality:preferredQuality];
     
     if (selectedStream) {
@@ -51,6 +57,11 @@
         return nil;
     }
     
+    if (availableBandwidth <= 0) {
+        availableBandwidth = [[M3U8BandwidthEstimator sharedEstimator] estimatedBandwidthKbps];
+        NSLog(@"[QualitySelector] 使用带宽估算: %ldkbps", (long)availableBandwidth);
+    }
+    
     NSArray<StreamInfo *> *availableStreams = masterPlaylist.streams;
     StreamInfo *bestStream = nil;
     NSInteger bestScore = -1;
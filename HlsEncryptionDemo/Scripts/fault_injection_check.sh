@@ -0,0 +1,148 @@
+#!/usr/bin/env bash
+#
+#  fault_injection_check.sh
+#  HlsEncryptionDemo
+#
+#  用注入故障的替身源站检查重试、重试预算和对冲：请求经M3U8LocalProxyServer进入真实的
+#  M3U8Loader（播放列表路径）和M3U8KeyManager（密钥路径），替身源站按请求id计数，
+#  据此判断客户端实际发了几次请求、哪些请求在对冲胜出后被取消。
+#  每个请求带唯一的id，绕过播放列表缓存、密钥缓存和同地址合并。
+#  代理需先在模拟器、macOS或Linux上运行，设置密钥管理器并允许替身源站：
+#      M3U8LocalProxyServer *server = [M3U8LocalProxyServer sharedServer];
+#      server.keyManager = <密钥管理器>;
+#      [server addAllowedHost:@"127.0.0.1:8766"];
+#  预算和对冲延迟是进程内状态，每次检查应使用新启动的应用。
+#
+#  用法：PROXY_PORT=<代理端口> [ORIGIN_PORT=8766] ./fault_injection_check.sh
+#
+
+set -u
+
+PROXY_PORT="${PROXY_PORT:?需要设置PROXY_PORT为代理监听端口}"
+ORIGIN_PORT="${ORIGIN_PORT:-8766}"
+PROXY="http://127.0.0.1:${PROXY_PORT}"
+ORIGIN="http://127.0.0.1:${ORIGIN_PORT}"
+
+# 与M3U8RetryPolicy的默认值一致
+MAX_ATTEMPTS=3
+MIN_SAMPLES_FOR_HEDGING=20
+HEDGED_DELAY_MS=1500
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+WORK_DIR="$(mktemp -d)"
+ORIGIN_PID=""
+FAILURES=0
+RUN_ID="$$-$(date +%s)"
+
+cleanup() {
+    [ -n "${ORIGIN_PID}" ] && kill "${ORIGIN_PID}" 2>/dev/null
+    rm -rf "${WORK_DIR}"
+}
+trap cleanup EXIT
+
+# 百分号编码代理地址中的url参数
+encode() {
+    python3 -c 'import sys, urllib.parse; print(urllib.parse.quote(sys.argv[1], safe=""))' "$1"
+}
+
+check() {
+    local name="$1" expected="$2" actual="$3"
+    if [ "${expected}" = "${actual}" ]; then
+        echo "PASS ${name}"
+    else
+        echo "FAIL ${name}: 期望 ${expected}，实际 ${actual}"
+        FAILURES=$((FAILURES + 1))
+    fi
+}
+
+# 经代理请求：fetch <playlist|key> <id> [故障参数]，返回状态码，耗时（毫秒）写入$WORK_DIR/elapsed
+fetch() {
+    local route="$1" id="${RUN_ID}-$2" params="${3:-}" path proxy_path
+    case "${route}" in
+        playlist) path="index.m3u8"; proxy_path="playlist.m3u8" ;;
+        key) path="key.bin"; proxy_path="key" ;;
+    esac
+    local url="${ORIGIN}/${path}?id=${id}${params:+&${params}}"
+    curl -s -o /dev/null -w '%{http_code} %{time_total}' "${PROXY}/${proxy_path}?url=$(encode "${url}")" |
+        awk -v out="${WORK_DIR}/elapsed" '{ print $1; printf "%d\n", $2 * 1000 > out }'
+}
+
+# 替身源站记录的计数：origin_stat <id> <requests|aborted>
+origin_stat() {
+    curl -s "${ORIGIN}/__stats?id=${RUN_ID}-$1" |
+        python3 -c 'import json, sys; print(json.load(sys.stdin)[sys.argv[1]])' "$2"
+}
+
+# 替身源站
+mkdir -p "${WORK_DIR}/origin"
+head -c 16 /dev/urandom > "${WORK_DIR}/origin/key.bin"
+cat > "${WORK_DIR}/origin/index.m3u8" <<PLAYLIST
+#EXTM3U
+#EXT-X-VERSION:3
+#EXT-X-TARGETDURATION:10
+#EXT-X-MEDIA-SEQUENCE:0
+#EXTINF:10.0,
+0.ts
+#EXT-X-ENDLIST
+PLAYLIST
+
+python3 "${SCRIPT_DIR}/standin_origin.py" --port "${ORIGIN_PORT}" --root "${WORK_DIR}/origin" &
+ORIGIN_PID=$!
+for _ in $(seq 1 50); do
+    curl -s -o /dev/null "${ORIGIN}/index.m3u8" && break
+    sleep 0.1
+done
+
+for route in playlist key; do
+    # 预热：成功样本达到minSamplesForHedging后才会对冲，对冲延迟取p95（本机约几毫秒）
+    warm_failures=0
+    for i in $(seq 1 $((MIN_SAMPLES_FOR_HEDGING + 5))); do
+        [ "$(fetch "${route}" "${route}-warm-${i}")" = 200 ] || warm_failures=$((warm_failures + 1))
+    done
+    check "${route} warm-up" 0 "${warm_failures}"
+
+    # 瞬时5xx：前两次503，第三次成功
+    check "${route} retry after 503 status" 200 "$(fetch "${route}" "${route}-retry" "fail=2&status=503")"
+    check "${route} retry after 503 requests" 3 "$(origin_stat "${route}-retry" requests)"
+
+    # 连接重置：第一次RST，重试成功
+    check "${route} retry after reset status" 200 "$(fetch "${route}" "${route}-reset" "reset=1")"
+    check "${route} retry after reset requests" 2 "$(origin_stat "${route}-reset" requests)"
+
+    # 持续5xx：最多尝试MAX_ATTEMPTS次后放弃，代理返回502（连续失败次数低于熔断阈值）
+    check "${route} attempts exhausted status" 502 "$(fetch "${route}" "${route}-exhausted" "fail=100")"
+    check "${route} attempts exhausted requests" "${MAX_ATTEMPTS}" "$(origin_stat "${route}-exhausted" requests)"
+
+    # 对冲：第一次请求延迟，超过p95后发出对冲请求，对冲先完成，原请求被取消
+    check "${route} hedge status" 200 "$(fetch "${route}" "${route}-hedge" "delay_ms=${HEDGED_DELAY_MS}")"
+    elapsed="$(cat "${WORK_DIR}/elapsed")"
+    check "${route} hedge beats delayed request" 1 "$([ "${elapsed}" -lt "${HEDGED_DELAY_MS}" ] && echo 1 || echo 0)"
+    check "${route} hedge requests" 2 "$(origin_stat "${route}-hedge" requests)"
+    for _ in $(seq 1 20); do
+        [ "$(origin_stat "${route}-hedge" aborted)" = 1 ] && break
+        sleep 0.1
+    done
+    check "${route} hedge cancels loser" 1 "$(origin_stat "${route}-hedge" aborted)"
+
+    # 重试预算：每次请求先503再成功，每次重试消耗1个令牌、成功只回补0.1个，
+    # 预算耗尽后不再重试，源站只收到一次请求，代理返回502
+    exhausted_at=""
+    for i in $(seq 1 40); do
+        if [ "$(fetch "${route}" "${route}-budget-${i}" "fail=1")" != 200 ]; then
+            exhausted_at="${i}"
+            break
+        fi
+    done
+    if [ -z "${exhausted_at}" ]; then
+        check "${route} retry budget exhausted" 1 0
+    else
+        echo "     ${route}: 第${exhausted_at}次请求时重试预算耗尽"
+        check "${route} no retry without budget" 1 "$(origin_stat "${route}-budget-${exhausted_at}" requests)"
+    fi
+done
+
+if [ "${FAILURES}" -ne 0 ]; then
+    echo "${FAILURES} 项检查失败"
+    exit 1
+fi
+echo "全部通过"
@@ -0,0 +1,163 @@
+#!/usr/bin/env bash
+#
+#  host_failover_check.sh
+#  HlsEncryptionDemo
+#
+#  检查M3U8HostSelector的选路和失败切换：本脚本起三个延迟不同的替身源站作为等价CDN主机，
+#  经M3U8LocalProxyServer请求播放列表（走真实的M3U8Loader，请求前由preferredURLForURL:改写主机，
+#  失败后由failoverURLForURL:切换主机），按各源站收到的请求数判断流量去向：
+#      1. 流量收敛到最快的主机（组内第一个主机最慢，初始首选是它）
+#      2. 停掉最快的主机后请求仍然成功，流量切换到剩下主机中较快的一个
+#      3. 最快的主机恢复且冷却结束后流量回到它
+#  代理需先在模拟器、macOS或Linux上运行，并注册等价主机组（组内主机自动加入代理白名单）：
+#      [[M3U8HostSelector sharedSelector] addEquivalentHosts:@[@"127.0.0.1:8771", @"127.0.0.1:8772", @"127.0.0.1:8773"]];
+#  主机评分是进程内状态，每次检查应使用新启动的应用。
+#
+#  用法：PROXY_PORT=<代理端口> ./host_failover_check.sh
+#
+
+set -u
+
+PROXY_PORT="${PROXY_PORT:?需要设置PROXY_PORT为代理监听端口}"
+PROXY="http://127.0.0.1:${PROXY_PORT}"
+
+# 组内顺序即初始首选顺序：慢、快、中
+SLOW=0
+FAST=1
+MEDIUM=2
+PORTS=(8771 8772 8773)
+DELAYS_MS=(250 20 100)
+
+# 与M3U8HostSelector的基础冷却时间（5秒）一致，多等1秒
+COOLDOWN_WAIT=6
+REQUESTS=20
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+WORK_DIR="$(mktemp -d)"
+FAILURES=0
+NONCE=0
+ORIGIN_PIDS=("" "" "")
+BEFORE=(0 0 0)
+DELTA=(0 0 0)
+
+cleanup() {
+    for pid in "${ORIGIN_PIDS[@]}"; do
+        [ -n "${pid}" ] && kill "${pid}" 2>/dev/null
+    done
+    rm -rf "${WORK_DIR}"
+}
+trap cleanup EXIT
+
+# 百分号编码代理地址中的url参数
+encode() {
+    python3 -c 'import sys, urllib.parse; print(urllib.parse.quote(sys.argv[1], safe=""))' "$1"
+}
+
+check() {
+    local name="$1" expected="$2" actual="$3"
+    if [ "${expected}" = "${actual}" ]; then
+        echo "PASS ${name}"
+    else
+        echo "FAIL ${name}: 期望 ${expected}，实际 ${actual}"
+        FAILURES=$((FAILURES + 1))
+    fi
+}
+
+# start_origin <SLOW|FAST|MEDIUM>
+start_origin() {
+    local port="${PORTS[$1]}"
+    python3 "${SCRIPT_DIR}/standin_origin.py" --port "${port}" --root "${WORK_DIR}/origin" --delay-ms "${DELAYS_MS[$1]}" &
+    ORIGIN_PIDS[$1]=$!
+    for _ in $(seq 1 50); do
+        curl -s -o /dev/null "http://127.0.0.1:${port}/__stats" && break
+        sleep 0.1
+    done
+}
+
+stop_origin() {
+    kill "${ORIGIN_PIDS[$1]}" 2>/dev/null
+    wait "${ORIGIN_PIDS[$1]}" 2>/dev/null
+    ORIGIN_PIDS[$1]=""
+}
+
+# 源站收到的请求总数，已停止的源站记为0
+origin_requests() {
+    curl -s "http://127.0.0.1:${PORTS[$1]}/__stats" |
+        python3 -c 'import json, sys; print(json.load(sys.stdin)["requests"])' 2>/dev/null || echo 0
+}
+
+# 经代理请求N个播放列表（地址都指向最慢的主机，由选路改写），返回非200的个数；
+# 每个地址带唯一参数，绕过播放列表缓存和同地址合并
+send_requests() {
+    local failed=0
+    for _ in $(seq 1 "$1"); do
+        NONCE=$((NONCE + 1))
+        local url="http://127.0.0.1:${PORTS[${SLOW}]}/index.m3u8?n=$$-${NONCE}"
+        [ "$(curl -s -o /dev/null -w '%{http_code}' "${PROXY}/playlist.m3u8?url=$(encode "${url}")")" = 200 ] ||
+            failed=$((failed + 1))
+    done
+    echo "${failed}"
+}
+
+# 各源站在一轮请求中分到的请求数写入DELTA
+snapshot() {
+    for i in ${SLOW} ${FAST} ${MEDIUM}; do
+        BEFORE[i]="$(origin_requests "${i}")"
+    done
+}
+measure() {
+    for i in ${SLOW} ${FAST} ${MEDIUM}; do
+        DELTA[i]=$(($(origin_requests "${i}") - BEFORE[i]))
+    done
+    echo "     慢=${DELTA[${SLOW}]} 快=${DELTA[${FAST}]} 中=${DELTA[${MEDIUM}]}"
+}
+
+# 多数：不少于一轮请求数的80%
+at_least_most() {
+    [ "$1" -ge $(($2 * 8 / 10)) ] && echo 1 || echo 0
+}
+
+# 替身源站
+mkdir -p "${WORK_DIR}/origin"
+cat > "${WORK_DIR}/origin/index.m3u8" <<PLAYLIST
+#EXTM3U
+#EXT-X-VERSION:3
+#EXT-X-TARGETDURATION:10
+#EXT-X-MEDIA-SEQUENCE:0
+#EXTINF:10.0,
+0.ts
+#EXT-X-ENDLIST
+PLAYLIST
+
+start_origin ${SLOW}
+start_origin ${FAST}
+start_origin ${MEDIUM}
+
+# 1. 预热让评分收敛，之后的请求应集中到最快的主机
+check "warm-up failures" 0 "$(send_requests 5)"
+snapshot
+check "steady failures" 0 "$(send_requests ${REQUESTS})"
+measure
+check "fastest host preferred" 1 "$(at_least_most "${DELTA[${FAST}]}" ${REQUESTS})"
+
+# 2. 停掉最快的主机：失败的请求立即切换到其他主机重试，之后的请求避开冷却中的主机
+stop_origin ${FAST}
+snapshot
+check "failover failures" 0 "$(send_requests ${REQUESTS})"
+measure
+check "failover to next fastest" 1 "$(at_least_most "${DELTA[${MEDIUM}]}" ${REQUESTS})"
+check "slow host avoided" 1 "$([ "${DELTA[${SLOW}]}" -lt "${DELTA[${MEDIUM}]}" ] && echo 1 || echo 0)"
+
+# 3. 恢复最快的主机，冷却结束后流量回到它
+start_origin ${FAST}
+sleep ${COOLDOWN_WAIT}
+snapshot
+check "recovery failures" 0 "$(send_requests ${REQUESTS})"
+measure
+check "fastest host restored" 1 "$(at_least_most "${DELTA[${FAST}]}" ${REQUESTS})"
+
+if [ "${FAILURES}" -ne 0 ]; then
+    echo "${FAILURES} 项检查失败"
+    exit 1
+fi
+echo "全部通过"
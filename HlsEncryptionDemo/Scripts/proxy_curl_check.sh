@@ -0,0 +1,122 @@
+#!/usr/bin/env bash
+#
+#  proxy_curl_check.sh
+#  HlsEncryptionDemo
+#
+#  用curl检查M3U8LocalProxyServer：本脚本用standin_origin.py起一个替身源站（明文播放列表、密钥和分片），
+#  再通过代理请求这些资源，检查播放列表改写、Range/HEAD、错误状态码和源站白名单。
+#  代理需先在模拟器、macOS或Linux上运行，并允许替身源站：
+#      [[M3U8LocalProxyServer sharedServer] addAllowedHost:@"127.0.0.1:8765"];
+#
+#  用法：PROXY_PORT=<代理端口> [ORIGIN_PORT=8765] ./proxy_curl_check.sh
+#
+
+set -u
+
+PROXY_PORT="${PROXY_PORT:?需要设置PROXY_PORT为代理监听端口}"
+ORIGIN_PORT="${ORIGIN_PORT:-8765}"
+PROXY="http://127.0.0.1:${PROXY_PORT}"
+ORIGIN="http://127.0.0.1:${ORIGIN_PORT}"
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+WORK_DIR="$(mktemp -d)"
+ORIGIN_PID=""
+FAILURES=0
+
+cleanup() {
+    [ -n "${ORIGIN_PID}" ] && kill "${ORIGIN_PID}" 2>/dev/null
+    rm -rf "${WORK_DIR}"
+}
+trap cleanup EXIT
+
+# 百分号编码代理地址中的url参数
+encode() {
+    python3 -c 'import sys, urllib.parse; print(urllib.parse.quote(sys.argv[1], safe=""))' "$1"
+}
+
+check() {
+    local name="$1" expected="$2" actual="$3"
+    if [ "${expected}" = "${actual}" ]; then
+        echo "PASS ${name}"
+    else
+        echo "FAIL ${name}: 期望 ${expected}，实际 ${actual}"
+        FAILURES=$((FAILURES + 1))
+    fi
+}
+
+# 返回状态码，响应体写入$WORK_DIR/body，响应头写入$WORK_DIR/headers
+request() {
+    curl -s -o "${WORK_DIR}/body" -D "${WORK_DIR}/headers" -w '%{http_code}' "$@"
+}
+
+header() {
+    grep -i "^$1:" "${WORK_DIR}/headers" | head -n 1 | cut -d' ' -f2- | tr -d '\r'
+}
+
+# 替身源站
+mkdir -p "${WORK_DIR}/origin"
+head -c 16 /dev/urandom > "${WORK_DIR}/origin/key.bin"
+head -c 4096 /dev/urandom > "${WORK_DIR}/origin/0.ts"
+head -c 4096 /dev/urandom > "${WORK_DIR}/origin/1.ts"
+cat > "${WORK_DIR}/origin/index.m3u8" <<PLAYLIST
+#EXTM3U
+#EXT-X-VERSION:3
+#EXT-X-TARGETDURATION:10
+#EXT-X-MEDIA-SEQUENCE:0
+#EXT-X-KEY:METHOD=AES-128,URI="key.bin"
+#EXTINF:10.0,
+0.ts
+#EXT-X-ENDLIST
+PLAYLIST
+
+python3 "${SCRIPT_DIR}/standin_origin.py" --port "${ORIGIN_PORT}" --root "${WORK_DIR}/origin" &
+ORIGIN_PID=$!
+for _ in $(seq 1 50); do
+    curl -s -o /dev/null "${ORIGIN}/index.m3u8" && break
+    sleep 0.1
+done
+
+PLAYLIST_URL="${PROXY}/playlist.m3u8?url=$(encode "${ORIGIN}/index.m3u8")"
+KEY_URL="${PROXY}/key?url=$(encode "${ORIGIN}/key.bin")"
+SEGMENT_URL="${PROXY}/segment.ts?url=$(encode "${ORIGIN}/0.ts")"
+
+# 播放列表：密钥和分片地址改写为代理地址
+check "playlist status" 200 "$(request "${PLAYLIST_URL}")"
+check "playlist rewrites key" 1 "$(grep -c '/key?url=' "${WORK_DIR}/body")"
+check "playlist rewrites segment" 1 "$(grep -c '/segment.ts?url=' "${WORK_DIR}/body")"
+
+# 密钥
+check "key status" 200 "$(request "${KEY_URL}")"
+check "key body" "$(od -An -tx1 "${WORK_DIR}/origin/key.bin")" "$(od -An -tx1 "${WORK_DIR}/body")"
+
+# 分片：第一次从源站下载，第二次命中分片缓存（sendfile）
+for attempt in miss hit; do
+    check "segment ${attempt} status" 200 "$(request "${SEGMENT_URL}")"
+    check "segment ${attempt} body" 0 "$(cmp -s "${WORK_DIR}/origin/0.ts" "${WORK_DIR}/body"; echo $?)"
+done
+
+# 未命中的Range请求转发给源站，只返回请求的部分
+RANGE_MISS_URL="${PROXY}/segment.ts?url=$(encode "${ORIGIN}/1.ts")"
+check "range miss status" 206 "$(request -r 0-99 "${RANGE_MISS_URL}")"
+check "range miss content-range" "bytes 0-99/4096" "$(header Content-Range)"
+check "range miss body" "$(head -c 100 "${WORK_DIR}/origin/1.ts" | od -An -tx1)" "$(od -An -tx1 "${WORK_DIR}/body")"
+
+# Range / HEAD（命中缓存）
+check "range status" 206 "$(request -r 100-199 "${SEGMENT_URL}")"
+check "range content-range" "bytes 100-199/4096" "$(header Content-Range)"
+check "range length" 100 "$(wc -c < "${WORK_DIR}/body" | tr -d ' ')"
+check "range unsatisfiable" 416 "$(request -r 5000-6000 "${SEGMENT_URL}")"
+check "head status" 200 "$(request -I "${SEGMENT_URL}")"
+check "head content-length" 4096 "$(header Content-Length)"
+
+# 错误状态码
+check "unknown path" 404 "$(request "${PROXY}/unknown?url=$(encode "${ORIGIN}/0.ts")")"
+check "unsupported method" 405 "$(request -X POST "${SEGMENT_URL}")"
+check "disallowed origin" 403 "$(request "${PROXY}/segment.ts?url=$(encode "http://example.invalid/0.ts")")"
+check "bad host header" 403 "$(request -H "Host: example.invalid" "${SEGMENT_URL}")"
+
+if [ "${FAILURES}" -ne 0 ]; then
+    echo "${FAILURES} 项检查失败"
+    exit 1
+fi
+echo "全部通过"
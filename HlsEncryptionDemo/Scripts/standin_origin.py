@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+#
+#  standin_origin.py
+#  HlsEncryptionDemo
+#
+#  检查脚本使用的替身源站：从目录提供播放列表、密钥和分片，支持HEAD和单个范围的Range请求。
+#  带id查询参数的请求按id计数，并可按查询参数注入故障（第n次请求指同一id的第n次）：
+#      fail=N&status=503   前N次请求返回status（默认503）
+#      reset=N             前N次请求直接重置连接（RST）
+#      delay_ms=D&delay_count=N  前N次请求（默认1次）延迟D毫秒再响应，期间客户端断开记为aborted
+#  GET /__stats?id=<id> 返回该id的计数：{"requests": 请求次数, "aborted": 延迟期间被客户端取消的次数}，
+#  不带id时返回本源站收到的全部请求数。--delay-ms为每个请求加上固定延迟，模拟远近不同的CDN节点。
+#
+#  用法：standin_origin.py --port 8765 --root <目录> [--delay-ms 0]
+#
+
+import argparse
+import http.server
+import json
+import os
+import re
+import select
+import socket
+import socketserver
+import struct
+import threading
+import time
+import urllib.parse
+
+STATS = {}
+STATS_LOCK = threading.Lock()
+BASE_DELAY = 0.0
+
+
+class StandInHandler(http.server.SimpleHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, format, *args):
+        pass
+
+    def do_GET(self):
+        if urllib.parse.urlsplit(self.path).path == "/__stats":
+            self.send_stats()
+        elif self.inject_fault():
+            self.send_file(head=False)
+
+    def do_HEAD(self):
+        if self.inject_fault():
+            self.send_file(head=True)
+
+    def send_stats(self):
+        query = urllib.parse.parse_qs(urllib.parse.urlsplit(self.path).query)
+        with STATS_LOCK:
+            stats = dict(STATS.get(query.get("id", [""])[0], {"requests": 0, "aborted": 0}))
+        body = json.dumps(stats).encode()
+        self.send_response(200)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    # 按查询参数注入故障，返回False表示已自行处理（错误状态码、重置或客户端已断开）
+    def inject_fault(self):
+        query = urllib.parse.parse_qs(urllib.parse.urlsplit(self.path).query)
+        identifier = query.get("id", [None])[0]
+        with STATS_LOCK:
+            STATS.setdefault("", {"requests": 0, "aborted": 0})["requests"] += 1
+        if BASE_DELAY > 0:
+            time.sleep(BASE_DELAY)
+        if identifier is None:
+            return True
+        param = lambda name, default: int(query.get(name, [default])[0])
+
+        with STATS_LOCK:
+            stats = STATS.setdefault(identifier, {"requests": 0, "aborted": 0})
+            stats["requests"] += 1
+            count = stats["requests"]
+
+        if count <= param("fail", 0):
+            self.send_response(param("status", 503))
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            return False
+
+        if count <= param("reset", 0):
+            # SO_LINGER为0时close发送RST，客户端看到连接被重置
+            self.connection.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+            self.connection.close()
+            self.close_connection = True
+            return False
+
+        delay = param("delay_ms", 0) / 1000.0
+        if delay > 0 and count <= param("delay_count", 1):
+            deadline = time.monotonic() + delay
+            while time.monotonic() < deadline:
+                readable, _, _ = select.select([self.connection], [], [], min(0.01, max(deadline - time.monotonic(), 0)))
+                if readable and self.peek() == b"":
+                    # 客户端在响应前断开（例如对冲请求胜出后取消了这个请求）
+                    with STATS_LOCK:
+                        stats["aborted"] += 1
+                    self.close_connection = True
+                    return False
+                if readable:
+                    time.sleep(0.01)
+        return True
+
+    def peek(self):
+        try:
+            return self.connection.recv(1, socket.MSG_PEEK)
+        except OSError:
+            return b""
+
+    def send_file(self, head):
+        path = self.translate_path(self.path)
+        if not os.path.isfile(path):
+            self.send_error(404)
+            return
+        with open(path, "rb") as f:
+            body = f.read()
+
+        status = 200
+        headers = {"Content-Type": self.guess_type(path), "Accept-Ranges": "bytes"}
+        match = re.fullmatch(r"bytes=(\d*)-(\d*)", self.headers.get("Range", ""))
+        if match and (match.group(1) or match.group(2)):
+            total = len(body)
+            if match.group(1):
+                start = int(match.group(1))
+                end = min(int(match.group(2)), total - 1) if match.group(2) else total - 1
+            else:
+                start = max(total - int(match.group(2)), 0)
+                end = total - 1
+            if start >= total or start > end:
+                self.send_response(416)
+                self.send_header("Content-Range", "bytes */%d" % total)
+                self.send_header("Content-Length", "0")
+                self.end_headers()
+                return
+            status = 206
+            headers["Content-Range"] = "bytes %d-%d/%d" % (start, end, total)
+            body = body[start:end + 1]
+
+        self.send_response(status)
+        for name, value in headers.items():
+            self.send_header(name, value)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        if not head:
+            self.wfile.write(body)
+
+
+class StandInServer(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description="HLS替身源站")
+    parser.add_argument("--port", type=int, required=True)
+    parser.add_argument("--root", required=True)
+    parser.add_argument("--delay-ms", type=int, default=0)
+    args = parser.parse_args()
+
+    global BASE_DELAY
+    BASE_DELAY = args.delay_ms / 1000.0
+
+    handler = lambda *a, **kw: StandInHandler(*a, directory=args.root, **kw)
+    StandInServer(("127.0.0.1", args.port), handler).serve_forever()
+
+
+if __name__ == "__main__":
+    main()